@@ -0,0 +1,227 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+/** Shared memory transport between the terminal and the bypass when both run on the same host.
+
+    The terminal creates the shared memory with SharedTransport::Create() and two eventfds, and passes them to the bypass as inherited file descriptors by the `--shm=MEMFD:BYPASS_EVENTFD:TERMINAL_EVENTFD` argument. The shared memory holds a single producer single consumer ring per direction. The input ring carries the input encoded exactly as it would be on stdin, the output ring carries the output of the command.
+
+    Each side waits on its own eventfd, which the other side signals only when the waiting side has announced that it is idle, so that no syscalls are made while both sides are busy.
+
+    Stdin and stdout stay open as the control channel, commands can still be sent over stdin and closing it hangs up the command. When the bypass attaches to the transport, it sets the attached flag and signals the terminal. A bypass that does not support the transport uses the pipes instead, which the terminal can tell by its output appearing on stdout.
+ */
+
+/** State of a ring in the shared memory.
+
+    The producer and consumer parts are on separate cache lines so that the sides do not invalidate each other's lines more than necessary.
+ */
+struct SharedRingState {
+    /** Total number of bytes written, and whether the consumer is idle and must be signalled when more are written.
+     */
+    alignas(64) std::atomic<uint64_t> write;
+    std::atomic<uint32_t> consumerIdle;
+    /** Set by the producer when there will be no more data.
+     */
+    std::atomic<uint32_t> closed;
+    /** Total number of bytes read, and whether the producer is idle and must be signalled when there is free space.
+     */
+    alignas(64) std::atomic<uint64_t> read;
+    std::atomic<uint32_t> producerIdle;
+}; // SharedRingState
+
+/** Header of the shared memory, which occupies its first page. The data of the input and the output rings follow, each of the capacity given in the header.
+ */
+struct SharedHeader {
+    static constexpr uint32_t Magic = 0x74707062; // "tppb"
+
+    uint32_t magic;
+    uint32_t capacity;
+    std::atomic<uint32_t> attached;
+    SharedRingState input;
+    SharedRingState output;
+}; // SharedHeader
+
+/** View of one ring in the shared memory.
+
+    The data of the ring is mapped twice into adjacent virtual memory so that both the data and the free space are always contiguous. The producer uses writePtr(), writable() and commit(), the consumer data(), size() and consume().
+ */
+class SharedRing {
+public:
+
+    SharedRing():
+        state_{nullptr},
+        data_{nullptr},
+        capacity_{0} {
+    }
+
+    SharedRing(SharedRingState * state, char * data, size_t capacity):
+        state_{state},
+        data_{data},
+        capacity_{capacity} {
+    }
+
+    char * data() { return data_ + state_->read.load(std::memory_order_relaxed) % capacity_; }
+    size_t size() const { return state_->write.load(std::memory_order_acquire) - state_->read.load(std::memory_order_relaxed); }
+
+    /** Releases the data to the producer. Returns true if the producer is idle and must be signalled.
+     */
+    bool consume(size_t numBytes) {
+        state_->read.store(state_->read.load(std::memory_order_relaxed) + numBytes, std::memory_order_seq_cst);
+        return state_->producerIdle.load(std::memory_order_seq_cst) != 0 && state_->producerIdle.exchange(0) != 0;
+    }
+
+    char * writePtr() { return data_ + state_->write.load(std::memory_order_relaxed) % capacity_; }
+    size_t writable() const { return capacity_ - (state_->write.load(std::memory_order_relaxed) - state_->read.load(std::memory_order_acquire)); }
+
+    /** Publishes the data to the consumer. Returns true if the consumer is idle and must be signalled.
+     */
+    bool commit(size_t numBytes) {
+        state_->write.store(state_->write.load(std::memory_order_relaxed) + numBytes, std::memory_order_seq_cst);
+        return state_->consumerIdle.load(std::memory_order_seq_cst) != 0 && state_->consumerIdle.exchange(0) != 0;
+    }
+
+    bool closed() const { return state_->closed.load(std::memory_order_acquire) != 0; }
+
+    /** Tells the consumer there will be no more data. Returns true if the consumer is idle and must be signalled.
+     */
+    bool close() {
+        state_->closed.store(1, std::memory_order_seq_cst);
+        return state_->consumerIdle.load(std::memory_order_seq_cst) != 0 && state_->consumerIdle.exchange(0) != 0;
+    }
+
+    /** Announces that the consumer is going to wait for more data, having left given number of bytes it can't process yet (such as an incomplete command) in the ring. Returns false if more data arrived (or the ring has been closed) in the meantime, in which case the consumer should not wait.
+     */
+    bool consumerIdle(size_t unprocessed = 0) {
+        state_->consumerIdle.store(1, std::memory_order_seq_cst);
+        if (size() == unprocessed && ! closed())
+            return true;
+        state_->consumerIdle.store(0, std::memory_order_relaxed);
+        return false;
+    }
+
+    /** Announces that the producer is going to wait for free space. Returns false if there is space already, in which case the producer should not wait.
+     */
+    bool producerIdle() {
+        state_->producerIdle.store(1, std::memory_order_seq_cst);
+        if (writable() == 0)
+            return true;
+        state_->producerIdle.store(0, std::memory_order_relaxed);
+        return false;
+    }
+
+private:
+    SharedRingState * state_;
+    char * data_;
+    size_t capacity_;
+}; // SharedRing
+
+/** The shared memory of the transport mapped into the process.
+ */
+class SharedTransport {
+public:
+
+    /** Creates the shared memory for the transport with rings of at least given capacity and returns its file descriptor.
+     */
+    static int Create(size_t capacity) {
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t c = page;
+        while (c < capacity)
+            c *= 2;
+        int fd = memfd_create("tpp-bypass-shm", MFD_CLOEXEC);
+        if (fd < 0)
+            throw std::runtime_error("Unable to create shared memory");
+        if (ftruncate(fd, page + 2 * c) != 0) {
+            close(fd);
+            throw std::runtime_error("Unable to size shared memory");
+        }
+        void * h = mmap(nullptr, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (h == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Unable to map shared memory");
+        }
+        SharedHeader * header = new (h) SharedHeader{};
+        header->magic = SharedHeader::Magic;
+        header->capacity = static_cast<uint32_t>(c);
+        munmap(h, page);
+        return fd;
+    }
+
+    /** Maps the shared memory of given file descriptor.
+     */
+    explicit SharedTransport(int fd):
+        page_{static_cast<size_t>(sysconf(_SC_PAGESIZE))} {
+        void * h = mmap(nullptr, page_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (h == MAP_FAILED)
+            throw std::runtime_error("Unable to map shared memory");
+        header_ = static_cast<SharedHeader *>(h);
+        if (header_->magic != SharedHeader::Magic || header_->capacity % page_ != 0) {
+            munmap(h, page_);
+            throw std::runtime_error("Invalid shared memory");
+        }
+        capacity_ = header_->capacity;
+        inputBase_ = MapMirrored(fd, page_, capacity_);
+        outputBase_ = MapMirrored(fd, page_ + capacity_, capacity_);
+        if (inputBase_ == nullptr || outputBase_ == nullptr) {
+            unmap();
+            throw std::runtime_error("Unable to map shared memory");
+        }
+        input_ = SharedRing{& header_->input, inputBase_, capacity_};
+        output_ = SharedRing{& header_->output, outputBase_, capacity_};
+    }
+
+    ~SharedTransport() {
+        unmap();
+    }
+
+    SharedTransport(SharedTransport const &) = delete;
+    SharedTransport & operator = (SharedTransport const &) = delete;
+
+    SharedHeader * header() { return header_; }
+
+    /** The ring from the terminal to the bypass.
+     */
+    SharedRing & input() { return input_; }
+
+    /** The ring from the bypass to the terminal.
+     */
+    SharedRing & output() { return output_; }
+
+private:
+
+    void unmap() {
+        if (inputBase_ != nullptr)
+            munmap(inputBase_, capacity_ * 2);
+        if (outputBase_ != nullptr)
+            munmap(outputBase_, capacity_ * 2);
+        munmap(header_, page_);
+    }
+
+    /** Maps the region of the shared memory twice into adjacent virtual memory. Returns nullptr if the mapping fails.
+     */
+    static char * MapMirrored(int fd, size_t offset, size_t size) {
+        // reserve the address space for both copies first so that they can be mapped adjacent to each other
+        void * base = mmap(nullptr, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+            return nullptr;
+        char * b = static_cast<char *>(base);
+        if (mmap(b, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED || mmap(b + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED) {
+            munmap(base, size * 2);
+            return nullptr;
+        }
+        return b;
+    }
+
+    size_t page_;
+    size_t capacity_;
+    SharedHeader * header_;
+    char * inputBase_ = nullptr;
+    char * outputBase_ = nullptr;
+    SharedRing input_;
+    SharedRing output_;
+}; // SharedTransport
@@ -0,0 +1,162 @@
+#if (defined ARCH_LINUX)
+
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "helpers/helpers.h"
+#include "helpers/helpers_tests.h"
+
+/** The bypass executable, defined by the build. 
+ */
+#ifndef TPP_BYPASS_PATH
+#define TPP_BYPASS_PATH "tpp-bypass"
+#endif
+
+extern char ** environ;
+
+namespace {
+
+    /** Runs the bypass with --multiplex over pipes and decodes the frames it sends. 
+     */
+    struct Multiplexer {
+        pid_t pid;
+        int input;
+        int output;
+        std::unordered_map<unsigned, std::string> received;
+        std::unordered_map<unsigned, int> exitCodes;
+        std::string frames;
+
+        explicit Multiplexer(std::string const & command) {
+            int in[2];
+            int out[2];
+            OSCHECK(pipe(in) == 0 && pipe(out) == 0);
+            posix_spawn_file_actions_t actions;
+            posix_spawn_file_actions_init(& actions);
+            posix_spawn_file_actions_adddup2(& actions, in[0], STDIN_FILENO);
+            posix_spawn_file_actions_adddup2(& actions, out[1], STDOUT_FILENO);
+            posix_spawn_file_actions_addclose(& actions, in[1]);
+            posix_spawn_file_actions_addclose(& actions, out[0]);
+            char const * argv[] = { TPP_BYPASS_PATH, "--multiplex", "-e", "sh", "-c", command.c_str(), nullptr };
+            errno = posix_spawn(& pid, TPP_BYPASS_PATH, & actions, nullptr, const_cast<char * const *>(argv), environ);
+            posix_spawn_file_actions_destroy(& actions);
+            close(in[0]);
+            close(out[1]);
+            input = in[1];
+            output = out[0];
+            OSCHECK(errno == 0);
+        }
+
+        ~Multiplexer() {
+            closeInput();
+            close(output);
+            if (pid > 0)
+                waitpid(pid, nullptr, 0);
+        }
+
+        void send(std::string const & what) { OSCHECK(::write(input, what.c_str(), what.size()) == static_cast<ssize_t>(what.size())); }
+
+        void closeInput() {
+            if (input >= 0)
+                close(input);
+            input = -1;
+        }
+
+        /** Closes the input and returns the exit code of the bypass once it terminates. 
+         */
+        int wait() {
+            closeInput();
+            while (readFrames()) {
+            }
+            int status;
+            OSCHECK(waitpid(pid, & status, 0) == pid);
+            pid = -1;
+            return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        }
+
+        /** Reads the frames until the exits of given number of channels have been reported. 
+         */
+        void waitForExits(size_t n) {
+            while (exitCodes.size() < n) {
+                if (! readFrames())
+                    throw std::runtime_error("Bypass terminated before the channels did");
+            }
+        }
+
+        /** Reads the available output of the bypass and decodes all complete frames in it. Returns false when the output has been closed. 
+         */
+        bool readFrames() {
+            pollfd p{output, POLLIN, 0};
+            // the commands are trivial, so not getting any output for this long means the bypass is stuck
+            if (poll(& p, 1, 10000) != 1)
+                throw std::runtime_error("No output from the bypass");
+            char buffer[1024];
+            ssize_t n = ::read(output, buffer, sizeof(buffer));
+            OSCHECK(n >= 0);
+            frames.append(buffer, static_cast<size_t>(n));
+            while (decodeFrame()) {
+            }
+            return n > 0;
+        }
+
+        bool decodeFrame() {
+            size_t colon = frames.find(':');
+            size_t semicolon = frames.find(';');
+            if (colon == std::string::npos || semicolon == std::string::npos)
+                return false;
+            if (frames[0] != '`' || colon < 3 || semicolon < colon)
+                throw std::runtime_error("Invalid frame: " + frames);
+            unsigned id = static_cast<unsigned>(std::stoul(frames.substr(2, colon - 2)));
+            size_t value = std::stoul(frames.substr(colon + 1, semicolon - colon - 1));
+            if (frames[1] == 'x') {
+                exitCodes[id] = static_cast<int>(value);
+                frames.erase(0, semicolon + 1);
+                return true;
+            }
+            if (frames[1] != 'd')
+                throw std::runtime_error("Invalid frame: " + frames);
+            if (frames.size() < semicolon + 1 + value)
+                return false;
+            received[id] += frames.substr(semicolon + 1, value);
+            frames.erase(0, semicolon + 1 + value);
+            return true;
+        }
+    };
+
+}
+
+TEST(BypassMultiplex, Channels) {
+    Multiplexer m{"read x; echo \"<$x>\"; exit 3"};
+    m.send("`o1:80:25;`o2:80:25;`c1;foo\n`c2;bar\n");
+    m.waitForExits(2);
+    EXPECT(m.received[1].find("<foo>") != std::string::npos);
+    EXPECT(m.received[2].find("<bar>") != std::string::npos);
+    EXPECT(m.received[1].find("bar") == std::string::npos);
+    EXPECT(m.exitCodes[1], 3);
+    EXPECT(m.exitCodes[2], 3);
+    // hangup of the channel terminates its command without any input
+    m.send("`o7:80:25;`x7;");
+    m.waitForExits(3);
+    EXPECT(m.exitCodes.find(7) != m.exitCodes.end());
+    EXPECT(m.received[7].find("<") == std::string::npos);
+    EXPECT(m.wait(), EXIT_SUCCESS);
+}
+
+TEST(BypassMultiplex, InvalidCommands) {
+    Multiplexer m{"read x; echo \"<$x>\"; exit 3"};
+    // unknown and malformed commands are dropped and the channels keep being served
+    m.send("`o1:80:25;`q;`o2:x:25;`c1;foo\n");
+    m.waitForExits(1);
+    EXPECT(m.received[1].find("<foo>") != std::string::npos);
+    EXPECT(m.exitCodes[1], 3);
+    m.send("`c1:;`o3:80:25;bar\n");
+    m.waitForExits(2);
+    EXPECT(m.received[3].find("<bar>") != std::string::npos);
+    EXPECT(m.wait(), EXIT_SUCCESS);
+    // the malformed open did not open its channel
+    EXPECT(m.received.find(2) == m.received.end());
+    EXPECT(m.exitCodes.find(2) == m.exitCodes.end());
+}
+
+#endif
@@ -1,31 +1,124 @@
 
 #include <cstdlib>
+#include <cstdio>
 #include <cassert>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <sys/wait.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
 #include <pwd.h>
 #include <errno.h>
 #include <termios.h>
 #include <memory.h>
+#include <limits.h>
 #include <pty.h>
 
+#include <algorithm>
 #include <iostream>
+#include <memory>
 #include <fstream>
 #include <chrono>
-#include <thread>
 #include <string>
 #include <vector>
 #include <unordered_map>
 
+#include "shared_ring.h"
+
+/** Byte ring buffer for the input, whose unread data is always contiguous. 
+
+    The buffer is a memfd mapped twice into adjacent virtual memory so that the unread data and the free space can be accessed as single spans regardless of where they wrap around and never have to be moved. If the mapping fails, falls back to an ordinary allocation, where the unread data is moved to the beginning of the buffer when the free space at its end runs out. 
+ */
+class RingBuffer {
+public:
+
+    explicit RingBuffer(size_t capacity):
+	    base_{nullptr},
+		capacity_{static_cast<size_t>(sysconf(_SC_PAGESIZE))},
+		mirrored_{false},
+		read_{0},
+		write_{0} {
+		while (capacity_ < capacity)
+		    capacity_ *= 2;
+		int fd = memfd_create("tpp-bypass-input", MFD_CLOEXEC);
+		if (fd >= 0) {
+			if (ftruncate(fd, capacity_) == 0) {
+				// reserve the address space for both copies first so that they can be mapped adjacent to each other
+				void * base = mmap(nullptr, capacity_ * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				if (base != MAP_FAILED) {
+					char * b = static_cast<char *>(base);
+					if (mmap(b, capacity_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED && mmap(b + capacity_, capacity_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED) {
+						base_ = b;
+						mirrored_ = true;
+					} else {
+						munmap(base, capacity_ * 2);
+					}
+				}
+			}
+			close(fd);
+		}
+		if (! mirrored_)
+		    base_ = new char[capacity_];
+	}
+
+	~RingBuffer() {
+		if (mirrored_)
+		    munmap(base_, capacity_ * 2);
+		else
+		    delete [] base_;
+	}
+
+	char * data() { return base_ + read_ % capacity_; }
+	size_t size() const { return write_ - read_; }
+
+	void consume(size_t numBytes) { read_ += numBytes; }
+
+	/** Returns the start of the free space, which is contiguous. 
+	 */
+	char * writePtr() {
+		if (read_ == write_) {
+			read_ = write_ = 0;
+		} else if (! mirrored_ && read_ != 0) {
+			size_t n = size();
+			memmove(base_, data(), n);
+			read_ = 0;
+			write_ = n;
+		}
+		return base_ + write_ % capacity_;
+	}
+
+	size_t writable() const { return capacity_ - size(); }
+
+	void commit(size_t numBytes) { write_ += numBytes; }
+
+private:
+    char * base_;
+	size_t capacity_;
+	bool mirrored_;
+	/** Total number of bytes read and written. The unread data is between the two. 
+	 */
+	size_t read_;
+	size_t write_;
+}; // RingBuffer
+
 /** The Windows ConPTY bypass via WSL
  
     The bypass creates a pseudoterminal in the WSL and relays any traffic on that terminal unchanged to the terminal connected via standard input and output, thus bypassing the Win32 ConPTY and its encoding and decoding of the escape sequences. This allows the terminal to use the terminal for linux applications in the same way it would on linux and spares it any issues the ConPTY might have. 
 
 	Extra terminal commands, such as terminal resize events are encoded in the stream using the backtick escape character.
 
+	With `--multiplex`, a single bypass runs the command in any number of pseudoterminals (channels) opened by the terminal over the same stdin and stdout, see multiplex().
+
 	An additional benefit is increase in speed since the ConPTY has to do much than the simple bypass. 
  */
 class Bypass {
@@ -35,6 +128,8 @@ public:
 	 */
     Bypass(int argc, char * argv[]):
 	    bufferSize_{10240},
+		splice_{true},
+		coalesceUs_{0},
 		pipe_{0} {
 		int i = 1;
 		for (; i < argc; ++i) {
@@ -56,6 +151,27 @@ public:
 					arg = argv[i];
 					bufferSize_ = std::stoul(arg);
 				}
+			} else if (arg == "--no-splice") {
+				splice_ = false;
+			} else if (arg == "--multiplex") {
+				multiplex_ = true;
+			} else if (arg.find("--coalesce") == 0) {
+				if (arg[10] == '=') {
+					coalesceUs_ = std::stoul(arg.substr(11));
+				} else {
+					if (++i == argc)
+					    throw std::runtime_error("Missing coalesce deadline value (and command to execute)");
+					arg = argv[i];
+					coalesceUs_ = std::stoul(arg);
+				}
+			} else if (arg.find("--shm") == 0) {
+				if (arg[5] == '=') {
+					parseShm(arg.substr(6));
+				} else {
+					if (++i == argc)
+					    throw std::runtime_error("Missing shared memory file descriptors (and command to execute)");
+					parseShm(argv[i]);
+				}
 			} else {
 				size_t assignPos = arg.find("=");
 				if (assignPos == std::string::npos)
@@ -69,34 +185,75 @@ public:
 
 	}
 
+	/** Parses the MEMFD:BYPASS_EVENTFD:TERMINAL_EVENTFD file descriptors of the shared memory transport, see shared_ring.h. 
+	 */
+	void parseShm(std::string const & value) {
+		size_t first = value.find(':');
+		size_t second = value.find(':', first + 1);
+		if (first == std::string::npos || second == std::string::npos)
+		    throw std::runtime_error(std::string("Invalid shared memory file descriptors: ") + value);
+		shmFd_ = std::stoi(value.substr(0, first));
+		shmEvent_ = std::stoi(value.substr(first + 1, second - first - 1));
+		terminalEvent_ = std::stoi(value.substr(second + 1));
+	}
+
 	/** Executes the command and relays its I/O.
 
 	    When the command terminates, returns its exit code.  
 	 */
 	int run() {
-		switch (pid_ = forkpty(&pipe_, nullptr, nullptr, nullptr)) {
-			case -1:
-			    throw std::runtime_error("Fork failed");
-			// child process
-			case 0: {
-			    setsid();
-                if (ioctl(1, TIOCSCTTY, nullptr) < 0)
-                    throw std::runtime_error("Unable to reach terminal in child");
-			    setTargetEnvironment();
-				clearTargetSignals(); 
-				char ** argv = commandToArgv();
-				if (execvp(cmd_.front().c_str(), argv) != -1)
-				    throw std::runtime_error("Unable to execute target command");
-				// this cannot happen
-				throw std::runtime_error("");				
-			}
-			default:
-			    return translate();
-		}
+		// the signals are received via signalfd, blocked before the fork so that none is missed
+		sigset_t signals = BypassSignals();
+		sigprocmask(SIG_BLOCK, &signals, nullptr);
+		// a closed stdout is detected by the failed write
+		signal(SIGPIPE, SIG_IGN);
+		// the shared memory transport is not for the command
+		for (int fd : {shmFd_, shmEvent_, terminalEvent_})
+		    if (fd >= 0)
+			    fcntl(fd, F_SETFD, FD_CLOEXEC);
+		if (multiplex_)
+		    return multiplex();
+		pid_ = startCommand(pipe_, nullptr);
+		if (pid_ < 0)
+		    throw std::runtime_error("Fork failed");
+		return translate();
 	}
 
 private:
 
+	/** A command multiplexed over stdin and stdout, see multiplex(). 
+	 */
+	struct Channel {
+		unsigned id;
+		pid_t pid;
+		int pty;
+		bool outputOpen = true;
+		bool watched = false;
+		/** Input the pseudoterminal has not taken yet, see flushChannelInput(). 
+		 */
+		std::string backlog;
+	};
+
+	/** Starts the command in a new pseudoterminal of given size (or the default size if null). Returns the pid of the command and sets pty to the master end of its pseudoterminal, or returns -1 if the fork failed.
+	 */
+	pid_t startCommand(int & pty, winsize * size) {
+		pid_t pid = forkpty(&pty, nullptr, nullptr, size);
+		// child process
+		if (pid == 0) {
+			setsid();
+			if (ioctl(1, TIOCSCTTY, nullptr) < 0)
+				throw std::runtime_error("Unable to reach terminal in child");
+			setTargetEnvironment();
+			clearTargetSignals();
+			char ** argv = commandToArgv();
+			if (execvp(cmd_.front().c_str(), argv) != -1)
+				throw std::runtime_error("Unable to execute target command");
+			// this cannot happen
+			throw std::runtime_error("");
+		}
+		return pid;
+	}
+
 	/** Converts the command from the commandline to the null terminated array of null terminated strings required by the execvp. 
 	 */
 	char ** commandToArgv() {
@@ -134,123 +291,939 @@ private:
 		signal(SIGQUIT, SIG_DFL);
 		signal(SIGTERM, SIG_DFL);
 		signal(SIGALRM, SIG_DFL);
+		signal(SIGPIPE, SIG_DFL);
+		sigset_t signals = BypassSignals();
+		sigprocmask(SIG_UNBLOCK, &signals, nullptr);
+	}
+
+	/** Signals the bypass receives via signalfd. 
+	 */
+	static sigset_t BypassSignals() {
+		sigset_t signals;
+		sigemptyset(&signals);
+		sigaddset(&signals, SIGCHLD);
+		sigaddset(&signals, SIGHUP);
+		sigaddset(&signals, SIGINT);
+		sigaddset(&signals, SIGTERM);
+		return signals;
 	}
 
-	/** Resizes the terminal to the target command. 
+	/** Resizes the terminal of the target command.
 	 */
-	void resize(int cols, int rows) {
+	void resize(int pty, int cols, int rows) {
         struct winsize s;
         s.ws_row = rows;
         s.ws_col = cols;
         s.ws_xpixel = 0;
         s.ws_ypixel = 0;
-        if (ioctl(pipe_, TIOCSWINSZ, &s) < 0)
+        if (ioctl(pty, TIOCSWINSZ, &s) < 0)
             throw std::runtime_error("Unable to resize target terminal");
 	}
 
     /** Reads the output of the command in the terminal pipe and outputs it unchanged on the stdout, reads the stdin, translates any extra commands (terminal resize) and passes the rest as input to the target commands's pseudoterminal.
+
+	    All of it is done by a single epoll loop, which also watches for the termination of the command via a pidfd (or SIGCHLD where pidfds are not supported) and for the signals sent to the bypass via a signalfd. When the terminal closes stdin, or the bypass is asked to terminate, the command is hung up as if its terminal was closed. 
 	    
-		When done, returns the exit code of the target command. 
+		When the command terminates, relays the output it left in the terminal and returns its exit code. 
 	 */
 	int translate() {
-		std::thread outputBypass{[this]() {
-			char * buffer = new char [bufferSize_];
-			while (true) {
-				int numBytes = 0;
-				while (true) {
-					numBytes = read(pipe_, (void*)buffer, bufferSize_);
-					if (numBytes == -1) {
-						if (errno == EINTR || errno == EAGAIN)
-						    continue;
-						numBytes = 0;
-					}
-					break;
+		epoll_ = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_ < 0)
+		    throw std::runtime_error("Unable to create epoll");
+#ifdef SYS_pidfd_open
+		pidfd_ = static_cast<int>(syscall(SYS_pidfd_open, pid_, 0));
+#endif
+		sigset_t signals = BypassSignals();
+		// the termination of the command is reported by the pidfd if available
+		if (pidfd_ >= 0)
+		    sigdelset(&signals, SIGCHLD);
+		signals_ = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+		if (signals_ < 0)
+		    throw std::runtime_error("Unable to create signalfd");
+		// the input is written only when the terminal can take it so that the loop never blocks on it while the command waits for its output to be read
+		fcntl(pipe_, F_SETFL, fcntl(pipe_, F_GETFL) | O_NONBLOCK);
+		inputBuffer_.reset(new RingBuffer{bufferSize_});
+		struct stat st;
+		if (shmFd_ >= 0) {
+			shm_.reset(new SharedTransport{shmFd_});
+			close(shmFd_);
+			fcntl(shmEvent_, F_SETFL, fcntl(shmEvent_, F_GETFL) | O_NONBLOCK);
+			outputMode_ = OutputMode::Shared;
+		} else if (coalesceUs_ != 0) {
+			outputMode_ = OutputMode::Coalesce;
+			timer_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+			if (timer_ < 0)
+			    throw std::runtime_error("Unable to create timerfd");
+		} else if (splice_ && fstat(STDOUT_FILENO, &st) == 0 && S_ISFIFO(st.st_mode)) {
+			outputMode_ = OutputMode::Splice;
+		} else {
+			outputMode_ = OutputMode::Copy;
+		}
+		if (outputMode_ != OutputMode::Splice && outputMode_ != OutputMode::Shared)
+		    outputBuffer_.resize(bufferSize_);
+		// stdin that can't be polled, such as a regular file or /dev/null, is always readable
+		stdinPollable_ = watch(STDIN_FILENO, EPOLLIN);
+		updatePipeWatch();
+		watch(signals_, EPOLLIN);
+		if (pidfd_ >= 0)
+		    watch(pidfd_, EPOLLIN);
+		if (timer_ >= 0)
+		    watch(timer_, EPOLLIN);
+		if (shm_ != nullptr) {
+			watch(shmEvent_, EPOLLIN);
+			shm_->header()->attached.store(1);
+			Notify(terminalEvent_);
+			// whatever the terminal sent before the bypass attached
+			readSharedInput();
+		}
+		epoll_event events[8];
+		while (! exited_) {
+			bool readStdin = inputOpen_ && ! stdinPollable_ && input_.empty();
+			int n = epoll_wait(epoll_, events, 8, readStdin ? 0 : -1);
+			if (n < 0) {
+				if (errno == EINTR)
+				    continue;
+				throw std::runtime_error("Unable to wait for events");
+			}
+			for (int i = 0; i < n; ++i) {
+				int fd = events[i].data.fd;
+				if (fd == STDIN_FILENO) {
+					readInput();
+				} else if (fd == pipe_) {
+					if (events[i].events & EPOLLOUT)
+					    writeInput();
+					if (outputOpen_ && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+					    readOutput();
+				} else if (fd == signals_) {
+					readSignals();
+				} else if (fd == pidfd_) {
+					reap();
+				} else if (fd == timer_) {
+					uint64_t expirations;
+					if (read(timer_, &expirations, sizeof(expirations)) > 0)
+					    flushOutput();
+				} else if (fd == shmEvent_) {
+					readSharedEvent();
+				}
+			}
+			if (readStdin && inputOpen_ && input_.empty())
+			    readInput();
+		}
+		// the command has terminated, relay whatever output it left in the terminal
+		while (outputOpen_) {
+			if (readOutput())
+			    continue;
+			// the terminal has yet to make space for the rest of the output
+			if (! outputPaused_ || ! waitShared())
+			    break;
+		}
+		flushOutput();
+		if (shm_ != nullptr) {
+			if (shm_->output().close())
+			    Notify(terminalEvent_);
+			close(shmEvent_);
+			close(terminalEvent_);
+		}
+		close(epoll_);
+		close(signals_);
+		if (pidfd_ >= 0)
+		    close(pidfd_);
+		if (timer_ >= 0)
+		    close(timer_);
+		return exitCode_;
+	}
+
+	/** Relays the I/O of any number of channels over stdin and stdout in the --multiplex mode. 
+
+	    Each channel runs the command in its own pseudoterminal, so that a terminal with many tabs needs a single bypass and opening a tab costs only a fork. The terminal opens a channel by `` `o ID : COLS : ROWS ; ``, which also selects it, selects the channel that receives the input which follows by `` `c ID ; ``, resizes the selected channel by the usual resize command and hangs up the command of a channel by `` `x ID ; ``. Input for an unknown channel is discarded. Unknown, or malformed commands are dropped up to their terminating semicolon, or the next command, rather than ending the bypass with all its channels.
+
+		Each read of the output of a channel is sent as a single frame, `` `d ID : LENGTH ; `` followed by LENGTH bytes of the output, so that the output itself needs no escaping. When the command of a channel terminates, its remaining output is sent, followed by `` `x ID : EXITCODE ; `` after which the id may be reused.
+
+		The channels are served fairly, every iteration of the loop reads at most bufferSize_ bytes from each channel with output, so that a command flooding its terminal does not hold back the others. Input the pseudoterminal of a channel can't take is kept for the channel rather than stalling the input of the others, and stdin is only paused while a channel is more than MaxChannelBacklog bytes behind. 
+
+		Runs until stdin is closed, which hangs up all channels, and all commands have terminated. The output is always copied, --no-splice, --coalesce and --shm do not apply. 
+	 */
+	int multiplex() {
+		epoll_ = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_ < 0)
+		    throw std::runtime_error("Unable to create epoll");
+		// with many commands their termination is reported by SIGCHLD rather than a pidfd each
+		sigset_t signals = BypassSignals();
+		signals_ = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+		if (signals_ < 0)
+		    throw std::runtime_error("Unable to create signalfd");
+		inputBuffer_.reset(new RingBuffer{bufferSize_});
+		outputBuffer_.resize(MaxFrameHeaderSize + bufferSize_);
+		stdinPollable_ = watch(STDIN_FILENO, EPOLLIN);
+		watch(signals_, EPOLLIN);
+		std::vector<epoll_event> events;
+		while (inputOpen_ || ! channels_.empty()) {
+			// room for all channels so that each gets its turn in every iteration
+			events.resize(channels_.size() + 2);
+			bool readStdin = inputOpen_ && ! stdinPollable_ && ! inputPaused_;
+			int n = epoll_wait(epoll_, events.data(), static_cast<int>(events.size()), readStdin ? 0 : -1);
+			if (n < 0) {
+				if (errno == EINTR)
+				    continue;
+				throw std::runtime_error("Unable to wait for events");
+			}
+			for (int i = 0; i < n; ++i) {
+				int fd = events[i].data.fd;
+				if (fd == STDIN_FILENO) {
+					readInput();
+				} else if (fd == signals_) {
+					readSignals();
+				} else {
+					// the channel may have been closed by an earlier event
+					auto c = channelFds_.find(fd);
+					if (c == channelFds_.end())
+					    continue;
+					if (events[i].events & EPOLLOUT)
+					    writeChannel(*c->second);
+					if (c->second->outputOpen && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+					    readChannel(*c->second);
 				}
-				if (numBytes == 0)
+			}
+			if (readStdin && inputOpen_ && ! inputPaused_)
+			    readInput();
+		}
+		close(epoll_);
+		close(signals_);
+		return EXIT_SUCCESS;
+	}
+
+	/** Starts the command in a new channel of given size and selects it. 
+	
+	    If the id is already in use, no channel is opened and the input that follows is discarded. If the command can't be started, the channel is reported as terminated right away. 
+	 */
+	void openChannel(unsigned id, unsigned cols, unsigned rows) {
+		selected_ = nullptr;
+		// a mistake of the terminal, which must not take down the other channels
+		if (channels_.find(id) != channels_.end())
+		    return;
+		winsize size{static_cast<unsigned short>(rows), static_cast<unsigned short>(cols), 0, 0};
+		std::unique_ptr<Channel> c{new Channel{}};
+		c->id = id;
+		c->pid = startCommand(c->pty, &size);
+		if (c->pid < 0) {
+			sendExit(id, EXIT_FAILURE);
+			return;
+		}
+		// the commands of other channels must not inherit the pseudoterminal
+		fcntl(c->pty, F_SETFD, FD_CLOEXEC);
+		fcntl(c->pty, F_SETFL, fcntl(c->pty, F_GETFL) | O_NONBLOCK);
+		selected_ = c.get();
+		channelFds_.insert(std::make_pair(c->pty, c.get()));
+		updateChannelWatch(*c);
+		channels_.insert(std::make_pair(id, std::move(c)));
+	}
+
+	/** Updates the events watched for the pseudoterminal of the channel, see updatePipeWatch(). 
+	 */
+	void updateChannelWatch(Channel & c) {
+		uint32_t events = 0;
+		if (c.outputOpen)
+		    events |= EPOLLIN;
+		if (! c.backlog.empty())
+		    events |= EPOLLOUT;
+		if (events == 0) {
+			if (c.watched)
+			    epoll_ctl(epoll_, EPOLL_CTL_DEL, c.pty, nullptr);
+		} else if (c.watched) {
+			setWatch(c.pty, events);
+		} else {
+			watch(c.pty, events);
+		}
+		c.watched = events != 0;
+	}
+
+	/** Reaps the commands of the channels that have terminated. The output they left in their terminals is relayed before the terminal is told, after which the channel is closed. 
+	 */
+	void reapChannels() {
+		int status;
+		pid_t pid;
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+			auto i = std::find_if(channels_.begin(), channels_.end(), [pid](auto const & c) { return c.second->pid == pid; });
+			if (i == channels_.end())
+			    continue;
+			Channel & c = *i->second;
+			while (c.outputOpen && readChannel(c)) {
+			}
+			sendExit(c.id, WEXITSTATUS(status));
+			// closing the pseudoterminal removes it from the epoll as well
+			close(c.pty);
+			channelFds_.erase(c.pty);
+			if (selected_ == &c)
+			    selected_ = nullptr;
+			channels_.erase(i);
+		}
+		resumeInput();
+	}
+
+	/** Relays the output available in the pseudoterminal of the channel as a single frame. Returns false if there was none. 
+	 */
+	bool readChannel(Channel & c) {
+		char * data = outputBuffer_.data() + MaxFrameHeaderSize;
+		ssize_t numBytes = read(c.pty, (void*)data, bufferSize_);
+		if (numBytes == -1) {
+			if (errno == EINTR)
+			    return true;
+			if (errno == EAGAIN)
+			    return false;
+			// EIO when the command closed the terminal
+			numBytes = 0;
+		}
+		if (numBytes == 0) {
+			c.outputOpen = false;
+			c.backlog.clear();
+			updateChannelWatch(c);
+			resumeInput();
+			return false;
+		}
+		// the header is put right before the data so that the frame is sent by a single write
+		char header[MaxFrameHeaderSize];
+		int headerSize = snprintf(header, sizeof(header), "`d%u:%zd;", c.id, numBytes);
+		memcpy(data - headerSize, header, headerSize);
+		sendFrame(data - headerSize, headerSize + numBytes);
+		return true;
+	}
+
+	/** Tells the terminal that the command of the channel has terminated. 
+	 */
+	void sendExit(unsigned id, int exitCode) {
+		char frame[MaxFrameHeaderSize];
+		int size = snprintf(frame, sizeof(frame), "`x%u:%d;", id, exitCode);
+		sendFrame(frame, size);
+	}
+
+	/** Writes the frame to stdout. When stdout has been closed, hangs up all channels and discards their output until they terminate. 
+	 */
+	void sendFrame(char const * frame, size_t size) {
+		if (! outputOpen_)
+		    return;
+		if (! WriteAll(STDOUT_FILENO, frame, size)) {
+			outputOpen_ = false;
+			hangup();
+		}
+	}
+
+	/** Writes the input the pseudoterminal of the channel could not take before, when it becomes writable. 
+	 */
+	void writeChannel(Channel & c) {
+		while (! c.backlog.empty()) {
+			ssize_t written = write(c.pty, (void const *)c.backlog.data(), c.backlog.size());
+			if (written == -1) {
+				if (errno == EINTR)
+				    continue;
+				if (errno == EAGAIN)
 				    break;
-				write(STDOUT_FILENO, (void*)buffer, numBytes);
+				// the command closed the terminal, it can't receive the input
+				c.backlog.clear();
+				break;
+			}
+			c.backlog.erase(0, written);
+		}
+		updateChannelWatch(c);
+		resumeInput();
+	}
+
+	/** Resumes reading stdin paused by flushChannelInput() once no channel is more than MaxChannelBacklog bytes behind. 
+	 */
+	void resumeInput() {
+		if (! inputPaused_)
+		    return;
+		for (auto & i : channels_)
+		    if (i.second->backlog.size() > MaxChannelBacklog)
+			    return;
+		inputPaused_ = false;
+		if (inputOpen_ && stdinPollable_)
+		    watch(STDIN_FILENO, EPOLLIN);
+	}
+
+	/** Adds the file descriptor to the epoll. Returns false if the file descriptor does not support polling. 
+	 */
+	bool watch(int fd, uint32_t events) {
+		epoll_event e;
+		e.events = events;
+		e.data.fd = fd;
+		if (epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &e) == 0)
+		    return true;
+		if (errno == EPERM)
+		    return false;
+		throw std::runtime_error("Unable to add file descriptor to epoll");
+	}
+
+	/** Changes the events watched for the file descriptor. 
+	 */
+	void setWatch(int fd, uint32_t events) {
+		epoll_event e;
+		e.events = events;
+		e.data.fd = fd;
+		epoll_ctl(epoll_, EPOLL_CTL_MOD, fd, &e);
+	}
+
+	/** Updates the events watched for the pseudoterminal. 
+
+	    Its output is not read while there is no space for it in the shared memory, and it is watched for being writable only while it has not taken all of the input. If there is neither, it is not watched at all, because hangup is reported regardless. 
+	 */
+	void updatePipeWatch() {
+		uint32_t events = 0;
+		if (outputOpen_ && ! outputPaused_)
+		    events |= EPOLLIN;
+		if (! input_.empty())
+		    events |= EPOLLOUT;
+		if (events == 0) {
+			if (pipeWatched_)
+			    epoll_ctl(epoll_, EPOLL_CTL_DEL, pipe_, nullptr);
+		} else if (pipeWatched_) {
+			setWatch(pipe_, events);
+		} else {
+			watch(pipe_, events);
+		}
+		pipeWatched_ = events != 0;
+	}
+
+	/** Reaps the command if it has terminated. 
+	 */
+	void reap() {
+		int status;
+		pid_t x = waitpid(pid_, &status, WNOHANG);
+		if (x == pid_) {
+			exitCode_ = WEXITSTATUS(status);
+			exited_ = true;
+		} else if (x < 0 && errno != EINTR) {
+			if (errno != ECHILD)
+			    throw std::runtime_error("Unable to wait for target process termination.");
+			exited_ = true;
+		}
+	}
+
+	/** Handles the signals received by the bypass. 
+	 */
+	void readSignals() {
+		signalfd_siginfo info;
+		while (read(signals_, &info, sizeof(info)) == sizeof(info)) {
+			if (info.ssi_signo != SIGCHLD)
+			    hangup();
+			else if (multiplex_)
+			    reapChannels();
+			else
+			    reap();
+		}
+	}
+
+	/** Hangs up the command (or the commands of all channels when multiplexing), as if its terminal was closed.
+	 */
+	void hangup() {
+		if (multiplex_) {
+			for (auto & i : channels_)
+			    HangUp(i.second->pid, i.second->pty);
+			return;
+		}
+		if (exited_)
+		    return;
+		HangUp(pid_, pipe_);
+	}
+
+	static void HangUp(pid_t pid, int pty) {
+		kill(pid, SIGHUP);
+		// the foreground job of the terminal, if other than the command itself
+		ioctl(pty, TIOCSIG, SIGHUP);
+	}
+
+	/** Reads the input from stdin and sends it to the command. 
+	 */
+	void readInput() {
+		ssize_t numBytes = read(STDIN_FILENO, (void *) inputBuffer_->writePtr(), inputBuffer_->writable());
+		if (numBytes == -1) {
+			if (errno == EINTR || errno == EAGAIN)
+			    return;
+			numBytes = 0;
+		}
+		if (numBytes == 0) {
+			inputOpen_ = false;
+			// the terminal is gone, while a regular file or /dev/null simply has no more input
+			if (stdinPollable_) {
+			    epoll_ctl(epoll_, EPOLL_CTL_DEL, STDIN_FILENO, nullptr);
+				hangup();
+			}
+			return;
+		}
+		inputBuffer_->commit(numBytes);
+		// the command has closed its terminal and can't receive the input
+		if (! outputOpen_) {
+			inputBuffer_->consume(inputBuffer_->size());
+			return;
+		}
+		sendInput(false);
+	}
+
+	/** Reads the input from the shared memory and sends it to the command, until there is no more, in which case the terminal is told to signal when there is. The input ends when the terminal closes the ring. 
+	 */
+	void readSharedInput() {
+		SharedRing & ring = shm_->input();
+		size_t unprocessed = 0;
+		while (input_.empty()) {
+			if (ring.size() == unprocessed) {
+				// the terminal has closed the ring and is gone, just like at the end of stdin
+				if (ring.closed()) {
+					if (inputOpen_) {
+						inputOpen_ = false;
+						if (stdinPollable_)
+						    epoll_ctl(epoll_, EPOLL_CTL_DEL, STDIN_FILENO, nullptr);
+						hangup();
+					}
+					return;
+				}
+				if (ring.consumerIdle(unprocessed))
+				    return;
+				continue;
+			}
+			// the command has closed its terminal and can't receive the input
+			if (! outputOpen_) {
+				if (ring.consume(ring.size()))
+				    Notify(terminalEvent_);
+				continue;
+			}
+			unprocessed = sendInput(true);
+		}
+	}
+
+	/** Handles the signal from the terminal, which either sent more input, or made space for more output. 
+	 */
+	void readSharedEvent() {
+		uint64_t value;
+		if (read(shmEvent_, &value, sizeof(value)) < 0)
+		    return;
+		if (outputPaused_ && shm_->output().writable() > 0) {
+			outputPaused_ = false;
+			updatePipeWatch();
+		}
+		if (input_.empty())
+		    readSharedInput();
+	}
+
+	/** Blocks until the terminal signals, unless stdin tells the terminal is gone. Returns true if the terminal has signalled. 
+	 */
+	bool waitShared() {
+		pollfd p[2] = {{shmEvent_, POLLIN, 0}, {inputOpen_ && stdinPollable_ ? STDIN_FILENO : -1, 0, 0}};
+		while (poll(p, 2, -1) < 0) {
+			if (errno != EINTR)
+			    return false;
+		}
+		if (p[1].revents != 0)
+		    return false;
+		uint64_t value;
+		read(shmEvent_, &value, sizeof(value));
+		return true;
+	}
+
+	/** Decodes the input in stdin's or the shared buffer and writes it to the terminal of the command. Returns the number of bytes left in the buffer, such as an incomplete command, which stays there until the rest of it is read. 
+
+	    If the terminal can't take all of the input, the input is not read until it can, see writeInput(). The queued input points into the buffer, which is only released when it has been written. 
+	 */
+	size_t sendInput(bool shared) {
+		char * buffer = shared ? shm_->input().data() : inputBuffer_->data();
+		size_t size = shared ? shm_->input().size() : inputBuffer_->size();
+		size_t processed = decodeInput(buffer, size);
+		if (input_.empty()) {
+			consumeInput(shared, processed);
+		} else {
+			stalledShared_ = shared;
+			stalledDecoded_ = processed;
+			// removed rather than watched for no events, because hangup is reported regardless
+			if (stdinPollable_ && inputOpen_)
+			    epoll_ctl(epoll_, EPOLL_CTL_DEL, STDIN_FILENO, nullptr);
+			updatePipeWatch();
+		}
+		return size - processed;
+	}
+
+	/** Releases the input that has been written from stdin's or the shared buffer. 
+	 */
+	void consumeInput(bool shared, size_t numBytes) {
+		if (! shared)
+		    inputBuffer_->consume(numBytes);
+		else if (shm_->input().consume(numBytes))
+		    Notify(terminalEvent_);
+	}
+
+	/** Writes the input the terminal could not take before, when it becomes writable, and resumes reading the input once all of it has been written. 
+	 */
+	void writeInput() {
+		if (! flushInput())
+		    return;
+		consumeInput(stalledShared_, stalledDecoded_);
+		updatePipeWatch();
+		sendInput(stalledShared_);
+		if (input_.empty()) {
+			if (inputOpen_ && stdinPollable_)
+			    watch(STDIN_FILENO, EPOLLIN);
+			if (shm_ != nullptr)
+			    readSharedInput();
+		}
+	}
+
+	/** Relays the output of the command available in the terminal. Returns false if there was none. 
+	 */
+	bool readOutput() {
+		ssize_t numBytes;
+		if (outputMode_ == OutputMode::Splice) {
+			numBytes = splice(pipe_, nullptr, STDOUT_FILENO, nullptr, bufferSize_, SPLICE_F_MOVE | SPLICE_F_MORE);
+			// no splice support for the pseudoterminal, nothing has been relayed yet so the output can be copied instead
+			if (numBytes == -1 && errno == EINVAL && ! spliced_) {
+				outputMode_ = OutputMode::Copy;
+				outputBuffer_.resize(bufferSize_);
+				return readOutput();
 			}
-            delete [] buffer;
-		}};
-		std::thread inputDecoder{[this]() {
-            char * buffer = new char[bufferSize_];
-            char * bufferWrite = buffer;
-            while (true) {
-                size_t numBytes = read(STDIN_FILENO, (void *) bufferWrite, bufferSize_ - (bufferWrite - buffer));
-                if (numBytes == 0)
-                    break;
-                numBytes += bufferWrite - buffer;
-                size_t processed = decodeInput(buffer, numBytes);
-                if (processed != numBytes) {
-                    memcpy(buffer, buffer + processed, numBytes - processed);
-                    bufferWrite = buffer + (numBytes - processed);
-                } else {
-                    bufferWrite = buffer;
-                }
-            }
-            delete [] buffer;
-
-		}};
-		inputDecoder.detach();
-		outputBypass.join();
-		int ec;
-		pid_t x = waitpid(pid_, &ec, 0);
-		ec = WEXITSTATUS(ec);
-		if (x < 0 && errno != ECHILD)
-		    throw std::runtime_error("Unable to wait for target process termination.");
-		return ec;
+		} else if (outputMode_ == OutputMode::Shared) {
+			SharedRing & ring = shm_->output();
+			// wait for the terminal to make space, unless it did in the meantime
+			if (ring.writable() == 0 && ring.producerIdle()) {
+				outputPaused_ = true;
+				updatePipeWatch();
+				return false;
+			}
+			numBytes = read(pipe_, (void*)ring.writePtr(), ring.writable());
+		} else {
+			numBytes = read(pipe_, (void*)(outputBuffer_.data() + outputSize_), outputBuffer_.size() - outputSize_);
+		}
+		if (numBytes == -1) {
+			if (errno == EINTR)
+			    return true;
+			if (errno == EAGAIN) {
+				// when splicing, the stdout pipe may be full and non-blocking
+				if (outputMode_ == OutputMode::Splice)
+				    WaitWritable(STDOUT_FILENO);
+				return false;
+			}
+			// EIO when the command closed the terminal
+			numBytes = 0;
+		}
+		if (numBytes == 0) {
+			// the output coalesced so far is still sent
+			flushOutput();
+			if (outputOpen_)
+			    closeOutput();
+			return false;
+		}
+		switch (outputMode_) {
+			// all data read from the terminal is in the pipe, there are no partial writes to take care of
+			case OutputMode::Splice:
+			    spliced_ = true;
+				break;
+			case OutputMode::Copy:
+			    if (! WriteAll(STDOUT_FILENO, outputBuffer_.data(), numBytes)) {
+					hangup();
+					closeOutput();
+				}
+				break;
+			case OutputMode::Coalesce:
+			    coalesceOutput(numBytes);
+				break;
+			case OutputMode::Shared:
+			    if (shm_->output().commit(numBytes))
+				    Notify(terminalEvent_);
+				break;
+		}
+		return true;
+	}
+
+	/** Adds the output just read to the coalesced output. 
+
+	    The output is accumulated as long as the command keeps producing it and sent when the buffer is full, when coalesceUs_ elapsed since the first byte of the batch, or when the pseudoterminal goes idle for CoalesceIdleUs, so that interactive echo is not delayed. The timer is armed for the earlier of the latter two, and rearmed by each read. 
+	 */
+	void coalesceOutput(size_t numBytes) {
+		auto now = std::chrono::steady_clock::now();
+		if (outputSize_ == 0)
+		    outputStart_ = now;
+		outputSize_ += numBytes;
+		if (outputSize_ < outputBuffer_.size()) {
+			long wait = std::min<long>(coalesceUs_ - std::chrono::duration_cast<std::chrono::microseconds>(now - outputStart_).count(), CoalesceIdleUs);
+			if (wait > 0) {
+				itimerspec t{{0, 0}, {0, wait * 1000}};
+				timerfd_settime(timer_, 0, &t, nullptr);
+				return;
+			}
+		}
+		flushOutput();
+	}
+
+	/** Sends the coalesced output. 
+
+	    After each batch the buffer size is adapted to the observed output rate so that a batch roughly spans the deadline, between bufferSize_ and MaxCoalesceBufferSize. 
+	 */
+	void flushOutput() {
+		if (outputSize_ == 0)
+		    return;
+		if (! WriteAll(STDOUT_FILENO, outputBuffer_.data(), outputSize_)) {
+			outputSize_ = 0;
+			hangup();
+			closeOutput();
+			return;
+		}
+		// the rate at which the command produced the batch, in bytes per deadline
+		size_t capacity = outputBuffer_.size();
+		auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - outputStart_).count();
+		size_t target = elapsed > 0 ? static_cast<size_t>(outputSize_ * static_cast<double>(coalesceUs_) / elapsed) : MaxCoalesceBufferSize;
+		if (target > capacity && capacity < MaxCoalesceBufferSize) {
+			outputBuffer_.resize(std::min(capacity * 2, MaxCoalesceBufferSize));
+		} else if (target < capacity / 4 && capacity / 2 >= bufferSize_) {
+			outputBuffer_.resize(capacity / 2);
+			outputBuffer_.shrink_to_fit();
+		}
+		outputSize_ = 0;
+	}
+
+	/** Stops relaying the output, either because the command closed its terminal, or because stdout has been closed. The input can no longer be sent either. 
+	 */
+	void closeOutput() {
+		outputOpen_ = false;
+		if (! input_.empty()) {
+			input_.clear();
+			consumeInput(stalledShared_, stalledDecoded_);
+			if (inputOpen_ && stdinPollable_)
+			    watch(STDIN_FILENO, EPOLLIN);
+		}
+		updatePipeWatch();
 	}
 
     /** Input comes encoded and must be decoded and sent to the pty. 
+
+	    The data between the commands is collected and written to the pty by a single writev when the whole buffer has been decoded, or before a command that must see the data preceding it is executed. Returns the number of bytes processed, which is less than the buffer size if the buffer ends with an incomplete command, or if the pty can't take all of the data, in which case the data queued so far is left in input_. 
      */
     size_t decodeInput(char * buffer, size_t bufferSize) {
 		
-#define WRITE(FROM, TO) if (FROM != TO) { write(pipe_, (void*)(buffer + FROM), TO - FROM); FROM = TO; }
-#define NEXT if (++i == bufferSize) return processed
-#define NUMBER(VAR) if (!ParseNumber(buffer, bufferSize, i, VAR)) return processed
-#define POP(WHAT) if (buffer[i++] != WHAT) { throw std::runtime_error(std::string("Expected ") + #WHAT + ", but found " + buffer[i]); }
+#define WRITE(FROM, TO) if (FROM != TO) { queueInput(buffer + FROM, TO - FROM); FROM = TO; }
+#define NEXT if (++i == bufferSize) { flushInput(); return processed; }
+#define NUMBER(VAR) if (!ParseNumber(buffer, bufferSize, i, VAR)) { flushInput(); return processed; }
+// a mistake of the terminal must not take down the other channels, so when multiplexing the invalid command is dropped instead
+#define INVALID(WHAT) { \
+	if (! multiplex_) \
+	    throw std::runtime_error(WHAT); \
+	if (! SkipCommand(buffer, bufferSize, i)) { flushInput(); return processed; } \
+	processed = i; \
+	start = processed; \
+	continue; \
+}
+#define POP(WHAT) if (buffer[i] != WHAT) INVALID(std::string("Expected ") + #WHAT + ", but found " + buffer[i]) else ++i;
 		size_t processed = 0;
 		size_t start = 0;
 		while (processed < bufferSize) {
-			if (buffer[processed] == '`') {
-				WRITE(start, processed);
-				size_t i = processed;
-				NEXT;
-				switch (buffer[i]) {
-					// if the character after backtick is backtick, the second backtick will be the beginning of next batch
-					case '`':
-						start = i;
-						processed = i + 1;
-						continue;
-					// the resize command (`r COLS : ROWS ;)
-					case 'r': {
-						unsigned cols;
-						unsigned rows;
-						NEXT;
-						NUMBER(cols);
-						POP(':');
-						NUMBER(rows);
-						POP(';');
-						resize(cols, rows);
-						processed = i;
-						start = processed;
-						continue;
-					// otherwise (unrecognized command) do an error
-					default:
-					    throw std::runtime_error(std::string("Unrecognized command") + buffer[i]);
-					}
+			// the commands are rare, most of the input is data
+			char * command = static_cast<char *>(memchr(buffer + processed, '`', bufferSize - processed));
+			if (command == nullptr) {
+				processed = bufferSize;
+				break;
+			}
+			processed = command - buffer;
+			WRITE(start, processed);
+			size_t i = processed;
+			NEXT;
+			switch (buffer[i]) {
+				// if the character after backtick is backtick, the second backtick will be the beginning of next batch
+				case '`':
+					start = i;
+					processed = i + 1;
+					continue;
+				// the resize command (`r COLS : ROWS ;)
+				case 'r': {
+					unsigned cols;
+					unsigned rows;
+					NEXT;
+					NUMBER(cols);
+					POP(':');
+					NUMBER(rows);
+					POP(';');
+					// the data before the resize must be processed by the old size, the command is decoded again when it has been written
+					if (! flushInput())
+					    return processed;
+					if (! multiplex_)
+					    resize(pipe_, cols, rows);
+					else if (selected_ != nullptr)
+					    resize(selected_->pty, cols, rows);
+					processed = i;
+					start = processed;
+					continue;
+				}
+				// opens a channel and selects it (`o ID : COLS : ROWS ;)
+				case 'o': {
+					if (! multiplex_)
+					    INVALID(std::string("Unrecognized command") + buffer[i]);
+					unsigned id;
+					unsigned cols;
+					unsigned rows;
+					NEXT;
+					NUMBER(id);
+					POP(':');
+					NUMBER(cols);
+					POP(':');
+					NUMBER(rows);
+					POP(';');
+					flushInput();
+					openChannel(id, cols, rows);
+					processed = i;
+					start = processed;
+					continue;
+				}
+				// selects the channel that receives the data which follows (`c ID ;)
+				case 'c': {
+					if (! multiplex_)
+					    INVALID(std::string("Unrecognized command") + buffer[i]);
+					unsigned id;
+					NEXT;
+					NUMBER(id);
+					POP(';');
+					flushInput();
+					auto c = channels_.find(id);
+					selected_ = c == channels_.end() ? nullptr : c->second.get();
+					processed = i;
+					start = processed;
+					continue;
+				}
+				// hangs up the command of the channel (`x ID ;)
+				case 'x': {
+					if (! multiplex_)
+					    INVALID(std::string("Unrecognized command") + buffer[i]);
+					unsigned id;
+					NEXT;
+					NUMBER(id);
+					POP(';');
+					flushInput();
+					auto c = channels_.find(id);
+					if (c != channels_.end())
+					    HangUp(c->second->pid, c->second->pty);
+					processed = i;
+					start = processed;
+					continue;
 				}
-			} 
-			++processed;
+				// otherwise (unrecognized command) do an error
+				default:
+				    INVALID(std::string("Unrecognized command") + buffer[i]);
+			}
 		}
 		WRITE(start, processed);
+		flushInput();
 		return processed;
 #undef WRITE
 #undef NEXT
 #undef NUMBER
+#undef INVALID
 #undef POP
     }
 
+	/** Adds the data to the input to be written to the pty by flushInput(). The data must stay valid until then. 
+	 */
+	void queueInput(char * data, size_t numBytes) {
+		input_.push_back(iovec{data, numBytes});
+	}
+
+	/** Writes the queued input to the pty (or to the selected channel when multiplexing, see flushChannelInput()). Returns false if the pty can't take all of it, in which case the rest stays queued. 
+	 */
+	bool flushInput() {
+		if (multiplex_)
+		    return flushChannelInput();
+		return WriteQueued(pipe_, input_);
+	}
+
+	/** Writes the queued data to the non-blocking file descriptor by a single writev (or more if there are more than IOV_MAX spans), retrying partial writes. Returns false if the file descriptor can't take all of it, in which case the rest stays queued. 
+	 */
+	static bool WriteQueued(int fd, std::vector<iovec> & queue) {
+		size_t done = 0;
+		while (done < queue.size()) {
+			ssize_t written = writev(fd, queue.data() + done, std::min<size_t>(queue.size() - done, IOV_MAX));
+			if (written == -1) {
+				if (errno == EINTR)
+				    continue;
+				if (errno == EAGAIN) {
+					queue.erase(queue.begin(), queue.begin() + done);
+					return false;
+				}
+				// the target command closed the terminal, it can't receive the input
+				break;
+			}
+			while (done < queue.size() && static_cast<size_t>(written) >= queue[done].iov_len) {
+				written -= queue[done].iov_len;
+				++done;
+			}
+			if (done < queue.size()) {
+				queue[done].iov_base = static_cast<char *>(queue[done].iov_base) + written;
+				queue[done].iov_len -= written;
+			}
+		}
+		queue.clear();
+		return true;
+	}
+
+	/** Writes the queued input to the selected channel. 
+	
+	    Whatever its pseudoterminal can't take is appended to the channel's backlog, so that the input buffer is always released and a busy channel does not hold back the input of the others. Always returns true. 
+	 */
+	bool flushChannelInput() {
+		Channel * c = selected_;
+		// the input must not overtake the backlog
+		if (c != nullptr && c->outputOpen && (! c->backlog.empty() || ! WriteQueued(c->pty, input_))) {
+			for (iovec const & i : input_)
+			    c->backlog.append(static_cast<char const *>(i.iov_base), i.iov_len);
+			updateChannelWatch(*c);
+			if (c->backlog.size() > MaxChannelBacklog && ! inputPaused_) {
+				inputPaused_ = true;
+				if (inputOpen_ && stdinPollable_)
+				    epoll_ctl(epoll_, EPOLL_CTL_DEL, STDIN_FILENO, nullptr);
+			}
+		}
+		input_.clear();
+		return true;
+	}
+
+	/** Writes the whole buffer, retrying partial writes. Returns false if the write fails, such as when the reading end has been closed. 
+	 */
+	static bool WriteAll(int fd, char const * buffer, size_t numBytes) {
+		while (numBytes > 0) {
+			ssize_t written = write(fd, (void const *)buffer, numBytes);
+			if (written == -1) {
+				if (errno == EINTR)
+				    continue;
+				if (errno == EAGAIN) {
+					WaitWritable(fd);
+					continue;
+				}
+				return false;
+			}
+			buffer += written;
+			numBytes -= written;
+		}
+		return true;
+	}
+
+	/** Signals the eventfd. 
+	 */
+	static void Notify(int fd) {
+		uint64_t value = 1;
+		write(fd, &value, sizeof(value));
+	}
+
+	/** Blocks until the non-blocking file descriptor can be written to. 
+	 */
+	static void WaitWritable(int fd) {
+		pollfd p{fd, POLLOUT, 0};
+		poll(&p, 1, -1);
+	}
+
+	/** Skips the rest of an invalid command from i up to and including its terminating semicolon, or up to the backtick of the next command. Returns false if the buffer ends first. 
+	 */
+	static bool SkipCommand(char const * buffer, size_t bufferSize, size_t & i) {
+		for (; i < bufferSize; ++i) {
+			if (buffer[i] == ';') {
+				++i;
+				return true;
+			}
+			if (buffer[i] == '`')
+			    return true;
+		}
+		return false;
+	}
+
 	static bool ParseNumber(char* buffer, size_t bufferSize, size_t& i, unsigned& value) {
 		value = 0;
 		while (buffer[i] >= '0' && buffer[i] <= '9') {
@@ -264,6 +1237,93 @@ private:
     std::vector<std::string> cmd_;
 	std::unordered_map<std::string, std::string> env_;
 	unsigned bufferSize_;
+	/** Whether to splice the output to stdout when it is a pipe, or always copy it. 
+	 */
+	bool splice_;
+	/** Deadline in microseconds for the coalesced output, 0 if the output is not coalesced, see coalesceOutput(). 
+	 */
+	unsigned coalesceUs_;
+
+	int epoll_ = -1;
+	int signals_ = -1;
+	/** The pidfd of the command, -1 if not supported, in which case SIGCHLD is received instead. 
+	 */
+	int pidfd_ = -1;
+	/** Timer for sending the coalesced output. 
+	 */
+	int timer_ = -1;
+	bool exited_ = false;
+	int exitCode_ = 0;
+
+	/** Whether stdin is still open and can be polled (regular files and /dev/null can't). 
+	 */
+	bool inputOpen_ = true;
+	bool stdinPollable_ = true;
+	std::unique_ptr<RingBuffer> inputBuffer_;
+	/** Input for the pty decoded from the input buffer, which the pty has not taken yet, see flushInput(). 
+	 */
+	std::vector<iovec> input_;
+	/** Whether the input in input_ comes from the shared memory or stdin, and the number of bytes of it decoded, which are released when it has been written. 
+	 */
+	bool stalledShared_ = false;
+	size_t stalledDecoded_ = 0;
+
+	/** The shared memory transport given by --shm, see shared_ring.h, and the eventfds on which the bypass and the terminal wait. 
+	 */
+	int shmFd_ = -1;
+	int shmEvent_ = -1;
+	int terminalEvent_ = -1;
+	std::unique_ptr<SharedTransport> shm_;
+
+	enum class OutputMode {
+		Splice,
+		Copy,
+		Coalesce,
+		Shared,
+	};
+
+	OutputMode outputMode_ = OutputMode::Copy;
+	bool outputOpen_ = true;
+	/** Whether there is no space for the output in the shared memory, in which case the pseudoterminal is not read until the terminal makes some. 
+	 */
+	bool outputPaused_ = false;
+	bool pipeWatched_ = false;
+	/** Whether any output has been spliced, after which the splice support of the pseudoterminal is no longer in question. 
+	 */
+	bool spliced_ = false;
+	/** Buffer for copied and coalesced output and the size of the coalesced output in it, see coalesceOutput(). 
+	 */
+	std::vector<char> outputBuffer_;
+	size_t outputSize_ = 0;
+	std::chrono::steady_clock::time_point outputStart_;
+
+	/** Time without output from the command after which the coalesced output is sent. 
+	 */
+	static constexpr long CoalesceIdleUs = 50;
+	/** Largest size the buffer for the coalesced output adapts to. 
+	 */
+	static constexpr size_t MaxCoalesceBufferSize = 1024 * 1024;
+
+	/** Whether to multiplex channels given by the terminal instead of running a single command, see multiplex(). 
+	 */
+	bool multiplex_ = false;
+	std::unordered_map<unsigned, std::unique_ptr<Channel>> channels_;
+	/** The channels by their pseudoterminals, for the epoll events. 
+	 */
+	std::unordered_map<int, Channel *> channelFds_;
+	/** The channel that receives the input, nullptr if the input is discarded. 
+	 */
+	Channel * selected_ = nullptr;
+	/** Whether stdin is not read because a channel is too far behind, see flushChannelInput(). 
+	 */
+	bool inputPaused_ = false;
+
+	/** Input a channel may fall behind before stdin is paused. 
+	 */
+	static constexpr size_t MaxChannelBacklog = 1024 * 1024;
+	/** Room for the largest frame header in front of the output of a channel. 
+	 */
+	static constexpr size_t MaxFrameHeaderSize = 48;
 
     pid_t pid_;
 	int pipe_;
@@ -284,9 +1344,13 @@ int main(int argc, char * argv[]) {
 		}
 	} catch (std::exception const & e) {
 		std::cerr << "ConPTY Bypass for t++. Usage: " << std::endl << std::endl;
-		std::cerr << "tpp-bypass {--buffer-size | envVar=value } [ -e cmd { arg }]" << std::endl << std::endl;
+		std::cerr << "tpp-bypass {--buffer-size | --no-splice | --coalesce | --shm | --multiplex | envVar=value } [ -e cmd { arg }]" << std::endl << std::endl;
 		std::cerr << "Where:" << std::endl;
 		std::cerr << "   --buffer-size determines the sizes of the I/O byuffers (--bufferSize=1024)" << std::endl;
+		std::cerr << "   --no-splice always copies the output instead of splicing it to stdout when stdout is a pipe" << std::endl;
+		std::cerr << "   --coalesce accumulates output of the command for up to given microseconds before sending it (--coalesce=2000)" << std::endl;
+		std::cerr << "   --shm passes the I/O via shared memory and eventfds inherited from the terminal (--shm=MEMFD:BYPASS_EVENTFD:TERMINAL_EVENTFD)" << std::endl;
+		std::cerr << "   --multiplex runs the command in channels opened by the terminal over the same stdin and stdout (`o ID:COLS:ROWS; `c ID; `x ID;)" << std::endl;
 		std::cerr << "   envVar=value sets given environment variable to the value before executing the command" << std::endl;
 		std::cerr << "   -e sets the command to execute (defaults to current users's shell)" << std::endl;
 		std::cerr << "Bypass error: " << e.what() << std::endl;
@@ -60,6 +60,8 @@ public:
 
 inline bool isDecimalDigit(char c) { return c >= '0' && c <= '9'; }
 
+inline bool isHexadecimalDigit(char c) { return isDecimalDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'); }
+
 inline bool isPrintableCharacter(char c) { return c >= 32 && c < 127; }
 
 inline char nibbleToHex(uint8_t x) {
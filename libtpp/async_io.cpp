@@ -0,0 +1,494 @@
+#if (defined ARCH_LINUX)
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <linux/time_types.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+#include "async_io.h"
+
+namespace tpp {
+
+#if (defined ARCH_LINUX)
+
+    // AsyncIO
+
+    std::unique_ptr<AsyncIO> AsyncIO::Create(Backend backend) {
+        switch (backend) {
+            case Backend::Epoll:
+                return std::make_unique<EpollIO>();
+            case Backend::IoUring:
+                return std::make_unique<UringIO>();
+            default:
+                // io_uring may be missing, or disabled by the kernel, or the registered buffers may be over the memlock limit
+                try {
+                    return std::make_unique<UringIO>();
+                } catch (OSError const &) {
+                    return std::make_unique<EpollIO>();
+                }
+        }
+    }
+
+    bool AsyncIO::IoUringAvailable() {
+        try {
+            UringIO io{8, 4096, 1};
+            return true;
+        } catch (OSError const &) {
+            return false;
+        }
+    }
+
+    void AsyncIO::SetNonBlocking(int fd) {
+        int flags = fcntl(fd, F_GETFL);
+        OSCHECK(flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0);
+    }
+
+    // EpollIO
+
+    void EpollIO::add(int fd, ReceiveHandler handler) {
+        ASSERT(channels_.find(fd) == channels_.end());
+        SetNonBlocking(fd);
+        channels_.emplace(fd, std::make_unique<Channel>(Channel{std::move(handler), std::string{}, false}));
+        loop_.add(fd, EPOLLIN, [this](int fd, uint32_t events) { ready(fd, events); });
+    }
+
+    void EpollIO::remove(int fd) {
+        auto i = channels_.find(fd);
+        ASSERT(i != channels_.end());
+        // the loop stops watching the channel at the end of its input
+        if (loop_.contains(fd))
+            loop_.remove(fd);
+        // the channel's handler may be the one being called
+        removed_.push_back(std::move(i->second));
+        channels_.erase(i);
+    }
+
+    void EpollIO::send(int fd, char const * buffer, size_t numBytes) {
+        auto i = channels_.find(fd);
+        ASSERT(i != channels_.end());
+        if (i->second->output.empty())
+            sending_.push_back(fd);
+        i->second->output.append(buffer, numBytes);
+    }
+
+    size_t EpollIO::poll(int timeoutMs) {
+        for (int fd : sending_) {
+            auto i = channels_.find(fd);
+            if (i != channels_.end())
+                write(fd, *i->second);
+        }
+        sending_.clear();
+        calls_ = 0;
+        loop_.poll(timeoutMs);
+        removed_.clear();
+        return calls_;
+    }
+
+    size_t EpollIO::pending(int fd) const {
+        auto i = channels_.find(fd);
+        ASSERT(i != channels_.end());
+        return i->second->output.size();
+    }
+
+    void EpollIO::ready(int fd, uint32_t events) {
+        // the channel stays alive even if its handler removes it
+        Channel & channel = *channels_.find(fd)->second;
+        if (events & EPOLLOUT)
+            write(fd, channel);
+        if (! (events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+            return;
+        ssize_t numBytes = ::read(fd, buffer_, sizeof(buffer_));
+        if (numBytes < 0 && (errno == EAGAIN || errno == EINTR))
+            return;
+        ++calls_;
+        if (numBytes > 0) {
+            channel.handler(buffer_, static_cast<size_t>(numBytes));
+            return;
+        }
+        // end of input, or error, stop watching the channel, the queued output can't be written either
+        loop_.remove(fd);
+        channel.output.clear();
+        channel.handler(nullptr, 0);
+    }
+
+    void EpollIO::write(int fd, Channel & channel) {
+        if (! loop_.contains(fd))
+            return;
+        while (! channel.output.empty()) {
+            ssize_t written = ::write(fd, channel.output.data(), channel.output.size());
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                // the error will be reported by the read
+                if (errno != EAGAIN)
+                    channel.output.clear();
+                break;
+            }
+            channel.output.erase(0, static_cast<size_t>(written));
+        }
+        bool writing = ! channel.output.empty();
+        if (writing != channel.writing) {
+            channel.writing = writing;
+            loop_.modify(fd, writing ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+        }
+    }
+
+    // UringIO
+
+    UringIO::UringIO(unsigned entries, size_t bufferSize, size_t numBuffers):
+        sqRing_{MAP_FAILED},
+        cqRing_{MAP_FAILED},
+        sqes_{static_cast<io_uring_sqe *>(MAP_FAILED)},
+        bufferSize_{bufferSize},
+        buffers_{new char[bufferSize * numBuffers]},
+        slots_(numBuffers) {
+        io_uring_params p{};
+        ring_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, & p));
+        OSCHECK(ring_ >= 0);
+        try {
+            // the single mmap also implies the kernel version with working registered buffers for reads from pollable files
+            if ((p.features & IORING_FEAT_SINGLE_MMAP) == 0 || (p.features & IORING_FEAT_NODROP) == 0 || (p.features & IORING_FEAT_EXT_ARG) == 0) {
+                errno = ENOSYS;
+                OSCHECK(false);
+            }
+            sqRingSize_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            cqRingSize_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+            sqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+            sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_, IORING_OFF_SQ_RING);
+            OSCHECK(sqRing_ != MAP_FAILED);
+            // both rings share the mapping
+            cqRing_ = sqRing_;
+            cqRingSize_ = 0;
+            sqesSize_ = p.sq_entries * sizeof(io_uring_sqe);
+            sqes_ = static_cast<io_uring_sqe *>(mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_, IORING_OFF_SQES));
+            OSCHECK(sqes_ != MAP_FAILED);
+            char * sq = static_cast<char *>(sqRing_);
+            sqHead_ = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+            sqTail_ = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+            sqMask_ = * reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+            sqEntries_ = p.sq_entries;
+            sqArray_ = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+            char * cq = static_cast<char *>(cqRing_);
+            cqHead_ = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+            cqTail_ = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+            cqMask_ = * reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+            cqes_ = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+            // register all read buffers as a single fixed buffer
+            iovec iov{buffers_.get(), bufferSize * numBuffers};
+            OSCHECK(syscall(__NR_io_uring_register, ring_, IORING_REGISTER_BUFFERS, & iov, 1) == 0);
+        } catch (...) {
+            close();
+            throw;
+        }
+        for (size_t i = 0; i < numBuffers; ++i) {
+            slots_[i].buffer = buffers_.get() + i * bufferSize;
+            freeSlots_.push_back(& slots_[numBuffers - 1 - i]);
+        }
+    }
+
+    UringIO::~UringIO() {
+        // cancel all reads and wait for the cancellations so that the kernel does not write to the buffers once they are freed
+        std::vector<int> fds;
+        for (auto & i : channels_)
+            fds.push_back(i.first);
+        for (int fd : fds)
+            remove(fd);
+        try {
+            for (int i = 0; i < 100 && ! removed_.empty(); ++i)
+                poll(10);
+        } catch (...) {
+        }
+        close();
+    }
+
+    void UringIO::add(int fd, ReceiveHandler handler) {
+        ASSERT(channels_.find(fd) == channels_.end());
+        // a write larger than the free space of a blocking PTY blocks the io_uring_enter call, while the non-blocking PTY supports waiting for the space via the internal poll of io_uring
+        SetNonBlocking(fd);
+        auto channel = std::make_unique<Channel>();
+        channel->fd = fd;
+        channel->handler = std::move(handler);
+        postReads(*channel);
+        channels_.emplace(fd, std::move(channel));
+    }
+
+    void UringIO::remove(int fd) {
+        auto i = channels_.find(fd);
+        ASSERT(i != channels_.end());
+        Channel & channel = *i->second;
+        channel.removed = true;
+        channel.output.clear();
+        for (Slot & slot : slots_) {
+            if (slot.channel != & channel)
+                continue;
+            // the read may be waiting for its poll, cancelling the poll cancels the read linked to it
+            for (uint64_t tag : {uint64_t{0}, PollTag}) {
+                io_uring_sqe * sqe = getSqe();
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = reinterpret_cast<uint64_t>(& slot) | tag;
+                sqe->user_data = IgnoreTag;
+            }
+        }
+        if (channel.writeInFlight) {
+            for (uint64_t tag : {uint64_t{0}, PollTag}) {
+                io_uring_sqe * sqe = getSqe();
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = reinterpret_cast<uint64_t>(& channel) | WriteTag | tag;
+                sqe->user_data = IgnoreTag;
+            }
+        }
+        removed_.push_back(std::move(i->second));
+        channels_.erase(i);
+        release(channel);
+    }
+
+    void UringIO::send(int fd, char const * buffer, size_t numBytes) {
+        auto i = channels_.find(fd);
+        ASSERT(i != channels_.end());
+        Channel & channel = *i->second;
+        if (channel.eof)
+            return;
+        if (channel.output.empty())
+            sending_.push_back(fd);
+        channel.output.append(buffer, numBytes);
+    }
+
+    size_t UringIO::poll(int timeoutMs) {
+        for (int fd : sending_) {
+            auto i = channels_.find(fd);
+            if (i != channels_.end())
+                postWrite(*i->second);
+        }
+        sending_.clear();
+        calls_ = 0;
+        // completions that are already there do not need to wait
+        processCompletions();
+        if (calls_ == 0) {
+            __kernel_timespec ts{};
+            io_uring_getevents_arg arg{};
+            if (timeoutMs >= 0) {
+                ts.tv_sec = timeoutMs / 1000;
+                ts.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+                arg.ts = reinterpret_cast<uint64_t>(& ts);
+            }
+            enter(1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, & arg, sizeof(arg));
+        } else if (toSubmit_ > 0) {
+            enter(0, 0, nullptr, 0);
+        }
+        processCompletions();
+        return calls_;
+    }
+
+    size_t UringIO::pending(int fd) const {
+        auto i = channels_.find(fd);
+        ASSERT(i != channels_.end());
+        Channel const & channel = *i->second;
+        return channel.output.size() + channel.writing.size() - channel.written;
+    }
+
+    io_uring_sqe * UringIO::getSqe() {
+        unsigned tail = *sqTail_;
+        // submit what we have if the submission queue is full
+        if (tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) == sqEntries_)
+            enter(0, 0, nullptr, 0);
+        unsigned index = tail & sqMask_;
+        io_uring_sqe * sqe = sqes_ + index;
+        std::memset(sqe, 0, sizeof(io_uring_sqe));
+        sqArray_[index] = index;
+        __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+        ++toSubmit_;
+        return sqe;
+    }
+
+    void UringIO::postReads(Channel & channel) {
+        while (channel.reads < ReadsPerChannel && ! channel.eof && ! channel.removed) {
+            if (freeSlots_.empty()) {
+                starving_.push_back(channel.fd);
+                return;
+            }
+            Slot * slot = freeSlots_.back();
+            freeSlots_.pop_back();
+            slot->channel = & channel;
+            postRead(*slot, false);
+            ++channel.reads;
+        }
+    }
+
+    void UringIO::postRead(Slot & slot, bool afterPoll) {
+        if (afterPoll)
+            postPoll(slot.channel->fd, POLLIN, reinterpret_cast<uint64_t>(& slot) | PollTag);
+        io_uring_sqe * sqe = getSqe();
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->fd = slot.channel->fd;
+        sqe->addr = reinterpret_cast<uint64_t>(slot.buffer);
+        sqe->len = static_cast<uint32_t>(bufferSize_);
+        // read from the current position, the PTYs are streams
+        sqe->off = static_cast<uint64_t>(-1);
+        sqe->buf_index = 0;
+        sqe->user_data = reinterpret_cast<uint64_t>(& slot);
+    }
+
+    void UringIO::postWrite(Channel & channel) {
+        if (channel.writeInFlight || channel.output.empty())
+            return;
+        std::swap(channel.writing, channel.output);
+        channel.output.clear();
+        channel.written = 0;
+        channel.writeInFlight = true;
+        postWriteRest(channel);
+    }
+
+    void UringIO::postWriteRest(Channel & channel, bool afterPoll) {
+        if (afterPoll)
+            postPoll(channel.fd, POLLOUT, reinterpret_cast<uint64_t>(& channel) | WriteTag | PollTag);
+        io_uring_sqe * sqe = getSqe();
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = channel.fd;
+        sqe->addr = reinterpret_cast<uint64_t>(channel.writing.data() + channel.written);
+        sqe->len = static_cast<uint32_t>(channel.writing.size() - channel.written);
+        sqe->off = static_cast<uint64_t>(-1);
+        sqe->user_data = reinterpret_cast<uint64_t>(& channel) | WriteTag;
+    }
+
+    void UringIO::postPoll(int fd, uint32_t events, uint64_t userData) {
+        // the poll must be submitted together with the linked operation
+        if (*sqTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) + 2 > sqEntries_)
+            enter(0, 0, nullptr, 0);
+        io_uring_sqe * sqe = getSqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = events;
+        // hangups and errors complete the poll as well, the linked operation then reports them
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = userData;
+    }
+
+    void UringIO::complete(io_uring_cqe const & cqe) {
+        // a failed poll fails the linked operation too, which reports it
+        if (cqe.user_data == IgnoreTag || (cqe.user_data & PollTag))
+            return;
+        if (cqe.user_data & WriteTag)
+            writeCompleted(* reinterpret_cast<Channel *>(cqe.user_data & ~WriteTag), cqe.res);
+        else
+            readCompleted(* reinterpret_cast<Slot *>(cqe.user_data), cqe.res);
+    }
+
+    void UringIO::readCompleted(Slot & slot, int result) {
+        Channel & channel = * slot.channel;
+        // the kernel does not wait for non-blocking descriptors, read again when there is something to read
+        if (result == -EAGAIN && ! channel.removed && ! channel.eof) {
+            postRead(slot, true);
+            return;
+        }
+        if (! channel.removed) {
+            if (result > 0 && ! channel.eof) {
+                ++calls_;
+                channel.handler(slot.buffer, static_cast<size_t>(result));
+            } else if (result == 0 || (result < 0 && result != -EAGAIN && result != -EINTR && result != -ECANCELED)) {
+                // end of input, or error (such as EIO when the other side of the PTY is closed), the pending output can't be written either
+                if (! channel.eof) {
+                    channel.eof = true;
+                    channel.output.clear();
+                    ++calls_;
+                    channel.handler(nullptr, 0);
+                }
+            }
+        }
+        // only count the read done and free the slot after the handler, which may remove the channel, is done with its data
+        --channel.reads;
+        slot.channel = nullptr;
+        freeSlots_.push_back(& slot);
+        // the handler may have removed the channel
+        if (channel.removed) {
+            release(channel);
+        } else {
+            postReads(channel);
+        }
+        while (! freeSlots_.empty() && ! starving_.empty()) {
+            auto i = channels_.find(starving_.front());
+            starving_.pop_front();
+            if (i != channels_.end())
+                postReads(*i->second);
+        }
+    }
+
+    void UringIO::writeCompleted(Channel & channel, int result) {
+        if (result > 0)
+            channel.written += static_cast<size_t>(result);
+        // errors other than interrupts drop the output, they will be reported by the reads
+        bool retry = result > 0 || result == -EAGAIN || result == -EINTR;
+        if (channel.removed || ! retry || channel.written == channel.writing.size()) {
+            channel.writeInFlight = false;
+            channel.writing.clear();
+            channel.written = 0;
+            if (! retry)
+                channel.output.clear();
+        }
+        if (channel.removed)
+            release(channel);
+        else if (channel.writeInFlight)
+            postWriteRest(channel, result == -EAGAIN);
+        else
+            postWrite(channel);
+    }
+
+    void UringIO::release(Channel & channel) {
+        if (channel.reads > 0 || channel.writeInFlight)
+            return;
+        auto i = std::find_if(removed_.begin(), removed_.end(), [& channel](std::unique_ptr<Channel> const & x) { return x.get() == & channel; });
+        ASSERT(i != removed_.end());
+        removed_.erase(i);
+    }
+
+    void UringIO::processCompletions() {
+        unsigned head = *cqHead_;
+        while (true) {
+            unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+            if (head == tail)
+                break;
+            while (head != tail) {
+                // copy the completion and return the entry to the kernel before the handler is called
+                io_uring_cqe cqe = cqes_[head & cqMask_];
+                ++head;
+                __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+                complete(cqe);
+            }
+        }
+    }
+
+    bool UringIO::enter(unsigned minComplete, unsigned flags, void * arg, size_t argSize) {
+        while (true) {
+            long result = syscall(__NR_io_uring_enter, ring_, toSubmit_, minComplete, flags, arg, argSize);
+            // the kernel consumes the submissions even if the wait fails
+            toSubmit_ = *sqTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+            if (result >= 0)
+                return true;
+            if (errno == ETIME)
+                return false;
+            // interrupted wait returns, the caller will poll again
+            if (errno == EINTR)
+                return true;
+            // the completion queue is full, make some room
+            if (errno == EBUSY || errno == EAGAIN) {
+                processCompletions();
+                continue;
+            }
+            OSCHECK(false);
+        }
+    }
+
+    void UringIO::close() {
+        if (sqes_ != MAP_FAILED)
+            munmap(sqes_, sqesSize_);
+        if (sqRing_ != MAP_FAILED)
+            munmap(sqRing_, sqRingSize_);
+        ::close(ring_);
+    }
+
+#endif // ARCH_LINUX
+
+} // namespace tpp
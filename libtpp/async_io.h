@@ -0,0 +1,258 @@
+#pragma once
+
+#if (defined ARCH_LINUX)
+    #include <unistd.h>
+    #include <linux/io_uring.h>
+#endif
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "helpers/helpers.h"
+
+#include "event_loop.h"
+
+namespace tpp {
+
+#if (defined ARCH_LINUX)
+
+    /** Asynchronous I/O on many PTY file descriptors from a single thread.
+
+        Unlike the PTY interface, which maps each send() and receive() to a blocking syscall, the asynchronous I/O keeps reading all registered file descriptors at once and reports the received data via callbacks. Sends are queued and submitted in a batch by the next poll(), so that a host with hundreds of sessions can drive all of their I/O from one or two threads.
+
+        Create() selects the io_uring backend when the kernel supports it and falls back to epoll otherwise. The object is not thread safe, all methods must be called from the thread that calls poll(). The file descriptors are not owned and must stay open until they are removed.
+     */
+    class AsyncIO {
+    public:
+
+        /** Called with the data received from the file descriptor. The data is only valid for the duration of the call. Called with no data when the end of the file descriptor's input has been reached (or reading from it failed, such as when the other side of the PTY has been closed), after which no more data will be received.
+         */
+        using ReceiveHandler = std::function<void(char const *, size_t)>;
+
+        enum class Backend {
+            Auto,
+            Epoll,
+            IoUring,
+        };
+
+        virtual ~AsyncIO() = default;
+
+        /** Creates the asynchronous I/O with given backend. Auto selects io_uring if available, epoll otherwise. Throws OSError if io_uring has been explicitly requested, but is not available.
+         */
+        static std::unique_ptr<AsyncIO> Create(Backend backend = Backend::Auto);
+
+        /** Returns true if the kernel supports all io_uring features required by the io_uring backend.
+         */
+        static bool IoUringAvailable();
+
+        virtual Backend backend() const = 0;
+
+        /** Starts reading from the file descriptor. The file descriptor is switched to the non-blocking mode.
+         */
+        virtual void add(int fd, ReceiveHandler handler) = 0;
+
+        /** Stops reading from and writing to the file descriptor. Pending sends are discarded and the handler will not be called any more.
+         */
+        virtual void remove(int fd) = 0;
+
+        /** Queues the data to be written to the file descriptor. The data is copied and written by the next poll() together with the other sends.
+         */
+        virtual void send(int fd, char const * buffer, size_t numBytes) = 0;
+
+        /** Submits the queued sends, waits for the given timeout in milliseconds (negative waits indefinitely) and calls the handlers of all received data. Returns the number of handler calls.
+         */
+        virtual size_t poll(int timeoutMs = -1) = 0;
+
+        /** Returns the number of bytes queued, or in flight for given file descriptor.
+         */
+        virtual size_t pending(int fd) const = 0;
+
+    protected:
+
+        static void SetNonBlocking(int fd);
+
+    }; // tpp::AsyncIO
+
+    /** Epoll based asynchronous I/O.
+
+        Each readable descriptor is read once per wakeup and queued sends are written by a single write per descriptor, with the rest written when the descriptor becomes writable.
+     */
+    class EpollIO : public AsyncIO {
+    public:
+
+        Backend backend() const override { return Backend::Epoll; }
+
+        void add(int fd, ReceiveHandler handler) override;
+        void remove(int fd) override;
+        void send(int fd, char const * buffer, size_t numBytes) override;
+        size_t poll(int timeoutMs = -1) override;
+        size_t pending(int fd) const override;
+
+    private:
+
+        struct Channel {
+            ReceiveHandler handler;
+            std::string output;
+            bool writing = false;
+        };
+
+        void ready(int fd, uint32_t events);
+
+        /** Writes as much of the channel's output as possible and updates the events the channel waits for.
+         */
+        void write(int fd, Channel & channel);
+
+        EventLoop loop_;
+        std::unordered_map<int, std::unique_ptr<Channel>> channels_;
+        /** Channels removed during the current poll(). Their handlers may be the ones being called, so they are only deleted once the poll is done.
+         */
+        std::vector<std::unique_ptr<Channel>> removed_;
+        /** Channels with output queued since the last poll().
+         */
+        std::vector<int> sending_;
+        size_t calls_ = 0;
+        char buffer_[65536];
+
+    }; // tpp::EpollIO
+
+    /** io_uring based asynchronous I/O.
+
+        Keeps a single read posted against each file descriptor, reading into fixed buffers registered with the kernel. The kernel does not order the completions of independent requests on the same file descriptor, so more reads in flight could deliver the data out of order. Reads and writes the kernel could not complete right away are posted again after a poll for the file descriptor's readiness, so that they do not spin. Queued sends are submitted as one write per file descriptor together with all other pending submissions and the wait for completions in a single io_uring_enter call.
+     */
+    class UringIO : public AsyncIO {
+    public:
+
+        /** Creates the ring with given number of submission entries and numBuffers registered read buffers of given size. Each file descriptor uses up to ReadsPerChannel buffers.
+         */
+        explicit UringIO(unsigned entries = 256, size_t bufferSize = 16384, size_t numBuffers = 512);
+        ~UringIO() override;
+
+        Backend backend() const override { return Backend::IoUring; }
+
+        void add(int fd, ReceiveHandler handler) override;
+        void remove(int fd) override;
+        void send(int fd, char const * buffer, size_t numBytes) override;
+        size_t poll(int timeoutMs = -1) override;
+        size_t pending(int fd) const override;
+
+        /** Reads posted against each file descriptor, more than one would not keep the order of the data.
+         */
+        static constexpr size_t ReadsPerChannel = 1;
+
+    private:
+
+        struct Channel;
+
+        /** Registered read buffer. Its address is the user data of the read posted into it.
+         */
+        struct Slot {
+            Channel * channel = nullptr;
+            char * buffer;
+        };
+
+        struct Channel {
+            int fd;
+            ReceiveHandler handler;
+            /** Sends queued since the last write was submitted and the data of the write in flight.
+             */
+            std::string output;
+            std::string writing;
+            size_t written = 0;
+            bool writeInFlight = false;
+            /** Number of reads posted.
+             */
+            size_t reads = 0;
+            bool eof = false;
+            bool removed = false;
+        };
+
+        /** Marks the user data of the write completions, reads have the slot's address.
+         */
+        static constexpr uint64_t WriteTag = 1;
+        /** User data of cancellations and timeouts, whose completions are ignored.
+         */
+        static constexpr uint64_t IgnoreTag = 0;
+        /** Marks the user data of the polls linked before the reads and writes posted again, whose completions are ignored. The rest is the user data of the read, or write.
+         */
+        static constexpr uint64_t PollTag = 2;
+
+        io_uring_sqe * getSqe();
+        void postReads(Channel & channel);
+        /** Posts the read into the slot, after a poll for the channel's readiness if requested.
+         */
+        void postRead(Slot & slot, bool afterPoll);
+        /** Posts the queued output unless there is a write in flight already.
+         */
+        void postWrite(Channel & channel);
+        /** Posts the rest of the write in flight after a partial write, after a poll for the channel's readiness if requested.
+         */
+        void postWriteRest(Channel & channel, bool afterPoll = false);
+        /** Posts a poll for given events linked to the operation posted next.
+         */
+        void postPoll(int fd, uint32_t events, uint64_t userData);
+        void complete(io_uring_cqe const & cqe);
+        void readCompleted(Slot & slot, int result);
+        void writeCompleted(Channel & channel, int result);
+        /** Deletes the removed channel if it has no operations in flight.
+         */
+        void release(Channel & channel);
+        /** Calls handlers of all completions in the completion queue.
+         */
+        void processCompletions();
+
+        /** Submits the prepared sqes and optionally waits for the completions. Returns false if the wait timed out.
+         */
+        bool enter(unsigned minComplete, unsigned flags, void * arg, size_t argSize);
+
+        /** Unmaps the rings and closes the ring.
+         */
+        void close();
+
+        int ring_;
+        /** The mapped rings.
+         */
+        void * sqRing_;
+        size_t sqRingSize_;
+        void * cqRing_;
+        size_t cqRingSize_;
+        io_uring_sqe * sqes_;
+        size_t sqesSize_;
+        unsigned * sqHead_;
+        unsigned * sqTail_;
+        unsigned sqMask_;
+        unsigned sqEntries_;
+        unsigned * sqArray_;
+        unsigned * cqHead_;
+        unsigned * cqTail_;
+        unsigned cqMask_;
+        io_uring_cqe * cqes_;
+        /** Number of sqes prepared, but not yet submitted.
+         */
+        unsigned toSubmit_ = 0;
+
+        /** Registered buffers.
+         */
+        size_t bufferSize_;
+        std::unique_ptr<char[]> buffers_;
+        std::vector<Slot> slots_;
+        std::vector<Slot *> freeSlots_;
+        /** Channels that have fewer reads posted than they should because there were no free slots.
+         */
+        std::deque<int> starving_;
+
+        std::unordered_map<int, std::unique_ptr<Channel>> channels_;
+        /** Removed channels with operations still in flight.
+         */
+        std::vector<std::unique_ptr<Channel>> removed_;
+        std::vector<int> sending_;
+        size_t calls_ = 0;
+
+    }; // tpp::UringIO
+
+#endif // ARCH_LINUX
+
+} // namespace tpp
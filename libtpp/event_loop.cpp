@@ -0,0 +1,110 @@
+#include "event_loop.h"
+
+namespace tpp {
+
+#if (defined ARCH_LINUX)
+
+    EventLoop::EventLoop():
+        epoll_{epoll_create1(EPOLL_CLOEXEC)} {
+        OSCHECK(epoll_ >= 0);
+    }
+
+    EventLoop::~EventLoop() {
+        close(epoll_);
+    }
+
+    void EventLoop::add(int fd, uint32_t events, Handler handler) {
+        ASSERT(! contains(fd) && "File descriptor already registered");
+        epoll_event e{};
+        e.events = events;
+        e.data.fd = fd;
+        OSCHECK(epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, & e) == 0);
+        handlers_.emplace(fd, std::make_unique<Handler>(std::move(handler)));
+    }
+
+    bool EventLoop::tryAdd(int fd, uint32_t events, Handler handler) {
+        ASSERT(! contains(fd) && "File descriptor already registered");
+        epoll_event e{};
+        e.events = events;
+        e.data.fd = fd;
+        if (epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, & e) != 0) {
+            OSCHECK(errno == EPERM);
+            return false;
+        }
+        handlers_.emplace(fd, std::make_unique<Handler>(std::move(handler)));
+        return true;
+    }
+
+    void EventLoop::modify(int fd, uint32_t events) {
+        // not checking the handlers here as they may be modified by the loop's thread, epoll_ctl fails for unregistered descriptors anyway
+        epoll_event e{};
+        e.events = events;
+        e.data.fd = fd;
+        OSCHECK(epoll_ctl(epoll_, EPOLL_CTL_MOD, fd, & e) == 0);
+    }
+
+    void EventLoop::remove(int fd) {
+        auto i = handlers_.find(fd);
+        ASSERT(i != handlers_.end());
+        OSCHECK(epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr) == 0);
+        // the handler may be the one being called, so keep it alive until the end of the wakeup
+        removed_.push_back(std::move(i->second));
+        handlers_.erase(i);
+    }
+
+    int EventLoop::addTimer(std::chrono::nanoseconds interval, bool periodic, std::function<void()> handler) {
+        int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        OSCHECK(timer >= 0);
+        itimerspec spec{};
+        spec.it_value.tv_sec = static_cast<time_t>(interval.count() / 1000000000);
+        spec.it_value.tv_nsec = static_cast<long>(interval.count() % 1000000000);
+        // zero value would disarm the timer
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+            spec.it_value.tv_nsec = 1;
+        if (periodic)
+            spec.it_interval = spec.it_value;
+        if (timerfd_settime(timer, 0, & spec, nullptr) != 0) {
+            close(timer);
+            OSCHECK(false);
+        }
+        add(timer, EPOLLIN, [this, periodic, handler = std::move(handler)](int fd, uint32_t) {
+            uint64_t expirations;
+            // the timer may have been read already if it was removed and added again in the same wakeup
+            if (::read(fd, & expirations, sizeof(expirations)) != sizeof(expirations))
+                return;
+            if (! periodic)
+                removeTimer(fd);
+            handler();
+        });
+        return timer;
+    }
+
+    void EventLoop::removeTimer(int timer) {
+        remove(timer);
+        close(timer);
+    }
+
+    size_t EventLoop::poll(int timeoutMs) {
+        epoll_event events[MaxEvents];
+        int n;
+        do {
+            n = epoll_wait(epoll_, events, MaxEvents, timeoutMs);
+        } while (n < 0 && errno == EINTR);
+        OSCHECK(n >= 0);
+        size_t dispatched = 0;
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            // the descriptor may have been removed by a handler called earlier in this wakeup
+            auto h = handlers_.find(fd);
+            if (h == handlers_.end())
+                continue;
+            (*h->second)(fd, events[i].events);
+            ++dispatched;
+        }
+        removed_.clear();
+        return dispatched;
+    }
+
+#endif // ARCH_LINUX
+
+} // namespace tpp
@@ -0,0 +1,90 @@
+#pragma once
+
+#if (defined ARCH_LINUX)
+    #include <unistd.h>
+    #include <sys/epoll.h>
+    #include <sys/timerfd.h>
+#endif
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "helpers/helpers.h"
+
+namespace tpp {
+
+#if (defined ARCH_LINUX)
+
+    /** Event loop over epoll.
+
+        File descriptors are registered together with a handler that is called with the ready events whenever the descriptor becomes ready. A single call to poll() waits for the next wakeup and then dispatches all descriptors that are ready at that time, so that an application can multiplex its own sockets, pipes and timers on the same thread as the terminal input, see LocalClient.
+
+        The loop is not thread safe, descriptors must be added and removed from the thread that calls poll(), including from the handlers themselves.
+     */
+    class EventLoop {
+    public:
+
+        /** Handler of a registered file descriptor, called with the file descriptor and the ready epoll events.
+         */
+        using Handler = std::function<void(int, uint32_t)>;
+
+        EventLoop();
+        ~EventLoop();
+
+        EventLoop(EventLoop const &) = delete;
+        EventLoop & operator = (EventLoop const &) = delete;
+
+        /** Registers the file descriptor for given epoll events (such as EPOLLIN). The descriptor is not owned by the loop.
+         */
+        void add(int fd, uint32_t events, Handler handler);
+
+        /** Registers the file descriptor like add(), unless it does not support polling (such as regular files), in which case returns false. 
+         */
+        bool tryAdd(int fd, uint32_t events, Handler handler);
+
+        /** Changes the events the file descriptor is registered for.
+
+            Unlike the other methods, can be called from any thread, such as to re-arm a descriptor registered with EPOLLONESHOT.
+         */
+        void modify(int fd, uint32_t events);
+
+        /** Unregisters the file descriptor. If the descriptor is ready in the current wakeup, its handler will not be called.
+         */
+        void remove(int fd);
+
+        bool contains(int fd) const { return handlers_.find(fd) != handlers_.end(); }
+
+        /** Adds a timer that calls the handler after given interval, either once, or periodically. Returns the timer id, which is the timerfd owned by the loop.
+
+            A periodic timer that expired multiple times since the last wakeup calls its handler only once.
+         */
+        int addTimer(std::chrono::nanoseconds interval, bool periodic, std::function<void()> handler);
+
+        /** Removes the timer and closes its file descriptor.
+         */
+        void removeTimer(int timer);
+
+        /** Waits for the next wakeup and calls handlers of all ready file descriptors. Returns the number of handlers called, which is 0 if the timeout in milliseconds expired first. Negative timeout waits indefinitely.
+         */
+        size_t poll(int timeoutMs = -1);
+
+    private:
+
+        /** Maximum number of file descriptors dispatched by a single wakeup. The rest will be dispatched by the next poll() without waiting.
+         */
+        static constexpr int MaxEvents = 64;
+
+        int epoll_;
+        std::unordered_map<int, std::unique_ptr<Handler>> handlers_;
+        /** Handlers removed during the current wakeup.
+         */
+        std::vector<std::unique_ptr<Handler>> removed_;
+
+    }; // tpp::EventLoop
+
+#endif // ARCH_LINUX
+
+} // namespace tpp
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include "helpers/helpers.h"
+
+namespace tpp {
+
+    /** String payload of a sequence, such as OSC value, tpp argument, or a text run.
+
+        The payload is either borrowed, i.e. a view into the buffer the sequence was parsed from, which is valid only until the buffer is released, or owned. The parsers return borrowed payloads whenever possible so that large payloads, such as clipboard contents or tpp data packets are not copied. If the payload must outlive the buffer, call detach() to take ownership of the data.
+
+        Copying a borrowed payload is cheap and produces another borrowed payload, copying an owned payload copies the data.
+     */
+    class Payload {
+    public:
+
+        Payload() = default;
+
+        /** Creates payload borrowed from the given data.
+         */
+        Payload(std::string_view borrowed):
+            view_{borrowed} {
+        }
+
+        Payload(char const * borrowed):
+            view_{borrowed} {
+        }
+
+        Payload(char const * borrowed, size_t size):
+            view_{borrowed, size} {
+        }
+
+        /** Takes ownership of the given buffer.
+         */
+        Payload(std::unique_ptr<char[]> && owned, size_t size):
+            view_{owned.get(), size},
+            owned_{std::move(owned)} {
+        }
+
+        /** Creates an owned payload from the given string.
+         */
+        static Payload Own(std::string_view data) {
+            Payload result{data};
+            result.detach();
+            return result;
+        }
+
+        Payload(Payload const & from):
+            view_{from.view_} {
+            if (from.owned_)
+                detach();
+        }
+
+        Payload(Payload && from) noexcept:
+            view_{from.view_},
+            owned_{std::move(from.owned_)} {
+            from.view_ = std::string_view{};
+        }
+
+        Payload & operator = (Payload const & other) {
+            if (this != & other) {
+                owned_.reset();
+                view_ = other.view_;
+                if (other.owned_)
+                    detach();
+            }
+            return *this;
+        }
+
+        Payload & operator = (Payload && other) noexcept {
+            view_ = other.view_;
+            owned_ = std::move(other.owned_);
+            other.view_ = std::string_view{};
+            return *this;
+        }
+
+        /** Returns true if the payload owns its data.
+         */
+        bool owned() const { return owned_ != nullptr || view_.empty(); }
+
+        /** Copies borrowed data so that the payload no longer depends on the buffer it was parsed from. Does nothing if the payload already owns its data.
+         */
+        void detach() {
+            if (owned())
+                return;
+            owned_.reset(new char[view_.size()]);
+            std::memcpy(owned_.get(), view_.data(), view_.size());
+            view_ = std::string_view{owned_.get(), view_.size()};
+        }
+
+        std::string_view view() const { return view_; }
+        operator std::string_view () const { return view_; }
+
+        char const * data() const { return view_.data(); }
+        size_t size() const { return view_.size(); }
+        bool empty() const { return view_.empty(); }
+
+        char operator [] (size_t index) const { return view_[index]; }
+
+        /** Returns copy of the payload as string.
+         */
+        std::string str() const { return std::string{view_}; }
+
+        friend bool operator == (Payload const & a, std::string_view b) { return a.view_ == b; }
+        friend bool operator != (Payload const & a, std::string_view b) { return a.view_ != b; }
+        friend bool operator == (Payload const & a, Payload const & b) { return a.view_ == b.view_; }
+        friend bool operator != (Payload const & a, Payload const & b) { return a.view_ != b.view_; }
+        friend bool operator == (Payload const & a, char const * b) { return a.view_ == b; }
+        friend bool operator != (Payload const & a, char const * b) { return a.view_ != b; }
+
+        friend std::ostream & operator << (std::ostream & s, Payload const & p) {
+            s << p.view_;
+            return s;
+        }
+
+    private:
+        std::string_view view_;
+        std::unique_ptr<char[]> owned_;
+    }; // tpp::Payload
+
+} // namespace tpp
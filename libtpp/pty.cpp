@@ -1,23 +1,325 @@
+#if (defined ARCH_UNIX)
+    #include <pwd.h>
+    #include <stdlib.h>
+    #include <sys/stat.h>
+    #if (defined ARCH_LINUX)
+        #include <sys/syscall.h>
+    #endif
+#endif
+
 #include "sequence.h"
 
 #include "pty.h"
 
+#if (defined ARCH_UNIX)
+extern char ** environ;
+#endif
+
 
 
 namespace tpp::pty {
 
 #if (defined ARCH_UNIX)
 
+    namespace {
+
+        /** Signals whose handlers are reset to defaults in the child processes of LocalServer. 
+         */
+        int const ChildDefaultSignals[] = { SIGCHLD, SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGALRM, SIGPIPE, SIGWINCH };
+
+#if (defined ARCH_LINUX)
+        /** The P_PIDFD id type for waitid, which older C library headers do not have. 
+         */
+        constexpr int PidfdIdType = 3;
+#endif
+
+        /** Backs up the terminal settings of stdin and switches it to the raw mode. 
+         
+            Takes the backup of the tc attrs to be restored when the PTY dies so that we do not leave the the pty in some weird state, then sets up own needs such as disabling canonical and echo modes, and so on.
+         */
+        void EnterRawMode(termios & backup) {
+            OSCHECK(tcgetattr(STDIN_FILENO, & backup) == 0);
+            termios raw = backup;
+            raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+            raw.c_oflag &= ~(OPOST);
+            raw.c_cflag |= (CS8);
+            raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+            OSCHECK(tcsetattr(STDIN_FILENO, TCSAFLUSH, & raw) == 0);
+        }
+
+    } // tpp::pty::anonymous
+
+#if (defined ARCH_LINUX)
+
+    LocalClient::LocalClient():
+        wakeup_{eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)} {
+        OSCHECK(wakeup_ >= 0);
+        {
+            std::lock_guard<std::mutex> g{clientsGuard_};
+            if (clients_.empty()) {
+                EnterRawMode(backup_);
+                // block the signal so that it can be read from the signalfd
+                sigset_t mask;
+                sigemptyset(& mask);
+                sigaddset(& mask, SIGWINCH);
+                OSCHECK(pthread_sigmask(SIG_BLOCK, & mask, nullptr) == 0);
+                signalFd_ = signalfd(-1, & mask, SFD_NONBLOCK | SFD_CLOEXEC);
+                OSCHECK(signalFd_ >= 0);
+            }
+            clients_.push_back(this);
+        }
+        loop_.add(STDIN_FILENO, EPOLLIN, [this](int, uint32_t) { readInput(); });
+        loop_.add(signalFd_, EPOLLIN, [this](int, uint32_t) { readSignals(); });
+        loop_.add(wakeup_, EPOLLIN, [this](int, uint32_t) { readWakeup(); });
+        openOutput();
+    }
+
+    void LocalClient::openOutput() {
+        // the non-blocking flag belongs to the open file description, which stdout shares with stdin, stderr and other processes on the same terminal, so the output gets own description of the same file
+        struct stat st;
+        OSCHECK(fstat(STDOUT_FILENO, & st) == 0);
+        // a regular file would be reopened at a different offset, and it never blocks anyway
+        if (! S_ISREG(st.st_mode)) {
+            outputFd_ = open("/proc/self/fd/1", O_WRONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+            // one shot so that it can be re-armed by the sender thread when there is output left, see writeQueued()
+            if (outputFd_ >= 0 && loop_.tryAdd(outputFd_, EPOLLONESHOT, [this](int, uint32_t events) { writeReady(events); })) {
+                outputPolled_ = true;
+                return;
+            }
+            if (outputFd_ >= 0)
+                close(outputFd_);
+        }
+        // stdout that can't be reopened (such as a socket), or polled (such as /dev/null) is written directly with blocking writes
+        outputFd_ = STDOUT_FILENO;
+    }
+
+    LocalClient::~LocalClient() {
+        // no need to throw errors from destructor, if the output can't be written, there is nothing to be done
+        try {
+            flush();
+        } catch (...) {
+        }
+        {
+            std::lock_guard<std::mutex> g{clientsGuard_};
+            clients_.erase(std::find(clients_.begin(), clients_.end(), this));
+            if (clients_.empty()) {
+                close(signalFd_);
+                signalFd_ = -1;
+                // with no active PTY there is no need to react to the signal, the pending signals are discarded as ignored by default
+                sigset_t mask;
+                sigemptyset(& mask);
+                sigaddset(& mask, SIGWINCH);
+                pthread_sigmask(SIG_UNBLOCK, & mask, nullptr);
+                // restore the terminal settings from the backup we took when creating the pty
+                tcsetattr(STDIN_FILENO, TCSAFLUSH, &backup_);
+            }
+        }
+        if (resizeTimer_ != -1)
+            loop_.removeTimer(resizeTimer_);
+        if (outputPolled_)
+            close(outputFd_);
+        close(wakeup_);
+    }
+
+    void LocalClient::send(char const * buffer, size_t numBytes) {
+        std::unique_lock<std::mutex> g{outputGuard_};
+        queue(buffer, numBytes);
+        if (frames_ > 0 && queued_ <= maxQueued_)
+            return;
+        writeQueued(g, maxQueued_);
+    }
+
+    void LocalClient::beginFrame() {
+        std::lock_guard<std::mutex> g{outputGuard_};
+        ++frames_;
+    }
+
+    void LocalClient::endFrame() {
+        std::unique_lock<std::mutex> g{outputGuard_};
+        ASSERT(frames_ > 0);
+        if (--frames_ == 0)
+            writeQueued(g, maxQueued_);
+    }
+
+    void LocalClient::flush() {
+        std::unique_lock<std::mutex> g{outputGuard_};
+        writeQueued(g, 0);
+    }
+
+    void LocalClient::queue(char const * buffer, size_t numBytes) {
+        if (numBytes == 0)
+            return;
+        if (output_.empty() || output_.back().size() + numBytes > OutputBlockSize)
+            output_.emplace_back().reserve(std::max(numBytes, OutputBlockSize));
+        output_.back().append(buffer, numBytes);
+        queued_ += numBytes;
+    }
+
+    bool LocalClient::writeQueued() {
+        while (! output_.empty()) {
+            iovec iov[64];
+            int n = 0;
+            for (auto i = output_.begin(), e = output_.end(); i != e && n < 64; ++i, ++n) {
+                iov[n].iov_base = i->data();
+                iov[n].iov_len = i->size();
+            }
+            iov[0].iov_base = output_.front().data() + outputOffset_;
+            iov[0].iov_len -= outputOffset_;
+            ssize_t written = ::writev(outputFd_, iov, n);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN)
+                    return false;
+                OSCHECK(false);
+            }
+            // remove the written blocks
+            size_t x = static_cast<size_t>(written);
+            queued_ -= x;
+            while (x > 0) {
+                size_t left = output_.front().size() - outputOffset_;
+                if (x < left) {
+                    outputOffset_ += x;
+                    break;
+                }
+                x -= left;
+                outputOffset_ = 0;
+                output_.pop_front();
+            }
+        }
+        return true;
+    }
+
+    void LocalClient::writeQueued(std::unique_lock<std::mutex> & lock, size_t limit) {
+        while (! writeQueued()) {
+            if (queued_ <= limit && outputPolled_) {
+                loop_.modify(outputFd_, EPOLLOUT | EPOLLONESHOT);
+                return;
+            }
+            // over the limit, wait for the terminal without holding the lock so that the event loop handler does not block
+            lock.unlock();
+            pollfd p{outputFd_, POLLOUT, 0};
+            while (::poll(& p, 1, -1) < 0)
+                OSCHECK(errno == EINTR);
+            lock.lock();
+        }
+    }
+
+    void LocalClient::writeReady(uint32_t events) {
+        std::lock_guard<std::mutex> g{outputGuard_};
+        // the terminal is gone, nothing will ever be written, so drop the output (the sender will get the error on the next write)
+        if (events & (EPOLLERR | EPOLLHUP)) {
+            output_.clear();
+            outputOffset_ = 0;
+            queued_ = 0;
+            return;
+        }
+        if (! writeQueued())
+            loop_.modify(outputFd_, EPOLLOUT | EPOLLONESHOT);
+    }
+
+    void LocalClient::terminate() {
+        terminatePending_ = true;
+        wakeup();
+    }
+
+    size_t LocalClient::receive(char * buffer, size_t bufferLength) {
+        ASSERT(bufferLength >= sizeof(TerminalResize) && "Buffer must be big enough for at least TerminalResize sequence");
+        if (! pendingResize_) {
+            Batch batch = receiveBatch(buffer, bufferLength);
+            // input goes first, the resize is returned by the next call
+            if (batch.numBytes > 0) {
+                pendingResize_ = batch.resized;
+                return batch.numBytes;
+            }
+            if (! batch.resized)
+                return 0;
+        }
+        pendingResize_ = false;
+        auto s{size()};
+        new (buffer) TerminalResize{s.first, s.second};
+        return sizeof(TerminalResize);
+    }
+
+    LocalClient::Batch LocalClient::receiveBatch(char * buffer, size_t bufferLength) {
+        batch_ = Batch{};
+        batch_.terminated = terminated_;
+        batchBuffer_ = buffer;
+        batchBufferLength_ = bufferLength;
+        while (batch_.numBytes == 0 && ! batch_.resized && ! batch_.terminated)
+            loop_.poll();
+        batchBuffer_ = nullptr;
+        return batch_;
+    }
+
+    void LocalClient::readInput() {
+        // only called from receiveBatch, leaves the input in stdin if the buffer is full
+        if (batchBuffer_ == nullptr || batch_.numBytes == batchBufferLength_)
+            return;
+        // a single read returns all input available on the terminal that fits in the buffer
+        ssize_t numBytes = ::read(STDIN_FILENO, batchBuffer_ + batch_.numBytes, batchBufferLength_ - batch_.numBytes);
+        // stdin may have been made non-blocking by the application
+        if (numBytes < 0 && (errno == EINTR || errno == EAGAIN))
+            return;
+        OSCHECK(numBytes >= 0);
+        // end of stdin
+        if (numBytes == 0)
+            batch_.terminated = true;
+        batch_.numBytes += static_cast<size_t>(numBytes);
+    }
+
+    void LocalClient::readSignals() {
+        // all clients are woken up by the signalfd, but only one of them gets to read the signal, which then notifies everyone
+        signalfd_siginfo info[8];
+        bool received = false;
+        while (::read(signalFd_, info, sizeof(info)) > 0)
+            received = true;
+        if (! received)
+            return;
+        std::lock_guard<std::mutex> g{clientsGuard_};
+        for (LocalClient * client : clients_) {
+            client->resizePending_ = true;
+            client->wakeup();
+        }
+    }
+
+    void LocalClient::readWakeup() {
+        // reading the eventfd resets its counter, so that any number of notifications results in a single wakeup
+        uint64_t x;
+        if (::read(wakeup_, & x, sizeof(x)) != sizeof(x))
+            return;
+        if (terminatePending_) {
+            terminated_ = true;
+            batch_.terminated = true;
+        }
+        if (resizePending_.exchange(false))
+            resize();
+    }
+
+    void LocalClient::resize() {
+        auto now = std::chrono::steady_clock::now();
+        auto sinceLast = now - lastResize_;
+        if (sinceLast < minResizeInterval_) {
+            // the timer reports all resizes since the last one at once
+            if (resizeTimer_ == -1)
+                resizeTimer_ = loop_.addTimer(minResizeInterval_ - sinceLast, false, [this]() {
+                    resizeTimer_ = -1;
+                    resize();
+                });
+            return;
+        }
+        lastResize_ = now;
+        auto s{size()};
+        batch_.resized = true;
+        batch_.cols = s.first;
+        batch_.rows = s.second;
+    }
+
+#else
+
     LocalClient::LocalClient() {
         ASSERT(pipe_[0] == 0 && pipe_[1] == 0 && "LocalPTY is singleton");
-        // terminal setup on the stdin file - first get backup of the tc attrs to be restored when the PTY dies so that we do not leave the the pty in some weird state, then set up own needs such as disabling canonical and echo modes, and so on
-        OSCHECK(tcgetattr(STDIN_FILENO, & backup_) == 0);
-        termios raw = backup_;
-        raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
-        raw.c_oflag &= ~(OPOST);
-        raw.c_cflag |= (CS8);
-        raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
-        OSCHECK(tcsetattr(STDIN_FILENO, TCSAFLUSH, & raw) == 0);
+        EnterRawMode(backup_);
         // create the pipe
         OSCHECK(pipe(pipe_) == 0);
         // install the SIGWINCH signal handler and block its processing
@@ -42,6 +344,21 @@ namespace tpp::pty {
         tcsetattr(STDIN_FILENO, TCSAFLUSH, &backup_);
     }
 
+    void LocalClient::terminate() {
+        OSCHECK(::write(pipe_[1], & TERMINATE_EVENT, 1) == 1);
+    }
+
+    void LocalClient::send(char const * buffer, size_t numBytes) {
+        while (numBytes > 0) {
+            ssize_t written = ::write(STDOUT_FILENO, buffer, numBytes);
+            if (written < 0 && errno == EINTR)
+                continue;
+            OSCHECK(written > 0);
+            buffer += written;
+            numBytes -= static_cast<size_t>(written);
+        }
+    }
+
     size_t LocalClient::receive(char * buffer, size_t bufferLength) {
         ASSERT(bufferLength >= sizeof(TerminalResize) && "Buffer must be big enough for at least TerminalResize sequence");
         while (true) {
@@ -73,5 +390,267 @@ namespace tpp::pty {
         }
     }
 
+#endif // ARCH_LINUX
+
+    LocalServer::LocalServer(std::vector<std::string> const & command, std::unordered_map<std::string, std::string> const & env, int cols, int rows) {
+        ASSERT(! command.empty());
+        master_ = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+        OSCHECK(master_ >= 0);
+        try {
+            OSCHECK(grantpt(master_) == 0 && unlockpt(master_) == 0);
+#if (defined ARCH_LINUX)
+            char slave[128];
+            OSCHECK(ptsname_r(master_, slave, sizeof(slave)) == 0);
+#else
+            char const * slave = ptsname(master_);
+            OSCHECK(slave != nullptr);
+#endif
+            resize(cols, rows);
+            // the target environment clears interfering definitions and makes the child act as a proper terminal (i.e. terminfo, color profile, shell, etc.)
+            std::unordered_map<std::string, std::string> vars;
+            for (char ** e = environ; *e != nullptr; ++e) {
+                char const * assign = strchr(*e, '=');
+                if (assign != nullptr)
+                    vars[std::string(*e, assign - *e)] = assign + 1;
+            }
+            vars.erase("COLUMNS");
+            vars.erase("LINES");
+            vars.erase("TERMCAP");
+            if (env.find("SHELL") == env.end()) {
+                passwd const * pw = getpwuid(getuid());
+                if (pw != nullptr)
+                    vars["SHELL"] = pw->pw_shell;
+            }
+            if (env.find("TERM") == env.end())
+                vars["TERM"] = "xterm-256color";
+            if (env.find("COLORTERM") == env.end())
+                vars["COLORTERM"] = "truecolor";
+            for (auto const & i : env)
+                vars[i.first] = i.second;
+            std::vector<std::string> envStrings;
+            for (auto const & i : vars)
+                envStrings.push_back(i.first + "=" + i.second);
+            std::vector<char *> envp;
+            for (auto & i : envStrings)
+                envp.push_back(i.data());
+            envp.push_back(nullptr);
+            std::vector<char *> argv;
+            for (auto const & i : command)
+                argv.push_back(const_cast<char *>(i.c_str()));
+            argv.push_back(nullptr);
+            if (! spawnChild(slave, argv.data(), envp.data()))
+                forkChild(slave, argv.data(), envp.data());
+            int flags = fcntl(master_, F_GETFL);
+            OSCHECK(flags >= 0 && fcntl(master_, F_SETFL, flags | O_NONBLOCK) == 0);
+#if (defined ARCH_LINUX)
+            // older kernels do not have pidfds, in which case the child is reaped by its pid
+            pidfd_ = static_cast<int>(syscall(SYS_pidfd_open, pid_, 0));
+            if (pidfd_ >= 0)
+                fcntl(pidfd_, F_SETFD, FD_CLOEXEC);
+#endif
+        } catch (...) {
+            close(master_);
+            throw;
+        }
+    }
+
+    LocalServer::~LocalServer() {
+        // no need to throw errors from destructor
+        try {
+            hangup();
+            if (! wait(HangupTimeout).has_value())
+                kill();
+        } catch (...) {
+        }
+        if (pidfd_ >= 0)
+            close(pidfd_);
+    }
+
+    void LocalServer::send(char const * buffer, size_t numBytes) {
+        while (numBytes > 0) {
+            ssize_t written = ::write(master_, buffer, numBytes);
+            if (written < 0) {
+                OSCHECK(errno == EINTR || errno == EAGAIN);
+                if (errno == EAGAIN) {
+                    pollfd p{master_, POLLOUT, 0};
+                    OSCHECK(::poll(& p, 1, -1) >= 0 || errno == EINTR);
+                }
+                continue;
+            }
+            buffer += written;
+            numBytes -= static_cast<size_t>(written);
+        }
+    }
+
+    size_t LocalServer::receive(char * buffer, size_t bufferLength) {
+        while (true) {
+            std::optional<size_t> numBytes = tryReceive(buffer, bufferLength);
+            if (numBytes.has_value())
+                return numBytes.value();
+            pollfd p{master_, POLLIN, 0};
+            OSCHECK(::poll(& p, 1, -1) >= 0 || errno == EINTR);
+        }
+    }
+
+    std::optional<size_t> LocalServer::tryReceive(char * buffer, size_t bufferLength) {
+        while (true) {
+            ssize_t numBytes = ::read(master_, buffer, bufferLength);
+            if (numBytes >= 0)
+                return static_cast<size_t>(numBytes);
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                return std::nullopt;
+            // reading from the master after the child closed the slave fails with EIO
+            OSCHECK(errno == EIO);
+            return 0;
+        }
+    }
+
+    void LocalServer::resize(int cols, int rows) {
+        winsize s;
+        s.ws_row = static_cast<unsigned short>(rows);
+        s.ws_col = static_cast<unsigned short>(cols);
+        s.ws_xpixel = 0;
+        s.ws_ypixel = 0;
+        OSCHECK(ioctl(master_, TIOCSWINSZ, & s) == 0);
+    }
+
+    std::optional<int> LocalServer::exitCode() {
+        if (! exitCode_.has_value())
+            reap(false);
+        return exitCode_;
+    }
+
+    int LocalServer::wait() {
+        if (! exitCode_.has_value())
+            reap(true);
+        return exitCode_.value();
+    }
+
+    std::optional<int> LocalServer::wait(std::chrono::milliseconds timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (! exitCode_.has_value() && ! reap(false)) {
+            auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (remaining.count() <= 0)
+                return std::nullopt;
+            if (pidfd_ >= 0) {
+                pollfd p{pidfd_, POLLIN, 0};
+                OSCHECK(::poll(& p, 1, static_cast<int>(remaining.count())) >= 0 || errno == EINTR);
+            } else {
+                // without pidfds there is nothing to wait on, poll the child's state instead
+                std::this_thread::sleep_for(std::min(remaining, std::chrono::milliseconds{10}));
+            }
+        }
+        return exitCode_;
+    }
+
+    void LocalServer::hangup() {
+        if (master_ < 0)
+            return;
+        close(master_);
+        master_ = -1;
+        // closing the master only hangs up the child if it still has the terminal open
+        if (! exitCode_.has_value())
+            ::kill(pid_, SIGHUP);
+    }
+
+    int LocalServer::kill() {
+        if (! exitCode_.has_value()) {
+            ::kill(pid_, SIGKILL);
+            reap(true);
+        }
+        return exitCode_.value();
+    }
+
+    bool LocalServer::spawnChild([[maybe_unused]] char const * slave, [[maybe_unused]] char * const * argv, [[maybe_unused]] char * const * envp) {
+#if (defined POSIX_SPAWN_SETSID)
+        posix_spawnattr_t attr;
+        OSCHECK(posix_spawnattr_init(& attr) == 0);
+        posix_spawn_file_actions_t actions;
+        OSCHECK(posix_spawn_file_actions_init(& actions) == 0);
+        // the new session is created before the file actions, so opening the slave makes it the controlling terminal of the child
+        sigset_t defaults;
+        sigemptyset(& defaults);
+        for (int sig : ChildDefaultSignals)
+            sigaddset(& defaults, sig);
+        sigset_t mask;
+        sigemptyset(& mask);
+        int err = posix_spawnattr_setflags(& attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+        if (err == 0)
+            err = posix_spawnattr_setsigdefault(& attr, & defaults);
+        if (err == 0)
+            err = posix_spawnattr_setsigmask(& attr, & mask);
+        if (err == 0)
+            err = posix_spawn_file_actions_addopen(& actions, STDIN_FILENO, slave, O_RDWR, 0);
+        if (err == 0)
+            err = posix_spawn_file_actions_adddup2(& actions, STDIN_FILENO, STDOUT_FILENO);
+        if (err == 0)
+            err = posix_spawn_file_actions_adddup2(& actions, STDIN_FILENO, STDERR_FILENO);
+        if (err == 0)
+            err = posix_spawnp(& pid_, argv[0], & actions, & attr, argv, envp);
+        posix_spawn_file_actions_destroy(& actions);
+        posix_spawnattr_destroy(& attr);
+        errno = err;
+        OSCHECK(err == 0);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void LocalServer::forkChild(char const * slave, char * const * argv, char * const * envp) {
+        pid_ = ::fork();
+        OSCHECK(pid_ >= 0);
+        if (pid_ != 0)
+            return;
+        // child process, only async-signal-safe calls until exec
+        setsid();
+        int fd = open(slave, O_RDWR);
+        if (fd < 0 || ioctl(fd, TIOCSCTTY, nullptr) < 0)
+            _exit(127);
+        dup2(fd, STDIN_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        if (fd > STDERR_FILENO)
+            close(fd);
+        for (int sig : ChildDefaultSignals)
+            signal(sig, SIG_DFL);
+        sigset_t mask;
+        sigemptyset(& mask);
+        sigprocmask(SIG_SETMASK, & mask, nullptr);
+        environ = const_cast<char **>(envp);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    bool LocalServer::reap(bool block) {
+        int status;
+#if (defined ARCH_LINUX)
+        if (pidfd_ >= 0) {
+            siginfo_t info{};
+            int result;
+            do {
+                result = waitid(static_cast<idtype_t>(PidfdIdType), static_cast<id_t>(pidfd_), & info, WEXITED | (block ? 0 : WNOHANG));
+            } while (result < 0 && errno == EINTR);
+            OSCHECK(result == 0);
+            // no child has changed its state
+            if (info.si_pid == 0)
+                return false;
+            exitCode_ = (info.si_code == CLD_EXITED) ? info.si_status : 128 + info.si_status;
+            return true;
+        }
+#endif
+        pid_t result;
+        do {
+            result = waitpid(pid_, & status, block ? 0 : WNOHANG);
+        } while (result < 0 && errno == EINTR);
+        OSCHECK(result >= 0);
+        if (result == 0)
+            return false;
+        exitCode_ = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        return true;
+    }
+
 #endif // ARCH_UNIX
 } // namespace tpp::pty
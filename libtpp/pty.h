@@ -8,21 +8,36 @@
     #include <sys/wait.h>
     #include <sys/ioctl.h>
     #include <errno.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <sys/uio.h>
+    #include <spawn.h>
     #if (defined ARCH_LINUX)
         #include <pty.h>
+        #include <sys/eventfd.h>
+        #include <sys/signalfd.h>
     #elif (defined ARCH_MACOS)
         #include <util.h>
     #endif
 #endif
 
 #include <thread>
+#include <chrono>
 #include <functional>
 #include <mutex>
 #include <atomic>
+#include <deque>
+#include <optional>
+#include <string>
+#include <unordered_map>
 #include <variant>
+#include <vector>
 
 #include "helpers/helpers.h"
 
+#include "event_loop.h"
+#include "sequence_writer.h"
+
 namespace tpp::pty {
 
 
@@ -33,11 +48,25 @@ namespace tpp::pty {
         virtual ~PTY() = default;
         virtual void send(char const * buffer, size_t numBytes) = 0;
         virtual size_t receive(char * buffer, size_t bufferLength) = 0;
+
+        /** Sends everything written to the writer with a single send() call and clears the writer. 
+         
+            Batching all sequences of a frame this way is much cheaper than sending them one by one. 
+         */
+        void send(SequenceWriter & writer) {
+            if (! writer.empty())
+                send(writer.data(), writer.size());
+            writer.clear();
+        }
     }; // tpp::pty::PTY
 
     /** Local pseudoterminal client (app). 
      
         Encapsulates pseudoterminal connection via the standard operating system mode, such as the stdin file and terminal resize signal on Linux. 
+
+        On Linux the stdin and the resize notifications are multiplexed by an epoll event loop owned by the client. Applications can register their own file descriptors and timers with the loop (see eventLoop()), whose handlers are then called from within receive() and receiveBatch() on the receiving thread.
+
+        The SIGWINCH signal is received via signalfd shared by all clients, so it is blocked in the thread that creates the first client. Threads started before that must block SIGWINCH themselves, otherwise the signal may be delivered to them and lost. The client that reads the signal notifies all clients via their eventfds, which coalesces any number of signals into a single resize event. Multiple clients may exist at the same time, the terminal is put into the raw mode by the first one and restored by the last one.
         */
     class LocalClient : public PTY {
 #if (defined ARCH_UNIX)
@@ -48,12 +77,71 @@ namespace tpp::pty {
 
         LocalClient(LocalClient const & ) = delete;
 
-        void send(char const * buffer, size_t numBytes) override {
-            OSCHECK(::write(STDOUT_FILENO, buffer, numBytes) == static_cast<int>(numBytes));
-        }
+        using PTY::send;
 
+        /** Writes the whole buffer to stdout. 
+         
+            On Linux the data is appended to the output queue first and written to stdout through own non-blocking open file description of it, so that the flags of stdin and stdout, which other code and processes share, are left intact. Outside of a frame the queue is then written immediately with a single writev. Whatever the terminal does not accept right away stays in the queue and is written by the event loop of the receiving thread when stdout becomes writable, so that a slow terminal does not block the sender. Only when the queue grows over the limit (see setMaxQueuedBytes()) the sender blocks until enough of the queue has been written. 
+         */
+        void send(char const * buffer, size_t numBytes) override;
+
+        /** Receives the input from stdin, or the TerminalResize sequence when the terminal has been resized. Returns 0 when the client has been terminated. 
+         */
         size_t receive(char * buffer, size_t bufferLength) override;
 
+        /** Wakes up the receiver, which will return 0 from receive(). Can be called from any thread. 
+         */
+        void terminate();
+
+#if (defined ARCH_LINUX)
+        /** Input and events received by a single wakeup. 
+         */
+        struct Batch {
+            /** Number of bytes read from stdin into the buffer. 
+             */
+            size_t numBytes = 0;
+            /** True if the terminal has been resized (any number of times), in which case cols and rows contain the latest size. 
+             */
+            bool resized = false;
+            bool terminated = false;
+            int cols = 0;
+            int rows = 0;
+        };
+
+        /** Waits until there is input, or resize or termination event and then returns everything that is available at once. 
+
+            All input available on stdin is read into the buffer with a single read. Multiple resizes are coalesced into a single event. Handlers of any other file descriptors registered with the event loop are called as they become ready while waiting. 
+         */
+        Batch receiveBatch(char * buffer, size_t bufferLength);
+
+        EventLoop & eventLoop() { return loop_; }
+
+        /** Sets the minimal interval between two resize events. 
+
+            Resizes that come sooner after the last resize event are postponed until the interval elapses and then reported as a single event with the latest size. This limits the number of redraws when the terminal window is being dragged. Defaults to 0, i.e. each wakeup reports the resizes immediately. 
+         */
+        void setMinResizeInterval(std::chrono::milliseconds interval) { minResizeInterval_ = interval; }
+
+        /** Starts a frame. Until the frame ends, send() only queues the data, unless the queue grows over the limit. Frames can be nested. 
+         */
+        void beginFrame();
+
+        /** Ends the frame and writes the whole frame with a single writev if this was the outermost frame. 
+         */
+        void endFrame();
+
+        /** Writes all queued data, blocking until the terminal accepts it. 
+         */
+        void flush();
+
+        /** Sets the maximum number of bytes queued for writing before send() blocks. Defaults to 4MB. 
+         */
+        void setMaxQueuedBytes(size_t numBytes) { 
+            std::lock_guard<std::mutex> g{outputGuard_};
+            maxQueued_ = numBytes; 
+        }
+#endif
+
         /** Returns the size of the terminal in columns and rows by querying the STDIN ioctls.
          */
         std::pair<int, int> size() const {
@@ -70,6 +158,92 @@ namespace tpp::pty {
 
     private:
 
+        /** Backup terminal settings to be restored when the local PTY is destroyed. 
+         */
+        static inline termios backup_;
+
+#if (defined ARCH_LINUX)
+        void readInput();
+        void readSignals();
+        void readWakeup();
+
+        /** Reports the resize in the current batch, or postpones it if the last resize was reported too recently. 
+         */
+        void resize();
+
+        /** Wakes up the receiver, which will then check the pending resize and termination flags. 
+         */
+        void wakeup() {
+            uint64_t x = 1;
+            OSCHECK(::write(wakeup_, & x, sizeof(x)) == sizeof(x));
+        }
+
+        EventLoop loop_;
+        /** Eventfd signalled when the client is resized, or terminated. 
+         */
+        int wakeup_ = -1;
+        std::atomic<bool> resizePending_ = false;
+        std::atomic<bool> terminatePending_ = false;
+        bool terminated_ = false;
+
+        std::chrono::milliseconds minResizeInterval_{0};
+        std::chrono::steady_clock::time_point lastResize_;
+        /** Timer of the postponed resize event, -1 if none. 
+         */
+        int resizeTimer_ = -1;
+
+        /** The batch being received and its buffer. 
+         */
+        Batch batch_;
+        char * batchBuffer_ = nullptr;
+        size_t batchBufferLength_ = 0;
+        /** Resize received together with input by receive(), to be returned by the next call. 
+         */
+        bool pendingResize_ = false;
+
+        /** Appends the data to the output queue, merging small writes into a single block. 
+         */
+        void queue(char const * buffer, size_t numBytes);
+
+        /** Writes as much of the queue as the terminal accepts without blocking. Returns true if the queue is empty afterwards. 
+         */
+        bool writeQueued();
+
+        /** Writes the queue, blocking only while it is over given limit. Data left in the queue is written by the event loop. 
+         */
+        void writeQueued(std::unique_lock<std::mutex> & lock, size_t limit);
+
+        /** Called by the event loop when stdout becomes writable.
+         */
+        void writeReady(uint32_t events);
+
+        /** Reopens stdout as the non-blocking output descriptor and registers it with the event loop, or falls back to blocking writes to stdout itself if that is not possible. 
+         */
+        void openOutput();
+
+        /** Size of the blocks in the output queue. Sends larger than this get own block. 
+         */
+        static constexpr size_t OutputBlockSize = 64 * 1024;
+
+        /** Output queue. The front block is partially written up to outputOffset_. All output state is protected by the guard as both the sender and the event loop may write. 
+         */
+        std::mutex outputGuard_;
+        std::deque<std::string> output_;
+        size_t outputOffset_ = 0;
+        size_t queued_ = 0;
+        size_t maxQueued_ = 4 * 1024 * 1024;
+        unsigned frames_ = 0;
+        /** Descriptor the output is written to. Own non-blocking descriptor of stdout when it is polled by the event loop, otherwise stdout itself, written with blocking writes. 
+         */
+        int outputFd_ = STDOUT_FILENO;
+        bool outputPolled_ = false;
+
+        /** Live clients to be notified about resizes, protected by the guard, which also protects the signalfd and terminal settings. 
+         */
+        static inline std::mutex clientsGuard_;
+        static inline std::vector<LocalClient *> clients_;
+        static inline int signalFd_ = -1;
+#else
         static inline char const RESIZE_EVENT = 1;
         static inline char const TERMINATE_EVENT = 2;
 
@@ -77,12 +251,104 @@ namespace tpp::pty {
             OSCHECK(::write(pipe_[1], & RESIZE_EVENT, 1) == 1);
         }
 
-        /** Backup terminal settings to be restored when the local PTY is destroyed. 
-         */
-        static inline termios backup_;
-
         static inline int pipe_[2] = {0,0};
+#endif
 #endif // ARCH_UNIX
     }; // tpp::pty::LocalClient
 
+    /** Local pseudoterminal server (terminal side). 
+
+        Owns the master end of a new pseudoterminal and the child process that runs the command attached to its slave end as its controlling terminal. The child is spawned via posix_spawn where the platform supports starting a new session with it, which uses vfork-like cloning of the parent and so its cost does not depend on the size of the parent process. Otherwise the child is forked. 
+
+        The master is non-blocking. The receive() and send() methods of the PTY interface still block until they can do their work, while tryReceive() only reads what is available. On Linux the child is reaped through its pidfd, which can also be registered with an event loop to learn about the child's termination without waiting. 
+     */
+    class LocalServer : public PTY {
+#if (defined ARCH_UNIX)
+    public:
+
+        /** Spawns the command (the first element is the program, looked up in PATH) on a new pseudoterminal of given size. 
+         
+            The environment of the child is that of the current process without the variables that would interfere with the terminal (COLUMNS, LINES, TERMCAP), with SHELL, TERM and COLORTERM set to defaults and with the given variables set on top. The signals in the child are reset to their defaults and unblocked. Throws OSError if the pseudoterminal can't be created, or the command can't be executed. 
+         */
+        LocalServer(std::vector<std::string> const & command, std::unordered_map<std::string, std::string> const & env = {}, int cols = 80, int rows = 25);
+
+        /** Time the child is given to terminate after being hung up before it is killed. 
+         */
+        static constexpr std::chrono::milliseconds HangupTimeout{1000};
+
+        /** Hangs up the child and reaps it. Children that do not terminate within HangupTimeout, such as those ignoring SIGHUP, are killed. 
+         */
+        ~LocalServer() override;
+
+        LocalServer(LocalServer const &) = delete;
+
+        using PTY::send;
+
+        /** Writes the whole buffer to the child, waiting for the pseudoterminal to accept it. 
+         */
+        void send(char const * buffer, size_t numBytes) override;
+
+        /** Waits for the output of the child and reads as much of it as fits in the buffer. Returns 0 when the child closed the terminal. 
+         */
+        size_t receive(char * buffer, size_t bufferLength) override;
+
+        /** Reads the output of the child that is available without waiting. Returns nothing if there is no output available, 0 when the child closed the terminal. 
+         */
+        std::optional<size_t> tryReceive(char * buffer, size_t bufferLength);
+
+        /** Resizes the pseudoterminal, the child receives SIGWINCH. 
+         */
+        void resize(int cols, int rows);
+
+        /** The master end of the pseudoterminal. 
+         */
+        int master() const { return master_; }
+
+        pid_t pid() const { return pid_; }
+
+        /** The pidfd of the child, which becomes readable when the child terminates. -1 if pidfds are not supported. 
+         */
+        int pidfd() const { return pidfd_; }
+
+        /** Reaps the child if it has terminated and returns its exit code, returns nothing if the child is still running. 
+         */
+        std::optional<int> exitCode();
+
+        /** Waits for the child to terminate and returns its exit code. 
+         */
+        int wait();
+
+        /** Waits at most given time for the child to terminate and returns its exit code, returns nothing if the child is still running. 
+         */
+        std::optional<int> wait(std::chrono::milliseconds timeout);
+
+        /** Closes the master and sends SIGHUP to the child. The pseudoterminal can't be used afterwards. 
+         */
+        void hangup();
+
+        /** Kills the child with SIGKILL unless it has already terminated and returns its exit code. 
+         */
+        int kill();
+
+    private:
+
+        /** Spawns the child via posix_spawn, returns false if the platform does not support it. 
+         */
+        bool spawnChild(char const * slave, char * const * argv, char * const * envp);
+
+        /** Forks and executes the child. 
+         */
+        void forkChild(char const * slave, char * const * argv, char * const * envp);
+
+        /** Reaps the child, blocking if requested, returns false if the child is still running. 
+         */
+        bool reap(bool block);
+
+        int master_ = -1;
+        pid_t pid_ = -1;
+        int pidfd_ = -1;
+        std::optional<int> exitCode_;
+#endif // ARCH_UNIX
+    }; // tpp::pty::LocalServer
+
 } // namespace tpp::pty
\ No newline at end of file
@@ -2,9 +2,18 @@
 
 namespace tpp::pty {
 
-
-    Sequence Reader::receive() {
-        NOT_IMPLEMENTED;
+    bool Reader::readNext(size_t numBytes) {
+        if (eof_)
+            return false;
+        if (numBytes > buffer_.capacity() || buffer_.writable() < MinReceiveSize)
+            buffer_.grow(std::max(numBytes, buffer_.capacity() * 2));
+        size_t received = pty_->receive(buffer_.writePtr(), buffer_.writable());
+        if (received == 0) {
+            eof_ = true;
+            return false;
+        }
+        buffer_.commit(received);
+        return true;
     }
 
-} // namespace tpp::pty
\ No newline at end of file
+} // namespace tpp::pty
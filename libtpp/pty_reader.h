@@ -1,56 +1,109 @@
 #pragma once
 
+#include <cstring>
+
 #include "helpers/helpers.h"
 
 #include "pty.h"
+#include "reader.h"
+#include "ring_buffer.h"
 #include "sequence.h"
 
 namespace tpp::pty {
 
-    /** Buffered reader and decoder of PTY data stream. 
-     
-        Takes the the stream in and parses its contents on demand. The contents is multiplexed to data and control sequences with automatic buffering. 
+    /** Buffered reader and decoder of PTY data stream.
+
+        Takes the the stream in and parses its contents on demand. The contents is multiplexed to data and control sequences with automatic buffering.
+
+        The data is received from the PTY straight into the free space of a ring buffer, which is mirrored so that the unread data is always contiguous, see RingBuffer. Sequences that wrap around the end of the buffer therefore never have to be moved and the text runs and payloads of the received sequences point directly into the buffer. They are valid until the next call to receive(), or any other method that may read from the PTY.
+
+        The reader implements the reader concept (see reader.h) so that the parsers can work directly on its buffer.
      */
     class Reader {
     public:
 
-        Reader(std::unique_ptr<PTY> && pty): pty_{std::move(pty)} {
-            ASSERT(buffer_.size() != 0 && "Zero buffer capacity is not possible");
+        explicit Reader(std::unique_ptr<PTY> && pty, size_t capacity = 1024 * 1024):
+            pty_{std::move(pty)},
+            buffer_{capacity} {
         }
 
-        /** Sends the given buffer to the underlying pty. 
+        /** Sends the given buffer to the underlying pty.
          */
         void send(char const * buffer, size_t numBytes) { pty_->send(buffer, numBytes); }
 
-        /** Receives next data or control sequence from the PTY. 
-         
-            If there is enough data for a correct answer in the local buffer, returns immediately. Otherwise the function might block by calling pty's receive() to read more data. 
+        /** Receives next text run, or control sequence from the PTY.
+
+            If there is enough data for a correct answer in the local buffer, returns immediately. Otherwise the function might block by calling pty's receive() to read more data. Text runs end at the next ESC, or at the end of the data received so far. Returns None when the PTY has no more data. Throws SequenceError if the sequence is invalid, in which case the reader is advanced to the offending character so that receiving can continue.
         */
-        Sequence receive();
+        std::optional<Sequence> receive() {
+            if (! require(1))
+                return std::nullopt;
+            char const * x = data();
+            if (*x != '\033') {
+                char const * esc = static_cast<char const *>(std::memchr(x, '\033', available()));
+                size_t n = esc == nullptr ? available() : static_cast<size_t>(esc - x);
+                buffer_.consume(n);
+                return Payload{x, n};
+            }
+            return ParseSequence(*this);
+        }
 
+        /** \name Window API, see reader.h.
+         */
+        //@{
+        char const * data() const { return buffer_.data(); }
+        char const * end() const { return buffer_.data() + buffer_.size(); }
+        size_t available() const { return buffer_.size(); }
 
-        char top() {
+        /** Makes sure at least given number of bytes is available, receiving from the PTY if necessary. Returns false if the PTY has no more data.
+         */
+        bool require(size_t numBytes) {
+            while (buffer_.size() < numBytes)
+                if (! readNext(numBytes))
+                    return false;
+            return true;
+        }
+
+        void advance(size_t numBytes) { buffer_.consume(numBytes); }
+        //@}
 
+        /** \name Stream API, see reader.h.
+         */
+        //@{
+        bool eof() { return ! require(1); }
+
+        char top() {
+            if (! require(1))
+                throw tpp::Reader::EndOfFile{};
+            return *data();
         }
 
         char pop() {
-
+            char result = top();
+            buffer_.consume(1);
+            return result;
         }
 
         char peek(size_t index) {
-
+            if (! require(index + 1))
+                throw tpp::Reader::EndOfFile{};
+            return data()[index];
         }
-
+        //@}
 
     private:
 
-        void readNext() {
-            // first adjust the buffer position and 
-        }
+        /** Minimal free space in the buffer for a single receive from the PTY.
+         */
+        static constexpr size_t MinReceiveSize = 4096;
+
+        /** Receives as much data as fits in the buffer, growing the buffer first if it can't hold the given number of bytes. Returns false if the PTY has no more data.
+         */
+        bool readNext(size_t numBytes);
 
         std::unique_ptr<PTY> pty_;
-        std::vector<char> buffer_;
-        size_t bufferPos_{0};
+        RingBuffer buffer_;
+        bool eof_ = false;
     }; // tpp::pty::Reader
 
-} // namespace tpp
\ No newline at end of file
+} // namespace tpp::pty
@@ -1,18 +1,38 @@
 #pragma once
 
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
 #include "helpers/helpers.h"
 #include "helpers/helpers_pretty.h"
 
 namespace tpp {
 
-    /** A stream the reader can read from */
+    /** \name Readers.
+
+        Readers provide the parsers with a window of contiguous input bytes. The readers are not polymorphic, parsers that work with any reader are templates over the reader type and expect the following API:
+
+        - `data()` and `end()` delimit the window of bytes available for reading, `available()` is their number,
+        - `require(n)` makes sure that at least `n` bytes are available, returns false if the input ends before,
+        - `advance(n)` consumes `n` available bytes,
+        - `eof()`, `top()`, `pop()` and `peek()` access single bytes and throw EndOfFile past the end of the input.
+
+        Checking the bounds on every byte is expensive, so rather than using the single byte accessors, parsers should require the number of bytes they are going to examine up front and then read the window directly, or run over the whole window and require more bytes only if the window ends before the sequence does, see ParseFromReader().
+
+        The window is only valid until the next call to `require()`, so the payloads borrowed from it must be detached before then.
+     */
+    //@{
+
+    /** Reader over a span of memory.
+     */
     class Reader {
     public:
 
-        class EOF : public std::runtime_error {
+        class EndOfFile : public std::runtime_error {
         public:
-            EOF(): std::runtime_error{"Unexpected end of file"} {}
-        }; // Reader::EOF
+            EndOfFile(): std::runtime_error{"Unexpected end of file"} {}
+        }; // Reader::EndOfFile
 
         class Error: public std::runtime_error {
         public:
@@ -25,109 +45,137 @@ namespace tpp {
 
         Reader(char const * buffer, size_t numBytes): buffer_{buffer}, end_{buffer + numBytes} {}
 
-        /** \name Stream API. 
+        /** \name Window API.
+         */
+        //@{
+        char const * data() const { return buffer_; }
+        char const * end() const { return end_; }
+        size_t available() const { return static_cast<size_t>(end_ - buffer_); }
+
+        /** The span is the whole input, so there is nothing to read.
+         */
+        bool require(size_t numBytes) const { return available() >= numBytes; }
+
+        void advance(size_t offset) {
+            ASSERT(offset <= available() && "Advancing past the end of the buffer");
+            buffer_ += offset;
+        }
+        //@}
+
+        /** \name Stream API.
          */
         //@{
         bool eof() const { return buffer_ >= end_; }
 
         char top() const {
             if (buffer_ >= end_)
-                throw EOF{};
+                throw EndOfFile{};
             return *buffer_;
         }
 
         char pop() {
             if (buffer_ >= end_)
-                throw EOF{};
+                throw EndOfFile{};
             return *(buffer_++);
         }
 
         char peek(size_t offset) const {
             if (buffer_ + offset >= end_)
-                throw EOF{};
+                throw EndOfFile{};
             return *(buffer_ + offset);
         }
-
-        void advance(sie_t offset) {
-            ASSERT(buffer_ < end_ && "Running advance on eof'd buffer is not recommended");
-            buffer_ += offset;
-        }
-
         //@}
 
-    private:
+    protected:
        char const * buffer_;
        char const * end_;
     }; // tpp::Reader
 
-    class BufferedReader {
-
-    }; // tpp::BufferedReader
+    /** Reader that refills its buffer from a source.
 
-    /** A simple byte reader from a buffer. 
-     
-        Useful for parsing, also an interface specification for other readers. Since reader is to be used in performance critical loops, virtual functions are not used and templates are preffered instead. 
-    */
-    class Reader {
+        The source is a callable with the `size_t (char * buffer, size_t bufferSize)` signature, such as PTY::receive(), which may block and returns the number of bytes read, or 0 at the end of the input. The buffer is refilled only when more bytes are required than available, in which case the unread bytes are moved to the beginning of the buffer and the buffer grows if they would not fit.
+     */
+    template<typename SOURCE>
+    class BufferedReader : public Reader {
     public:
 
-        class Error: public std::runtime_error {
-        public:
-            Error(std::string const & what): std::runtime_error{what} {}
-        }; // ByteReader::Error
+        explicit BufferedReader(SOURCE source, size_t capacity = 65536):
+            Reader{nullptr, nullptr},
+            source_{std::move(source)},
+            storage_{new char[capacity]},
+            capacity_{capacity} {
+            ASSERT(capacity_ != 0 && "Zero buffer capacity is not possible");
+            buffer_ = storage_.get();
+            end_ = buffer_;
+        }
 
-        ByteReader(char const * buffer, char const * end): buffer_{buffer}, end_{end} {
-            ASSERT(end_ >= buffer_);
+        /** \name Window API.
+         */
+        //@{
+        bool require(size_t numBytes) {
+            while (available() < numBytes)
+                if (! fill(numBytes))
+                    return false;
+            return true;
         }
+        //@}
 
-        ByteReader(char const * buffer, size_t numBytes): buffer_{buffer}, end_{buffer + numBytes} {}
+        /** \name Stream API.
 
-        bool eof() const { return buffer_ >= end_; }
+            Unlike the span reader, reaching the end of the window refills the buffer first.
+         */
+        //@{
+        bool eof() { return ! require(1); }
 
-        char top() const {
-            if (buffer_ >= end_)
-                throw EOF{};
+        char top() {
+            if (! require(1))
+                throw EndOfFile{};
             return *buffer_;
         }
 
         char pop() {
-            if (buffer_ >= end_)
-                throw EOF{};
+            if (! require(1))
+                throw EndOfFile{};
             return *(buffer_++);
         }
 
-        char peek(size_t offset) const {
-            if (buffer_ + offset >= end_)
-                throw EOF{};
+        char peek(size_t offset) {
+            if (! require(offset + 1))
+                throw EndOfFile{};
             return *(buffer_ + offset);
         }
+        //@}
 
-        void advance(sie_t offset) {
-            ASSERT(buffer_ < end_ && "Running advance on eof'd buffer is not recommended");
-            buffer_ += offset;
-        }
-
-        template<typename T>
-        static void expectPop(T & reader, char expected) {
-            if (reader.top() != expected)
-                throw Error{"Expected " << PRETTY(expected) << " but " << PRETTY(*buffer_) << " found"};
-            return reader.pop();
-        }
+    private:
 
-        template<typename T>
-        static bool condPop(T & reader, char expected) {
-            if (reader.top() == expected) {
-                reader.pop();
-                return true;
-            } else {
+        /** Reads from the source once so that there is room for at least the given number of bytes. Returns false if the source has no more data.
+         */
+        bool fill(size_t numBytes) {
+            if (eof_)
                 return false;
+            size_t unread = available();
+            if (numBytes > capacity_) {
+                capacity_ = std::max(capacity_ * 2, numBytes);
+                std::unique_ptr<char[]> storage{new char[capacity_]};
+                std::memcpy(storage.get(), buffer_, unread);
+                storage_ = std::move(storage);
+            } else if (buffer_ != storage_.get()) {
+                std::memmove(storage_.get(), buffer_, unread);
             }
+            buffer_ = storage_.get();
+            size_t read = source_(storage_.get() + unread, capacity_ - unread);
+            end_ = buffer_ + unread + read;
+            if (read == 0)
+                eof_ = true;
+            return read != 0;
         }
 
-    private:
+        SOURCE source_;
+        std::unique_ptr<char[]> storage_;
+        size_t capacity_;
+        bool eof_ = false;
+    }; // tpp::BufferedReader
 
-       char const * buffer_;
-       char const * end_;
-    }; // tpp::ByteReader
+    //@}
 
-} // namespace tpp
\ No newline at end of file
+} // namespace tpp
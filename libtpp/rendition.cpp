@@ -0,0 +1,326 @@
+#include "rendition.h"
+#include "sequence.h"
+#include "sequence_dispatch.h"
+
+namespace tpp {
+
+    namespace {
+
+        /** Decodes the SGR arguments into the delta.
+
+            The arguments are fed in groups, where a group is an argument followed by its colon separated sub-parameters. Only the first few values of a group are ever used, any other values are only counted. Missing values are zero.
+         */
+        class Decoder {
+        public:
+
+            static constexpr unsigned MaxGroupValues = 6;
+
+            explicit Decoder(RenditionDelta & delta): delta_{delta} {}
+
+            void group(int const * values, unsigned count) {
+                int code = values[0];
+                // values following the semicolon form of extended color, i.e. 38;5;n or 38;2;r;g;b
+                if (colorTarget_ != 0) {
+                    extendedColor(code);
+                    return;
+                }
+                switch (code) {
+                    case 0:
+                        delta_ = RenditionDelta{};
+                        delta_.changes = RenditionDelta::Reset;
+                        break;
+                    case 1:
+                        set(Rendition::Bold);
+                        break;
+                    case 2:
+                        set(Rendition::Faint);
+                        break;
+                    case 3:
+                        set(Rendition::Italic);
+                        break;
+                    case 4:
+                        // 4:x selects the underline style, 4:0 is the same as 24
+                        if (count == 1)
+                            underline(UnderlineStyle::Single);
+                        else if (values[1] <= static_cast<int>(UnderlineStyle::Dashed))
+                            underline(static_cast<UnderlineStyle>(values[1]));
+                        break;
+                    case 5:
+                    case 6:
+                        set(Rendition::Blink);
+                        break;
+                    case 7:
+                        set(Rendition::Inverse);
+                        break;
+                    case 8:
+                        set(Rendition::Hidden);
+                        break;
+                    case 9:
+                        set(Rendition::Strikethrough);
+                        break;
+                    case 21:
+                        underline(UnderlineStyle::Double);
+                        break;
+                    case 22:
+                        reset(Rendition::Bold | Rendition::Faint);
+                        break;
+                    case 23:
+                        reset(Rendition::Italic);
+                        break;
+                    case 24:
+                        underline(UnderlineStyle::None);
+                        break;
+                    case 25:
+                        reset(Rendition::Blink);
+                        break;
+                    case 27:
+                        reset(Rendition::Inverse);
+                        break;
+                    case 28:
+                        reset(Rendition::Hidden);
+                        break;
+                    case 29:
+                        reset(Rendition::Strikethrough);
+                        break;
+                    case 38:
+                    case 48:
+                    case 58:
+                        if (count == 1) {
+                            colorTarget_ = code;
+                            colorState_ = 0;
+                        } else {
+                            colonColor(code, values, count);
+                        }
+                        break;
+                    case 39:
+                        color(38, Color{});
+                        break;
+                    case 49:
+                        color(48, Color{});
+                        break;
+                    case 53:
+                        set(Rendition::Overline);
+                        break;
+                    case 55:
+                        reset(Rendition::Overline);
+                        break;
+                    case 59:
+                        color(58, Color{});
+                        break;
+                    default:
+                        if (code >= 30 && code <= 37)
+                            color(38, Color::Indexed(static_cast<uint8_t>(code - 30)));
+                        else if (code >= 40 && code <= 47)
+                            color(48, Color::Indexed(static_cast<uint8_t>(code - 40)));
+                        else if (code >= 90 && code <= 97)
+                            color(38, Color::Indexed(static_cast<uint8_t>(code - 90 + 8)));
+                        else if (code >= 100 && code <= 107)
+                            color(48, Color::Indexed(static_cast<uint8_t>(code - 100 + 8)));
+                        break;
+                }
+            }
+
+        private:
+
+            static bool isByte(int value) { return value >= 0 && value <= 255; }
+
+            void set(unsigned attributes) {
+                delta_.set = static_cast<uint16_t>(delta_.set | attributes);
+                delta_.clear = static_cast<uint16_t>(delta_.clear & ~attributes);
+            }
+
+            void reset(unsigned attributes) {
+                delta_.clear = static_cast<uint16_t>(delta_.clear | attributes);
+                delta_.set = static_cast<uint16_t>(delta_.set & ~attributes);
+            }
+
+            void underline(UnderlineStyle style) {
+                delta_.underline = style;
+                delta_.changes |= RenditionDelta::Underline;
+            }
+
+            /** Sets the color selected by the given extended color code, i.e. foreground for 38, background for 48 and underline for 58.
+             */
+            void color(int code, Color value) {
+                switch (code) {
+                    case 38:
+                        delta_.foreground = value;
+                        delta_.changes |= RenditionDelta::Foreground;
+                        break;
+                    case 48:
+                        delta_.background = value;
+                        delta_.changes |= RenditionDelta::Background;
+                        break;
+                    default:
+                        delta_.underlineColor = value;
+                        delta_.changes |= RenditionDelta::UnderlineColor;
+                        break;
+                }
+            }
+
+            /** The colon form, either 38:5:n, or 38:2:colorspace:r:g:b where the colorspace is often omitted altogether, i.e. 38:2:r:g:b.
+             */
+            void colonColor(int code, int const * values, unsigned count) {
+                if (values[1] == 5 && count >= 3) {
+                    if (isByte(values[2]))
+                        color(code, Color::Indexed(static_cast<uint8_t>(values[2])));
+                } else if (values[1] == 2 && count >= 5) {
+                    int const * rgb = count >= 6 ? values + 3 : values + 2;
+                    if (isByte(rgb[0]) && isByte(rgb[1]) && isByte(rgb[2]))
+                        color(code, Color::RGB(static_cast<uint8_t>(rgb[0]), static_cast<uint8_t>(rgb[1]), static_cast<uint8_t>(rgb[2])));
+                }
+            }
+
+            /** Processes the arguments after 38, 48, or 58 in the semicolon form. The state is 0 for the color type, 1 for the palette index and 2 - 4 for the components.
+             */
+            void extendedColor(int value) {
+                switch (colorState_) {
+                    case 0:
+                        if (value == 5) {
+                            colorState_ = 1;
+                        } else if (value == 2) {
+                            colorState_ = 2;
+                        } else {
+                            colorTarget_ = 0;
+                        }
+                        return;
+                    case 1:
+                        if (isByte(value))
+                            color(colorTarget_, Color::Indexed(static_cast<uint8_t>(value)));
+                        colorTarget_ = 0;
+                        return;
+                    default:
+                        rgb_[colorState_ - 2] = value;
+                        if (++colorState_ == 5) {
+                            if (isByte(rgb_[0]) && isByte(rgb_[1]) && isByte(rgb_[2]))
+                                color(colorTarget_, Color::RGB(static_cast<uint8_t>(rgb_[0]), static_cast<uint8_t>(rgb_[1]), static_cast<uint8_t>(rgb_[2])));
+                            colorTarget_ = 0;
+                        }
+                        return;
+                }
+            }
+
+            RenditionDelta & delta_;
+            int colorTarget_ = 0;
+            unsigned colorState_ = 0;
+            int rgb_[3];
+
+        }; // tpp::anonymous::Decoder
+
+    } // tpp::anonymous
+
+    RenditionDelta RenditionDelta::Decode(CSIArgs const & args) {
+        RenditionDelta result;
+        Decoder decoder{result};
+        // no arguments is the same as single 0
+        int values[Decoder::MaxGroupValues] = {};
+        if (args.empty()) {
+            decoder.group(values, 1);
+            return result;
+        }
+        size_t i = 0;
+        size_t n = args.size();
+        while (i != n) {
+            unsigned count = 0;
+            do {
+                if (count < Decoder::MaxGroupValues)
+                    values[count] = args.get(i, 0);
+                ++count;
+                ++i;
+            } while (i != n && args.isSubParameter(i));
+            decoder.group(values, count);
+        }
+        return result;
+    }
+
+    bool RenditionDelta::Decode(char const * & buffer, char const * end, RenditionDelta & result) {
+        result = RenditionDelta{};
+        Decoder decoder{result};
+        int values[Decoder::MaxGroupValues] = {};
+        unsigned count = 0;
+        char const * x = buffer;
+        while (true) {
+            int value = 0;
+            while (true) {
+                if (x == end)
+                    return false;
+                unsigned digit = static_cast<unsigned char>(*x) - '0';
+                if (digit > 9)
+                    break;
+                value = dispatch::appendDigit(value, *x);
+                ++x;
+            }
+            if (count < Decoder::MaxGroupValues)
+                values[count] = value;
+            ++count;
+            if (*x == ':') {
+                ++x;
+                continue;
+            }
+            decoder.group(values, count);
+            if (*x != ';')
+                break;
+            count = 0;
+            ++x;
+        }
+        buffer = x;
+        return true;
+    }
+
+    void RenditionDelta::toArgs(CSIArgs & args) const {
+        if (changes & Reset)
+            args.push_back(0);
+        static constexpr int SetCodes[] = { 1, 2, 3, 5, 7, 8, 9, 53 };
+        static constexpr int ClearCodes[] = { 22, 22, 23, 25, 27, 28, 29, 55 };
+        for (unsigned i = 0; i < 8; ++i) {
+            // bold and faint are both cleared by 22
+            if ((clear & (1u << i)) && ! (i == 1 && (clear & Rendition::Bold)))
+                args.push_back(ClearCodes[i]);
+        }
+        for (unsigned i = 0; i < 8; ++i)
+            if (set & (1u << i))
+                args.push_back(SetCodes[i]);
+        if (changes & Underline) {
+            if (underline == UnderlineStyle::None) {
+                args.push_back(24);
+            } else {
+                args.push_back(4);
+                if (underline != UnderlineStyle::Single)
+                    args.push_back(static_cast<int>(underline), true);
+            }
+        }
+        auto color = [&](int code, Color value) {
+            switch (value.kind()) {
+                case Color::Kind::Default:
+                    args.push_back(code + 1);
+                    break;
+                case Color::Kind::Indexed:
+                    // the basic and bright colors of foreground and background have their own codes
+                    if (code != 58 && value.index() < 8) {
+                        args.push_back(code - 8 + value.index());
+                    } else if (code != 58 && value.index() < 16) {
+                        args.push_back(code + 52 + value.index() - 8);
+                    } else {
+                        args.push_back(code);
+                        args.push_back(5);
+                        args.push_back(value.index());
+                    }
+                    break;
+                case Color::Kind::RGB:
+                    args.push_back(code);
+                    args.push_back(2);
+                    args.push_back(value.red());
+                    args.push_back(value.green());
+                    args.push_back(value.blue());
+                    break;
+            }
+        };
+        if (changes & Foreground)
+            color(38, foreground);
+        if (changes & Background)
+            color(48, background);
+        if (changes & UnderlineColor)
+            color(58, underlineColor);
+    }
+
+} // namespace tpp
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstdint>
+
+namespace tpp {
+
+    class CSIArgs;
+
+    /** Color of the text, background, or underline packed in 32 bits.
+
+        The top byte is the kind of the color, the lower three bytes are either the index in the 256 color palette, or the red, green and blue components.
+     */
+    class Color {
+    public:
+
+        enum class Kind : uint8_t {
+            /** The default color of the terminal.
+             */
+            Default,
+            /** Color from the 256 color palette, where the first 16 colors are the basic and bright colors of SGR 30 - 37 and 90 - 97.
+             */
+            Indexed,
+            /** Truecolor.
+             */
+            RGB,
+        }; // Color::Kind
+
+        constexpr Color() = default;
+
+        static constexpr Color Indexed(uint8_t index) {
+            return Color{(uint32_t{1} << 24) | index};
+        }
+
+        static constexpr Color RGB(uint8_t red, uint8_t green, uint8_t blue) {
+            return Color{(uint32_t{2} << 24) | (uint32_t{red} << 16) | (uint32_t{green} << 8) | blue};
+        }
+
+        Kind kind() const { return static_cast<Kind>(raw_ >> 24); }
+        uint8_t index() const { return static_cast<uint8_t>(raw_); }
+        uint8_t red() const { return static_cast<uint8_t>(raw_ >> 16); }
+        uint8_t green() const { return static_cast<uint8_t>(raw_ >> 8); }
+        uint8_t blue() const { return static_cast<uint8_t>(raw_); }
+
+        bool operator == (Color const & other) const { return raw_ == other.raw_; }
+        bool operator != (Color const & other) const { return raw_ != other.raw_; }
+
+    private:
+
+        constexpr explicit Color(uint32_t raw): raw_{raw} {}
+
+        uint32_t raw_ = 0;
+    }; // tpp::Color
+
+    enum class UnderlineStyle : uint8_t {
+        None,
+        Single,
+        Double,
+        Curly,
+        Dotted,
+        Dashed,
+    }; // tpp::UnderlineStyle
+
+    /** Graphic rendition of the text, i.e. its attributes and colors.
+     */
+    class Rendition {
+    public:
+
+        /** Attributes that can be either set, or cleared, stored as bitmask.
+         */
+        enum Attribute : uint16_t {
+            Bold = 1,
+            Faint = 2,
+            Italic = 4,
+            Blink = 8,
+            Inverse = 16,
+            Hidden = 32,
+            Strikethrough = 64,
+            Overline = 128,
+        }; // Rendition::Attribute
+
+        uint16_t attributes = 0;
+        UnderlineStyle underline = UnderlineStyle::None;
+        Color foreground;
+        Color background;
+        Color underlineColor;
+
+        bool operator == (Rendition const & other) const {
+            return attributes == other.attributes && underline == other.underline && foreground == other.foreground && background == other.background && underlineColor == other.underlineColor;
+        }
+
+        bool operator != (Rendition const & other) const { return ! (*this == other); }
+
+    }; // tpp::Rendition
+
+    /** Change of the graphic rendition described by a single SGR sequence.
+
+        The arguments of the sequence are processed in order, so that the delta describes their combined effect, i.e. `1;22` clears bold and `1;0` only resets. Codes the terminal does not support are ignored. Both the semicolon (`38;2;r;g;b`) and colon (`38:2::r:g:b`, or `38:2:r:g:b`) forms of the extended colors are supported, as well as the underline styles (`4:3`).
+
+        The delta is packed in 20 bytes and decoding it does not allocate.
+     */
+    class RenditionDelta {
+    public:
+
+        /** Parts of the rendition changed by the delta other than the attributes.
+         */
+        enum Change : uint8_t {
+            /** The rendition is reset to default before the rest of the delta is applied.
+             */
+            Reset = 1,
+            Underline = 2,
+            Foreground = 4,
+            Background = 8,
+            UnderlineColor = 16,
+        }; // RenditionDelta::Change
+
+        /** Attributes to set and to clear, see Rendition::Attribute.
+         */
+        uint16_t set = 0;
+        uint16_t clear = 0;
+        uint8_t changes = 0;
+        UnderlineStyle underline = UnderlineStyle::None;
+        Color foreground;
+        Color background;
+        Color underlineColor;
+
+        void apply(Rendition & rendition) const {
+            if (changes & Reset)
+                rendition = Rendition{};
+            rendition.attributes = static_cast<uint16_t>((rendition.attributes & ~clear) | set);
+            if (changes & Underline)
+                rendition.underline = underline;
+            if (changes & Foreground)
+                rendition.foreground = foreground;
+            if (changes & Background)
+                rendition.background = background;
+            if (changes & UnderlineColor)
+                rendition.underlineColor = underlineColor;
+        }
+
+        bool operator == (RenditionDelta const & other) const {
+            return set == other.set && clear == other.clear && changes == other.changes && underline == other.underline && foreground == other.foreground && background == other.background && underlineColor == other.underlineColor;
+        }
+
+        bool operator != (RenditionDelta const & other) const { return ! (*this == other); }
+
+        /** Decodes the delta from already parsed arguments of the SGR sequence.
+         */
+        static RenditionDelta Decode(CSIArgs const & args);
+
+        /** Decodes the delta directly from the arguments of SGR sequence, i.e. the bytes following ESC [.
+
+            The arguments end with the first character that is not a digit, semicolon, or colon, where the buffer is left. It is up to the caller to check that the character is the SGR final byte. Returns false if the buffer ends before the arguments do.
+         */
+        static bool Decode(char const * & buffer, char const * end, RenditionDelta & result);
+
+        /** Converts the delta back to the SGR arguments.
+
+            Note that SGR 22 clears both bold and faint, so clearing only one of them is not preserved.
+         */
+        void toArgs(CSIArgs & args) const;
+
+    }; // tpp::RenditionDelta
+
+} // namespace tpp
@@ -0,0 +1,97 @@
+#if (defined ARCH_UNIX)
+    #include <unistd.h>
+    #include <sys/mman.h>
+#endif
+
+#include "ring_buffer.h"
+
+namespace tpp {
+
+    namespace {
+
+        size_t pageSize() {
+#if (defined ARCH_UNIX)
+            return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#else
+            return 4096;
+#endif
+        }
+
+        /** Maps the memfd of given size twice into adjacent virtual memory and returns the start of the mapping, or nullptr if any of the steps fails.
+         */
+        char * mapMirrored([[maybe_unused]] size_t size) {
+#if (defined ARCH_LINUX)
+            int fd = memfd_create("tpp-ring-buffer", MFD_CLOEXEC);
+            if (fd < 0)
+                return nullptr;
+            char * result = nullptr;
+            if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+                // reserve the address space for both copies first so that they can be mapped adjacent to each other
+                void * base = mmap(nullptr, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (base != MAP_FAILED) {
+                    char * b = static_cast<char *>(base);
+                    if (mmap(b, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED && mmap(b + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED)
+                        result = b;
+                    else
+                        munmap(base, size * 2);
+                }
+            }
+            // the mappings keep the memory alive
+            close(fd);
+            return result;
+#else
+            return nullptr;
+#endif
+        }
+
+    } // tpp::anonymous
+
+    RingBuffer::RingBuffer(size_t capacity) {
+        allocate(capacity);
+    }
+
+    RingBuffer::~RingBuffer() {
+        release(base_, capacity_, mirrored_);
+    }
+
+    void RingBuffer::grow(size_t capacity) {
+        if (capacity <= capacity_)
+            return;
+        char * base = base_;
+        size_t oldCapacity = capacity_;
+        bool mirrored = mirrored_;
+        char const * data = this->data();
+        size_t n = size();
+        allocate(capacity);
+        // the old data is contiguous either because it was mirrored, or compacted
+        std::memcpy(base_, data, n);
+        read_ = 0;
+        write_ = n;
+        release(base, oldCapacity, mirrored);
+    }
+
+    void RingBuffer::allocate(size_t capacity) {
+        size_t page = pageSize();
+        capacity_ = page;
+        while (capacity_ < capacity)
+            capacity_ *= 2;
+        mask_ = capacity_ - 1;
+        base_ = mapMirrored(capacity_);
+        mirrored_ = (base_ != nullptr);
+        if (! mirrored_)
+            base_ = new char[capacity_];
+    }
+
+    void RingBuffer::release(char * base, size_t capacity, bool mirrored) {
+        if (base == nullptr)
+            return;
+        if (mirrored) {
+#if (defined ARCH_UNIX)
+            munmap(base, capacity * 2);
+#endif
+        } else {
+            delete [] base;
+        }
+    }
+
+} // namespace tpp
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "helpers/helpers.h"
+
+namespace tpp {
+
+    /** Byte ring buffer whose readable and writable regions are always contiguous.
+
+        On Linux the buffer is a memfd mapped twice into adjacent virtual memory, so that the byte after the end of the buffer is its first byte again. Both the unread data and the free space can then be accessed as a single span regardless of where they wrap around and the data never has to be moved. On other platforms, or if the mapping fails, the buffer falls back to an ordinary allocation, where the unread data is moved to the beginning of the buffer when the free space at its end runs out.
+
+        The buffer is written by a single producer, which fills the span returned by writable() and then calls commit(), and read by a single consumer, which reads the span returned by data() and then calls consume(). The capacity is rounded up to the page size.
+     */
+    class RingBuffer {
+    public:
+
+        explicit RingBuffer(size_t capacity = 1024 * 1024);
+
+        ~RingBuffer();
+
+        RingBuffer(RingBuffer const &) = delete;
+        RingBuffer & operator = (RingBuffer const &) = delete;
+
+        size_t capacity() const { return capacity_; }
+
+        /** Returns true if the buffer is mirrored, i.e. the data is never moved.
+         */
+        bool mirrored() const { return mirrored_; }
+
+        /** \name Reading.
+         */
+        //@{
+        char const * data() const { return base_ + (read_ & mask_); }
+        size_t size() const { return static_cast<size_t>(write_ - read_); }
+        bool empty() const { return write_ == read_; }
+
+        void consume(size_t numBytes) {
+            ASSERT(numBytes <= size());
+            read_ += numBytes;
+        }
+        //@}
+
+        /** \name Writing.
+         */
+        //@{
+        /** Returns the start of the free space. The free space is contiguous, see writable().
+         */
+        char * writePtr() {
+            // without the mirror, the free space is only contiguous if the unread data starts at the beginning of the buffer
+            if (! mirrored_ && read_ != 0)
+                compact();
+            // when all data has been read, writing from the beginning again keeps the buffer in cache
+            else if (read_ == write_)
+                read_ = write_ = 0;
+            return base_ + (write_ & mask_);
+        }
+
+        /** Returns the size of the free space.
+         */
+        size_t writable() const { return capacity_ - size(); }
+
+        void commit(size_t numBytes) {
+            ASSERT(numBytes <= writable());
+            write_ += numBytes;
+        }
+        //@}
+
+        /** Replaces the buffer with one of at least the given capacity, keeping the unread data.
+         */
+        void grow(size_t capacity);
+
+    private:
+
+        /** Moves the unread data to the beginning of the buffer that is not mirrored.
+         */
+        void compact() {
+            size_t n = size();
+            std::memmove(base_, data(), n);
+            read_ = 0;
+            write_ = n;
+        }
+
+        void allocate(size_t capacity);
+
+        static void release(char * base, size_t capacity, bool mirrored);
+
+        char * base_ = nullptr;
+        size_t capacity_ = 0;
+        /** The capacity is a power of two, so that the positions in the buffer can be masked.
+         */
+        uint64_t mask_ = 0;
+        bool mirrored_ = false;
+        /** Total number of bytes ever read and written. The unread data is between the two.
+         */
+        uint64_t read_ = 0;
+        uint64_t write_ = 0;
+
+    }; // tpp::RingBuffer
+
+} // namespace tpp
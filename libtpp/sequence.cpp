@@ -1,325 +1,338 @@
+#include <algorithm>
+#include <cstring>
+
 #include "helpers/helpers_pretty.h"
 #include "sequence.h"
+#include "sequence_dispatch.h"
+#include "sequence_visitor.h"
+#include "text_scanner.h"
 
 namespace tpp {
 
+    using dispatch::parseChar;
+    using dispatch::parseInt;
+    using dispatch::parseCSIArgs;
+    using dispatch::parseOSCId;
+    using dispatch::parseOSCValues;
+    using dispatch::appendDigit;
+
     namespace {
 
-        std::optional<bool> parseChar(char x, char const * & buffer, char const * end) {
-            if (buffer == end)
-                return std::nullopt;
-            return *buffer++ == x;
+        /** Throws SequenceError with given message for a failed parse, reporting the offending character if there is one. 
+         */
+        [[noreturn]] void raise(char const * what, char const * buffer, char const * end) {
+            if (buffer < end)
+                throw SequenceError{STR(what << ", " << PRETTY(*buffer) << " found")};
+            throw SequenceError{what};
         }
 
-        std::optional<bool> parseChar(char x, char const * & buffer, char const * end, char const * msg) {
-            if (buffer == end)
-                return std::nullopt;
-            if (*buffer != x)
-                throw SequenceError(STR(msg << ". " << PRETTY(*buffer) << " found instead"));
-            ++buffer;
-            return true;
+        template<typename T>
+        std::optional<T> parseOrRaise(char const * & buffer, char const * end, char const * what) {
+            T result;
+            switch (T::TryParse(buffer, end, result)) {
+                case ParseResult::Ok:
+                    return result;
+                case ParseResult::Incomplete:
+                    return std::nullopt;
+                default:
+                    raise(what, buffer, end);
+            }
         }
 
-        std::optional<int> parseInt(char const * & buffer, char const * end) {
-            int result = 0;
-            char const * x = buffer;
-            while (true) {
-                if (x >= end)
-                    return std::nullopt;
-                if (isDecimalDigit(*x))
-                result = (result * 10) + (*(x++) - '0');
-            else
-                break;
+        /** Values of hexadecimal digits, zero for other characters. 
+         */
+        struct HexValues {
+            uint8_t values[256] = {};
+            constexpr HexValues() {
+                for (int i = 0; i < 10; ++i)
+                    values['0' + i] = static_cast<uint8_t>(i);
+                for (int i = 0; i < 6; ++i) {
+                    values['a' + i] = static_cast<uint8_t>(10 + i);
+                    values['A' + i] = static_cast<uint8_t>(10 + i);
+                }
             }
-            buffer = x;
-            return result;
+        };
+
+        constexpr HexValues HexValueTable{};
+
+        /** Value of the byte encoded by the two hexadecimal digits. 
+         */
+        inline uint8_t hexByte(char const * digits) {
+            return static_cast<uint8_t>((HexValueTable.values[static_cast<uint8_t>(digits[0])] << 4) | HexValueTable.values[static_cast<uint8_t>(digits[1])]);
         }
 
+        template<typename T, typename = void>
+        struct HasDetach : std::false_type {};
+
+        template<typename T>
+        struct HasDetach<T, std::void_t<decltype(std::declval<T &>().detach())>> : std::true_type {};
+
     } // tpp::anonymous
 
-    std::optional<CSISequence> CSISequence::Parse(char const * & buffer, char const * end) {
-        if (buffer == end)
-            return std::nullopt;
+    /** Propagates incomplete and error results of nested parsing functions. 
+     
+        In case of an error, the buffer is updated to the offending character, incomplete results leave the buffer intact. Expects the current position to be stored in local variable `x`.
+     */
+    #define TRY(...) if (ParseResult r_ = (__VA_ARGS__); r_ != ParseResult::Ok) { \
+        if (r_ == ParseResult::Error) \
+            buffer = x; \
+        return r_; \
+    }
+
+    ParseResult CSISequence::TryParse(char const * & buffer, char const * end, CSISequence & result) {
         char const * x = buffer;
-        try {
-            parseChar('\033', x, end, "Expected CSI sequence start (ESC [)").value();
-            parseChar('[', x, end, "Expected CSI sequence start (ESC [)").value();
-            CSISequence result;
-            while (true) {
-                if (x == end)
-                    return std::nullopt;
-                std::optional<int> arg;
-                if (isDecimalDigit(*x)) {
-                    int value = 0;
-                    do {
-                        value = (value * 10) + (*x - '0');
-                        if (++x == end)
-                            return std::nullopt;
-                    } while (isDecimalDigit(*x));
-                    arg = value;
-                }
-                if (*x == ';') {
-                    ++x;
-                    result.args_.push_back(arg);
-                // can be either unsupported parameter byte, unsupported intermediate bytes, or final byte, make sure we add the last argument if there was actually one (otherwise ars are only ever stored with semicolon separators) or extra separator                    
-                } else {
-                    if (arg.has_value() || ! result.args_.empty())
-                        result.args_.push_back(arg);
-                    break; 
-                }
-            }
-            if (IsFinalByte(*x)) {
-                result.suffix_ = *x;
-                ++x;
-            } else if (IsParameterByte(*x)) {
-                throw SequenceError{"Parameter bytes are not supported"};
-            } else if (IsIntermediateByte(*x)) {
-                throw SequenceError{"Intermediatebytes are not supported"};
-            }
-            buffer = x;
-            return result;
-        } catch (std::bad_optional_access const &) {
-            return std::nullopt;
-        } catch (...) {
-            buffer = x;
-            throw;
-        }
+        TRY(parseChar('\033', x, end));
+        TRY(parseChar('[', x, end));
+        result.args_.clear();
+        TRY(parseCSIArgs(x, end, result.args_));
+        result.suffix_ = *x;
+        buffer = x + 1;
+        return ParseResult::Ok;
     }
 
-    std::optional<DECSequence> DECSequence::Parse(char const * & buffer, char const * end) {
-        if (buffer == end)
-            return std::nullopt;
+    std::optional<CSISequence> CSISequence::Parse(char const * & buffer, char const * end) {
+        return parseOrRaise<CSISequence>(buffer, end, "Invalid CSI sequence (parameter and intermediate bytes are not supported)");
+    }
+
+    ParseResult DECSequence::TryParse(char const * & buffer, char const * end, DECSequence & result) {
         char const * x = buffer;
-        try {
-            parseChar('\033', x, end, "Expected DEC sequence start (ESC [ ?)").value();
-            parseChar('[', x, end, "Expected DEC sequence start (ESC [ ?)").value();
-            parseChar('?', x, end, "Expected DEC sequence start (ESC [ ?)").value();
+        TRY(parseChar('\033', x, end));
+        TRY(parseChar('[', x, end));
+        TRY(parseChar('?', x, end));
+        result.clear();
+        while (true) {
             int id = 0;
             bool idParsed = false;
             while (true) {
                 if (x == end)
-                    return std::nullopt;
+                    return ParseResult::Incomplete;
                 if (!isDecimalDigit(*x))
                     break;
-                id = id * 10 + (*(x++) - '0');
+                id = appendDigit(id, *(x++));
                 idParsed = true;                    
             }
-            if (!idParsed)
-                throw SequenceError{STR("DEC sequence must have an integer id, but " << PRETTY(*x) << " found")};
-            switch (*x) {
-                case 'h':
-                    buffer = x + 1;
-                    return DECSequence{id, true};
-                case 'l':
-                    buffer = x + 1;
-                    return DECSequence{id, false};
-                default:
-                    throw SequenceError{STR("Dec sequence must end with 'h' or 'l', but  " << PRETTY(*x) << " found")};
-            }                
-        } catch (std::bad_optional_access const &) {
-            return std::nullopt;
-        } catch (...) {
+            // every id must be present and there can only be MaxIds of them
+            if (!idParsed || !result.push_back(id)) {
+                buffer = x;
+                return ParseResult::Error;
+            }
+            if (*x != ';')
+                break;
+            ++x;
+        }
+        // DEC sequence must end with either 'h' or 'l'
+        if (*x != 'h' && *x != 'l') {
             buffer = x;
-            throw;
+            return ParseResult::Error;
         }
+        result.value = (*x == 'h');
+        buffer = x + 1;
+        return ParseResult::Ok;
+    }
+
+    std::optional<DECSequence> DECSequence::Parse(char const * & buffer, char const * end) {
+        return parseOrRaise<DECSequence>(buffer, end, "Invalid DEC sequence (expected ESC [ ? semicolon separated ids followed by 'h' or 'l')");
+    }
+
+    ParseResult OSCSequence::TryParse(char const * & buffer, char const * end, OSCSequence & result) {
+        char const * x = buffer;
+        TRY(parseChar('\033', x, end));
+        TRY(parseChar(']', x, end));
+        TRY(parseOSCId(x, end, result.id));
+        result.values.clear();
+        TRY(parseOSCValues(x, end, [&](Payload && value) {
+            result.values.push_back(std::move(value));
+        }));
+        buffer = x;
+        return ParseResult::Ok;
     }
 
     std::optional<OSCSequence> OSCSequence::Parse(char const * & buffer, char const * end) {
-        if (buffer == end)
-            return std::nullopt;
+        return parseOrRaise<OSCSequence>(buffer, end, "Invalid OSC sequence (expected ESC ] id ;)");
+    }
+
+    ParseResult TppSequence::TryParse(char const * & buffer, char const * end, TppSequence & result) {
         char const * x = buffer;
-        try {
-            parseChar('\033', x, end, "Expected OSC sequence start (ESC ])").value();
-            parseChar(']', x, end, "Expected OSC sequence start (ESC ])").value();
-            int id = 0;
-            bool idParsed = false;
+        TRY(parseChar('\033', x, end));
+        TRY(parseChar('P', x, end));
+        TRY(parseArg<int>(x, end, result.id));
+        TRY(parseChar('t', x, end));
+        TRY(TryParseArgs(x, end, result));
+        buffer = x;
+        return ParseResult::Ok;
+    }
+
+    ParseResult TppSequence::TryParseArgs(char const * & buffer, char const * end, TppSequence & result) {
+        char const * x = buffer;
+        result.args.clear();
+        // now parse the arguments, each is terminated by either separator, or ESC
+        if (x == end)
+            return ParseResult::Incomplete;
+        if (*x != '\033') {
             while (true) {
-                if (x == end)
-                    return std::nullopt;
-                if (!isDecimalDigit(*x))
+                result.args.emplace_back();
+                TRY(parseArg<Payload>(x, end, result.args.back()));
+                if (*x == ';')
+                    ++x;
+                else 
                     break;
-                id = id * 10 + (*(x++) - '0');
-                idParsed = true;                    
-            }
-            if (*x != ';')
-                throw SequenceError{STR("Expected semicolon after OSC id, but " << PRETTY(*x) << " found")};
-            ++x;
-            // now parse the string payload(s), which can be terminated by either BEL, or ST
-            OSCSequence result;
-            if (idParsed)
-                result.id = id;
-            char const * valueStart = x;
-            auto addPayload = [&](char const * valueEnd){
-                result.values.push_back(std::string{valueStart, static_cast<size_t>(valueEnd - valueStart)});
-                valueStart = x;
-            };
-            while (true) {
-                if (x == end)
-                    return std::nullopt;
-                switch (* x++) {
-                    case ';':
-                        addPayload(x - 1);
-                        break;
-                    case '\b':
-                        addPayload(x - 1);
-                        buffer = x;
-                        return result; 
-                    case '\033':
-                        if (x == end)
-                            return std::nullopt;
-                        if (*x == '\\') {
-                            addPayload(x - 1);
-                            ++x;
-                            return result;
-                        }
-                        // fallthorugh to default case
-                    default:
-                        break;
-                }
             }
-        } catch (std::bad_optional_access const &) {
-            return std::nullopt;
-        } catch (...) {
-            buffer = x;
-            throw;
         }
+        TRY(parseEnd(x, end));
+        buffer = x;
+        return ParseResult::Ok;
     }
 
     std::optional<TppSequence> TppSequence::Parse(char const * & buffer, char const * end) {
-        if (buffer == end)
-            return std::nullopt;
-        char const * x = buffer;
-        try {
-            parseChar('\033', x, end, "Expected DEC sequence start (ESC P)").value();
-            parseChar('P', x, end, "Expected DEC sequence start (ESC P)").value();
-            TppSequence res{parseArg<int>(x, end).value()};
-            parseChar('t', x, end, "Expected tpp sequence final character 't'").value();
-            // now parse the arguments, after each, we 
-            if (x == end)
-                return std::nullopt;
-            if (*x != '\033') {
-                while (true) {
-                    res.args.push_back(parseArg<std::string>(x, end).value());
-                    if (x == end)
-                        return std::nullopt;
-                    if (*x == ';') {
-                        ++x;
-                        continue;
-                    } else if (*x == '\033') {
-                        break;
-                    } else {
-                        throw SequenceError{STR("Invalid character in tpp sequence: " << PRETTY(*x))};
-                    }
+        return parseOrRaise<TppSequence>(buffer, end, "Invalid tpp sequence (expected ESC P id t args ST)");
+    }
+
+    ParseResult TppSequence::MeasureArg(char const * buffer, char const * end, char const * & argEnd, size_t & size) {
+        // hexadecimal digits are never delimiters, the argument ends at the first one
+        char const * x = FindAnyOf(buffer, end, ';', '\033', '\033');
+        size_t encoded;
+        if (! CountHexEncoded(buffer, x, encoded)) {
+            // find the invalid encoded byte, which may also be incomplete if the buffer ends
+            for (char const * i = buffer; i != x; ++i) {
+                if (*i != '`')
+                    continue;
+                if (i + 1 == end || (isHexadecimalDigit(i[1]) && i + 2 == end))
+                    return ParseResult::Incomplete;
+                if (! isHexadecimalDigit(i[1]) || ! isHexadecimalDigit(i[2])) {
+                    argEnd = isHexadecimalDigit(i[1]) ? i + 2 : i + 1;
+                    return ParseResult::Error;
                 }
+                i += 2;
             }
-            ++x; // for ESC
-            parseChar('\\', x, end, "Expected ST (ESC \\)").value();
-            buffer = x;
-            return res;
-        } catch (std::bad_optional_access const &) {
-            return std::nullopt;
-        } catch (...) {
-            buffer = x;
-            throw;
+            ASSERT(false && "CountHexEncoded reported invalid encoding that does not exist");
         }
+        if (x == end)
+            return ParseResult::Incomplete;
+        argEnd = x;
+        size = static_cast<size_t>(x - buffer) - 2 * encoded;
+        return ParseResult::Ok;
     }
 
-    void TppSequence::Encode(std::ostream & s, std::string const & value) {
-        for (char c : value) {
-            if (!isPrintableCharacter(c) || c == ';' || c == '`')
-                s << '`' << nibbleToHex(c >> 4) << nibbleToHex(c & 0xf);
-            else
-                s << c;
+    char * TppSequence::DecodeArg(char const * buffer, char const * argEnd, char * output) {
+        // number of digits of already decoded byte yet to be skipped
+        unsigned skip = 0;
+        // the blocks read up to two bytes past their end
+        while (argEnd - buffer >= 18) {
+            if (skip == 0) {
+                char const * tick = static_cast<char const *>(std::memchr(buffer, '`', static_cast<size_t>(argEnd - buffer)));
+                if (tick == nullptr)
+                    tick = argEnd;
+                if (tick - buffer >= 16) {
+                    std::memcpy(output, buffer, static_cast<size_t>(tick - buffer));
+                    output += tick - buffer;
+                    buffer = tick;
+                    continue;
+                }
+            }
+            /* Encoded bytes in binary payloads are unpredictable, so each input position is processed without branches: a byte is written for every position, but the output only advances for positions that are not digits of an encoded byte. The extra write always lands on the slot of the next output byte, which is overwritten later.
+             */
+            for (int i = 0; i < 16; ++i) {
+                uint8_t c = static_cast<uint8_t>(buffer[i]);
+                unsigned isTick = c == '`';
+                uint8_t decoded = hexByte(buffer + i + 1);
+                uint8_t mask = static_cast<uint8_t>(0 - isTick);
+                *output = static_cast<char>((decoded & mask) | (c & ~mask));
+                output += (skip == 0);
+                // ticks are never inside encoded bytes, i.e. skip is zero for them
+                skip = skip - (skip != 0) + 2 * isTick;
+            }
+            buffer += 16;
+        }
+        buffer += skip;
+        while (buffer != argEnd) {
+            if (*buffer == '`') {
+                *output++ = static_cast<char>(hexByte(buffer + 1));
+                buffer += 3;
+            } else {
+                *output++ = *buffer++;
+            }
         }
+        return output;
     }
 
-    std::optional<bool> TppSequence::parseSeparator(char const * & buffer, char const * end) {
-        return parseChar(';', buffer, end, "Expected tpp sequence rgument separator ';'");
+    ParseResult TppSequence::parseSeparator(char const * & buffer, char const * end) {
+        return parseChar(';', buffer, end);
     }
 
-    std::optional<bool> TppSequence::parseEnd(char const * & buffer, char const * end) {
+    ParseResult TppSequence::parseEnd(char const * & buffer, char const * end) {
         char const * x = buffer;
-        try {
-            parseChar('\033', x, end, "Expected tpp sequence end (ESC \\)").value();
-            parseChar('\\', x, end, "Expected tpp sequence end (ESC \\)").value();
-            buffer = x;
-            return true;
-        } catch (std::bad_optional_access const &) {
-            return std::nullopt;
-        } catch (...) {
-            buffer = x;
-            throw;
-        }
+        TRY(parseChar('\033', x, end));
+        TRY(parseChar('\\', x, end));
+        buffer = x;
+        return ParseResult::Ok;
+    }
+
+    #undef TRY
+
+    ParseResult TryParseSequence(char const * & buffer, char const * end, std::optional<Sequence> & result) {
+        dispatch::SequenceCollector collector{result};
+        return VisitSequence(buffer, end, collector);
     }
 
     std::optional<Sequence> ParseSequence(char const * & buffer, char const * end) {
-        if (buffer + 3 <= end) {
-            if (buffer[1] == '[') {
-                if (buffer[2] == '?') {
-                    auto seq = DECSequence::Parse(buffer, end);
-                    if (!seq.has_value())
-                        return std::nullopt;
-                    switch (seq->id) {
-                        #define DEC(_, NAME, ID) case ID: return NAME{seq.value()};
-                        #include "sequences.inc.h"
-                        default:
-                            return seq.value();
-                    }
-                } else {
-                    auto seq = CSISequence::Parse(buffer, end);
-                    if (!seq.has_value())
-                        return std::nullopt;
-                    switch (seq->suffix()) {
-                        #define CSI0(_, NAME, SUFFIX) case SUFFIX: return NAME{std::move(seq.value())}; 
-                        #define CSI1(_, NAME, SUFFIX, ...) case SUFFIX: return NAME{std::move(seq.value())}; 
-                        #define CSI2(_, NAME, SUFFIX, ...) case SUFFIX: return NAME{std::move(seq.value())}; 
-                        #include "sequences.inc.h"
-                        default:
-                            return seq.value();
-                    }
-                }
-            } else if (buffer[1] == ']') {
-                auto seq = OSCSequence::Parse(buffer, end);
-                if (!seq.has_value())
-                    return std::nullopt;
-                if (seq->id.has_value()) {
-                    switch (seq->id.value()) {
-                        #define OSC1(_, NAME, ID, ...) case ID: return NAME{std::move(seq.value())};
-                        #define OSC2(_, NAME, ID, ...) case ID: return NAME{std::move(seq.value())};
-                        #include "sequences.inc.h"
-                        default:
-                            break;
-                    }
-                }
-                return seq.value();
-            } else if (buffer[1] == 'P') {
-                char const * x = buffer + 2;
-                try {
-                    int id = parseInt(x, end).value();
-                    parseChar('t', x, end, "Expected TPP final byte 't'").value();
-                    std::optional<Sequence> result;
-                    switch (id) {
-                        #define TPP2(_, NAME, ...) case NAME::Id: result = NAME::parseBody(x, end); break;
-                        #include "sequences.inc.h"
-                        default:
-                            result = TppSequence::Parse(x, end).value();
-                            break;
-                    }
-                    if (result.has_value())
-                        buffer = x;
-                    return result;
-                } catch (std::bad_optional_access const &) {
-                    return std::nullopt;
-                } catch (...) {
-                    buffer = x;
-                    throw;
-                }
-            } else {
-                throw SequenceError{STR("Invalid ANSI escape sequence")};
-            }
-        } else {
-            return std::nullopt;
-        }
+        std::optional<Sequence> result;
+        if (TryParseSequence(buffer, end, result) == ParseResult::Error)
+            raise("Invalid ANSI escape sequence", buffer, end);
+        return result;
+    }
+
+    Sequence Specialize(CSISequence && seq) {
+        using namespace dispatch;
+        CSIVisitor<SequenceCollector> visitor = CSIVisitors<SequenceCollector>[seq.suffix()];
+        if (visitor == nullptr)
+            return std::move(seq);
+        std::optional<Sequence> result;
+        SequenceCollector collector{result};
+        CSIArgs args{seq.args()};
+        if (visitor(args, collector) != ParseResult::Ok)
+            throw SequenceError{STR("Invalid arguments of CSI sequence " << PRETTY(seq))};
+        return std::move(result.value());
+    }
+
+    Sequence Specialize(DECSequence const & seq) {
+        using namespace dispatch;
+        DECVisitor<SequenceCollector> const * visitor = seq.numIds() == 1 ? DECVisitors<SequenceCollector>.find(seq.id(0)) : nullptr;
+        if (visitor == nullptr)
+            return seq;
+        std::optional<Sequence> result;
+        SequenceCollector collector{result};
+        (*visitor)(seq.value, collector);
+        return std::move(result.value());
+    }
+
+    Sequence Specialize(OSCSequence && seq) {
+        using namespace dispatch;
+        OSCVisitor<SequenceCollector> const * visitor = seq.id.has_value() ? OSCVisitors<SequenceCollector>.find(seq.id.value()) : nullptr;
+        if (visitor == nullptr)
+            return std::move(seq);
+        std::optional<Sequence> result;
+        SequenceCollector collector{result};
+        if ((*visitor)(seq.values.data(), seq.values.size(), collector) == ParseResult::Ok)
+            return std::move(result.value());
+        throw SequenceError{STR("Invalid number of values of OSC sequence " << PRETTY(seq))};
+    }
+
+    Sequence Specialize(TppSequence && seq) {
+        using namespace dispatch;
+        TppVisitor<SequenceCollector> const * visitor = TppVisitors<SequenceCollector>.find(seq.id);
+        if (visitor == nullptr)
+            return std::move(seq);
+        std::optional<Sequence> result;
+        SequenceCollector collector{result};
+        visitor->convert(std::move(seq), collector);
+        return std::move(result.value());
+    }
+
+    void Detach(Sequence & seq) {
+        std::visit([](auto & s) {
+            if constexpr (HasDetach<std::decay_t<decltype(s)>>::value)
+                s.detach();
+        }, seq);
     }
 
-} // namespace tpp
\ No newline at end of file
+} // namespace tpp
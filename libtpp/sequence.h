@@ -1,5 +1,9 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
 #include <vector>
 #include <optional>
 #include <variant>
@@ -8,6 +12,8 @@
 #include "helpers/helpers_pretty.h"
 
 #include "reader.h"
+#include "payload.h"
+#include "rendition.h"
 
 namespace tpp {
 
@@ -17,109 +23,357 @@ namespace tpp {
         SequenceError(std::string const & what): std::runtime_error{what} {}
     }; // tpp::SequenceError
 
+    /** Result of the exception-free parsing functions. 
+
+        Partial sequences are very common in the input stream as the reads from the terminal can be split anywhere. The `TryParse` family of functions therefore reports both incomplete input and syntax errors via return codes. The `Parse` functions are wrappers over them that throw SequenceError on syntax errors. 
+     */
+    enum class ParseResult {
+        /** The sequence has been parsed and the buffer advanced past it. 
+         */
+        Ok,
+        /** The buffer ends before the sequence is complete, the buffer is left unchanged. 
+         */
+        Incomplete,
+        /** The sequence is invalid, the buffer points to the offending character. 
+         */
+        Error,
+    }; // tpp::ParseResult
+
+    namespace dispatch {
+
+        /** Largest value of a numeric argument. Longer digit runs, which may come from untrusted input, saturate to it rather than overflow, as in xterm. 
+         */
+        constexpr int MaxNumericArg = 65535;
+
+        /** Appends the decimal digit to the value, saturating at MaxNumericArg. Shared by all parsers of numeric arguments, see sequence_dispatch.h. 
+         */
+        inline int appendDigit(int value, char digit) {
+            return std::min(value * 10 + (digit - '0'), MaxNumericArg);
+        }
+
+    } // tpp::dispatch
+
+    /** Parses a single sequence from the reader, see reader.h.
+
+        Runs the `tryParse` function over the reader's window and requires more bytes from the reader only if the window ends before the sequence does, so that the bounds are checked once per sequence rather than on every byte. On success advances the reader past the sequence and returns true. Returns false if the input ends before the sequence is complete, leaving the reader unchanged. If the sequence is invalid, advances the reader to the offending character and calls the `parse` function on the original window to raise the appropriate SequenceError, as errors are rare.
+     */
+    template<typename READER, typename TRY_PARSE, typename PARSE>
+    bool ParseFromReader(READER & reader, TRY_PARSE tryParse, PARSE parse) {
+        size_t required = 1;
+        while (reader.require(required)) {
+            char const * start = reader.data();
+            char const * end = reader.end();
+            char const * x = start;
+            switch (tryParse(x, end)) {
+                case ParseResult::Ok:
+                    reader.advance(static_cast<size_t>(x - start));
+                    return true;
+                case ParseResult::Incomplete:
+                    required = reader.available() + 1;
+                    break;
+                default:
+                    reader.advance(static_cast<size_t>(x - start));
+                    parse(start, end);
+                    throw SequenceError{"Invalid sequence"};
+            }
+        }
+        return false;
+    }
+
+    /** Parses the specific sequence type from the reader using its TryParse and Parse functions.
+     */
+    template<typename T, typename READER>
+    std::optional<T> ParseFromReader(READER & reader) {
+        T result;
+        if (ParseFromReader(reader, 
+                [&result](char const * & buffer, char const * end) { return T::TryParse(buffer, end, result); },
+                [](char const * buffer, char const * end) { T::Parse(buffer, end); }))
+            return result;
+        return std::nullopt;
+    }
+
+    /** Arguments of a CSI sequence. 
+
+        CSI sequences are by far the most frequent sequences in the terminal traffic and their argument lists are short. The arguments are therefore stored inline up to InlineCapacity, and only the arguments beyond it are stored on the heap. Each argument is a packed int32_t value with its presence (arguments can be omitted to use the default value) stored in a bitmask, which is more compact than std::optional<int>.
+
+        Arguments can also be separated by colons, in which case they are sub-parameters of the preceding argument, such as the color components in the `38:2::r:g:b` SGR sequence. Sub-parameters are marked in another bitmask.
+     */
+    class CSIArgs {
+    public:
+
+        static constexpr size_t InlineCapacity = 16;
+
+        CSIArgs() {}
+
+        CSIArgs(CSIArgs const & from):
+            present_{from.present_},
+            subParameters_{from.subParameters_},
+            size_{from.size_},
+            overflow_{from.overflow_} {
+            copyValues(from);
+        }
+
+        CSIArgs(CSIArgs && from) noexcept:
+            present_{from.present_},
+            subParameters_{from.subParameters_},
+            size_{from.size_},
+            overflow_{std::move(from.overflow_)} {
+            copyValues(from);
+        }
+
+        CSIArgs & operator = (CSIArgs const & other) {
+            if (this != & other) {
+                present_ = other.present_;
+                subParameters_ = other.subParameters_;
+                size_ = other.size_;
+                overflow_ = other.overflow_;
+                copyValues(other);
+            }
+            return *this;
+        }
+
+        CSIArgs & operator = (CSIArgs && other) noexcept {
+            present_ = other.present_;
+            subParameters_ = other.subParameters_;
+            size_ = other.size_;
+            overflow_ = std::move(other.overflow_);
+            copyValues(other);
+            return *this;
+        }
+
+        /** Iterator over the arguments, dereferences to std::optional<int>. 
+         */
+        class const_iterator {
+        public:
+            std::optional<int> operator * () const { return (*args_)[index_]; }
+
+            const_iterator & operator ++ () {
+                ++index_;
+                return *this;
+            }
+
+            bool operator == (const_iterator const & other) const { return index_ == other.index_; }
+            bool operator != (const_iterator const & other) const { return index_ != other.index_; }
+
+        private:
+            friend class CSIArgs;
+
+            const_iterator(CSIArgs const * args, size_t index): args_{args}, index_{index} {}
+
+            CSIArgs const * args_;
+            size_t index_;
+        }; // CSIArgs::const_iterator
+
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+
+        const_iterator begin() const { return const_iterator{this, 0}; }
+        const_iterator end() const { return const_iterator{this, size_}; }
+
+        /** Returns true if the argument at given index is present, i.e. it was not omitted. 
+         */
+        bool has(size_t index) const {
+            if (index < InlineCapacity)
+                return index < size_ && (present_ & (1u << index));
+            return index < size_ && overflow_[index - InlineCapacity].value.has_value();
+        }
+
+        /** Returns true if the argument at given index is a sub-parameter, i.e. it is separated from the previous argument by colon. 
+         */
+        bool isSubParameter(size_t index) const {
+            if (index < InlineCapacity)
+                return index < size_ && (subParameters_ & (1u << index));
+            return index < size_ && overflow_[index - InlineCapacity].subParameter;
+        }
+
+        /** Returns the argument at given index, or the default value if the argument is not present. 
+         */
+        int get(size_t index, int defaultValue) const {
+            if (index < InlineCapacity)
+                return (index < size_ && (present_ & (1u << index))) ? values_[index] : defaultValue;
+            return index < size_ ? overflow_[index - InlineCapacity].value.value_or(defaultValue) : defaultValue;
+        }
+
+        std::optional<int> operator [] (size_t index) const {
+            ASSERT(index < size_);
+            if (index < InlineCapacity)
+                return (present_ & (1u << index)) ? std::optional<int>{values_[index]} : std::nullopt;
+            return overflow_[index - InlineCapacity].value;
+        }
+
+        void push_back(std::optional<int> value, bool subParameter = false) {
+            if (size_ < InlineCapacity) {
+                if (value.has_value()) {
+                    values_[size_] = value.value();
+                    present_ |= (1u << size_);
+                }
+                if (subParameter)
+                    subParameters_ |= (1u << size_);
+            } else {
+                overflow_.push_back(OverflowArg{value, subParameter});
+            }
+            ++size_;
+        }
+
+        void clear() {
+            size_ = 0;
+            present_ = 0;
+            subParameters_ = 0;
+            overflow_.clear();
+        }
+
+    private:
+
+        struct OverflowArg {
+            std::optional<int32_t> value;
+            bool subParameter;
+        }; // CSIArgs::OverflowArg
+
+        void copyValues(CSIArgs const & from) {
+            std::memcpy(values_, from.values_, std::min<size_t>(size_, InlineCapacity) * sizeof(int32_t));
+        }
+
+        /** Only the values of present arguments are ever read, so the array is deliberately left uninitialized as zeroing it would be a significant part of parsing a short sequence. 
+         */
+        int32_t values_[InlineCapacity];
+        uint32_t present_ = 0;
+        uint32_t subParameters_ = 0;
+        uint32_t size_ = 0;
+        std::vector<OverflowArg> overflow_;
+    }; // tpp::CSIArgs
+
     /** CSI sequence. 
      
-        CSI Sequence is characterized by the prefix ESC [, followed by zero or more semicolon separated integers and terminated by a special character that determines the type of the sequence. This class is a generic representation of any such sequence. 
+        CSI Sequence is characterized by the prefix ESC [, followed by zero or more semicolon (or colon for sub-parameters) separated integers and terminated by a special character that determines the type of the sequence. This class is a generic representation of any such sequence. 
 
         The CSI prefix is then followed by any number of parameter bytes (0x30 - 0x3f), followed by any number of intermediate bytes (0x20 - 0x2f) and then by a required final byte (0x40 - 0x7e). 
      */
     class CSISequence {
     public:
-        using iterator = std::vector<std::optional<int>>::iterator;
-        using const_iterator = std::vector<std::optional<int>>::const_iterator;
+        using iterator = CSIArgs::const_iterator;
+        using const_iterator = CSIArgs::const_iterator;
+
+        CSISequence() = default;
+
+        CSISequence(CSIArgs args, char suffix):
+            args_{std::move(args)},
+            suffix_{suffix} {
+        }
 
         size_t numArgs() const { return args_.size(); }
-        iterator begin() { return args_.begin(); }    
         const_iterator begin() const { return args_.begin(); }
-        iterator end() { return args_.end(); }
         const_iterator end() const { return args_.end(); }
 
+        CSIArgs const & args() const { return args_; }
+
         char suffix() const { return suffix_; }
 
         int arg(size_t index, int defaultValue) const {
-            if (index >= args_.size())
-                return defaultValue;
-            auto const & i = args_[index];
-            return i.has_value() ? i.value() : defaultValue;
+            return args_.get(index, defaultValue);
         }
 
         /** Prettyprints the seuence in human readable form. 
          */
         void prettyPrint(std::ostream & s) const {
             s << "ESC [";
-            auto i = args_.begin(), e = args_.end();
-            if (i != e) {
-                s << ' ';
-                if (i->has_value())
-                    s << i->value();
-                ++i;
-                while (i != e) {
-                    s << "; ";
-                    if (i->has_value())
-                        s << i->value();
-                    ++i;
-                }
+            for (size_t i = 0, e = args_.size(); i != e; ++i) {
+                s << (i == 0 ? " " : (args_.isSubParameter(i) ? ": " : "; "));
+                if (args_.has(i))
+                    s << args_.get(i, 0);
             }
             s << ' ' << suffix_;
         }
 
-        friend std::ostream & operator << (std::ostream & s, CSISequence const & seq) {
-            s << "\033[";
-            auto i = seq.begin(), e = seq.end();
-            if (i != e) {
-                if (i->has_value())
-                    s << i->value();
-                ++i;
-                while (i != e) {
-                    s << ";";
-                    if (i->has_value())
-                        s << i->value();
-                    ++i;
-                }
-            }
-            s << seq.suffix();
-            return s;
-        }
+        /** Serializes the sequence, see SequenceWriter. 
+         */
+        friend std::ostream & operator << (std::ostream & s, CSISequence const & seq);
 
-        static std::optional<CSISequence> Parse(char const * & buffer, char const * end);
+        static ParseResult TryParse(char const * & buffer, char const * end, CSISequence & result);
 
-        template<typename T>
-        static std::optional<CSISequence> Parse(T const & reader) {
-            try {
+        static std::optional<CSISequence> Parse(char const * & buffer, char const * end);
 
-            } catch (Reader::EOF)
-        }
+        /** Parses the sequence from the reader, see ParseFromReader(). 
+         */
+        template<typename READER>
+        static std::optional<CSISequence> Parse(READER & reader) { return ParseFromReader<CSISequence>(reader); }
 
     private:
-        std::vector<std::optional<int>> args_;
-        char suffix_;
+        friend class SequenceParser;
 
-        static bool IsParameterByte(char c) { return c >= 0x30 && c <= 0x3f; }
-        static bool IsIntermediateByte(char c) { return c >= 0x20 && c <= 0x2f; }
-        static bool IsFinalByte(char c) { return c >= 0x40 && c <= 0x7f; }
+        CSIArgs args_;
+        char suffix_;
 
     }; 
 
     /** DECSET and DECCLR sequences
 
-        The DEC sequences all follow the same format, where ESC [ ? is followed by a single number and then either 'h' or 'l' as the final character. Their purpose is to enable or disable certain terminal features.  
+        The DEC sequences all follow the same format, where ESC [ ? is followed by a semicolon separated list of mode ids and then either 'h' or 'l' as the final character, which sets, or resets all the modes in the list. Their purpose is to enable or disable certain terminal features. Applications often set several modes at once, such as `ESC [ ? 1049;1004;2004 h`, on every redraw.
+
+        The ids are stored inline so that the sequence never allocates. Sequences with more than MaxIds ids are rejected as invalid.
      */
     class DECSequence {
     public:
-        int id;
-        bool value; 
+
+        static constexpr size_t MaxIds = 16;
+
+        bool value = false;
+
+        DECSequence() = default;
+
+        DECSequence(int id, bool value):
+            value{value},
+            size_{1} {
+            ids_[0] = id;
+        }
+
+        DECSequence(std::initializer_list<int> ids, bool value):
+            value{value} {
+            ASSERT(ids.size() <= MaxIds);
+            for (int id : ids)
+                ids_[size_++] = id;
+        }
+
+        size_t numIds() const { return size_; }
+
+        int id(size_t index) const {
+            ASSERT(index < size_);
+            return ids_[index];
+        }
+
+        int const * begin() const { return ids_; }
+        int const * end() const { return ids_ + size_; }
+
+        void clear() { size_ = 0; }
+
+        /** Adds the id to the sequence, returns false if there already is MaxIds ids.
+         */
+        bool push_back(int id) {
+            if (size_ == MaxIds)
+                return false;
+            ids_[size_++] = id;
+            return true;
+        }
 
         void prettyPrint(std::ostream & s) const {
-            s << "ESC [ ? " << id << (value ? 'h' : 'l');
+            s << "ESC [ ? ";
+            for (size_t i = 0; i < size_; ++i)
+                s << (i == 0 ? "" : "; ") << ids_[i];
+            s << (value ? 'h' : 'l');
         }
 
-        friend std::ostream & operator << (std::ostream & s, DECSequence seq) {
-            s << "\033[?" << seq.id << (seq.value ? 'h' : 'l');
-            return s;
-        }        
+        friend std::ostream & operator << (std::ostream & s, DECSequence const & seq);
         
+        static ParseResult TryParse(char const * & buffer, char const * end, DECSequence & result);
+
         static std::optional<DECSequence> Parse(char const * & buffer, char const * end);
 
+        template<typename READER>
+        static std::optional<DECSequence> Parse(READER & reader) { return ParseFromReader<DECSequence>(reader); }
+
+    private:
+        int ids_[MaxIds] = {};
+        uint32_t size_ = 0;
+
     }; // DECSequence
 
     /** OSCSequences
@@ -129,7 +383,16 @@ namespace tpp {
     class OSCSequence {
     public:
         std::optional<int> id;
-        std::vector<std::string> values;
+        /** The values are borrowed from the parsed buffer, see Payload. 
+         */
+        std::vector<Payload> values;
+
+        /** Takes ownership of the values so that the sequence can outlive the buffer it was parsed from.
+         */
+        void detach() {
+            for (auto & v : values)
+                v.detach();
+        }
 
         void prettyPrint(std::ostream & s) const {
             s << "ESC ] ";
@@ -144,21 +407,14 @@ namespace tpp {
             s << " BEL";
         }
 
-        friend std::ostream & operator << (std::ostream & s, OSCSequence const & seq) {
-            s << "\033]";
-            if (seq.id.has_value())
-                s << seq.id.value() << ";";
-            auto i = seq.values.begin(), e = seq.values.end();
-            if (i != e) {
-                s << *i++;
-                while (i != e)
-                    s << ';' << *i++;
-            }
-            s << '\b';
-            return s;
-        }
+        friend std::ostream & operator << (std::ostream & s, OSCSequence const & seq);
+
+        static ParseResult TryParse(char const * & buffer, char const * end, OSCSequence & result);
 
-        static std::optional<OSCSequence> Parse(char const * & buffer, char const * end); 
+        static std::optional<OSCSequence> Parse(char const * & buffer, char const * end);
+
+        template<typename READER>
+        static std::optional<OSCSequence> Parse(READER & reader) { return ParseFromReader<OSCSequence>(reader); }
 
     }; // OSCSequence
 
@@ -176,8 +432,19 @@ namespace tpp {
      */
     class TppSequence {
     public:
-        int id;
-        std::vector<std::string> args;
+        int id = 0;
+        /** Arguments without encoded bytes are borrowed from the parsed buffer, arguments that had to be decoded are owned, see Payload.
+         */
+        std::vector<Payload> args;
+
+        TppSequence() = default;
+
+        /** Takes ownership of the arguments so that the sequence can outlive the buffer it was parsed from.
+         */
+        void detach() {
+            for (auto & a : args)
+                a.detach();
+        }
 
         void prettyPrint(std::ostream & s) const {
             s << "ESC P " << id << 't';
@@ -192,88 +459,143 @@ namespace tpp {
             s << " ST";
         }
 
-        friend std::ostream & operator << (std::ostream & s, TppSequence const & seq) {
-            s << "\033P" << seq.id << 't';
-            auto i = seq.args.begin(), e = seq.args.end();
-            if (i != e) {
-                Encode(s, *i++);
-                while (i != e) {
-                    s << ';';
-                    Encode(s, *i++);
-                }
-            }
-            s << "\033\\";
-            return s;
-        }
+        friend std::ostream & operator << (std::ostream & s, TppSequence const & seq);
+
+        static ParseResult TryParse(char const * & buffer, char const * end, TppSequence & result);
 
         static std::optional<TppSequence> Parse(char const * & buffer, char const * end);
+
+        template<typename READER>
+        static std::optional<TppSequence> Parse(READER & reader) { return ParseFromReader<TppSequence>(reader); }
+
+        /** Parses the arguments and the terminating ST that follow ESC P id t. 
+         */
+        static ParseResult TryParseArgs(char const * & buffer, char const * end, TppSequence & result);
         
-        static void Encode(std::ostream &s, std::string const & value);
+        /** Writes the encoded argument to the stream, see SequenceWriter::encode(). 
+         */
+        static void Encode(std::ostream &s, std::string_view value);
+
+        /** Determines the extent and decoded size of the encoded argument at the beginning of the buffer. 
+
+            On success, argEnd is set to the separator, or ESC that terminates the argument and size to the number of bytes the argument decodes to so that the caller can provide the output buffer for DecodeArg(). Returns ParseResult::Incomplete if the buffer ends before the argument and ParseResult::Error with argEnd pointing to the offending character if an encoded byte is not valid. 
+         */
+        static ParseResult MeasureArg(char const * buffer, char const * end, char const * & argEnd, size_t & size);
+
+        /** Decodes argument validated by MeasureArg() into the output, which must be large enough for the decoded size. Returns the end of the decoded data. 
+         */
+        static char * DecodeArg(char const * buffer, char const * argEnd, char * output);
 
     protected:
 
         #define TPP2(_, NAME, ...) friend class NAME;
         #include "sequences.inc.h"
+        friend class SequenceParser;
 
         TppSequence(int id): id{id} {}
 
         template<typename T>
-        static std::optional<T> parseArg(char const * & buffer, char const * end); 
-        static std::optional<bool> parseSeparator(char const * & buffer, char const * end);
-        static std::optional<bool> parseEnd(char const * & buffer, char const * end);
+        static ParseResult parseArg(char const * & buffer, char const * end, T & result); 
+        template<typename T>
+        static T convertArg(Payload & arg);
+        static ParseResult parseSeparator(char const * & buffer, char const * end);
+        static ParseResult parseEnd(char const * & buffer, char const * end);
 
     }; // TppSequence
 
     template<>
-    inline std::optional<int> TppSequence::parseArg<int>(char const * & buffer, char const * end) {
-        int result = 0;
+    inline ParseResult TppSequence::parseArg<int>(char const * & buffer, char const * end, int & result) {
+        result = 0;
         char const * x = buffer;
         while (true) {
             if (x == end)
-                return std::nullopt;
+                return ParseResult::Incomplete;
             if (isDecimalDigit(*x))
-                result = (result * 10) + (*(x++) - '0');
+                result = dispatch::appendDigit(result, *(x++));
             else
                 break;
         }
         buffer = x;
-        return result;
+        return ParseResult::Ok;
     }
 
+    /** Decodes string argument into the result, reusing its storage. 
+     */
     template<>
-    inline std::optional<std::string> TppSequence::parseArg<std::string>(char const * & buffer, char const * end) {
-        std::stringstream s;
-        char const * x = buffer;
-        while (x < end) {
-            if (*x == ';' || *x == '\033') {
-                buffer = x;
-                return s.str();
-            }
-            if (*x == '`') {
-                if (x + 2 >= end)
-                    break;
-                ++x;
-                char c = (hexToNibble(*x++) << 4);
-                c |= hexToNibble(*x++);
-                s << c;
+    inline ParseResult TppSequence::parseArg<std::string>(char const * & buffer, char const * end, std::string & result) {
+        char const * argEnd;
+        size_t size;
+        ParseResult r = MeasureArg(buffer, end, argEnd, size);
+        if (r == ParseResult::Ok) {
+            result.resize(size);
+            DecodeArg(buffer, argEnd, result.data());
+        }
+        if (r != ParseResult::Incomplete)
+            buffer = argEnd;
+        return r;
+    }
+
+    /** Parses string argument, borrowing it from the buffer if it contains no encoded bytes. 
+     
+        Arguments with encoded bytes are decoded into an owned payload.
+     */
+    template<>
+    inline ParseResult TppSequence::parseArg<Payload>(char const * & buffer, char const * end, Payload & result) {
+        char const * argEnd;
+        size_t size;
+        ParseResult r = MeasureArg(buffer, end, argEnd, size);
+        if (r == ParseResult::Ok) {
+            if (size == static_cast<size_t>(argEnd - buffer)) {
+                result = Payload{buffer, size};
             } else {
-                s << *x++;
+                std::unique_ptr<char[]> decoded{new char[size]};
+                DecodeArg(buffer, argEnd, decoded.get());
+                result = Payload{std::move(decoded), size};
             }
+        }
+        if (r != ParseResult::Incomplete)
+            buffer = argEnd;
+        return r;
+    }
 
+    /** Converts already decoded generic argument to integer. 
+
+        Follows the semantics of parseArg<int>, i.e. an empty argument is zero. 
+     */
+    template<>
+    inline int TppSequence::convertArg<int>(Payload & arg) {
+        int result = 0;
+        for (char c : arg.view()) {
+            if (! isDecimalDigit(c))
+                throw SequenceError{STR("Expected integer tpp sequence argument, but " << PRETTY(c) << " found")};
+            result = dispatch::appendDigit(result, c);
         }
-        return std::nullopt;
+        return result;
+    }
+
+    template<>
+    inline std::string TppSequence::convertArg<std::string>(Payload & arg) {
+        return arg.str();
+    }
+
+    template<>
+    inline Payload TppSequence::convertArg<Payload>(Payload & arg) {
+        return std::move(arg);
     }
 
     #define CSI0(SHORTHAND, NAME, SUFFIX) \
         class NAME { \
         public: \
             static constexpr char Suffix = SUFFIX; \
+            explicit NAME(CSIArgs const &) {} \
             NAME(CSISequence && seq) { \
                 if (seq.numArgs() != 0) \
                     throw SequenceError{STR("Non zero arguments for CSI sequence " << PRETTY(seq) << " when converting to SHORTHAND")}; \
                 if (seq.suffix() != Suffix) \
                     throw SequenceError{STR("Invalid suffix for CSI sequence " << PRETTY(seq) << " when converting to SHORTHAND (suffix" << SUFFIX << ")")}; \
             } \
+            static bool IsValid(CSISequence const & seq) { return seq.suffix() == Suffix && IsValid(seq.args()); } \
+            static bool IsValid(CSIArgs const & args) { return args.empty(); } \
         }; 
 
     #define CSI1(SHORTHAND, NAME, SUFFIX, VALUE_NAME, DEFAULT_VALUE) \
@@ -281,6 +603,7 @@ namespace tpp {
         public: \
             static constexpr char Suffix = SUFFIX; \
             int VALUE_NAME; \
+            explicit NAME(CSIArgs const & args): VALUE_NAME{args.get(0, DEFAULT_VALUE)} {} \
             NAME(CSISequence && seq) { \
                 if (seq.numArgs() > 1) \
                     throw SequenceError{STR("Invalid number of arguments for for CSI sequence " << PRETTY(seq) << " when converting to SHORTHAND")}; \
@@ -288,6 +611,8 @@ namespace tpp {
                     throw SequenceError{STR("Invalid suffix for CSI sequence " << PRETTY(seq) << " when converting to SHORTHAND (suffix" << SUFFIX << ")")}; \
                 VALUE_NAME = seq.arg(0, DEFAULT_VALUE); \
             } \
+            static bool IsValid(CSISequence const & seq) { return seq.suffix() == Suffix && IsValid(seq.args()); } \
+            static bool IsValid(CSIArgs const & args) { return args.size() <= 1; } \
         }; 
 
     #define CSI2(SHORTHAND, NAME, SUFFIX, VALUE_NAME1, DEFAULT_VALUE1, VALUE_NAME2, DEFAULT_VALUE2) \
@@ -296,6 +621,7 @@ namespace tpp {
             static constexpr char Suffix = SUFFIX; \
             int VALUE_NAME1; \
             int VALUE_NAME2; \
+            explicit NAME(CSIArgs const & args): VALUE_NAME1{args.get(0, DEFAULT_VALUE1)}, VALUE_NAME2{args.get(1, DEFAULT_VALUE2)} {} \
             NAME(CSISequence && seq) { \
                 if (seq.numArgs() > 2) \
                     throw SequenceError{STR("Invalid number of arguments for for CSI sequence " << PRETTY(seq) << " when converting to SHORTHAND")}; \
@@ -304,25 +630,49 @@ namespace tpp {
                 VALUE_NAME1 = seq.arg(0, DEFAULT_VALUE1); \
                 VALUE_NAME2 = seq.arg(1, DEFAULT_VALUE2); \
             } \
+            static bool IsValid(CSISequence const & seq) { return seq.suffix() == Suffix && IsValid(seq.args()); } \
+            static bool IsValid(CSIArgs const & args) { return args.size() <= 2; } \
         }; 
 
+    #define CSIn(SHORTHAND, NAME, SUFFIX, DEFAULT_VALUE) \
+        class NAME { \
+        public: \
+            static constexpr char Suffix = SUFFIX; \
+            static constexpr int DefaultValue = DEFAULT_VALUE; \
+            CSIArgs args; \
+            explicit NAME(CSIArgs && from): args{std::move(from)} {} \
+            NAME(CSISequence && seq): \
+                args{seq.args()} { \
+                if (seq.suffix() != Suffix) \
+                    throw SequenceError{STR("Invalid suffix for CSI sequence " << PRETTY(seq) << " when converting to SHORTHAND (suffix" << SUFFIX << ")")}; \
+            } \
+            size_t numArgs() const { return args.size(); } \
+            int arg(size_t index) const { return args.get(index, DefaultValue); } \
+            static bool IsValid(CSISequence const & seq) { return seq.suffix() == Suffix; } \
+            static bool IsValid(CSIArgs const &) { return true; } \
+        };
+
     #define DEC(SHORTHAND, NAME, ID) \
         class NAME { \
         public: \
             static constexpr int Id = ID; \
             bool value; \
-            NAME(DECSequence seq): \
+            explicit NAME(bool value): value{value} {} \
+            NAME(DECSequence const & seq): \
                 value{seq.value} { \
-                if (seq.id != Id) \
+                if (! IsValid(seq)) \
                     throw SequenceError{STR("Invalid id for DEC sequence " << PRETTY(seq) << " when converting to SHORTHAND (index " << Id << ")")}; \
             } \
+            static bool IsValid(DECSequence const & seq) { return seq.numIds() == 1 && seq.id(0) == Id; } \
         };
 
     #define OSC1(SHORTHAND, NAME, ID, VALUE_NAME) \
         class NAME { \
         public: \
             static constexpr int Id = ID; \
-            std::string VALUE_NAME; \
+            static constexpr size_t NumValues = 1; \
+            Payload VALUE_NAME; \
+            explicit NAME(Payload && VALUE_NAME): VALUE_NAME{std::move(VALUE_NAME)} {} \
             NAME(OSCSequence && seq) { \
                 if (seq.id.value() != Id) \
                     throw SequenceError{STR("Invalid id for OSC sequence " << PRETTY(seq) << " when converting to SHORTHAND (index " << Id << ")")}; \
@@ -330,22 +680,28 @@ namespace tpp {
                     throw SequenceError{STR("Invalid number of arguments: " << PRETTY(seq) << " provides " << seq.values.size() << " but only 1 expected")}; \
                 VALUE_NAME = std::move(seq.values[0]); \
             } \
+            void detach() { VALUE_NAME.detach(); } \
+            static bool IsValid(OSCSequence const & seq) { return seq.id == Id && seq.values.size() == 1; } \
         };
 
     #define OSC2(SHORTHAND, NAME, ID, VALUE_NAME1, VALUE_NAME2) \
         class NAME { \
         public: \
             static constexpr int Id = ID; \
-            std::string VALUE_NAME1; \
-            std::string VALUE_NAME2; \
+            static constexpr size_t NumValues = 2; \
+            Payload VALUE_NAME1; \
+            Payload VALUE_NAME2; \
+            NAME(Payload && VALUE_NAME1, Payload && VALUE_NAME2): VALUE_NAME1{std::move(VALUE_NAME1)}, VALUE_NAME2{std::move(VALUE_NAME2)} {} \
             NAME(OSCSequence && seq) { \
                 if (seq.id.value() != Id) \
                     throw SequenceError{STR("Invalid id for OSC sequence " << PRETTY(seq) << " when converting to SHORTHAND (index " << Id << ")")}; \
                 if (seq.values.size() != 2) \
-                    throw SequenceError{STR("Invalid number of arguments: " << PRETTY(seq) << " provides " << seq.values.size() << " but only 1 expected")}; \
+                    throw SequenceError{STR("Invalid number of arguments: " << PRETTY(seq) << " provides " << seq.values.size() << " but 2 expected")}; \
                 VALUE_NAME1 = std::move(seq.values[0]); \
-                VALUE_NAME1 = std::move(seq.values[1]); \
+                VALUE_NAME2 = std::move(seq.values[1]); \
             } \
+            void detach() { VALUE_NAME1.detach(); VALUE_NAME2.detach(); } \
+            static bool IsValid(OSCSequence const & seq) { return seq.id == Id && seq.values.size() == 2; } \
         };
 
     #define TPP2(SHORTHAND, NAME, ID, VALUE_NAME1, VALUE_TYPE1, VALUE_NAME2, VALUE_TYPE2) \
@@ -355,35 +711,78 @@ namespace tpp {
             VALUE_TYPE1 VALUE_NAME1; \
             VALUE_TYPE2 VALUE_NAME2; \
             NAME(VALUE_TYPE1 VALUE_NAME1, VALUE_TYPE2 VALUE_NAME2): VALUE_NAME1{VALUE_NAME1}, VALUE_NAME2{VALUE_NAME2} {} \
-            static std::optional<NAME> parseBody(char const * & buffer, char const * end) { \
+            NAME(TppSequence && seq) { \
+                if (seq.id != Id) \
+                    throw SequenceError{STR("Invalid id for tpp sequence " << PRETTY(seq) << " when converting to SHORTHAND (index " << Id << ")")}; \
+                if (seq.args.size() != 2) \
+                    throw SequenceError{STR("Invalid number of arguments: " << PRETTY(seq) << " provides " << seq.args.size() << " but 2 expected")}; \
+                VALUE_NAME1 = TppSequence::convertArg<VALUE_TYPE1>(seq.args[0]); \
+                VALUE_NAME2 = TppSequence::convertArg<VALUE_TYPE2>(seq.args[1]); \
+            } \
+            static ParseResult parseBody(char const * & buffer, char const * end, std::optional<NAME> & result) { \
                 char const * x = buffer; \
-                try { \
-                    auto first{TppSequence::parseArg<VALUE_TYPE1>(x, end).value()}; \
-                    TppSequence::parseSeparator(x, end).value(); \
-                    auto second{TppSequence::parseArg<VALUE_TYPE2>(x, end).value()}; \
-                    TppSequence::parseEnd(x, end).value(); \
-                    buffer = x; \
-                    return NAME{first, second}; \
-                } catch (std::bad_optional_access const &) { \
-                    return std::nullopt; \
-                } catch (...) { \
+                VALUE_TYPE1 first{}; \
+                VALUE_TYPE2 second{}; \
+                ParseResult r = TppSequence::parseArg<VALUE_TYPE1>(x, end, first); \
+                if (r == ParseResult::Ok) \
+                    r = TppSequence::parseSeparator(x, end); \
+                if (r == ParseResult::Ok) \
+                    r = TppSequence::parseArg<VALUE_TYPE2>(x, end, second); \
+                if (r == ParseResult::Ok) \
+                    r = TppSequence::parseEnd(x, end); \
+                if (r == ParseResult::Ok) \
+                    result.emplace(std::move(first), std::move(second)); \
+                if (r != ParseResult::Incomplete) \
                     buffer = x; \
-                    throw; \
-                } \
+                return r; \
             } \
         }; 
         
     #include "sequences.inc.h"
 
+    /** Sets the graphic rendition, i.e. the text attributes and colors. 
+
+        SGR is by far the most frequent sequence in the terminal traffic. Instead of keeping the arguments, the sequence decodes them into the packed RenditionDelta, which also understands the colon separated sub-parameters of extended colors and underline styles. TryParseSequence() decodes the arguments of any CSI sequence speculatively directly from the buffer, see TryParseArgs(), and only if the final byte turns out not to be SGR, parses the sequence again as generic CSI sequence. 
+     */
+    class SelectGraphicRendition {
+    public:
+        static constexpr char Suffix = 'm';
+
+        RenditionDelta delta;
+
+        SelectGraphicRendition() = default;
+
+        explicit SelectGraphicRendition(RenditionDelta const & delta): delta{delta} {}
+
+        explicit SelectGraphicRendition(CSIArgs const & args): delta{RenditionDelta::Decode(args)} {}
+
+        SelectGraphicRendition(CSISequence && seq):
+            delta{RenditionDelta::Decode(seq.args())} {
+            if (seq.suffix() != Suffix)
+                throw SequenceError{STR("Invalid suffix for CSI sequence " << PRETTY(seq) << " when converting to SGR (suffix" << Suffix << ")")};
+        }
+
+        static bool IsValid(CSISequence const & seq) { return seq.suffix() == Suffix; }
+        static bool IsValid(CSIArgs const &) { return true; }
+
+        /** Decodes the arguments of the sequence following ESC [, leaving the buffer at the first character after them, which is the final byte if the sequence is valid SGR, see RenditionDelta::Decode(). 
+         */
+        static ParseResult TryParseArgs(char const * & buffer, char const * end, SelectGraphicRendition & result) {
+            return RenditionDelta::Decode(buffer, end, result.delta) ? ParseResult::Ok : ParseResult::Incomplete;
+        }
+
+    }; // tpp::SelectGraphicRendition
+
     /** Union of all known sequences. 
      
-        See the `sequences.inc.h` for more details about the sequences supported. The union contains both specific sequences defined therein and generic sequences for which no special type has been created, which is useful for working with syntactically valid sequences of unknown semantics. 
+        See the `sequences.inc.h` for more details about the sequences supported. The union contains both specific sequences defined therein and generic sequences for which no special type has been created, which is useful for working with syntactically valid sequences of unknown semantics. Plain text is represented by the Payload alternative. 
      */
     using Sequence = std::variant<
         #define CSI0(_, NAME, ...) NAME,
         #define CSI1(_, NAME, ...) NAME, 
         #define CSI2(_, NAME, ...) NAME, 
-        //#define CSIn(_, NAME, ...) NAME,
+        #define CSIn(_, NAME, ...) NAME,
+        #define CSIx(_, NAME, ...) NAME,
         #define DEC(_, NAME, ...) NAME, 
         #define OSC1(_, NAME, ...) NAME, 
         #define OSC2(_, NAME, ...) NAME,
@@ -393,18 +792,54 @@ namespace tpp {
         DECSequence,
         OSCSequence,
         TppSequence,
-        std::string
+        Payload
     >;
 
-    /** Parses the given buffer for a sequence. 
+    /** Parses the given buffer for a sequence without throwing exceptions. 
      
-        If the buffer starts with a valid sequence, returns the sequence itself and advances the buffer to the first character after the parsed sequence. 
+        If the buffer starts with a valid sequence, stores the sequence in the result and advances the buffer to the first character after the parsed sequence. 
+
+        If the buffer starts with what appears to be a valid sequence, but ends before the sequence terminates, the function does not change the passed buffer pointer and returns ParseResult::Incomplete. 
 
-        If the buffer starts with what appears to be a valid sequence, but ends before the sequence terminates, the function does not change the passed buffer pointer and returns None. 
+        In all other cases, the function returns ParseResult::Error and advances the buffer to the offending character. If the sequence is syntactically valid, but its arguments do not match the specific sequence type for its suffix, or id, the buffer is advanced past the sequence. DEC sequences with multiple ids are stored as the generic DECSequence, see VisitDECModes(). 
 
-        In all other cases, the function throws an exception and advances the buffer to the offending character. 
+        String payloads of the parsed sequence are borrowed from the buffer whenever possible and are only valid until the buffer is released. Use Detach() if the sequence must live longer. 
+    */
+    ParseResult TryParseSequence(char const * & buffer, char const * end, std::optional<Sequence> & result);
+
+    /** Parses the given buffer for a sequence. 
+     
+        Like TryParseSequence, but returns None for incomplete sequences and throws SequenceError for invalid ones.  
     */
     std::optional<Sequence> ParseSequence(char const * & buffer, char const * end);
 
+    /** Parses a sequence from the reader, see ParseFromReader().
+
+        Returns None if the input ends before the sequence is complete and throws SequenceError for invalid sequences. Payloads of the sequence are borrowed from the reader's window. 
+     */
+    template<typename READER>
+    std::optional<Sequence> ParseSequence(READER & reader) {
+        std::optional<Sequence> result;
+        ParseFromReader(reader, 
+            [&result](char const * & buffer, char const * end) { return TryParseSequence(buffer, end, result); },
+            [](char const * buffer, char const * end) { ParseSequence(buffer, end); });
+        return result;
+    }
+
+    /** \name Specialization of generic sequences. 
+     
+        Converts the generic sequence to its specific type from `sequences.inc.h` if one exists for its suffix, or id. If there is no specific type, the generic sequence is returned. Throws SequenceError if the specific type exists, but the sequence's arguments do not match it. DEC sequences with multiple ids cannot be represented by a single specific sequence and are returned as they are, see VisitDECModes(). 
+     */
+    //@{
+    Sequence Specialize(CSISequence && seq);
+    Sequence Specialize(DECSequence const & seq);
+    Sequence Specialize(OSCSequence && seq);
+    Sequence Specialize(TppSequence && seq);
+    //@}
+
+    /** Takes ownership of all payloads borrowed by the sequence so that it no longer depends on the buffer it was parsed from. 
+     */
+    void Detach(Sequence & seq);
+
 } // namespace tpp
 
@@ -0,0 +1,384 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <type_traits>
+
+#include "sequence.h"
+
+/** Dispatch of the parsed sequences to their specific types.
+
+    Internal to the parsers, the tables are generated at compile time from `sequences.inc.h` so that adding a sequence there is all that is needed for it to be recognized. The specific types are built directly from the raw arguments of the sequence, without creating the generic sequence first, and passed to a handler. The tables are instantiated per handler type so that the handler is inlined in each table entry, see VisitSequence().
+ */
+namespace tpp::dispatch {
+
+    /** \name Parsing of the raw sequence parts.
+
+        Shared by the generic sequences and VisitSequence(), which builds the specific sequences without parsing the generic ones first.
+     */
+    //@{
+
+    inline ParseResult parseChar(char x, char const * & buffer, char const * end) {
+        if (buffer == end)
+            return ParseResult::Incomplete;
+        if (*buffer != x)
+            return ParseResult::Error;
+        ++buffer;
+        return ParseResult::Ok;
+    }
+
+    inline ParseResult parseInt(char const * & buffer, char const * end, int & result) {
+        result = 0;
+        char const * x = buffer;
+        while (true) {
+            if (x >= end)
+                return ParseResult::Incomplete;
+            if (isDecimalDigit(*x))
+                result = appendDigit(result, *(x++));
+            else
+                break;
+        }
+        buffer = x;
+        return ParseResult::Ok;
+    }
+
+    /** Final bytes of CSI sequences, see CSISequence. 
+     */
+    inline bool isFinalByte(char c) { return c >= 0x40 && c <= 0x7e; }
+
+    /** Parses the arguments of CSI sequence following ESC [ and leaves the buffer at the final byte. 
+     */
+    inline ParseResult parseCSIArgs(char const * & buffer, char const * end, CSIArgs & args) {
+        char const * x = buffer;
+        bool subParameter = false;
+        while (true) {
+            if (x == end)
+                return ParseResult::Incomplete;
+            std::optional<int> arg;
+            if (isDecimalDigit(*x)) {
+                int value = 0;
+                do {
+                    value = appendDigit(value, *x);
+                    if (++x == end)
+                        return ParseResult::Incomplete;
+                } while (isDecimalDigit(*x));
+                arg = value;
+            }
+            if (*x == ';' || *x == ':') {
+                args.push_back(arg, subParameter);
+                // the argument after colon is a sub-parameter of the current one
+                subParameter = (*x++ == ':');
+            // can be either unsupported parameter byte, unsupported intermediate bytes, or final byte, make sure we add the last argument if there was actually one (otherwise ars are only ever stored with semicolon separators) or extra separator                    
+            } else {
+                if (arg.has_value() || ! args.empty())
+                    args.push_back(arg, subParameter);
+                break; 
+            }
+        }
+        // parameter and intermediate bytes are not supported
+        buffer = x;
+        return isFinalByte(*x) ? ParseResult::Ok : ParseResult::Error;
+    }
+
+    /** Parses the OSC id followed by the semicolon, that follow ESC ]. 
+     */
+    inline ParseResult parseOSCId(char const * & buffer, char const * end, std::optional<int> & id) {
+        char const * x = buffer;
+        int value = 0;
+        bool parsed = false;
+        while (true) {
+            if (x == end)
+                return ParseResult::Incomplete;
+            if (!isDecimalDigit(*x))
+                break;
+            value = appendDigit(value, *(x++));
+            parsed = true;                    
+        }
+        // semicolon is required after the id
+        if (ParseResult r = parseChar(';', x, end); r != ParseResult::Ok) {
+            if (r == ParseResult::Error)
+                buffer = x;
+            return r;
+        }
+        id = parsed ? std::optional<int>{value} : std::nullopt;
+        buffer = x;
+        return ParseResult::Ok;
+    }
+
+    /** Parses the semicolon separated OSC values terminated by either BEL, or ST and passes each of them, borrowed from the buffer, to the given function. The buffer is advanced past the terminator. 
+     */
+    template<typename F>
+    ParseResult parseOSCValues(char const * & buffer, char const * end, F add) {
+        char const * x = buffer;
+        char const * valueStart = x;
+        while (true) {
+            if (x == end)
+                return ParseResult::Incomplete;
+            switch (* x++) {
+                case ';':
+                    add(Payload{valueStart, static_cast<size_t>(x - 1 - valueStart)});
+                    valueStart = x;
+                    break;
+                case '\a':
+                    add(Payload{valueStart, static_cast<size_t>(x - 1 - valueStart)});
+                    buffer = x;
+                    return ParseResult::Ok; 
+                case '\033':
+                    if (x == end)
+                        return ParseResult::Incomplete;
+                    if (*x == '\\') {
+                        add(Payload{valueStart, static_cast<size_t>(x - 1 - valueStart)});
+                        buffer = x + 1;
+                        return ParseResult::Ok;
+                    }
+                    // fallthorugh to default case
+                    [[fallthrough]];
+                default:
+                    break;
+            }
+        }
+    }
+
+    //@}
+
+    /** Builds the specific CSI sequence from its arguments and passes it to the handler. Returns ParseResult::Error if the arguments do not match the specific type. 
+     */
+    template<typename HANDLER>
+    using CSIVisitor = ParseResult (*)(CSIArgs & args, HANDLER & handler);
+
+    /** Builds the specific DEC sequence from its value and passes it to the handler. 
+     */
+    template<typename HANDLER>
+    using DECVisitor = void (*)(bool value, HANDLER & handler);
+
+    /** Builds the specific OSC sequence from its values and passes it to the handler. Returns ParseResult::Error if the number of values does not match the specific type. 
+     */
+    template<typename HANDLER>
+    using OSCVisitor = ParseResult (*)(Payload * values, size_t count, HANDLER & handler);
+
+    /** The specific tpp sequences are either parsed directly from the buffer following ESC P id t, or converted from already parsed generic sequence. 
+     */
+    template<typename HANDLER>
+    struct TppVisitor {
+        ParseResult (*parse)(char const * & buffer, char const * end, HANDLER & handler);
+        void (*convert)(TppSequence && seq, HANDLER & handler);
+    };
+
+    template<typename T, typename HANDLER>
+    ParseResult VisitCSI(CSIArgs & args, HANDLER & handler) {
+        if (! T::IsValid(args))
+            return ParseResult::Error;
+        handler(T{std::move(args)});
+        return ParseResult::Ok;
+    }
+
+    template<typename T, typename HANDLER>
+    void VisitDEC(bool value, HANDLER & handler) {
+        handler(T{value});
+    }
+
+    template<typename T, typename HANDLER>
+    ParseResult VisitOSC(Payload * values, size_t count, HANDLER & handler) {
+        if (count != T::NumValues)
+            return ParseResult::Error;
+        if constexpr (T::NumValues == 1)
+            handler(T{std::move(values[0])});
+        else
+            handler(T{std::move(values[0]), std::move(values[1])});
+        return ParseResult::Ok;
+    }
+
+    template<typename T, typename HANDLER>
+    ParseResult ParseTpp(char const * & buffer, char const * end, HANDLER & handler) {
+        std::optional<T> seq;
+        ParseResult r = T::parseBody(buffer, end, seq);
+        if (r == ParseResult::Ok)
+            handler(std::move(seq.value()));
+        return r;
+    }
+
+    template<typename T, typename HANDLER>
+    void ConvertTpp(TppSequence && seq, HANDLER & handler) {
+        handler(T{std::move(seq)});
+    }
+
+    /** Dense table of CSI visitors indexed by the final byte. Final bytes without specific sequence have no visitor.
+     */
+    template<typename HANDLER>
+    class CSITable {
+    public:
+        static constexpr char First = 0x40;
+        static constexpr char Last = 0x7e;
+
+        constexpr CSITable() {
+            #define CSI0(_, NAME, SUFFIX) add(SUFFIX, VisitCSI<NAME, HANDLER>);
+            #define CSI1(_, NAME, SUFFIX, ...) add(SUFFIX, VisitCSI<NAME, HANDLER>);
+            #define CSI2(_, NAME, SUFFIX, ...) add(SUFFIX, VisitCSI<NAME, HANDLER>);
+            #define CSIn(_, NAME, SUFFIX, ...) add(SUFFIX, VisitCSI<NAME, HANDLER>);
+            #define CSIx(_, NAME, SUFFIX) add(SUFFIX, VisitCSI<NAME, HANDLER>);
+            #include "sequences.inc.h"
+        }
+
+        /** Returns the visitor for given final byte, or nullptr if there is none.
+         */
+        CSIVisitor<HANDLER> operator [] (char suffix) const {
+            if (suffix < First || suffix > Last)
+                return nullptr;
+            return visitors_[suffix - First];
+        }
+
+    private:
+        constexpr void add(char suffix, CSIVisitor<HANDLER> visitor) {
+            // multiple sequences with the same final byte
+            if (visitors_[suffix - First] != nullptr)
+                throw "Duplicate CSI final byte in sequences.inc.h";
+            visitors_[suffix - First] = visitor;
+        }
+
+        CSIVisitor<HANDLER> visitors_[Last - First + 1] = {};
+    }; // tpp::dispatch::CSITable
+
+    template<typename T>
+    struct IdEntry {
+        int id;
+        T value;
+    }; // tpp::dispatch::IdEntry
+
+    /** Perfect hash table of sequence ids.
+
+        Multiplicative hash whose multiplier is searched at compile time so that no two ids collide. The table has at least twice as many slots as there are ids so that the search terminates quickly. A lookup is then a multiplication, a shift and a single comparison.
+     */
+    template<typename T, size_t N>
+    class IdTable {
+    public:
+
+        constexpr IdTable(std::array<IdEntry<T>, N> const & entries) {
+            // successive candidates must not be correlated, hence the LCG
+            for (uint32_t m = 0x9e3779b1; ; m = m * 1664525 + 1013904223) {
+                multiplier_ = m | 1;
+                if (fill(entries))
+                    return;
+            }
+        }
+
+        /** Returns the value for given id, or nullptr if the id is not in the table.
+         */
+        T const * find(int id) const {
+            Slot const & s = slots_[hash(id)];
+            return (s.valid && s.id == id) ? & s.value : nullptr;
+        }
+
+    private:
+
+        static constexpr unsigned Bits = [](){
+            unsigned result = 1;
+            while ((size_t{1} << result) < 2 * N)
+                ++result;
+            return result;
+        }();
+
+        static constexpr size_t Size = size_t{1} << Bits;
+
+        struct Slot {
+            int id = 0;
+            T value = {};
+            bool valid = false;
+        };
+
+        constexpr size_t hash(int id) const {
+            return (static_cast<uint32_t>(id) * multiplier_) >> (32 - Bits);
+        }
+
+        constexpr bool fill(std::array<IdEntry<T>, N> const & entries) {
+            for (auto & s : slots_)
+                s = Slot{};
+            for (auto & e : entries) {
+                Slot & s = slots_[hash(e.id)];
+                if (s.valid) {
+                    // duplicate ids would collide for any multiplier
+                    if (s.id == e.id)
+                        throw "Duplicate sequence id in sequences.inc.h";
+                    return false;
+                }
+                s = Slot{e.id, e.value, true};
+            }
+            return true;
+        }
+
+        uint32_t multiplier_ = 0;
+        Slot slots_[Size] = {};
+    }; // tpp::dispatch::IdTable
+
+    template<typename HANDLER>
+    inline constexpr CSITable<HANDLER> CSIVisitors{};
+
+    inline constexpr size_t NumDEC = 0
+        #define DEC(...) + 1
+        #include "sequences.inc.h"
+        ;
+
+    template<typename HANDLER>
+    inline constexpr IdTable<DECVisitor<HANDLER>, NumDEC> DECVisitors{std::array<IdEntry<DECVisitor<HANDLER>>, NumDEC>{{
+        #define DEC(_, NAME, ID) {ID, VisitDEC<NAME, HANDLER>},
+        #include "sequences.inc.h"
+    }}};
+
+    inline constexpr size_t NumOSC = 0
+        #define OSC1(...) + 1
+        #define OSC2(...) + 1
+        #include "sequences.inc.h"
+        ;
+
+    /** The largest number of values of a specific OSC sequence.
+     */
+    inline constexpr size_t MaxOSCValues = std::max<size_t>({ 1
+        #define OSC1(_, NAME, ...) , NAME::NumValues
+        #define OSC2(_, NAME, ...) , NAME::NumValues
+        #include "sequences.inc.h"
+    });
+
+    template<typename HANDLER>
+    inline constexpr IdTable<OSCVisitor<HANDLER>, NumOSC> OSCVisitors{std::array<IdEntry<OSCVisitor<HANDLER>>, NumOSC>{{
+        #define OSC1(_, NAME, ID, ...) {ID, VisitOSC<NAME, HANDLER>},
+        #define OSC2(_, NAME, ID, ...) {ID, VisitOSC<NAME, HANDLER>},
+        #include "sequences.inc.h"
+    }}};
+
+    inline constexpr size_t NumTpp = 0
+        #define TPP2(...) + 1
+        #include "sequences.inc.h"
+        ;
+
+    template<typename HANDLER>
+    inline constexpr IdTable<TppVisitor<HANDLER>, NumTpp> TppVisitors{std::array<IdEntry<TppVisitor<HANDLER>>, NumTpp>{{
+        #define TPP2(_, NAME, ID, ...) {ID, TppVisitor<HANDLER>{ParseTpp<NAME, HANDLER>, ConvertTpp<NAME, HANDLER>}},
+        #include "sequences.inc.h"
+    }}};
+
+    /** Determines whether VisitSequence() passes DEC sequences with multiple ids to the handler as a single generic DECSequence rather than as one sequence per mode. Handlers opt in by declaring `static constexpr bool WholeDECSequences = true`.
+     */
+    template<typename HANDLER, typename = void>
+    struct WantsWholeDECSequences : std::false_type {};
+
+    template<typename HANDLER>
+    struct WantsWholeDECSequences<HANDLER, std::void_t<decltype(HANDLER::WholeDECSequences)>> : std::bool_constant<HANDLER::WholeDECSequences> {};
+
+    /** Handler that stores the visited sequence in the Sequence variant. 
+     
+        Adapts the visitor API to TryParseSequence() and Specialize(). 
+     */
+    struct SequenceCollector {
+        /** The collector can only hold one sequence.
+         */
+        static constexpr bool WholeDECSequences = true;
+
+        std::optional<Sequence> & result;
+
+        template<typename T>
+        void operator () (T && seq) {
+            result.emplace(std::in_place_type<std::decay_t<T>>, std::forward<T>(seq));
+        }
+    }; // tpp::dispatch::SequenceCollector
+
+} // namespace tpp::dispatch
@@ -0,0 +1,457 @@
+#include <array>
+#include <cstring>
+
+#include "sequence_dispatch.h"
+#include "sequence_parser.h"
+#include "text_scanner.h"
+
+namespace tpp {
+
+    struct SequenceParser::Tables {
+
+        static constexpr size_t NumStates = static_cast<size_t>(State::Count_);
+        static constexpr size_t NumClasses = static_cast<size_t>(ByteClass::Count_);
+
+        static constexpr ByteClass Classify(unsigned char c) {
+            switch (c) {
+                case '\033':
+                    return ByteClass::Esc;
+                case '\a':
+                    return ByteClass::Bel;
+                case ';':
+                    return ByteClass::Semicolon;
+                case ':':
+                    return ByteClass::Colon;
+                case '?':
+                    return ByteClass::Question;
+                case '[':
+                    return ByteClass::LBracket;
+                case ']':
+                    return ByteClass::RBracket;
+                case 'P':
+                    return ByteClass::P;
+                case '\\':
+                    return ByteClass::Backslash;
+                case '`':
+                    return ByteClass::Backtick;
+                case 'h':
+                    return ByteClass::H;
+                case 'l':
+                    return ByteClass::L;
+                case 't':
+                    return ByteClass::T;
+                default:
+                    break;
+            }
+            if (c >= '0' && c <= '9')
+                return ByteClass::Digit;
+            if ((c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))
+                return ByteClass::HexFinalByte;
+            if (c >= 0x3a && c <= 0x3f)
+                return ByteClass::ParameterByte;
+            if (c >= 0x20 && c <= 0x2f)
+                return ByteClass::IntermediateByte;
+            if (c >= 0x40 && c <= 0x7e)
+                return ByteClass::FinalByte;
+            return ByteClass::Other;
+        }
+
+        static constexpr bool IsFinal(ByteClass c) {
+            switch (c) {
+                case ByteClass::FinalByte:
+                case ByteClass::HexFinalByte:
+                case ByteClass::LBracket:
+                case ByteClass::RBracket:
+                case ByteClass::P:
+                case ByteClass::Backslash:
+                case ByteClass::Backtick:
+                case ByteClass::H:
+                case ByteClass::L:
+                case ByteClass::T:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        static constexpr bool IsHex(ByteClass c) {
+            return c == ByteClass::Digit || c == ByteClass::HexFinalByte;
+        }
+
+        /** Describes the state machine.
+
+            Actions marked as replays (OSCEscapedCollect and TppArgStart) do not consume the character, which is then processed again in the next state.
+         */
+        static constexpr Transition Transit(State state, ByteClass c) {
+            switch (state) {
+                case State::Ground:
+                    return { Action::None, State::Ground };
+                case State::Escape:
+                    switch (c) {
+                        case ByteClass::LBracket:
+                            return { Action::None, State::CSIEntry };
+                        case ByteClass::RBracket:
+                            return { Action::None, State::OSCId };
+                        case ByteClass::P:
+                            return { Action::None, State::TppId };
+                        default:
+                            return { Action::Error, State::Ground };
+                    }
+                case State::CSIEntry:
+                    if (c == ByteClass::Question)
+                        return { Action::None, State::DECEntry };
+                    [[fallthrough]];
+                case State::CSIParam:
+                    if (c == ByteClass::Digit)
+                        return { Action::Digit, State::CSIParam };
+                    if (c == ByteClass::Semicolon || c == ByteClass::Colon)
+                        return { Action::CSISeparator, State::CSIParam };
+                    if (IsFinal(c))
+                        return { Action::CSIDispatch, State::Ground };
+                    return { Action::Error, State::Ground };
+                case State::DECEntry:
+                    if (c == ByteClass::Digit)
+                        return { Action::Digit, State::DECParam };
+                    return { Action::Error, State::Ground };
+                case State::DECParam:
+                    switch (c) {
+                        case ByteClass::Digit:
+                            return { Action::Digit, State::DECParam };
+                        case ByteClass::Semicolon:
+                            return { Action::DECSeparator, State::DECEntry };
+                        case ByteClass::H:
+                            return { Action::DECSet, State::Ground };
+                        case ByteClass::L:
+                            return { Action::DECReset, State::Ground };
+                        default:
+                            return { Action::Error, State::Ground };
+                    }
+                case State::OSCId:
+                    if (c == ByteClass::Digit)
+                        return { Action::Digit, State::OSCId };
+                    if (c == ByteClass::Semicolon)
+                        return { Action::SetId, State::OSCString };
+                    return { Action::Error, State::Ground };
+                case State::OSCString:
+                    switch (c) {
+                        case ByteClass::Semicolon:
+                            return { Action::OSCSeparator, State::OSCString };
+                        case ByteClass::Bel:
+                            return { Action::OSCDispatch, State::Ground };
+                        case ByteClass::Esc:
+                            return { Action::None, State::OSCStringEscape };
+                        default:
+                            return { Action::OSCCollect, State::OSCString };
+                    }
+                case State::OSCStringEscape:
+                    if (c == ByteClass::Backslash)
+                        return { Action::OSCDispatch, State::Ground };
+                    return { Action::OSCEscapedCollect, State::OSCString };
+                case State::TppId:
+                    if (c == ByteClass::Digit)
+                        return { Action::Digit, State::TppId };
+                    if (c == ByteClass::T)
+                        return { Action::SetId, State::TppEntry };
+                    return { Action::Error, State::Ground };
+                case State::TppEntry:
+                    if (c == ByteClass::Esc)
+                        return { Action::None, State::TppEnd };
+                    return { Action::TppArgStart, State::TppArg };
+                case State::TppArg:
+                    switch (c) {
+                        case ByteClass::Semicolon:
+                            return { Action::TppSeparator, State::TppArg };
+                        case ByteClass::Backtick:
+                            return { Action::None, State::TppArgHex1 };
+                        case ByteClass::Esc:
+                            return { Action::TppSeparator, State::TppEnd };
+                        default:
+                            return { Action::TppCollect, State::TppArg };
+                    }
+                case State::TppArgHex1:
+                    if (IsHex(c))
+                        return { Action::TppHex, State::TppArgHex2 };
+                    return { Action::Error, State::Ground };
+                case State::TppArgHex2:
+                    if (IsHex(c))
+                        return { Action::TppHex, State::TppArg };
+                    return { Action::Error, State::Ground };
+                case State::TppEnd:
+                    if (c == ByteClass::Backslash)
+                        return { Action::TppDispatch, State::Ground };
+                    return { Action::Error, State::Ground };
+                default:
+                    return { Action::Error, State::Ground };
+            }
+        }
+
+        static constexpr std::array<ByteClass, 256> BuildClasses() {
+            std::array<ByteClass, 256> result{};
+            for (size_t i = 0; i < 256; ++i)
+                result[i] = Classify(static_cast<unsigned char>(i));
+            return result;
+        }
+
+        static constexpr std::array<std::array<Transition, NumClasses>, NumStates> BuildTransitions() {
+            std::array<std::array<Transition, NumClasses>, NumStates> result{};
+            for (size_t s = 0; s < NumStates; ++s)
+                for (size_t c = 0; c < NumClasses; ++c)
+                    result[s][c] = Transit(static_cast<State>(s), static_cast<ByteClass>(c));
+            return result;
+        }
+
+        static ByteClass ClassOf(char c) {
+            static constexpr std::array<ByteClass, 256> Classes = BuildClasses();
+            return Classes[static_cast<unsigned char>(c)];
+        }
+
+        static Transition Next(State state, char c) {
+            static constexpr std::array<std::array<Transition, NumClasses>, NumStates> Transitions = BuildTransitions();
+            return Transitions[static_cast<size_t>(state)][static_cast<size_t>(ClassOf(c))];
+        }
+
+    }; // tpp::SequenceParser::Tables
+
+    std::optional<Sequence> SequenceParser::feed(char const * & buffer, char const * end) {
+        char const * x = buffer;
+        if (state_ == State::Ground) {
+            if (x == end)
+                return std::nullopt;
+            // text runs are returned immediately, up to the next ESC or end of the buffer
+            if (*x != '\033') {
+                char const * esc = static_cast<char const *>(std::memchr(x, '\033', end - x));
+                if (esc == nullptr)
+                    esc = end;
+                buffer = esc;
+                return Payload{x, static_cast<size_t>(esc - x)};
+            }
+            reset();
+            state_ = State::Escape;
+            ++x;
+        }
+        while (x != end) {
+            if (state_ == State::OSCString || state_ == State::TppArg) {
+                x = collect(x, end);
+                if (x == end)
+                    break;
+            }
+            Transition t = Tables::Next(state_, *x);
+            switch (t.action) {
+                case Action::None:
+                    break;
+                case Action::Error:
+                    error(buffer, x);
+                case Action::Digit:
+                    value_ = dispatch::appendDigit(value_, *x);
+                    valueParsed_ = true;
+                    break;
+                case Action::SetId:
+                    if (valueParsed_)
+                        id_ = value_;
+                    value_ = 0;
+                    valueParsed_ = false;
+                    break;
+                case Action::CSISeparator:
+                    csiArgs_.push_back(valueParsed_ ? std::optional<int>{value_} : std::nullopt, subParameter_);
+                    subParameter_ = (*x == ':');
+                    value_ = 0;
+                    valueParsed_ = false;
+                    break;
+                case Action::CSIDispatch: {
+                    // the last argument is only added if it is present, or if there were other arguments before it, see CSISequence::Parse
+                    if (valueParsed_ || ! csiArgs_.empty())
+                        csiArgs_.push_back(valueParsed_ ? std::optional<int>{value_} : std::nullopt, subParameter_);
+                    subParameter_ = false;
+                    state_ = State::Ground;
+                    buffer = x + 1;
+                    dispatch::CSIVisitor<dispatch::SequenceCollector> visitor = dispatch::CSIVisitors<dispatch::SequenceCollector>[*x];
+                    if (visitor == nullptr)
+                        return CSISequence{std::move(csiArgs_), *x};
+                    std::optional<Sequence> result;
+                    dispatch::SequenceCollector collector{result};
+                    if (visitor(csiArgs_, collector) == ParseResult::Ok)
+                        return result;
+                    // raises the error
+                    return Specialize(CSISequence{std::move(csiArgs_), *x});
+                }
+                case Action::DECSeparator:
+                    addDECId(buffer, x);
+                    break;
+                case Action::DECSet:
+                case Action::DECReset: {
+                    addDECId(buffer, x);
+                    dec_.value = (t.action == Action::DECSet);
+                    state_ = State::Ground;
+                    buffer = x + 1;
+                    dispatch::DECVisitor<dispatch::SequenceCollector> const * visitor = dec_.numIds() == 1 ? dispatch::DECVisitors<dispatch::SequenceCollector>.find(dec_.id(0)) : nullptr;
+                    if (visitor == nullptr)
+                        return dec_;
+                    std::optional<Sequence> result;
+                    dispatch::SequenceCollector collector{result};
+                    (*visitor)(t.action == Action::DECSet, collector);
+                    return result;
+                }
+                case Action::OSCSeparator:
+                    finishArg();
+                    break;
+                case Action::OSCCollect:
+                case Action::TppCollect:
+                    flushArg();
+                    arg_.push_back(*x);
+                    break;
+                case Action::OSCDispatch: {
+                    finishArg();
+                    state_ = State::Ground;
+                    buffer = x + 1;
+                    dispatch::OSCVisitor<dispatch::SequenceCollector> const * visitor = id_.has_value() ? dispatch::OSCVisitors<dispatch::SequenceCollector>.find(id_.value()) : nullptr;
+                    if (visitor != nullptr) {
+                        std::optional<Sequence> result;
+                        dispatch::SequenceCollector collector{result};
+                        if ((*visitor)(args_.data(), args_.size(), collector) == ParseResult::Ok)
+                            return result;
+                    }
+                    // generic sequence, or raises the error
+                    OSCSequence seq;
+                    seq.id = id_;
+                    seq.values = std::move(args_);
+                    return Specialize(std::move(seq));
+                }
+                // ESC inside OSC payload not followed by backslash is part of the payload, the character after it is processed again
+                case Action::OSCEscapedCollect:
+                    // if the ESC directly follows the borrowed span, it can be borrowed too
+                    if (argStart_ != nullptr && argEnd_ + 1 == x) {
+                        argEnd_ = x;
+                    } else {
+                        flushArg();
+                        arg_.push_back('\033');
+                    }
+                    state_ = t.next;
+                    continue;
+                case Action::TppArgStart:
+                    state_ = t.next;
+                    continue;
+                case Action::TppSeparator:
+                    finishArg();
+                    break;
+                case Action::TppHex:
+                    if (state_ == State::TppArgHex1) {
+                        hex_ = static_cast<uint8_t>(hexToNibble(*x) << 4);
+                    } else {
+                        // decoded arguments can't be borrowed
+                        flushArg();
+                        arg_.push_back(static_cast<char>(hex_ | hexToNibble(*x)));
+                    }
+                    break;
+                case Action::TppDispatch: {
+                    TppSequence seq{id_.value_or(0)};
+                    seq.args = std::move(args_);
+                    state_ = State::Ground;
+                    buffer = x + 1;
+                    return Specialize(std::move(seq));
+                }
+            }
+            state_ = t.next;
+            ++x;
+        }
+        // the buffer will be released by the caller, take ownership of what has been borrowed so far
+        flushArg();
+        for (auto & arg : args_)
+            arg.detach();
+        buffer = x;
+        return std::nullopt;
+    }
+
+    void SequenceParser::reset() {
+        state_ = State::Ground;
+        value_ = 0;
+        valueParsed_ = false;
+        subParameter_ = false;
+        csiArgs_.clear();
+        dec_.clear();
+        id_.reset();
+        args_.clear();
+        arg_.clear();
+        argStart_ = nullptr;
+        argEnd_ = nullptr;
+    }
+
+    void SequenceParser::addDECId(char const * & buffer, char const * x) {
+        if (! dec_.push_back(value_)) {
+            reset();
+            buffer = x;
+            throw SequenceError{STR("DEC sequence can have at most " << DECSequence::MaxIds << " ids")};
+        }
+        value_ = 0;
+        valueParsed_ = false;
+    }
+
+    void SequenceParser::error(char const * & buffer, char const * x) {
+        State state = state_;
+        reset();
+        buffer = x;
+        switch (state) {
+            case State::Escape:
+                throw SequenceError{STR("Invalid ANSI escape sequence, " << PRETTY(*x) << " found after ESC")};
+            case State::CSIEntry:
+            case State::CSIParam:
+                if (Tables::ClassOf(*x) == ByteClass::ParameterByte)
+                    throw SequenceError{"Parameter bytes are not supported"};
+                if (Tables::ClassOf(*x) == ByteClass::IntermediateByte)
+                    throw SequenceError{"Intermediatebytes are not supported"};
+                throw SequenceError{STR("Invalid character in CSI sequence: " << PRETTY(*x))};
+            case State::DECEntry:
+                throw SequenceError{STR("DEC sequence must have an integer id, but " << PRETTY(*x) << " found")};
+            case State::DECParam:
+                throw SequenceError{STR("Dec sequence must end with 'h' or 'l', but  " << PRETTY(*x) << " found")};
+            case State::OSCId:
+                throw SequenceError{STR("Expected semicolon after OSC id, but " << PRETTY(*x) << " found")};
+            case State::TppId:
+                throw SequenceError{STR("Expected tpp sequence final character 't', but " << PRETTY(*x) << " found")};
+            case State::TppArgHex1:
+            case State::TppArgHex2:
+                throw SequenceError{STR("Invalid hexadecimal character in tpp sequence: " << PRETTY(*x))};
+            case State::TppEnd:
+                throw SequenceError{STR("Expected ST (ESC \\), but " << PRETTY(*x) << " found")};
+            default:
+                throw SequenceError{STR("Invalid character in sequence: " << PRETTY(*x))};
+        }
+    }
+
+    char const * SequenceParser::collect(char const * buffer, char const * end) {
+        // the only characters which are not collected in the string states
+        char const * x = state_ == State::OSCString ? FindAnyOf(buffer, end, ';', '\a', '\033') : FindAnyOf(buffer, end, ';', '`', '\033');
+        if (argStart_ != nullptr && argEnd_ == buffer) {
+            argEnd_ = x;
+        } else if (argStart_ == nullptr && arg_.empty()) {
+            argStart_ = buffer;
+            argEnd_ = x;
+        } else {
+            flushArg();
+            arg_.append(buffer, x);
+        }
+        return x;
+    }
+
+    void SequenceParser::flushArg() {
+        if (argStart_ != nullptr) {
+            arg_.append(argStart_, argEnd_);
+            argStart_ = nullptr;
+            argEnd_ = nullptr;
+        }
+    }
+
+    void SequenceParser::finishArg() {
+        if (! arg_.empty()) {
+            flushArg();
+            args_.push_back(Payload::Own(arg_));
+            arg_.clear();
+        } else if (argStart_ != nullptr) {
+            args_.emplace_back(argStart_, static_cast<size_t>(argEnd_ - argStart_));
+            argStart_ = nullptr;
+            argEnd_ = nullptr;
+        } else {
+            args_.emplace_back();
+        }
+    }
+
+} // namespace tpp
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdint>
+
+#include "sequence.h"
+
+namespace tpp {
+
+    /** Incremental parser of the terminal data stream.
+
+        Unlike ParseSequence, which expects the whole sequence to be present in the buffer and has to be restarted from the ESC character once more data arrives, the parser keeps its partial state between calls to feed() so that every input byte is examined exactly once regardless of how the stream is split into chunks. This is important for long payloads, such as OSC 52 clipboard contents, or tpp data packets which span many reads from the pty.
+
+        The parser is table driven. Each input byte is classified by a static lookup table and the pair of current state and byte class then determines the action to perform and the next state. String payloads (OSC values and tpp arguments) are collected in bulk, i.e. spans of ordinary characters are appended at once.
+
+        The parser emits the same sequences as ParseSequence. Plain text between the sequences is emitted as Payload. Payloads that are contained in a single buffer passed to feed() are borrowed from it, payloads that span multiple buffers, or had to be decoded are owned by the sequence, see Detach().
+     */
+    class SequenceParser {
+    public:
+
+        /** Feeds the parser with the given buffer.
+
+            Consumes the buffer until the first sequence or text run is complete, in which case it is returned and the buffer is advanced to the first byte after it. If the buffer ends before a sequence is complete, the whole buffer is consumed, the partial state is retained for the next call and None is returned. Text runs are returned when an ESC is found, or when the buffer ends.
+
+            On a syntax error, SequenceError is thrown, the buffer points to the offending character and the parser is reset to its initial state.
+         */
+        std::optional<Sequence> feed(char const * & buffer, char const * end);
+
+        /** Returns true if the parser is in the middle of a sequence.
+         */
+        bool pending() const { return state_ != State::Ground; }
+
+        /** Discards any partially parsed sequence.
+         */
+        void reset();
+
+    private:
+
+        enum class State : uint8_t {
+            Ground,
+            Escape,
+            CSIEntry,
+            CSIParam,
+            DECEntry,
+            DECParam,
+            OSCId,
+            OSCString,
+            OSCStringEscape,
+            TppId,
+            TppEntry,
+            TppArg,
+            TppArgHex1,
+            TppArgHex2,
+            TppEnd,
+            Count_
+        }; // SequenceParser::State
+
+        enum class ByteClass : uint8_t {
+            Other,
+            Esc,
+            Bel,
+            Digit,
+            Semicolon,
+            Colon,
+            Question,
+            ParameterByte,
+            IntermediateByte,
+            FinalByte,
+            HexFinalByte,
+            LBracket,
+            RBracket,
+            P,
+            Backslash,
+            Backtick,
+            H,
+            L,
+            T,
+            Count_
+        }; // SequenceParser::ByteClass
+
+        enum class Action : uint8_t {
+            None,
+            Error,
+            Digit,
+            SetId,
+            CSISeparator,
+            CSIDispatch,
+            DECSeparator,
+            DECSet,
+            DECReset,
+            OSCSeparator,
+            OSCCollect,
+            OSCDispatch,
+            OSCEscapedCollect,
+            TppArgStart,
+            TppCollect,
+            TppSeparator,
+            TppHex,
+            TppDispatch,
+        }; // SequenceParser::Action
+
+        struct Transition {
+            Action action;
+            State next;
+        }; // SequenceParser::Transition
+
+        /** The byte classification and state transition tables, see sequence_parser.cpp. 
+         */
+        struct Tables;
+
+        [[noreturn]] void error(char const * & buffer, char const * x);
+
+        /** Adds the currently parsed integer to the ids of the DEC sequence, raising an error if there are too many.
+         */
+        void addDECId(char const * & buffer, char const * x);
+
+        /** Appends the longest run of ordinary string characters to the current argument and returns the pointer to the first character that must go through the transition table.
+         */
+        char const * collect(char const * buffer, char const * end);
+
+        /** Appends the borrowed part of the current argument, if any, to the owned part. 
+         */
+        void flushArg();
+
+        /** Finishes the current argument and adds it to the list of arguments. 
+         */
+        void finishArg();
+
+        State state_ = State::Ground;
+        /** Currently parsed integer (CSI argument, DEC, OSC or tpp id).
+         */
+        int value_ = 0;
+        bool valueParsed_ = false;
+        /** True if the current CSI argument follows a colon, i.e. it is a sub-parameter of the previous one, see CSIArgs.
+         */
+        bool subParameter_ = false;
+        uint8_t hex_ = 0;
+        CSIArgs csiArgs_;
+        DECSequence dec_;
+        std::optional<int> id_;
+        std::vector<Payload> args_;
+        /** The current argument consists of the owned part, followed by a span borrowed from the current buffer. As long as the owned part is empty, the argument is borrowed when finished. 
+         */
+        std::string arg_;
+        char const * argStart_ = nullptr;
+        char const * argEnd_ = nullptr;
+
+    }; // tpp::SequenceParser
+
+} // namespace tpp
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cstring>
+#include <type_traits>
+
+#include "sequence.h"
+#include "sequence_dispatch.h"
+
+namespace tpp {
+
+    /** \name Callback driven parsing.
+
+        Instead of materializing the parsed sequence in the Sequence variant, the sequence is passed directly to the handler, which must be callable with every alternative of the Sequence variant, i.e. every specific sequence from `sequences.inc.h`, the generic CSISequence, DECSequence, OSCSequence and TppSequence for sequences with no specific type, and Payload for text runs. A template call operator can be used as a catch-all for the sequences the handler is not interested in:
+
+            struct Handler {
+                void operator () (CursorPosition && seq) { ... }
+                void operator () (Payload && text) { ... }
+                template<typename T> void operator () (T &&) {}
+            };
+
+        DEC sequences setting, or resetting multiple modes are passed as the specific sequences of the modes, see VisitDECModes(). Handlers that want them as a single generic DECSequence instead declare `static constexpr bool WholeDECSequences = true`, see WantsWholeDECSequences.
+
+        The sequences are passed as rvalues and their string payloads are borrowed from the buffer, see TryParseSequence(). The dispatch tables are instantiated for every handler type so that the handler calls are inlined in them and no intermediate object is created. TryParseSequence() itself is a thin adapter that stores the visited sequence in the variant.
+     */
+    //@{
+
+    /** Passes the modes set, or reset by the DEC sequence to the handler.
+
+        Each id that has a specific sequence in `sequences.inc.h` is passed to the handler as that sequence, in the order of the ids. The remaining ids, if any, are then passed together as a single generic DECSequence. This is how VisitSequence() dispatches DEC sequences, and can be used for the generic DEC sequences with multiple ids returned by TryParseSequence() and SequenceParser.
+     */
+    template<typename HANDLER>
+    void VisitDECModes(DECSequence const & seq, HANDLER & handler) {
+        using namespace dispatch;
+        if (seq.numIds() == 1) {
+            if (DECVisitor<HANDLER> const * visitor = DECVisitors<HANDLER>.find(seq.id(0)))
+                (*visitor)(seq.value, handler);
+            else
+                handler(DECSequence{seq});
+            return;
+        }
+        DECSequence rest;
+        rest.value = seq.value;
+        for (int id : seq) {
+            if (DECVisitor<HANDLER> const * visitor = DECVisitors<HANDLER>.find(id))
+                (*visitor)(seq.value, handler);
+            else
+                rest.push_back(id);
+        }
+        if (rest.numIds() != 0)
+            handler(std::move(rest));
+    }
+
+    /** Parses a single sequence from the buffer and passes it to the handler.
+
+        The buffer and the return value have the same meaning as in TryParseSequence(). The handler is only called when ParseResult::Ok is returned.
+     */
+    template<typename HANDLER>
+    ParseResult VisitSequence(char const * & buffer, char const * end, HANDLER & handler) {
+        using namespace dispatch;
+        /* Propagates incomplete and error results of nested parsing functions, advancing the buffer to the offending character on errors, see TRY in sequence.cpp.
+         */
+        #define TPP_VISIT_TRY(...) if (ParseResult r_ = (__VA_ARGS__); r_ != ParseResult::Ok) { \
+            if (r_ == ParseResult::Error) \
+                buffer = x; \
+            return r_; \
+        }
+        if (buffer == end)
+            return ParseResult::Incomplete;
+        if (*buffer != '\033')
+            return ParseResult::Error;
+        // invalid introducer is an error regardless of how much of the sequence the buffer has
+        if (buffer + 1 != end && buffer[1] != '[' && buffer[1] != ']' && buffer[1] != 'P') {
+            ++buffer;
+            return ParseResult::Error;
+        }
+        if (buffer + 3 > end)
+            return ParseResult::Incomplete;
+        char const * x = buffer + 2;
+        if (buffer[1] == '[') {
+            if (buffer[2] == '?') {
+                DECSequence seq;
+                if (ParseResult r = DECSequence::TryParse(buffer, end, seq); r != ParseResult::Ok)
+                    return r;
+                if constexpr (WantsWholeDECSequences<HANDLER>::value) {
+                    if (seq.numIds() != 1) {
+                        handler(std::move(seq));
+                        return ParseResult::Ok;
+                    }
+                }
+                VisitDECModes(seq, handler);
+                return ParseResult::Ok;
+            }
+            // SGR is by far the most frequent sequence, so its arguments are decoded speculatively straight from the buffer and the sequence is parsed again as generic one only if the final byte turns out to be different
+            {
+                SelectGraphicRendition sgr;
+                char const * finalByte = x;
+                if (SelectGraphicRendition::TryParseArgs(finalByte, end, sgr) == ParseResult::Incomplete)
+                    return ParseResult::Incomplete;
+                if (*finalByte == SelectGraphicRendition::Suffix) {
+                    buffer = finalByte + 1;
+                    handler(std::move(sgr));
+                    return ParseResult::Ok;
+                }
+            }
+            CSIArgs args;
+            TPP_VISIT_TRY(parseCSIArgs(x, end, args));
+            char suffix = *x;
+            buffer = x + 1;
+            // if the arguments do not match the specific sequence, the buffer is still advanced past the sequence
+            if (CSIVisitor<HANDLER> visitor = CSIVisitors<HANDLER>[suffix])
+                return visitor(args, handler);
+            handler(CSISequence{std::move(args), suffix});
+            return ParseResult::Ok;
+        } else if (buffer[1] == ']') {
+            std::optional<int> id;
+            TPP_VISIT_TRY(parseOSCId(x, end, id));
+            OSCVisitor<HANDLER> const * visitor = id.has_value() ? OSCVisitors<HANDLER>.find(id.value()) : nullptr;
+            if (visitor != nullptr) {
+                // collect the values on stack, any values beyond the expected count are only counted
+                Payload values[MaxOSCValues];
+                size_t count = 0;
+                TPP_VISIT_TRY(parseOSCValues(x, end, [&](Payload && value) {
+                    if (count < MaxOSCValues)
+                        values[count] = std::move(value);
+                    ++count;
+                }));
+                buffer = x;
+                return (*visitor)(values, count, handler);
+            }
+            OSCSequence seq;
+            seq.id = id;
+            TPP_VISIT_TRY(parseOSCValues(x, end, [&](Payload && value) {
+                seq.values.push_back(std::move(value));
+            }));
+            buffer = x;
+            handler(std::move(seq));
+            return ParseResult::Ok;
+        } else {
+            int id;
+            TPP_VISIT_TRY(parseInt(x, end, id));
+            TPP_VISIT_TRY(parseChar('t', x, end));
+            if (TppVisitor<HANDLER> const * visitor = TppVisitors<HANDLER>.find(id)) {
+                TPP_VISIT_TRY(visitor->parse(x, end, handler));
+                buffer = x;
+            } else {
+                TppSequence seq;
+                seq.id = id;
+                TPP_VISIT_TRY(TppSequence::TryParseArgs(x, end, seq));
+                buffer = x;
+                handler(std::move(seq));
+            }
+            return ParseResult::Ok;
+        }
+        #undef TPP_VISIT_TRY
+    }
+
+    /** Parses the buffer and passes all text runs and sequences in it to the handler.
+
+        Text runs are the spans between the sequences (up to the next ESC) and are passed to the handler as borrowed Payloads. Stops at the first sequence that is incomplete, or invalid and returns the corresponding result, leaving the buffer at the start of the incomplete sequence, or at the offending character respectively (see TryParseSequence()). Returns ParseResult::Ok if the whole buffer has been consumed.
+     */
+    template<typename HANDLER>
+    ParseResult Visit(char const * & buffer, char const * end, HANDLER & handler) {
+        while (buffer != end) {
+            if (*buffer != '\033') {
+                char const * esc = static_cast<char const *>(std::memchr(buffer, '\033', static_cast<size_t>(end - buffer)));
+                if (esc == nullptr)
+                    esc = end;
+                handler(Payload{buffer, static_cast<size_t>(esc - buffer)});
+                buffer = esc;
+                continue;
+            }
+            if (ParseResult r = VisitSequence(buffer, end, handler); r != ParseResult::Ok)
+                return r;
+        }
+        return ParseResult::Ok;
+    }
+
+    //@}
+
+} // namespace tpp
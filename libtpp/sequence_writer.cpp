@@ -0,0 +1,362 @@
+#include <algorithm>
+
+#include "sequence_writer.h"
+#include "text_scanner.h"
+
+namespace tpp {
+
+    namespace {
+
+        /** Maximum number of characters of a formatted int.
+         */
+        constexpr size_t MaxIntLength = 11;
+
+        /** Pairs of decimal digits for numbers 0 - 99.
+         */
+        struct DigitPairs {
+            char digits[200] = {};
+            constexpr DigitPairs() {
+                for (int i = 0; i < 100; ++i) {
+                    digits[i * 2] = static_cast<char>('0' + i / 10);
+                    digits[i * 2 + 1] = static_cast<char>('0' + i % 10);
+                }
+            }
+        };
+
+        constexpr DigitPairs DigitPairTable{};
+
+        constexpr char HexDigits[] = "0123456789abcdef";
+
+        /** Encoded form of a character for tpp arguments, the last byte is the length of the encoded form (1 or 3).
+         */
+        struct EncodedCharacter {
+            char bytes[4];
+        };
+
+        struct EncodingTableType {
+            EncodedCharacter chars[256] = {};
+            constexpr EncodingTableType() {
+                for (int i = 0; i < 256; ++i) {
+                    char c = static_cast<char>(i);
+                    if (IsCharacterToEncode(c)) {
+                        chars[i].bytes[0] = '`';
+                        chars[i].bytes[1] = HexDigits[i >> 4];
+                        chars[i].bytes[2] = HexDigits[i & 0xf];
+                        chars[i].bytes[3] = 3;
+                    } else {
+                        chars[i].bytes[0] = c;
+                        chars[i].bytes[3] = 1;
+                    }
+                }
+            }
+        };
+
+        constexpr EncodingTableType EncodingTable{};
+
+        unsigned numDigits(uint32_t value) {
+            unsigned result = 1;
+            while (true) {
+                if (value < 10)
+                    return result;
+                if (value < 100)
+                    return result + 1;
+                if (value < 1000)
+                    return result + 2;
+                if (value < 10000)
+                    return result + 3;
+                value /= 10000;
+                result += 4;
+            }
+        }
+
+        /** Formats the integer at given position and returns the position after the last digit. There must be room for MaxIntLength characters.
+         */
+        char * formatInt(char * x, int value) {
+            uint32_t v = static_cast<uint32_t>(value);
+            if (value < 0) {
+                *x++ = '-';
+                v = 0 - v;
+            }
+            char * end = x + numDigits(v);
+            char * i = end;
+            while (v >= 100) {
+                unsigned pair = (v % 100) * 2;
+                v /= 100;
+                *--i = DigitPairTable.digits[pair + 1];
+                *--i = DigitPairTable.digits[pair];
+            }
+            if (v >= 10) {
+                *--i = DigitPairTable.digits[v * 2 + 1];
+                *--i = DigitPairTable.digits[v * 2];
+            } else {
+                *--i = static_cast<char>('0' + v);
+            }
+            return end;
+        }
+
+        template<typename T>
+        std::ostream & serialize(std::ostream & s, T const & what) {
+            SequenceWriter writer{256};
+            writer << what;
+            s.write(writer.data(), static_cast<std::streamsize>(writer.size()));
+            return s;
+        }
+
+    } // tpp::anonymous
+
+    std::ostream & operator << (std::ostream & s, CSISequence const & seq) { return serialize(s, seq); }
+    std::ostream & operator << (std::ostream & s, DECSequence const & seq) { return serialize(s, seq); }
+    std::ostream & operator << (std::ostream & s, OSCSequence const & seq) { return serialize(s, seq); }
+    std::ostream & operator << (std::ostream & s, TppSequence const & seq) { return serialize(s, seq); }
+
+    void TppSequence::Encode(std::ostream & s, std::string_view value) {
+        SequenceWriter writer{value.size() * 3};
+        writer.encode(value);
+        s.write(writer.data(), static_cast<std::streamsize>(writer.size()));
+    }
+
+    SequenceWriter & SequenceWriter::text(std::string_view text) {
+        put(text);
+        return *this;
+    }
+
+    SequenceWriter & SequenceWriter::text(char c) {
+        put(c);
+        return *this;
+    }
+
+    SequenceWriter & SequenceWriter::csi(char suffix) {
+        if (char * x = reserve(3)) {
+            x[0] = '\033';
+            x[1] = '[';
+            x[2] = suffix;
+            size_ += 3;
+        }
+        return *this;
+    }
+
+    SequenceWriter & SequenceWriter::csi(int arg, char suffix) {
+        if (char * x = reserve(3 + MaxIntLength)) {
+            char * start = x;
+            *x++ = '\033';
+            *x++ = '[';
+            x = formatInt(x, arg);
+            *x++ = suffix;
+            size_ += static_cast<size_t>(x - start);
+        }
+        return *this;
+    }
+
+    SequenceWriter & SequenceWriter::csi(int arg1, int arg2, char suffix) {
+        if (char * x = reserve(4 + 2 * MaxIntLength)) {
+            char * start = x;
+            *x++ = '\033';
+            *x++ = '[';
+            x = formatInt(x, arg1);
+            *x++ = ';';
+            x = formatInt(x, arg2);
+            *x++ = suffix;
+            size_ += static_cast<size_t>(x - start);
+        }
+        return *this;
+    }
+
+    SequenceWriter & SequenceWriter::csi(CSIArgs const & args, char suffix) {
+        if (char * x = reserve(3 + args.size() * (MaxIntLength + 1))) {
+            char * start = x;
+            *x++ = '\033';
+            *x++ = '[';
+            for (size_t i = 0, e = args.size(); i != e; ++i) {
+                if (i != 0)
+                    *x++ = args.isSubParameter(i) ? ':' : ';';
+                if (args.has(i))
+                    x = formatInt(x, args.get(i, 0));
+            }
+            *x++ = suffix;
+            size_ += static_cast<size_t>(x - start);
+        }
+        return *this;
+    }
+
+    SequenceWriter & SequenceWriter::dec(int id, bool value) {
+        if (char * x = reserve(4 + MaxIntLength)) {
+            char * start = x;
+            *x++ = '\033';
+            *x++ = '[';
+            *x++ = '?';
+            x = formatInt(x, id);
+            *x++ = value ? 'h' : 'l';
+            size_ += static_cast<size_t>(x - start);
+        }
+        return *this;
+    }
+
+    SequenceWriter & SequenceWriter::operator << (DECSequence const & seq) {
+        if (char * x = reserve(4 + seq.numIds() * (MaxIntLength + 1))) {
+            char * start = x;
+            *x++ = '\033';
+            *x++ = '[';
+            *x++ = '?';
+            for (size_t i = 0, e = seq.numIds(); i != e; ++i) {
+                if (i != 0)
+                    *x++ = ';';
+                x = formatInt(x, seq.id(i));
+            }
+            *x++ = seq.value ? 'h' : 'l';
+            size_ += static_cast<size_t>(x - start);
+        }
+        return *this;
+    }
+
+    SequenceWriter & SequenceWriter::osc(std::optional<int> id, std::initializer_list<std::string_view> values) {
+        // ESC ] id ; values separated by ; and the ST terminator
+        size_t length = 5 + MaxIntLength + values.size();
+        for (auto & v : values)
+            length += v.size();
+        if (char * x = reserve(length)) {
+            char * start = x;
+            *x++ = '\033';
+            *x++ = ']';
+            if (id.has_value()) {
+                x = formatInt(x, id.value());
+                *x++ = ';';
+            }
+            bool first = true;
+            for (auto & v : values) {
+                if (! first)
+                    *x++ = ';';
+                first = false;
+                std::memcpy(x, v.data(), v.size());
+                x += v.size();
+            }
+            *x++ = '\033';
+            *x++ = '\\';
+            size_ += static_cast<size_t>(x - start);
+        }
+        return *this;
+    }
+
+    SequenceWriter & SequenceWriter::tpp(int id, std::initializer_list<std::string_view> args) {
+        Mark m{*this};
+        tppStart(id);
+        bool first = true;
+        for (auto & a : args) {
+            if (! first)
+                put(';');
+            first = false;
+            encode(a);
+        }
+        tppEnd();
+        return m.commit();
+    }
+
+    SequenceWriter & SequenceWriter::encode(std::string_view value) {
+        Mark m{*this};
+        char const * x = value.data();
+        char const * end = x + value.size();
+        // the encoded blocks always store 4 bytes per character, hence the extra byte
+        char * o = (owned_ != nullptr || size_ + value.size() * 3 + 1 <= capacity_) ? reserve(value.size() * 3 + 1) : nullptr;
+        // fixed buffer that may still be large enough, encode character by character
+        if (o == nullptr) {
+            for (; x != end; ++x) {
+                EncodedCharacter const & e = EncodingTable.chars[static_cast<uint8_t>(*x)];
+                put(std::string_view{e.bytes, static_cast<size_t>(e.bytes[3])});
+            }
+            return m.commit();
+        }
+        char * start = o;
+        while (x != end) {
+            char const * run = FindCharacterToEncode(x, end);
+            std::memcpy(o, x, static_cast<size_t>(run - x));
+            o += run - x;
+            x = run;
+            // binary data alternates between the characters to encode and short runs of those that don't, so rather than searching again, encode the next block without branching
+            char const * blockEnd = x + std::min<size_t>(16, static_cast<size_t>(end - x));
+            for (; x != blockEnd; ++x) {
+                EncodedCharacter const & e = EncodingTable.chars[static_cast<uint8_t>(*x)];
+                std::memcpy(o, e.bytes, 4);
+                o += e.bytes[3];
+            }
+        }
+        size_ += static_cast<size_t>(o - start);
+        return m.commit();
+    }
+
+    SequenceWriter & SequenceWriter::operator << (SelectGraphicRendition const & seq) {
+        CSIArgs args;
+        seq.delta.toArgs(args);
+        // an empty delta changes nothing, while SGR without arguments would reset
+        if (args.empty())
+            return *this;
+        return csi(args, SelectGraphicRendition::Suffix);
+    }
+
+    SequenceWriter & SequenceWriter::operator << (OSCSequence const & seq) {
+        Mark m{*this};
+        put("\033]");
+        if (seq.id.has_value()) {
+            put(seq.id.value());
+            put(';');
+        }
+        bool first = true;
+        for (auto & v : seq.values) {
+            if (! first)
+                put(';');
+            first = false;
+            put(v.view());
+        }
+        put("\033\\");
+        return m.commit();
+    }
+
+    SequenceWriter & SequenceWriter::operator << (TppSequence const & seq) {
+        Mark m{*this};
+        tppStart(seq.id);
+        bool first = true;
+        for (auto & a : seq.args) {
+            if (! first)
+                put(';');
+            first = false;
+            encode(a.view());
+        }
+        tppEnd();
+        return m.commit();
+    }
+
+    SequenceWriter & SequenceWriter::operator << (Sequence const & seq) {
+        return std::visit([this](auto const & s) -> SequenceWriter & {
+            return *this << s;
+        }, seq);
+    }
+
+    char * SequenceWriter::grow(size_t n) {
+        if (owned_ == nullptr || overflow_) {
+            overflow_ = true;
+            return nullptr;
+        }
+        size_t capacity = std::max(capacity_ * 2, size_ + n);
+        std::unique_ptr<char[]> buffer{new char[capacity]};
+        std::memcpy(buffer.get(), buffer_, size_);
+        owned_ = std::move(buffer);
+        buffer_ = owned_.get();
+        capacity_ = capacity;
+        return buffer_ + size_;
+    }
+
+    void SequenceWriter::put(int value) {
+        if (char * x = reserve(MaxIntLength))
+            size_ += static_cast<size_t>(formatInt(x, value) - x);
+    }
+
+    void SequenceWriter::tppStart(int id) {
+        if (char * x = reserve(3 + MaxIntLength)) {
+            char * start = x;
+            *x++ = '\033';
+            *x++ = 'P';
+            x = formatInt(x, id);
+            *x++ = 't';
+            size_ += static_cast<size_t>(x - start);
+        }
+    }
+
+} // namespace tpp
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <string_view>
+
+#include "sequence.h"
+
+namespace tpp {
+
+    /** Serializes sequences into a contiguous byte buffer.
+
+        The writer either owns a growable buffer, or writes into a fixed buffer provided by the caller. Sequences are appended one after another so that many of them, such as the whole frame of an app redrawing its screen, can be sent to the pty with a single call. Integers are formatted two digits at a time and tpp arguments are encoded by copying the spans of characters that do not need encoding in bulk, see FindCharacterToEncode().
+
+        Each sequence is written atomically. If a sequence does not fit in a fixed buffer, nothing of it is written and the writer reports overflow and ignores any further writes (which would change the order of the sequences) until cleared, so that the caller can send what has been written so far and retry. Growable buffers never overflow.
+     */
+    class SequenceWriter {
+    public:
+
+        /** Creates writer with a growable buffer of given initial capacity.
+         */
+        explicit SequenceWriter(size_t capacity = 4096):
+            owned_{new char[capacity]},
+            buffer_{owned_.get()},
+            capacity_{capacity} {
+        }
+
+        /** Creates writer that writes into the given fixed buffer.
+         */
+        SequenceWriter(char * buffer, size_t capacity):
+            buffer_{buffer},
+            capacity_{capacity} {
+        }
+
+        SequenceWriter(SequenceWriter const &) = delete;
+        SequenceWriter & operator = (SequenceWriter const &) = delete;
+
+        char const * data() const { return buffer_; }
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+        std::string_view view() const { return std::string_view{buffer_, size_}; }
+
+        /** Returns true if a sequence did not fit in the fixed buffer since the last clear().
+         */
+        bool overflow() const { return overflow_; }
+
+        /** Discards the written data, keeping the buffer.
+         */
+        void clear() {
+            size_ = 0;
+            overflow_ = false;
+        }
+
+        /** \name Raw data.
+
+            Appends the bytes as they are, i.e. text to be displayed.
+         */
+        //@{
+        SequenceWriter & text(std::string_view text);
+        SequenceWriter & text(char c);
+        //@}
+
+        /** \name Sequences.
+         */
+        //@{
+        SequenceWriter & csi(char suffix);
+        SequenceWriter & csi(int arg, char suffix);
+        SequenceWriter & csi(int arg1, int arg2, char suffix);
+        SequenceWriter & csi(CSIArgs const & args, char suffix);
+        SequenceWriter & dec(int id, bool value);
+        SequenceWriter & osc(std::optional<int> id, std::initializer_list<std::string_view> values);
+        SequenceWriter & tpp(int id, std::initializer_list<std::string_view> args);
+        //@}
+
+        /** Appends the tpp sequence argument, encoding the characters that can't be transmitted as they are.
+         */
+        SequenceWriter & encode(std::string_view value);
+
+        SequenceWriter & operator << (CSISequence const & seq) { return csi(seq.args(), seq.suffix()); }
+        SequenceWriter & operator << (DECSequence const & seq);
+        SequenceWriter & operator << (OSCSequence const & seq);
+        SequenceWriter & operator << (TppSequence const & seq);
+        SequenceWriter & operator << (Payload const & text) { return this->text(text.view()); }
+        SequenceWriter & operator << (Sequence const & seq);
+
+        #define CSI0(_, NAME, SUFFIX) SequenceWriter & operator << (NAME const &) { return csi(SUFFIX); }
+        #define CSI1(_, NAME, SUFFIX, VALUE_NAME, ...) SequenceWriter & operator << (NAME const & seq) { return csi(seq.VALUE_NAME, SUFFIX); }
+        #define CSI2(_, NAME, SUFFIX, VALUE_NAME1, DEFAULT_VALUE1, VALUE_NAME2, ...) SequenceWriter & operator << (NAME const & seq) { return csi(seq.VALUE_NAME1, seq.VALUE_NAME2, SUFFIX); }
+        #define CSIn(_, NAME, SUFFIX, ...) SequenceWriter & operator << (NAME const & seq) { return csi(seq.args, SUFFIX); }
+        #define CSIx(_, NAME, ...) SequenceWriter & operator << (NAME const & seq);
+        #define DEC(_, NAME, ID) SequenceWriter & operator << (NAME const & seq) { return dec(ID, seq.value); }
+        #define OSC1(_, NAME, ID, VALUE_NAME) SequenceWriter & operator << (NAME const & seq) { return osc(ID, {seq.VALUE_NAME.view()}); }
+        #define OSC2(_, NAME, ID, VALUE_NAME1, VALUE_NAME2) SequenceWriter & operator << (NAME const & seq) { return osc(ID, {seq.VALUE_NAME1.view(), seq.VALUE_NAME2.view()}); }
+        #define TPP2(_, NAME, ID, VALUE_NAME1, VALUE_TYPE1, VALUE_NAME2, VALUE_TYPE2) SequenceWriter & operator << (NAME const & seq) { \
+            Mark m{*this}; \
+            tppStart(ID); \
+            arg(seq.VALUE_NAME1); \
+            put(';'); \
+            arg(seq.VALUE_NAME2); \
+            tppEnd(); \
+            return m.commit(); \
+        }
+        #include "sequences.inc.h"
+
+    private:
+
+        /** Remembers the size before a sequence is written so that a partially written sequence can be rolled back if the fixed buffer overflows.
+         */
+        class Mark {
+        public:
+            Mark(SequenceWriter & writer):
+                writer_{writer},
+                size_{writer.size_} {
+            }
+
+            SequenceWriter & commit() {
+                if (writer_.overflow_)
+                    writer_.size_ = size_;
+                return writer_;
+            }
+
+        private:
+            SequenceWriter & writer_;
+            size_t size_;
+        }; // SequenceWriter::Mark
+
+        /** Makes sure there is room for n more bytes and returns pointer to the first of them, or nullptr if the fixed buffer overflows.
+         */
+        char * reserve(size_t n) {
+            if (size_ + n <= capacity_ && ! overflow_)
+                return buffer_ + size_;
+            return grow(n);
+        }
+
+        char * grow(size_t n);
+
+        void put(char c) {
+            if (char * x = reserve(1)) {
+                *x = c;
+                ++size_;
+            }
+        }
+
+        void put(std::string_view str) {
+            if (char * x = reserve(str.size())) {
+                std::memcpy(x, str.data(), str.size());
+                size_ += str.size();
+            }
+        }
+
+        void put(int value);
+
+        void tppStart(int id);
+        void tppEnd() { put("\033\\"); }
+
+        void arg(int value) { put(value); }
+        void arg(std::string_view value) { encode(value); }
+
+        std::unique_ptr<char[]> owned_;
+        char * buffer_;
+        size_t size_ = 0;
+        size_t capacity_;
+        bool overflow_ = false;
+
+    }; // tpp::SequenceWriter
+
+} // namespace tpp
@@ -18,6 +18,11 @@
 #define CSIn(...)
 #endif
 
+// CSI sequence whose arguments are decoded by a dedicated parser, the class is defined in sequence.h
+#ifndef CSIx
+#define CSIx(...)
+#endif
+
 // DEC sequences (ESC [ ? value [h | l])
 #ifndef DEC
 #define DEC(...)
@@ -57,6 +62,8 @@ CSI2(HVP, HorizontalVerticalPosition, 'f', x, 1, y, 1)
 CSI0(ANSISYSSC, SaveCursor, 's')
 // Restores the current cursor position from stack
 CSI0(ANSISYSRC, RestoreCursor, 'u')
+// Sets the graphic rendition (text attributes and colors), arguments are the attributes to set, missing argument means reset (0)
+CSIx(SGR, SelectGraphicRendition, 'm')
 
 DEC(DCT25, ShowCursor, 25)
 DEC(DCT1004, EnableFocusReporting, 1004)
@@ -112,6 +119,7 @@ TPP2(TERMRES, TerminalResize, 0, cols, int, rows, int)
 #undef CSI1
 #undef CSI2
 #undef CSIn
+#undef CSIx
 #undef DEC
 #undef OSC1
 #undef OSC2
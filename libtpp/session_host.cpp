@@ -0,0 +1,317 @@
+#if (defined ARCH_LINUX)
+    #include <sys/eventfd.h>
+#endif
+
+#include "session_host.h"
+
+namespace tpp::pty {
+
+#if (defined ARCH_LINUX)
+
+    // SessionHost::Session
+
+    void SessionHost::Session::send(char const * buffer, size_t numBytes) {
+        std::lock_guard<std::mutex> g{guard_};
+        if (state_ == State::Terminated)
+            return;
+        input_.append(buffer, numBytes);
+        writeInput();
+        // busy sessions write the rest of the input when they run
+        if (! input_.empty() && state_ == State::Armed)
+            host_->workers_[owner_]->loop.modify(server_.master(), EPOLLIN | EPOLLOUT | EPOLLONESHOT);
+    }
+
+    void SessionHost::Session::writeInput() {
+        size_t written = 0;
+        while (written < input_.size()) {
+            ssize_t n = ::write(server_.master(), input_.data() + written, input_.size() - written);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                // the child closed the terminal, the end of the output will terminate the session
+                if (errno != EAGAIN)
+                    written = input_.size();
+                break;
+            }
+            written += static_cast<size_t>(n);
+        }
+        input_.erase(0, written);
+    }
+
+    // SessionHost
+
+    SessionHost::SessionHost(size_t numWorkers) {
+        if (numWorkers == 0)
+            numWorkers = std::max(1u, std::thread::hardware_concurrency());
+        // all workers must exist before any of them starts stealing
+        for (size_t i = 0; i < numWorkers; ++i) {
+            auto w = std::make_unique<Worker>();
+            w->wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            OSCHECK(w->wakeup >= 0);
+            Worker * worker = w.get();
+            w->loop.add(w->wakeup, EPOLLIN, [worker](int fd, uint32_t) {
+                uint64_t x;
+                if (::read(fd, & x, sizeof(x)) != sizeof(x))
+                    return;
+                std::vector<std::function<void()>> tasks;
+                {
+                    std::lock_guard<std::mutex> g{worker->guard};
+                    std::swap(tasks, worker->tasks);
+                }
+                for (auto & task : tasks)
+                    task();
+            });
+            workers_.push_back(std::move(w));
+        }
+        for (size_t i = 0; i < numWorkers; ++i)
+            workers_[i]->thread = std::thread{[this, i]() { workerMain(i); }};
+    }
+
+    SessionHost::~SessionHost() {
+        stop_ = true;
+        for (auto & w : workers_)
+            wake(*w);
+        for (auto & w : workers_)
+            w->thread.join();
+        // hang up all children first so that they terminate in parallel, sessions kept alive by their users can't send to them any more
+        for (auto & w : workers_) {
+            for (auto & i : w->sessions) {
+                std::lock_guard<std::mutex> g{i.first->guard_};
+                i.first->state_ = Session::State::Terminated;
+                i.first->server_.hangup();
+            }
+        }
+        // then reap them with a common deadline, killing those that ignore the hangup
+        auto deadline = std::chrono::steady_clock::now() + LocalServer::HangupTimeout;
+        for (auto & w : workers_) {
+            for (auto & i : w->sessions) {
+                auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                try {
+                    if (! i.first->server_.wait(std::max(remaining, std::chrono::milliseconds{0})).has_value())
+                        i.first->server_.kill();
+                } catch (...) {
+                }
+            }
+        }
+        for (auto & w : workers_) {
+            w->sessions.clear();
+            close(w->wakeup);
+        }
+    }
+
+    std::shared_ptr<SessionHost::Session> SessionHost::spawn(std::vector<std::string> const & command, OutputHandler output, ExitHandler exit, std::unordered_map<std::string, std::string> const & env, int cols, int rows) {
+        size_t owner = nextOwner_++ % workers_.size();
+        std::shared_ptr<Session> session{new Session{this, owner, command, env, cols, rows, std::move(output), std::move(exit)}};
+        ++numSessions_;
+        // the session is busy until registered with the owner so that sends do not modify its registration
+        session->state_ = Session::State::Running;
+        post(owner, [this, owner, session]() {
+            Worker & w = *workers_[owner];
+            Session * s = session.get();
+            w.sessions.emplace(s, session);
+            w.loop.add(s->server_.master(), EPOLLONESHOT, [this, owner, s](int, uint32_t) {
+                {
+                    std::lock_guard<std::mutex> g{s->guard_};
+                    if (s->state_ != Session::State::Armed)
+                        return;
+                    s->state_ = Session::State::Queued;
+                }
+                enqueue(owner, s);
+            });
+            arm(s);
+        });
+        return session;
+    }
+
+    void SessionHost::workerMain(size_t index) {
+        Worker & w = *workers_[index];
+        size_t slices = 0;
+        while (! stop_) {
+            Session * s = dequeue(index);
+            if (s == nullptr)
+                s = steal(index);
+            if (s != nullptr) {
+                run(index, s);
+                // keep picking up new events and tasks while busy
+                if (++slices % 16 == 0)
+                    w.loop.poll(0);
+                continue;
+            }
+            // try stealing once more after becoming idle so that no wakeup is missed
+            w.idle = true;
+            s = steal(index);
+            if (s != nullptr) {
+                w.idle = false;
+                run(index, s);
+                continue;
+            }
+            w.loop.poll();
+            w.idle = false;
+        }
+    }
+
+    void SessionHost::post(size_t worker, std::function<void()> task) {
+        Worker & w = *workers_[worker];
+        {
+            std::lock_guard<std::mutex> g{w.guard};
+            w.tasks.push_back(std::move(task));
+        }
+        wake(w);
+    }
+
+    void SessionHost::wake(Worker & worker) {
+        uint64_t x = 1;
+        OSCHECK(::write(worker.wakeup, & x, sizeof(x)) == sizeof(x));
+    }
+
+    void SessionHost::enqueue(size_t worker, Session * session) {
+        Worker & w = *workers_[worker];
+        size_t queued;
+        {
+            std::lock_guard<std::mutex> g{w.guard};
+            w.runQueue.push_back(session);
+            queued = w.runQueue.size();
+            w.queued = queued;
+        }
+        if (queued < 2)
+            return;
+        for (auto & other : workers_) {
+            if (other->idle) {
+                wake(*other);
+                break;
+            }
+        }
+    }
+
+    SessionHost::Session * SessionHost::dequeue(size_t worker) {
+        Worker & w = *workers_[worker];
+        std::lock_guard<std::mutex> g{w.guard};
+        if (w.runQueue.empty())
+            return nullptr;
+        Session * result = w.runQueue.front();
+        w.runQueue.pop_front();
+        w.queued = w.runQueue.size();
+        return result;
+    }
+
+    SessionHost::Session * SessionHost::steal(size_t worker) {
+        size_t victim = worker;
+        size_t most = 0;
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            size_t queued = workers_[i]->queued;
+            if (i != worker && queued > most) {
+                victim = i;
+                most = queued;
+            }
+        }
+        if (victim == worker)
+            return nullptr;
+        // never hold two worker locks at once, two workers may be stealing from each other
+        std::vector<Session *> stolen;
+        {
+            Worker & v = *workers_[victim];
+            std::lock_guard<std::mutex> g{v.guard};
+            size_t n = (v.runQueue.size() + 1) / 2;
+            for (size_t i = 0; i < n; ++i) {
+                stolen.push_back(v.runQueue.back());
+                v.runQueue.pop_back();
+            }
+            v.queued = v.runQueue.size();
+        }
+        if (stolen.empty())
+            return nullptr;
+        numStolen_ += stolen.size();
+        if (stolen.size() > 1) {
+            Worker & w = *workers_[worker];
+            std::lock_guard<std::mutex> g{w.guard};
+            // the stolen sessions are in reverse order, the first one is returned
+            w.runQueue.insert(w.runQueue.end(), stolen.rbegin() + 1, stolen.rend());
+            w.queued = w.runQueue.size();
+        }
+        return stolen.back();
+    }
+
+    void SessionHost::run(size_t worker, Session * session) {
+        {
+            std::lock_guard<std::mutex> g{session->guard_};
+            session->state_ = Session::State::Running;
+            session->writeInput();
+        }
+        char buffer[SliceBytes];
+        size_t total = 0;
+        bool eof = false;
+        while (total < SliceBytes) {
+            std::optional<size_t> numBytes = session->server_.tryReceive(buffer, SliceBytes - total);
+            if (! numBytes.has_value())
+                break;
+            if (numBytes.value() == 0) {
+                eof = true;
+                break;
+            }
+            session->output_(*session, buffer, numBytes.value());
+            total += numBytes.value();
+        }
+        if (eof) {
+            terminate(session);
+        } else if (total == SliceBytes) {
+            // there is likely more output, give the other sessions their slices first
+            {
+                std::lock_guard<std::mutex> g{session->guard_};
+                session->state_ = Session::State::Queued;
+            }
+            enqueue(worker, session);
+        } else {
+            arm(session);
+        }
+    }
+
+    void SessionHost::arm(Session * session) {
+        std::lock_guard<std::mutex> g{session->guard_};
+        session->state_ = Session::State::Armed;
+        uint32_t events = EPOLLIN | EPOLLONESHOT;
+        if (! session->input_.empty())
+            events |= EPOLLOUT;
+        workers_[session->owner_]->loop.modify(session->server_.master(), events);
+    }
+
+    void SessionHost::terminate(Session * session) {
+        {
+            std::lock_guard<std::mutex> g{session->guard_};
+            session->state_ = Session::State::Terminated;
+            session->input_.clear();
+        }
+        std::optional<int> exitCode = session->server_.exitCode();
+        if (exitCode.has_value()) {
+            finish(session, exitCode.value());
+        } else if (session->server_.pidfd() >= 0) {
+            // the child closed the terminal, but is still running, wait for it without blocking the worker
+            size_t owner = session->owner_;
+            post(owner, [this, owner, session]() {
+                Worker & w = *workers_[owner];
+                w.loop.add(session->server_.pidfd(), EPOLLIN, [this, &w, session](int fd, uint32_t) {
+                    w.loop.remove(fd);
+                    finish(session, session->server_.wait());
+                });
+            });
+        } else {
+            finish(session, session->server_.wait());
+        }
+    }
+
+    void SessionHost::finish(Session * session, int exitCode) {
+        session->terminated_ = true;
+        --numSessions_;
+        session->exit_(*session, exitCode);
+        size_t owner = session->owner_;
+        post(owner, [this, owner, session]() {
+            Worker & w = *workers_[owner];
+            int master = session->server_.master();
+            if (w.loop.contains(master))
+                w.loop.remove(master);
+            w.sessions.erase(session);
+        });
+    }
+
+#endif // ARCH_LINUX
+
+} // namespace tpp::pty
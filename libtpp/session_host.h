@@ -0,0 +1,200 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "helpers/helpers.h"
+
+#include "event_loop.h"
+#include "pty.h"
+
+namespace tpp::pty {
+
+#if (defined ARCH_LINUX)
+
+    /** Host of many local PTY sessions driven by a fixed pool of worker threads.
+
+        Each session is a LocalServer registered with the event loop of one of the workers (its owner), round robin. When the session's master becomes ready, the owner puts the session at the end of its run queue. The workers take sessions from the front of their run queues and run them for a single time slice, during which the session's pending input is written and at most SliceBytes of its output are read and passed to the output handler. A session that still has output left goes to the end of the run queue again, so that a session flooding its output can't starve the interactive sessions, which get their slice within one round of the queue. Sessions with no output left are re-armed with their owner's event loop.
+
+        A worker whose run queue is empty steals half of the run queue of the busiest worker, so that busy sessions spread across all cores regardless of their owners. The sessions are registered with EPOLLONESHOT, which guarantees that each session is either armed with its owner's event loop, waiting in a run queue, or being run by exactly one worker. Handlers of a single session are therefore never called concurrently, but handlers of different sessions are called from different worker threads.
+     */
+    class SessionHost {
+    public:
+
+        class Session;
+
+        /** Called with the output of the session. The data is only valid for the duration of the call.
+         */
+        using OutputHandler = std::function<void(Session &, char const *, size_t)>;
+
+        /** Called with the exit code of the session's child once its output has been read completely and the child terminated. No handlers of the session are called afterwards.
+         */
+        using ExitHandler = std::function<void(Session &, int)>;
+
+        /** Maximum number of output bytes read from a session in a single time slice.
+         */
+        static constexpr size_t SliceBytes = 16384;
+
+        /** A single session of the host.
+
+            The session is kept alive by the host until its child exits and can be kept alive by its users afterwards, but sending to a terminated session does nothing.
+         */
+        class Session {
+        public:
+
+            /** Queues the input for the session's child and writes as much of it as possible right away. Can be called from any thread.
+             */
+            void send(char const * buffer, size_t numBytes);
+
+            /** Resizes the session's terminal. Can be called from any thread, resizing a terminated session does nothing.
+             */
+            void resize(int cols, int rows) {
+                std::lock_guard<std::mutex> g{guard_};
+                if (state_ != State::Terminated)
+                    server_.resize(cols, rows);
+            }
+
+            pid_t pid() const { return server_.pid(); }
+
+            bool terminated() const { return terminated_; }
+
+        private:
+            friend class SessionHost;
+
+            enum class State {
+                Armed,
+                Queued,
+                Running,
+                Terminated,
+            };
+
+            Session(SessionHost * host, size_t owner, std::vector<std::string> const & command, std::unordered_map<std::string, std::string> const & env, int cols, int rows, OutputHandler output, ExitHandler exit):
+                server_{command, env, cols, rows},
+                host_{host},
+                owner_{owner},
+                output_{std::move(output)},
+                exit_{std::move(exit)} {
+            }
+
+            /** Writes as much of the pending input as the terminal accepts. Expects the guard to be locked.
+             */
+            void writeInput();
+
+            LocalServer server_;
+            SessionHost * host_;
+            /** Index of the worker whose event loop the session is registered with.
+             */
+            size_t owner_;
+            OutputHandler output_;
+            ExitHandler exit_;
+
+            /** Protects the state and the input.
+             */
+            std::mutex guard_;
+            State state_ = State::Armed;
+            std::string input_;
+            std::atomic<bool> terminated_ = false;
+
+        }; // tpp::pty::SessionHost::Session
+
+        /** Creates the host with given number of worker threads, defaults to the number of cores.
+         */
+        explicit SessionHost(size_t numWorkers = 0);
+
+        /** Stops the workers and terminates all sessions.
+
+            The children of all sessions are hung up together and those still running after LocalServer::HangupTimeout are killed.
+         */
+        ~SessionHost();
+
+        SessionHost(SessionHost const &) = delete;
+        SessionHost & operator = (SessionHost const &) = delete;
+
+        /** Spawns a new session, see LocalServer for the arguments. The handlers are called from the worker threads.
+         */
+        std::shared_ptr<Session> spawn(std::vector<std::string> const & command, OutputHandler output, ExitHandler exit, std::unordered_map<std::string, std::string> const & env = {}, int cols = 80, int rows = 25);
+
+        size_t numWorkers() const { return workers_.size(); }
+
+        /** Number of sessions whose children have not terminated yet.
+         */
+        size_t numSessions() const { return numSessions_; }
+
+        /** Number of sessions run by workers that did not own them.
+         */
+        size_t numStolen() const { return numStolen_; }
+
+    private:
+
+        struct Worker {
+            EventLoop loop;
+            /** Wakes the worker up when there are tasks, or sessions to steal.
+             */
+            int wakeup;
+            std::thread thread;
+
+            std::mutex guard;
+            std::deque<Session *> runQueue;
+            /** Size of the run queue, readable without the lock by the stealing workers.
+             */
+            std::atomic<size_t> queued = 0;
+            std::atomic<bool> idle = false;
+            /** Functions to be executed by the worker, such as registering and unregistering sessions with its event loop.
+             */
+            std::vector<std::function<void()>> tasks;
+            /** Sessions owned by the worker.
+             */
+            std::unordered_map<Session *, std::shared_ptr<Session>> sessions;
+        };
+
+        void workerMain(size_t index);
+
+        /** Executes the function on given worker's thread.
+         */
+        void post(size_t worker, std::function<void()> task);
+
+        void wake(Worker & worker);
+
+        /** Puts the session at the end of the worker's run queue and wakes an idle worker to steal it if the worker already has sessions to run.
+         */
+        void enqueue(size_t worker, Session * session);
+
+        Session * dequeue(size_t worker);
+
+        /** Moves half of the run queue of the busiest worker to the given worker and returns the first of the stolen sessions.
+         */
+        Session * steal(size_t worker);
+
+        /** Runs the session for a single time slice.
+         */
+        void run(size_t worker, Session * session);
+
+        /** Re-arms the session with its owner's event loop, waiting for output, or for the terminal to accept pending input.
+         */
+        void arm(Session * session);
+
+        /** Called when the session's output ended, reaps the child and unregisters the session.
+         */
+        void terminate(Session * session);
+
+        void finish(Session * session, int exitCode);
+
+        std::vector<std::unique_ptr<Worker>> workers_;
+        std::atomic<bool> stop_ = false;
+        std::atomic<size_t> nextOwner_ = 0;
+        std::atomic<size_t> numSessions_ = 0;
+        std::atomic<size_t> numStolen_ = 0;
+
+    }; // tpp::pty::SessionHost
+
+#endif // ARCH_LINUX
+
+} // namespace tpp::pty
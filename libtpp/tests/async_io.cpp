@@ -0,0 +1,223 @@
+#if (defined ARCH_LINUX)
+
+#include <fcntl.h>
+#include <pty.h>
+
+#include "helpers/helpers_tests.h"
+#include "libtpp/async_io.h"
+
+using namespace tpp;
+
+namespace {
+
+    /** Pseudoterminal pair in the raw mode so that the data passes unchanged. 
+     */
+    struct PTYPair {
+        int master;
+        int slave;
+
+        PTYPair() {
+            OSCHECK(openpty(& master, & slave, nullptr, nullptr, nullptr) == 0);
+            termios t;
+            OSCHECK(tcgetattr(slave, & t) == 0);
+            cfmakeraw(& t);
+            OSCHECK(tcsetattr(slave, TCSANOW, & t) == 0);
+        }
+
+        ~PTYPair() {
+            closeSlave();
+            close(master);
+        }
+
+        void closeSlave() {
+            if (slave != -1)
+                close(slave);
+            slave = -1;
+        }
+
+        void write(std::string const & what) { OSCHECK(::write(slave, what.c_str(), what.size()) == static_cast<ssize_t>(what.size())); }
+
+        /** Reads given number of bytes from the slave. 
+         */
+        std::string read(size_t numBytes) {
+            std::string result(numBytes, ' ');
+            size_t n = 0;
+            while (n < numBytes) {
+                ssize_t x = ::read(slave, result.data() + n, numBytes - n);
+                OSCHECK(x > 0);
+                n += static_cast<size_t>(x);
+            }
+            return result;
+        }
+    };
+
+    std::vector<AsyncIO::Backend> Backends() {
+        std::vector<AsyncIO::Backend> result{AsyncIO::Backend::Epoll};
+        if (AsyncIO::IoUringAvailable())
+            result.push_back(AsyncIO::Backend::IoUring);
+        return result;
+    }
+
+}
+
+TEST(AsyncIO, ReceiveAndSend) {
+    for (auto backend : Backends()) {
+        auto io = AsyncIO::Create(backend);
+        EXPECT(io->backend() == backend);
+        PTYPair p;
+        std::string received;
+        io->add(p.master, [&](char const * data, size_t numBytes) { received.append(data, numBytes); });
+        p.write("hello");
+        p.write(" world");
+        while (received.size() < 11)
+            io->poll();
+        EXPECT(received, "hello world");
+        // the sends are written by the next poll
+        io->send(p.master, "foo", 3);
+        io->send(p.master, "bar", 3);
+        EXPECT(io->pending(p.master), (size_t) 6);
+        while (io->pending(p.master) > 0)
+            io->poll(10);
+        EXPECT(p.read(6), "foobar");
+        io->remove(p.master);
+    }
+}
+
+TEST(AsyncIO, ManySessions) {
+    for (auto backend : Backends()) {
+        auto io = AsyncIO::Create(backend);
+        std::vector<std::unique_ptr<PTYPair>> pairs;
+        std::vector<std::string> received(64);
+        for (size_t i = 0; i < received.size(); ++i) {
+            pairs.push_back(std::make_unique<PTYPair>());
+            io->add(pairs[i]->master, [&received, i](char const * data, size_t numBytes) { received[i].append(data, numBytes); });
+        }
+        for (size_t round = 0; round < 10; ++round) {
+            for (size_t i = 0; i < pairs.size(); ++i)
+                pairs[i]->write(STR(i << ":" << round << ";"));
+            for (size_t i = 0; i < pairs.size(); ++i)
+                io->send(pairs[i]->master, "x", 1);
+            // the sends are in flight until their completion is processed by a poll
+            size_t done = 0;
+            while (done < pairs.size()) {
+                io->poll(10);
+                done = 0;
+                for (size_t i = 0; i < pairs.size(); ++i)
+                    if (received[i].size() == STR(i << ":" << round << ";").size() * (round + 1) && io->pending(pairs[i]->master) == 0)
+                        ++done;
+            }
+            for (size_t i = 0; i < pairs.size(); ++i)
+                EXPECT(pairs[i]->read(1), "x");
+        }
+        for (size_t i = 0; i < pairs.size(); ++i) {
+            EXPECT(received[i], STR(i << ":0;" << i << ":1;" << i << ":2;" << i << ":3;" << i << ":4;" << i << ":5;" << i << ":6;" << i << ":7;" << i << ":8;" << i << ":9;"));
+            io->remove(pairs[i]->master);
+        }
+    }
+}
+
+TEST(AsyncIO, LargeWrite) {
+    for (auto backend : Backends()) {
+        auto io = AsyncIO::Create(backend);
+        PTYPair p;
+        io->add(p.master, [](char const *, size_t) {});
+        // more than the pty buffer, so that the write is partial
+        std::string data;
+        for (size_t i = 0; data.size() < 256 * 1024; ++i)
+            data += STR(i << ";");
+        io->send(p.master, data.c_str(), data.size());
+        std::string received;
+        while (received.size() < data.size()) {
+            io->poll(0);
+            char buffer[4096];
+            ssize_t n = ::read(p.slave, buffer, sizeof(buffer));
+            OSCHECK(n > 0);
+            received.append(buffer, static_cast<size_t>(n));
+        }
+        EXPECT(received == data);
+        EXPECT(io->pending(p.master), (size_t) 0);
+        io->remove(p.master);
+    }
+}
+
+TEST(AsyncIO, LargeReceive) {
+    for (auto backend : Backends()) {
+        auto io = AsyncIO::Create(backend);
+        PTYPair p;
+        std::string received;
+        io->add(p.master, [&](char const * data, size_t numBytes) { received.append(data, numBytes); });
+        // many reads, whose data must be received in order
+        std::string data;
+        for (size_t i = 0; data.size() < 1024 * 1024; ++i)
+            data += STR(i << ";");
+        OSCHECK(fcntl(p.slave, F_SETFL, fcntl(p.slave, F_GETFL) | O_NONBLOCK) == 0);
+        size_t written = 0;
+        while (received.size() < data.size()) {
+            if (written < data.size()) {
+                ssize_t n = ::write(p.slave, data.c_str() + written, data.size() - written);
+                if (n > 0)
+                    written += static_cast<size_t>(n);
+            }
+            io->poll(0);
+        }
+        EXPECT(received == data);
+        io->remove(p.master);
+    }
+}
+
+TEST(AsyncIO, EndOfInput) {
+    for (auto backend : Backends()) {
+        auto io = AsyncIO::Create(backend);
+        PTYPair p;
+        size_t eofs = 0;
+        std::string received;
+        io->add(p.master, [&](char const * data, size_t numBytes) {
+            if (numBytes == 0)
+                ++eofs;
+            else
+                received.append(data, numBytes);
+        });
+        p.write("bye");
+        p.closeSlave();
+        while (eofs == 0)
+            io->poll();
+        EXPECT(received, "bye");
+        EXPECT(eofs, (size_t) 1);
+        EXPECT(io->poll(10), (size_t) 0);
+        io->remove(p.master);
+    }
+}
+
+TEST(AsyncIO, RemoveFromHandler) {
+    for (auto backend : Backends()) {
+        auto io = AsyncIO::Create(backend);
+        PTYPair data;
+        PTYPair eof;
+        // the captures keep the handlers' state on the heap, where it would be freed by an early removal
+        auto received = std::make_shared<std::string>();
+        auto eofs = std::make_shared<size_t>(0);
+        io->add(data.master, [&io, &data, received](char const * buffer, size_t numBytes) {
+            received->append(buffer, numBytes);
+            io->remove(data.master);
+            received->append("!");
+        });
+        io->add(eof.master, [&io, &eof, eofs](char const *, size_t numBytes) {
+            if (numBytes != 0)
+                return;
+            io->remove(eof.master);
+            ++*eofs;
+        });
+        data.write("abc");
+        eof.closeSlave();
+        while (received->empty() || *eofs == 0)
+            io->poll(10);
+        EXPECT(*received, "abc!");
+        EXPECT(*eofs, (size_t) 1);
+        // neither handler is called any more
+        data.write("def");
+        EXPECT(io->poll(10), (size_t) 0);
+        EXPECT(*received, "abc!");
+    }
+}
+
+#endif
@@ -0,0 +1,98 @@
+#if (defined ARCH_LINUX)
+
+#include "helpers/helpers_tests.h"
+#include "libtpp/event_loop.h"
+
+using namespace tpp;
+
+namespace {
+
+    /** Pipe that closes both ends when destroyed.
+     */
+    struct Pipe {
+        int fd[2];
+
+        Pipe() { OSCHECK(pipe(fd) == 0); }
+        ~Pipe() { close(fd[0]); close(fd[1]); }
+
+        void write(std::string const & what) { OSCHECK(::write(fd[1], what.c_str(), what.size()) == static_cast<ssize_t>(what.size())); }
+
+        std::string read() {
+            char buffer[64];
+            ssize_t n = ::read(fd[0], buffer, sizeof(buffer));
+            OSCHECK(n >= 0);
+            return std::string(buffer, static_cast<size_t>(n));
+        }
+    };
+
+}
+
+TEST(EventLoop, Timeout) {
+    EventLoop loop;
+    Pipe p;
+    size_t calls = 0;
+    loop.add(p.fd[0], EPOLLIN, [&](int, uint32_t) { ++calls; });
+    EXPECT(loop.poll(0), (size_t) 0);
+    EXPECT(calls, (size_t) 0);
+}
+
+TEST(EventLoop, AllReadyInSingleWakeup) {
+    EventLoop loop;
+    Pipe a;
+    Pipe b;
+    std::string received;
+    loop.add(a.fd[0], EPOLLIN, [&](int, uint32_t) { received += a.read(); });
+    loop.add(b.fd[0], EPOLLIN, [&](int, uint32_t) { received += b.read(); });
+    a.write("foo");
+    a.write("bar");
+    b.write("baz");
+    EXPECT(loop.poll(), (size_t) 2);
+    EXPECT(received.size(), (size_t) 9);
+    EXPECT(loop.poll(0), (size_t) 0);
+}
+
+TEST(EventLoop, RemoveFromHandler) {
+    EventLoop loop;
+    Pipe a;
+    Pipe b;
+    size_t calls = 0;
+    // whichever handler is called first removes the other one
+    loop.add(a.fd[0], EPOLLIN, [&](int, uint32_t) { ++calls; loop.remove(b.fd[0]); loop.remove(a.fd[0]); });
+    loop.add(b.fd[0], EPOLLIN, [&](int, uint32_t) { ++calls; loop.remove(a.fd[0]); loop.remove(b.fd[0]); });
+    a.write("x");
+    b.write("y");
+    EXPECT(loop.poll(), (size_t) 1);
+    EXPECT(calls, (size_t) 1);
+    EXPECT(! loop.contains(a.fd[0]));
+    EXPECT(! loop.contains(b.fd[0]));
+    EXPECT(loop.poll(0), (size_t) 0);
+}
+
+TEST(EventLoop, TryAdd) {
+    EventLoop loop;
+    Pipe p;
+    EXPECT(loop.tryAdd(p.fd[0], EPOLLIN, [](int, uint32_t) {}));
+    EXPECT(loop.contains(p.fd[0]));
+    // regular files can't be polled
+    FILE * f = tmpfile();
+    CHECK(f != nullptr);
+    EXPECT(! loop.tryAdd(fileno(f), EPOLLIN, [](int, uint32_t) {}));
+    EXPECT(! loop.contains(fileno(f)));
+    fclose(f);
+}
+
+TEST(EventLoop, Timers) {
+    EventLoop loop;
+    size_t once = 0;
+    size_t periodic = 0;
+    int t = loop.addTimer(std::chrono::milliseconds{1}, false, [&]() { ++once; });
+    int p = loop.addTimer(std::chrono::milliseconds{1}, true, [&]() { ++periodic; });
+    while (once == 0 || periodic < 3)
+        loop.poll();
+    EXPECT(once, (size_t) 1);
+    EXPECT(! loop.contains(t));
+    loop.removeTimer(p);
+    EXPECT(loop.poll(10), (size_t) 0);
+}
+
+#endif
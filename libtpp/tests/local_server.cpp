@@ -0,0 +1,97 @@
+#if (defined ARCH_UNIX)
+
+#include "helpers/helpers_tests.h"
+#include "libtpp/pty.h"
+
+using namespace tpp;
+using namespace tpp::pty;
+
+namespace {
+
+    /** Receives everything the child outputs until it closes the terminal. 
+     */
+    std::string ReceiveAll(LocalServer & server) {
+        std::string result;
+        char buffer[1024];
+        while (size_t numBytes = server.receive(buffer, sizeof(buffer)))
+            result.append(buffer, numBytes);
+        return result;
+    }
+
+}
+
+TEST(LocalServer, Output) {
+    LocalServer server{{"sh", "-c", "echo hello; exit 3"}};
+    EXPECT(server.pidfd() >= 0 || server.pid() > 0);
+    EXPECT(ReceiveAll(server), "hello\r\n");
+    EXPECT(server.wait(), 3);
+    EXPECT(server.exitCode().value(), 3);
+}
+
+TEST(LocalServer, Input) {
+    LocalServer server{{"sh", "-c", "read x; echo got $x"}};
+    server.send("abc\n", 4);
+    std::string output = ReceiveAll(server);
+    // the input is echoed by the terminal first
+    EXPECT(output, "abc\r\ngot abc\r\n");
+    EXPECT(server.wait(), 0);
+}
+
+TEST(LocalServer, ControllingTerminalAndSize) {
+    LocalServer server{{"sh", "-c", "stty size; tty > /dev/tty && echo ok"}, {}, 120, 40};
+    std::string output = ReceiveAll(server);
+    EXPECT(output.substr(0, 8), "40 120\r\n");
+    EXPECT(output.substr(output.size() - 4), "ok\r\n");
+    EXPECT(server.wait(), 0);
+}
+
+TEST(LocalServer, Environment) {
+    LocalServer server{{"sh", "-c", "echo $TERM $COLORTERM $FOO $COLUMNS"}, {{"FOO", "bar"}, {"COLORTERM", "24bit"}}};
+    EXPECT(ReceiveAll(server), "xterm-256color 24bit bar\r\n");
+}
+
+TEST(LocalServer, TryReceiveAndExitCode) {
+    LocalServer server{{"sh", "-c", "read x; exit 5"}};
+    char buffer[16];
+    EXPECT(! server.tryReceive(buffer, sizeof(buffer)).has_value());
+    EXPECT(! server.exitCode().has_value());
+    server.send("\n", 1);
+    ReceiveAll(server);
+    EXPECT(server.wait(), 5);
+}
+
+TEST(LocalServer, HangupOnDestruction) {
+    pid_t pid;
+    {
+        LocalServer server{{"sleep", "100"}};
+        pid = server.pid();
+    }
+    // the child has been hung up and reaped
+    EXPECT(kill(pid, 0) == -1 && errno == ESRCH);
+}
+
+TEST(LocalServer, KillOnDestruction) {
+    pid_t pid;
+    auto start = std::chrono::steady_clock::now();
+    {
+        // the child ignores the hangup
+        LocalServer server{{"sh", "-c", "trap '' HUP; exec sleep 100"}};
+        pid = server.pid();
+        EXPECT(! server.wait(std::chrono::milliseconds{100}).has_value());
+    }
+    EXPECT(std::chrono::steady_clock::now() - start < std::chrono::seconds{10});
+    EXPECT(kill(pid, 0) == -1 && errno == ESRCH);
+}
+
+TEST(LocalServer, Hangup) {
+    LocalServer server{{"sleep", "100"}};
+    server.hangup();
+    EXPECT(server.wait(std::chrono::seconds{10}).has_value());
+    EXPECT(server.kill(), server.wait());
+}
+
+TEST(LocalServer, InvalidCommand) {
+    EXPECT_THROWS(OSError, LocalServer({"/nonexistent/command"}));
+}
+
+#endif
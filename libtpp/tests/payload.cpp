@@ -0,0 +1,41 @@
+#include "helpers/helpers_tests.h"
+#include "libtpp/payload.h"
+
+using namespace tpp;
+
+TEST(Payload, Borrowed) {
+    std::string data{"hello"};
+    Payload p{data};
+    EXPECT(p.data(), data.c_str());
+    EXPECT(! p.owned());
+    // copies of borrowed payloads are borrowed as well
+    Payload q{p};
+    EXPECT(q.data(), data.c_str());
+    EXPECT(q, "hello");
+}
+
+TEST(Payload, Detach) {
+    std::string data{"hello"};
+    Payload p{data};
+    p.detach();
+    EXPECT(p.owned());
+    EXPECT(p.data() != data.c_str());
+    data = "xxxxx";
+    EXPECT(p, "hello");
+    Payload q{p};
+    EXPECT(q.data() != p.data());
+    EXPECT(q, "hello");
+    Payload r{std::move(p)};
+    EXPECT(r, "hello");
+    EXPECT(r.owned());
+    EXPECT(p.empty());
+}
+
+TEST(Payload, Own) {
+    Payload p = Payload::Own("foo");
+    EXPECT(p.owned());
+    EXPECT(p.str(), std::string{"foo"});
+    p = Payload{"bar"};
+    EXPECT(! p.owned());
+    EXPECT(p, "bar");
+}
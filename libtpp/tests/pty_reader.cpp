@@ -0,0 +1,84 @@
+#include "helpers/helpers_tests.h"
+#include "libtpp/pty_reader.h"
+#include "libtpp/sequence_writer.h"
+
+using namespace tpp;
+
+namespace {
+
+    /** PTY that returns the given input in chunks of given size. 
+     */
+    class FakePTY : public pty::PTY {
+    public:
+        FakePTY(std::string input, size_t chunkSize): input_{std::move(input)}, chunkSize_{chunkSize} {}
+
+        void send(char const *, size_t) override {}
+
+        size_t receive(char * buffer, size_t bufferLength) override {
+            size_t n = std::min({chunkSize_, bufferLength, input_.size() - pos_});
+            std::memcpy(buffer, input_.c_str() + pos_, n);
+            pos_ += n;
+            return n;
+        }
+
+    private:
+        std::string input_;
+        size_t chunkSize_;
+        size_t pos_ = 0;
+    };
+
+    /** Receives everything from the reader and serializes it, concatenating adjacent text runs. 
+     */
+    std::string ReceiveAll(pty::Reader & r) {
+        SequenceWriter w;
+        while (auto seq = r.receive())
+            w << seq.value();
+        return std::string{w.view()};
+    }
+
+}
+
+TEST(PTYReader, Receive) {
+    SequenceWriter w;
+    w.text("hello").csi(3, 4, 'H').dec(25, false).text("world").osc(2, {"title"}).tpp(0, {"80", "25"}).csi(1, 'm').text("!");
+    std::string input{w.view()};
+    for (size_t chunk = 1; chunk < 16; ++chunk) {
+        pty::Reader r{std::make_unique<FakePTY>(input, chunk), 4096};
+        EXPECT(ReceiveAll(r), input);
+        EXPECT(r.eof());
+    }
+}
+
+TEST(PTYReader, WrapAround) {
+    // sequences and text runs wrap around the end of the small ring buffer many times
+    SequenceWriter w;
+    for (int i = 0; i < 1000; ++i)
+        w.text("some text").osc(2, {"window title"}).csi(i, i + 1, 'H').tpp(56, {"foo", "bar"});
+    std::string input{w.view()};
+    pty::Reader r{std::make_unique<FakePTY>(input, 1000), 4096};
+    EXPECT(ReceiveAll(r), input);
+}
+
+TEST(PTYReader, LargeSequence) {
+    // the sequence does not fit in the buffer, which grows
+    std::string clipboard(20000, 'a');
+    SequenceWriter w;
+    w.text("x").osc(52, {"c", clipboard}).text("y");
+    std::string input{w.view()};
+    pty::Reader r{std::make_unique<FakePTY>(input, 3000), 4096};
+    EXPECT(ReceiveAll(r), input);
+}
+
+TEST(PTYReader, Errors) {
+    pty::Reader r{std::make_unique<FakePTY>("ab\033[1<Hcd\033[1;2", 3), 4096};
+    auto text = r.receive();
+    CHECK(text.has_value() && std::holds_alternative<Payload>(text.value()));
+    EXPECT(std::get<Payload>(text.value()), "ab");
+    EXPECT_THROWS(SequenceError, r.receive());
+    EXPECT(r.pop(), '<');
+    EXPECT(r.pop(), 'H');
+    EXPECT(ReceiveAll(r), std::string{"cd"});
+    // incomplete sequence at the end of input
+    EXPECT(r.available(), (size_t) 5);
+    EXPECT_THROWS(Reader::EndOfFile, r.peek(5));
+}
@@ -0,0 +1,135 @@
+#include "helpers/helpers_tests.h"
+#include "libtpp/reader.h"
+#include "libtpp/sequence.h"
+#include "libtpp/sequence_writer.h"
+
+using namespace tpp;
+
+namespace {
+
+    /** Source for the buffered reader that returns the input in chunks of given size.
+     */
+    struct ChunkedSource {
+        std::string input;
+        size_t chunkSize;
+        size_t reads = 0;
+        size_t pos = 0;
+
+        size_t operator () (char * buffer, size_t bufferSize) {
+            ++reads;
+            size_t n = std::min({chunkSize, bufferSize, input.size() - pos});
+            std::memcpy(buffer, input.c_str() + pos, n);
+            pos += n;
+            return n;
+        }
+    };
+
+    std::string Serialize(Sequence const & seq) {
+        SequenceWriter w;
+        w << seq;
+        return std::string{w.view()};
+    }
+
+}
+
+TEST(Reader, Span) {
+    std::string input{"abcd"};
+    Reader r{input.c_str(), input.size()};
+    EXPECT(r.available(), (size_t) 4);
+    EXPECT(r.require(4));
+    EXPECT(! r.require(5));
+    EXPECT(r.top(), 'a');
+    EXPECT(r.peek(3), 'd');
+    EXPECT_THROWS(Reader::EndOfFile, r.peek(4));
+    r.advance(3);
+    EXPECT(r.data(), input.c_str() + 3);
+    EXPECT(r.pop(), 'd');
+    EXPECT(r.eof());
+    EXPECT_THROWS(Reader::EndOfFile, r.top());
+}
+
+TEST(Reader, Buffered) {
+    BufferedReader<ChunkedSource> r{ChunkedSource{"abcdefghij", 3}, 4};
+    EXPECT(r.available(), (size_t) 0);
+    // single read
+    EXPECT(r.require(2));
+    EXPECT(r.available(), (size_t) 3);
+    EXPECT(r.pop(), 'a');
+    EXPECT(r.pop(), 'b');
+    // the unread byte is moved to the beginning and the buffer grows as 6 bytes don't fit
+    EXPECT(r.require(6));
+    EXPECT(std::string(r.data(), r.available()), std::string{"cdefghi"});
+    r.advance(7);
+    // the stream API refills as well
+    EXPECT(r.peek(0), 'j');
+    EXPECT(r.pop(), 'j');
+    EXPECT(r.eof());
+    EXPECT(! r.require(1));
+    EXPECT_THROWS(Reader::EndOfFile, r.top());
+}
+
+TEST(Reader, ParseSequence) {
+    SequenceWriter w;
+    w.csi(3, 4, 'H').dec(25, false).osc(2, {"title"}).tpp(0, {"80", "25"});
+    w.csi(1, 'm').csi('K');
+    std::string input{w.view()};
+    std::vector<std::string> expected;
+    char const * x = input.c_str();
+    char const * end = x + input.size();
+    while (x != end) {
+        auto seq = ParseSequence(x, end);
+        CHECK(seq.has_value());
+        expected.push_back(Serialize(seq.value()));
+    }
+    {
+        Reader r{input.c_str(), input.size()};
+        size_t i = 0;
+        while (auto seq = ParseSequence(r))
+            EXPECT(Serialize(seq.value()), expected[i++]);
+        EXPECT(i, expected.size());
+        EXPECT(r.eof());
+    }
+    // the sequences are split across the reads
+    for (size_t chunk = 1; chunk < 8; ++chunk) {
+        BufferedReader<ChunkedSource> r{ChunkedSource{input, chunk}, 8};
+        size_t i = 0;
+        while (auto seq = ParseSequence(r))
+            EXPECT(Serialize(seq.value()), expected[i++]);
+        EXPECT(i, expected.size());
+        EXPECT(r.eof());
+    }
+}
+
+TEST(Reader, SpecificParsers) {
+    BufferedReader<ChunkedSource> r{ChunkedSource{"\033[1;2H\033[?1049;25h\033]52;c;abc\a\033P3t1;2\033\\", 2}, 4};
+    auto csi = CSISequence::Parse(r);
+    CHECK(csi.has_value());
+    EXPECT(csi->suffix(), 'H');
+    EXPECT(csi->numArgs(), (size_t) 2);
+    auto dec = DECSequence::Parse(r);
+    CHECK(dec.has_value());
+    EXPECT(dec->numIds(), (size_t) 2);
+    auto osc = OSCSequence::Parse(r);
+    CHECK(osc.has_value());
+    EXPECT(osc->values.size(), (size_t) 2);
+    EXPECT(osc->values[1], "abc");
+    auto tpp = TppSequence::Parse(r);
+    CHECK(tpp.has_value());
+    EXPECT(tpp->id, 3);
+    EXPECT(tpp->args.size(), (size_t) 2);
+    EXPECT(r.eof());
+}
+
+TEST(Reader, IncompleteAndError) {
+    // incomplete sequence at the end of the input leaves the reader unchanged
+    BufferedReader<ChunkedSource> r{ChunkedSource{"\033[1;2", 2}, 4};
+    EXPECT(! CSISequence::Parse(r).has_value());
+    EXPECT(r.available(), (size_t) 5);
+    // errors advance the reader to the offending character
+    BufferedReader<ChunkedSource> e{ChunkedSource{"\033[1;2<H", 3}, 4};
+    EXPECT_THROWS(SequenceError, CSISequence::Parse(e));
+    EXPECT(e.top(), '<');
+    BufferedReader<ChunkedSource> s{ChunkedSource{"\033[?1xh", 3}, 4};
+    EXPECT_THROWS(SequenceError, ParseSequence(s));
+    EXPECT(s.top(), 'x');
+}
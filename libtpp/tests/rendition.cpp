@@ -0,0 +1,150 @@
+#include "helpers/helpers_tests.h"
+#include "libtpp/sequence_parser.h"
+#include "libtpp/sequence_writer.h"
+
+using namespace tpp;
+
+namespace {
+
+    /** Parses the SGR sequence with TryParseSequence, which decodes the arguments directly from the buffer.
+     */
+    RenditionDelta Parse(std::string const & buffer) {
+        char const * x = buffer.c_str();
+        std::optional<Sequence> seq;
+        if (TryParseSequence(x, x + buffer.size(), seq) != ParseResult::Ok || x != buffer.c_str() + buffer.size() || ! std::holds_alternative<SelectGraphicRendition>(seq.value()))
+            throw SequenceError{STR("Not a SGR sequence: " << buffer)};
+        return std::get<SelectGraphicRendition>(seq.value()).delta;
+    }
+
+    /** Parses the SGR sequence with SequenceParser, which decodes the already parsed arguments.
+     */
+    RenditionDelta Feed(std::string const & buffer) {
+        SequenceParser p;
+        char const * x = buffer.c_str();
+        auto seq = p.feed(x, x + buffer.size());
+        if (! seq.has_value() || ! std::holds_alternative<SelectGraphicRendition>(seq.value()))
+            throw SequenceError{STR("Not a SGR sequence: " << buffer)};
+        return std::get<SelectGraphicRendition>(seq.value()).delta;
+    }
+
+}
+
+TEST(Rendition, Attributes) {
+    RenditionDelta d = Parse("\033[1;3;4;9m");
+    EXPECT(d.set, (uint16_t) (Rendition::Bold | Rendition::Italic | Rendition::Strikethrough));
+    EXPECT(d.clear, (uint16_t) 0);
+    EXPECT(d.changes, (uint8_t) RenditionDelta::Underline);
+    EXPECT(d.underline == UnderlineStyle::Single);
+    // later arguments override the earlier ones
+    d = Parse("\033[1;2;22;7m");
+    EXPECT(d.set, (uint16_t) Rendition::Inverse);
+    EXPECT(d.clear, (uint16_t) (Rendition::Bold | Rendition::Faint));
+    // reset discards everything before it
+    d = Parse("\033[1;31;0;3m");
+    EXPECT(d.changes, (uint8_t) RenditionDelta::Reset);
+    EXPECT(d.set, (uint16_t) Rendition::Italic);
+    // missing arguments are reset too
+    EXPECT(Parse("\033[m").changes, (uint8_t) RenditionDelta::Reset);
+    EXPECT(Parse("\033[;1m").set, (uint16_t) Rendition::Bold);
+    EXPECT(Parse("\033[1;m").set, (uint16_t) 0);
+    // unknown codes are ignored
+    EXPECT(Parse("\033[1000;1m").set, (uint16_t) Rendition::Bold);
+}
+
+TEST(Rendition, Underline) {
+    EXPECT(Parse("\033[4:3m").underline == UnderlineStyle::Curly);
+    EXPECT(Parse("\033[4:5m").underline == UnderlineStyle::Dashed);
+    EXPECT(Parse("\033[4:0m").underline == UnderlineStyle::None);
+    EXPECT(Parse("\033[21m").underline == UnderlineStyle::Double);
+    EXPECT(Parse("\033[4;24m").underline == UnderlineStyle::None);
+    EXPECT(Parse("\033[4;24m").changes, (uint8_t) RenditionDelta::Underline);
+    // invalid style is ignored
+    EXPECT(Parse("\033[4:9m").changes, (uint8_t) 0);
+}
+
+TEST(Rendition, Colors) {
+    EXPECT(Parse("\033[31m").foreground == Color::Indexed(1));
+    EXPECT(Parse("\033[97m").foreground == Color::Indexed(15));
+    EXPECT(Parse("\033[42m").background == Color::Indexed(2));
+    EXPECT(Parse("\033[107m").background == Color::Indexed(15));
+    EXPECT(Parse("\033[31;39m").foreground == Color{});
+    EXPECT(Parse("\033[31;39m").changes, (uint8_t) RenditionDelta::Foreground);
+    // all forms of extended colors
+    EXPECT(Parse("\033[38;5;123m").foreground == Color::Indexed(123));
+    EXPECT(Parse("\033[38:5:123m").foreground == Color::Indexed(123));
+    EXPECT(Parse("\033[48;2;10;20;30m").background == Color::RGB(10, 20, 30));
+    EXPECT(Parse("\033[48:2::10:20:30m").background == Color::RGB(10, 20, 30));
+    EXPECT(Parse("\033[48:2:0:10:20:30m").background == Color::RGB(10, 20, 30));
+    EXPECT(Parse("\033[48:2:10:20:30m").background == Color::RGB(10, 20, 30));
+    EXPECT(Parse("\033[58:2::1:2:3m").underlineColor == Color::RGB(1, 2, 3));
+    EXPECT(Parse("\033[58;5;3;59m").changes, (uint8_t) RenditionDelta::UnderlineColor);
+    EXPECT(Parse("\033[58;5;3;59m").underlineColor == Color{});
+    // arguments after the semicolon form are processed normally
+    RenditionDelta d = Parse("\033[38;2;1;2;3;1;48;5;7;4m");
+    EXPECT(d.foreground == Color::RGB(1, 2, 3));
+    EXPECT(d.background == Color::Indexed(7));
+    EXPECT(d.set, (uint16_t) Rendition::Bold);
+    EXPECT(d.underline == UnderlineStyle::Single);
+    // and so are arguments after colon form, whose sub-parameters are ignored
+    d = Parse("\033[38:2::1:2:3:4:5;1m");
+    EXPECT(d.foreground == Color::RGB(1, 2, 3));
+    EXPECT(d.set, (uint16_t) Rendition::Bold);
+    // out of range values are ignored
+    EXPECT(Parse("\033[38;5;256m").changes, (uint8_t) 0);
+    EXPECT(Parse("\033[38;2;1;256;3;1m").changes, (uint8_t) 0);
+}
+
+TEST(Rendition, SameForAllParsers) {
+    for (char const * s : { "\033[m", "\033[0m", "\033[1;3;4m", "\033[38;5;100;48:2::1:2:3m", "\033[4:3;58:5:9m", "\033[1;22;23;31;100;39;49m", "\033[;;1;m", "\033[38;2;1;2m", "\033[38:2:1:2:3:4:5:6:7m", "\033[38;5;12345678901234567890;1m" }) {
+        std::string buffer{s};
+        RenditionDelta d = Parse(buffer);
+        EXPECT(Feed(buffer) == d);
+        char const * x = buffer.c_str();
+        auto seq = CSISequence::Parse(x, x + buffer.size());
+        EXPECT(std::get<SelectGraphicRendition>(Specialize(std::move(seq.value()))).delta == d);
+    }
+}
+
+TEST(Rendition, RoundTrip) {
+    for (char const * s : { "\033[0m", "\033[1;3;4m", "\033[38;5;100;48:2::1:2:3m", "\033[4:3;58:5:9m", "\033[1;22;23;24;31;100;39;49m", "\033[0;92;47;58;5;1;21m" }) {
+        RenditionDelta d = Parse(s);
+        SequenceWriter w;
+        w << SelectGraphicRendition{d};
+        EXPECT(Parse(std::string{w.view()}) == d);
+    }
+    // empty delta is not written at all as no arguments would mean reset
+    SequenceWriter w;
+    w << SelectGraphicRendition{RenditionDelta{}};
+    EXPECT(w.empty());
+}
+
+TEST(Rendition, Apply) {
+    Rendition r;
+    Parse("\033[1;4:3;31;48;2;1;2;3m").apply(r);
+    EXPECT(r.attributes, (uint16_t) Rendition::Bold);
+    EXPECT(r.underline == UnderlineStyle::Curly);
+    EXPECT(r.foreground == Color::Indexed(1));
+    EXPECT(r.background == Color::RGB(1, 2, 3));
+    Parse("\033[22;3;39m").apply(r);
+    EXPECT(r.attributes, (uint16_t) Rendition::Italic);
+    EXPECT(r.underline == UnderlineStyle::Curly);
+    EXPECT(r.foreground == Color{});
+    EXPECT(r.background == Color::RGB(1, 2, 3));
+    Parse("\033[0;7m").apply(r);
+    Rendition expected;
+    expected.attributes = Rendition::Inverse;
+    EXPECT(r == expected);
+}
+
+TEST(Rendition, Invalid) {
+    // private parameters, such as xterm's modifyOtherKeys are not SGR
+    std::string buffer{"\033[>4;2m"};
+    char const * x = buffer.c_str();
+    std::optional<Sequence> seq;
+    EXPECT(TryParseSequence(x, x + buffer.size(), seq) == ParseResult::Error);
+    EXPECT(x == buffer.c_str() + 2);
+    buffer = "\033[1;38:2";
+    x = buffer.c_str();
+    EXPECT(TryParseSequence(x, x + buffer.size(), seq) == ParseResult::Incomplete);
+    EXPECT(x == buffer.c_str());
+}
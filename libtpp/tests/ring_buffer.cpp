@@ -0,0 +1,49 @@
+#include "helpers/helpers_tests.h"
+#include "libtpp/ring_buffer.h"
+
+using namespace tpp;
+
+TEST(RingBuffer, Capacity) {
+    RingBuffer b{5000};
+    EXPECT(b.capacity() >= 5000);
+    // power of two
+    EXPECT((b.capacity() & (b.capacity() - 1)), (size_t) 0);
+    EXPECT(b.empty());
+    EXPECT(b.writable(), b.capacity());
+#if (defined ARCH_LINUX)
+    EXPECT(b.mirrored());
+#endif
+}
+
+TEST(RingBuffer, WrapAround) {
+    RingBuffer b{4096};
+    size_t capacity = b.capacity();
+    // fill the buffer up to its last 3 bytes and consume most of it
+    std::memset(b.writePtr(), 'x', capacity - 3);
+    b.commit(capacity - 3);
+    b.consume(capacity - 5);
+    EXPECT(b.writable(), capacity - 2);
+    // the write wraps around the end of the buffer, but is contiguous
+    std::memcpy(b.writePtr(), "abcdefgh", 8);
+    b.commit(8);
+    EXPECT(b.size(), (size_t) 10);
+    EXPECT(std::string(b.data(), b.size()), std::string{"xxabcdefgh"});
+    b.consume(5);
+    EXPECT(std::string(b.data(), b.size()), std::string{"defgh"});
+    b.consume(5);
+    EXPECT(b.empty());
+}
+
+TEST(RingBuffer, Grow) {
+    RingBuffer b{4096};
+    size_t capacity = b.capacity();
+    std::memset(b.writePtr(), 'x', capacity - 2);
+    b.commit(capacity - 2);
+    b.consume(capacity - 4);
+    std::memcpy(b.writePtr(), "abcd", 4);
+    b.commit(4);
+    b.grow(capacity * 3);
+    EXPECT(b.capacity() >= capacity * 3);
+    EXPECT(std::string(b.data(), b.size()), std::string{"xxabcd"});
+    EXPECT(b.writable(), b.capacity() - 6);
+}
@@ -112,6 +112,24 @@ TEST(CSISequence, DefaultArguments) {
     EXPECT(x == buffer.c_str() + 9);
 }
 
+TEST(CSISequence, SubParameters) {
+    std::string buffer{"\033[1;38:2::10:20:30;4:3z"};
+    char const * x = buffer.c_str();
+    auto r = CSISequence::Parse(x, x + buffer.size());
+    CHECK(r.has_value());
+    EXPECT(x == buffer.c_str() + buffer.size());
+    EXPECT(r->numArgs(), (size_t) 9);
+    EXPECT(! r->args().isSubParameter(0));
+    EXPECT(! r->args().isSubParameter(1));
+    EXPECT(r->args().isSubParameter(2));
+    EXPECT(! r->args().has(3));
+    EXPECT(r->args().isSubParameter(6));
+    EXPECT(! r->args().isSubParameter(7));
+    EXPECT(r->args().isSubParameter(8));
+    EXPECT(STR(PRETTY(r.value())), "ESC [ 1; 38: 2: : 10: 20: 30; 4: 3 z");
+    EXPECT(STR(r.value()), buffer);
+}
+
 TEST(CSISequence, CSI0Sequences) {
     #define CSI0(_, NAME, SUFFIX) { \
         std::string buffer{STR("\033[" << SUFFIX)}; \
@@ -181,9 +199,58 @@ TEST(DECSequence, DECSequencesLo) {
     #include "libtpp/sequences.inc.h"
 }
 
+TEST(DECSequence, MultipleIds) {
+    std::string buffer{"\033[?1049;1004;2004h"};
+    char const * x = buffer.c_str();
+    auto r = ParseSequence(x, x + buffer.size());
+    CHECK(r.has_value() && std::holds_alternative<DECSequence>(r.value()));
+    EXPECT(x == buffer.c_str() + buffer.size());
+    DECSequence & seq = std::get<DECSequence>(r.value());
+    CHECK(seq.numIds(), (size_t) 3);
+    EXPECT(seq.id(0), 1049);
+    EXPECT(seq.id(1), 1004);
+    EXPECT(seq.id(2), 2004);
+    EXPECT(seq.value == true);
+    EXPECT(STR(PRETTY(seq)), std::string{"ESC [ ? 1049; 1004; 2004h"});
+    EXPECT(STR(seq), buffer);
+    // long ids saturate rather than overflow
+    buffer = "\033[?12345678901234567890;25h";
+    x = buffer.c_str();
+    EXPECT(DECSequence::TryParse(x, x + buffer.size(), seq) == ParseResult::Ok);
+    EXPECT(seq.id(0), 65535);
+    EXPECT(seq.id(1), 25);
+    // multiple ids are never specialized, even if there is single id only
+    EXPECT(std::holds_alternative<DECSequence>(Specialize(DECSequence{{1049, 1049}, false})));
+    // missing ids
+    buffer = "\033[?1;;2l";
+    x = buffer.c_str();
+    EXPECT(DECSequence::TryParse(x, x + buffer.size(), seq) == ParseResult::Error);
+    EXPECT(x == buffer.c_str() + 5);
+    buffer = "\033[?1;l";
+    x = buffer.c_str();
+    EXPECT(DECSequence::TryParse(x, x + buffer.size(), seq) == ParseResult::Error);
+    EXPECT(x == buffer.c_str() + 5);
+    buffer = "\033[?1;2";
+    x = buffer.c_str();
+    EXPECT(DECSequence::TryParse(x, x + buffer.size(), seq) == ParseResult::Incomplete);
+    EXPECT(x == buffer.c_str());
+    // too many ids
+    std::string ids{"1"};
+    for (size_t i = 1; i < DECSequence::MaxIds; ++i)
+        ids += STR(";" << i);
+    buffer = "\033[?" + ids + "h";
+    x = buffer.c_str();
+    EXPECT(DECSequence::TryParse(x, x + buffer.size(), seq) == ParseResult::Ok);
+    EXPECT(seq.numIds(), DECSequence::MaxIds);
+    buffer = "\033[?" + ids + ";1h";
+    x = buffer.c_str();
+    EXPECT(DECSequence::TryParse(x, x + buffer.size(), seq) == ParseResult::Error);
+    EXPECT(x == buffer.c_str() + buffer.size() - 1);
+}
+
 TEST(OSCSequence, OSC1Sequences) {
     #define OSC1(_, NAME, ID, VALUE_NAME) { \
-        std::string buffer{STR("\033]" << ID << ";\b")}; \
+        std::string buffer{STR("\033]" << ID << ";\a")}; \
         char const * x = buffer.c_str(); \
         auto r = ParseSequence(x, x + buffer.size()); \
         EXPECT(r.has_value()); \
@@ -197,7 +264,7 @@ TEST(OSCSequence, OSC1Sequences) {
 
 TEST(OSCSequence, OSC2Sequences) {
     #define OSC2(_, NAME, ID, VALUE_NAME1, VALUE_NAME2) { \
-        std::string buffer{STR("\033]" << ID << ";;\b")}; \
+        std::string buffer{STR("\033]" << ID << ";;\a")}; \
         char const * x = buffer.c_str(); \
         auto r = ParseSequence(x, x + buffer.size()); \
         EXPECT(r.has_value()); \
@@ -262,6 +329,30 @@ TEST(TPPSequence, Arguments) {
 
 
 
+TEST(TPPSequence, DecodeArg) {
+    std::string data;
+    for (int i = 0; i < 256; ++i)
+        data.push_back(static_cast<char>(i));
+    data += "plain text long enough to be found by the vectorized search";
+    std::stringstream encoded;
+    TppSequence::Encode(encoded, data);
+    std::string buffer{encoded.str() + ";"};
+    char const * argEnd;
+    size_t size;
+    EXPECT(TppSequence::MeasureArg(buffer.c_str(), buffer.c_str() + buffer.size(), argEnd, size) == ParseResult::Ok);
+    EXPECT(argEnd, buffer.c_str() + buffer.size() - 1);
+    EXPECT(size, data.size());
+    std::string decoded(size, ' ');
+    EXPECT(TppSequence::DecodeArg(buffer.c_str(), argEnd, decoded.data()) == decoded.data() + size);
+    EXPECT(decoded == data);
+    // incomplete encoded byte and missing terminator
+    EXPECT(TppSequence::MeasureArg(buffer.c_str(), buffer.c_str() + 2, argEnd, size) == ParseResult::Incomplete);
+    EXPECT(TppSequence::MeasureArg(buffer.c_str(), buffer.c_str() + buffer.size() - 1, argEnd, size) == ParseResult::Incomplete);
+    buffer = "ab`1x;";
+    EXPECT(TppSequence::MeasureArg(buffer.c_str(), buffer.c_str() + buffer.size(), argEnd, size) == ParseResult::Error);
+    EXPECT(argEnd, buffer.c_str() + 4);
+}
+
 TEST(TPPSequence, Resize) {
     std::string buffer{"\033P0t0;0\033\\"};
     char const * x = buffer.c_str();
@@ -269,4 +360,205 @@ TEST(TPPSequence, Resize) {
     EXPECT(r.has_value());
     EXPECT(x, buffer.c_str() + buffer.size());
     EXPECT(std::holds_alternative<TerminalResize>(r.value()));
-}
\ No newline at end of file
+}
+TEST(Sequence, TryParseIncomplete) {
+    std::string buffer{"\033[?1049h\033]52;c;abc\a\033P0t80;25\033\\\033[5;6H"};
+    for (size_t i = 0; i < buffer.size(); ++i) {
+        char const * x = buffer.c_str();
+        char const * end = x + i;
+        while (x != end) {
+            std::optional<Sequence> seq;
+            char const * start = x;
+            ParseResult r = TryParseSequence(x, end, seq);
+            if (r == ParseResult::Incomplete) {
+                EXPECT(x == start);
+                EXPECT(! seq.has_value());
+                break;
+            }
+            CHECK(r == ParseResult::Ok);
+            EXPECT(seq.has_value());
+        }
+    }
+}
+
+TEST(Sequence, TryParseError) {
+    std::string buffer{"\033[12<"};
+    char const * x = buffer.c_str();
+    CSISequence csi;
+    EXPECT(CSISequence::TryParse(x, x + buffer.size(), csi) == ParseResult::Error);
+    EXPECT(x == buffer.c_str() + 4);
+    buffer = "\033[?h";
+    x = buffer.c_str();
+    DECSequence dec;
+    EXPECT(DECSequence::TryParse(x, x + buffer.size(), dec) == ParseResult::Error);
+    EXPECT(x == buffer.c_str() + 3);
+    buffer = "\033]a;\a";
+    x = buffer.c_str();
+    OSCSequence osc;
+    EXPECT(OSCSequence::TryParse(x, x + buffer.size(), osc) == ParseResult::Error);
+    EXPECT(x == buffer.c_str() + 2);
+    buffer = "\033P5tab`x0\033\\";
+    x = buffer.c_str();
+    TppSequence tpp;
+    EXPECT(TppSequence::TryParse(x, x + buffer.size(), tpp) == ParseResult::Error);
+    EXPECT(x == buffer.c_str() + 7);
+    // arguments not matching the specific sequence
+    buffer = "\033[1;2;3Hfoo";
+    x = buffer.c_str();
+    std::optional<Sequence> seq;
+    EXPECT(TryParseSequence(x, x + buffer.size(), seq) == ParseResult::Error);
+    EXPECT(x == buffer.c_str() + 8);
+    x = buffer.c_str();
+    EXPECT_THROWS(SequenceError, ParseSequence(x, x + buffer.size()));
+}
+
+TEST(TPPSequence, GenericViaParseSequence) {
+    std::string buffer{"\033P56tfoo;b`3bar\033\\"};
+    char const * x = buffer.c_str();
+    auto r = ParseSequence(x, x + buffer.size());
+    CHECK(r.has_value());
+    EXPECT(x, buffer.c_str() + buffer.size());
+    CHECK(std::holds_alternative<TppSequence>(r.value()));
+    EXPECT(std::get<TppSequence>(r.value()).args.size(), (size_t) 2);
+    EXPECT(std::get<TppSequence>(r.value()).args[1], "b;ar");
+}
+
+TEST(TPPSequence, LongNumbers) {
+    // the id and integer arguments saturate rather than overflow, the same as the other numeric arguments
+    std::string buffer{"\033P12345678901234567890t1;2\033\\"};
+    char const * x = buffer.c_str();
+    TppSequence tpp;
+    EXPECT(TppSequence::TryParse(x, x + buffer.size(), tpp) == ParseResult::Ok);
+    EXPECT(x == buffer.c_str() + buffer.size());
+    EXPECT(tpp.id, 65535);
+    buffer = "\033P0t12345678901234567890;25\033\\";
+    x = buffer.c_str();
+    EXPECT(TppSequence::TryParse(x, x + buffer.size(), tpp) == ParseResult::Ok);
+    Sequence seq = Specialize(std::move(tpp));
+    CHECK(std::holds_alternative<TerminalResize>(seq));
+    EXPECT(std::get<TerminalResize>(seq).cols, 65535);
+    EXPECT(std::get<TerminalResize>(seq).rows, 25);
+}
+
+TEST(CSISequence, CSInSequences) {
+    #define CSIn(_, NAME, SUFFIX, DEFAULT_VALUE) { \
+        std::string buffer{STR("\033[" << SUFFIX)}; \
+        char const * x = buffer.c_str(); \
+        auto r = ParseSequence(x, x + buffer.size()); \
+        EXPECT(r.has_value()); \
+        EXPECT(x == buffer.c_str() + buffer.size()); \
+        EXPECT(std::holds_alternative<NAME>(r.value())); \
+        auto seq = std::get<NAME>(r.value()); \
+        EXPECT(seq.numArgs(), (size_t) 0); \
+        EXPECT(seq.arg(0) == DEFAULT_VALUE); \
+        buffer = STR("\033[1;;3" << SUFFIX); \
+        x = buffer.c_str(); \
+        r = ParseSequence(x, x + buffer.size()); \
+        EXPECT(std::holds_alternative<NAME>(r.value())); \
+        seq = std::get<NAME>(r.value()); \
+        EXPECT(seq.numArgs(), (size_t) 3); \
+        EXPECT(seq.arg(0), 1); \
+        EXPECT(seq.arg(1) == DEFAULT_VALUE); \
+        EXPECT(seq.arg(2), 3); \
+    }
+    #include "libtpp/sequences.inc.h"
+}
+
+TEST(CSISequence, ManyArguments) {
+    std::string buffer{"\033["};
+    for (int i = 0; i < 40; ++i)
+        buffer += (i % 3 == 1) ? ";" : STR(i << ";");
+    buffer += "a";
+    char const * x = buffer.c_str();
+    auto r = CSISequence::Parse(x, x + buffer.size());
+    CHECK(r.has_value());
+    EXPECT(r->numArgs(), (size_t) 41);
+    EXPECT(STR(r.value()), buffer);
+    for (int i = 0; i < 40; ++i) {
+        EXPECT(r->args().has(i) == (i % 3 != 1));
+        EXPECT(r->arg(i, -1), (i % 3 == 1) ? -1 : i);
+    }
+    EXPECT(! r->args().has(40));
+    size_t n = 0;
+    for (auto arg : r.value())
+        n += arg.has_value() ? 1 : 0;
+    EXPECT(n, (size_t) 27);
+}
+
+TEST(CSISequence, LongArguments) {
+    // the values saturate rather than overflow
+    std::string buffer{"\033[12345678901234567890;5;99999H"};
+    char const * x = buffer.c_str();
+    auto r = CSISequence::Parse(x, x + buffer.size());
+    CHECK(r.has_value());
+    EXPECT(r->numArgs(), (size_t) 3);
+    EXPECT(r->arg(0, -1), 65535);
+    EXPECT(r->arg(1, -1), 5);
+    EXPECT(r->arg(2, -1), 65535);
+    buffer = "\033]12345678901234567890;x\a";
+    x = buffer.c_str();
+    auto osc = OSCSequence::Parse(x, x + buffer.size());
+    CHECK(osc.has_value());
+    EXPECT(osc->id.value(), 65535);
+}
+
+TEST(Sequence, DetachBorrowedPayloads) {
+    std::string buffer{"\033]52;c;abc\a"};
+    char const * x = buffer.c_str();
+    auto r = ParseSequence(x, x + buffer.size());
+    CHECK(r.has_value());
+    CHECK(std::holds_alternative<SetClipboard>(r.value()));
+    EXPECT(std::get<SetClipboard>(r.value()).data.data(), buffer.c_str() + 7);
+    EXPECT(! std::get<SetClipboard>(r.value()).data.owned());
+    Detach(r.value());
+    buffer = "\033]52;c;xyz\a";
+    EXPECT(std::get<SetClipboard>(r.value()).data.owned());
+    EXPECT(std::get<SetClipboard>(r.value()).data, "abc");
+    EXPECT(std::get<SetClipboard>(r.value()).bufferName, "c");
+}
+
+TEST(Sequence, DispatchAllSpecific) {
+    // every sequence in sequences.inc.h must be dispatched to its specific type by both ParseSequence and Specialize
+    auto parse = [](std::string const & buffer) {
+        char const * x = buffer.c_str();
+        auto r = ParseSequence(x, x + buffer.size());
+        return x == buffer.c_str() + buffer.size() ? r.value() : Sequence{CSISequence{}};
+    };
+    #define CSI0(_, NAME, SUFFIX) EXPECT(std::holds_alternative<NAME>(parse(STR("\033[" << SUFFIX)))); EXPECT(std::holds_alternative<NAME>(Specialize(CSISequence{CSIArgs{}, SUFFIX})));
+    #define CSI1(_, NAME, SUFFIX, ...) EXPECT(std::holds_alternative<NAME>(parse(STR("\033[7" << SUFFIX)))); EXPECT(std::holds_alternative<NAME>(Specialize(CSISequence{CSIArgs{}, SUFFIX})));
+    #define CSI2(_, NAME, SUFFIX, ...) EXPECT(std::holds_alternative<NAME>(parse(STR("\033[7;8" << SUFFIX)))); EXPECT(std::holds_alternative<NAME>(Specialize(CSISequence{CSIArgs{}, SUFFIX})));
+    #define CSIn(_, NAME, SUFFIX, ...) EXPECT(std::holds_alternative<NAME>(parse(STR("\033[1;2;3" << SUFFIX)))); EXPECT(std::holds_alternative<NAME>(Specialize(CSISequence{CSIArgs{}, SUFFIX})));
+    #define CSIx(_, NAME, SUFFIX, ...) EXPECT(std::holds_alternative<NAME>(parse(STR("\033[1;38:5:3" << SUFFIX)))); EXPECT(std::holds_alternative<NAME>(Specialize(CSISequence{CSIArgs{}, SUFFIX})));
+    #define DEC(_, NAME, ID) EXPECT(std::holds_alternative<NAME>(parse(STR("\033[?" << ID << "l")))); EXPECT(std::holds_alternative<NAME>(Specialize(DECSequence{ID, true})));
+    #define OSC1(_, NAME, ID, ...) EXPECT(std::holds_alternative<NAME>(parse(STR("\033]" << ID << ";a\a"))));
+    #define OSC2(_, NAME, ID, ...) EXPECT(std::holds_alternative<NAME>(parse(STR("\033]" << ID << ";a;b\a"))));
+    #define TPP2(_, NAME, ID, ...) EXPECT(std::holds_alternative<NAME>(parse(STR("\033P" << ID << "t1;2\033\\"))));
+    #include "libtpp/sequences.inc.h"
+}
+
+TEST(Sequence, DispatchGeneric) {
+    // ids and suffixes without specific type, including those colliding with the specific ones in the hash tables
+    for (int id = 0; id < 3000; ++id) {
+        std::string buffer{STR("\033[?" << id << "h\033]" << id << ";a;b;c\a\033P" << id << "t1;2\033\\")};
+        char const * x = buffer.c_str();
+        char const * end = x + buffer.size();
+        auto dec = ParseSequence(x, end);
+        EXPECT(std::holds_alternative<DECSequence>(dec.value()) == std::holds_alternative<DECSequence>(Specialize(DECSequence{id, true})));
+        if (std::holds_alternative<DECSequence>(dec.value()))
+            EXPECT(std::get<DECSequence>(dec.value()).id(0), id);
+        // no OSC sequence has three values, so it is either generic, or invalid
+        std::optional<Sequence> osc;
+        if (TryParseSequence(x, end, osc) == ParseResult::Ok)
+            EXPECT(std::get<OSCSequence>(osc.value()).id.value(), id);
+        auto tpp = ParseSequence(x, end);
+        if (std::holds_alternative<TppSequence>(tpp.value()))
+            EXPECT(std::get<TppSequence>(tpp.value()).id, id);
+        EXPECT(x == end);
+    }
+    std::string buffer{"\033[1;2z"};
+    char const * x = buffer.c_str();
+    auto r = ParseSequence(x, x + buffer.size());
+    CHECK(std::holds_alternative<CSISequence>(r.value()));
+    EXPECT(std::get<CSISequence>(r.value()).suffix(), 'z');
+    EXPECT(std::get<CSISequence>(r.value()).numArgs(), (size_t) 2);
+}
@@ -0,0 +1,212 @@
+#include "helpers/helpers_tests.h"
+#include "libtpp/sequence_parser.h"
+
+using namespace tpp;
+
+namespace {
+
+    /** Feeds the parser with the input split into chunks of given size and returns all sequences parsed.
+     */
+    std::vector<Sequence> FeedChunked(std::string const & input, size_t chunkSize) {
+        SequenceParser p;
+        std::vector<Sequence> result;
+        for (size_t i = 0; i < input.size(); i += chunkSize) {
+            char const * x = input.c_str() + i;
+            char const * end = input.c_str() + std::min(i + chunkSize, input.size());
+            while (x != end) {
+                auto seq = p.feed(x, end);
+                if (seq.has_value())
+                    result.push_back(std::move(seq.value()));
+            }
+        }
+        return result;
+    }
+
+}
+
+TEST(SequenceParser, CSI) {
+    std::string input{"\033[0;;2;3a\033[5A\033[H\033[5;6H"};
+    for (size_t chunk = 1; chunk <= input.size(); ++chunk) {
+        auto r = FeedChunked(input, chunk);
+        CHECK(r.size(), (size_t) 4);
+        CHECK(std::holds_alternative<CSISequence>(r[0]));
+        EXPECT(STR(PRETTY(std::get<CSISequence>(r[0]))), "ESC [ 0; ; 2; 3 a");
+        CHECK(std::holds_alternative<CursorUp>(r[1]));
+        EXPECT(std::get<CursorUp>(r[1]).value, 5);
+        EXPECT(std::holds_alternative<CursorPosition>(r[2]));
+        CHECK(std::holds_alternative<CursorPosition>(r[3]));
+        EXPECT(std::get<CursorPosition>(r[3]).x, 5);
+        EXPECT(std::get<CursorPosition>(r[3]).y, 6);
+    }
+}
+
+TEST(SequenceParser, LongArguments) {
+    // the values saturate rather than overflow
+    std::string input{"\033[12345678901234567890;5;99999a\033]12345678901234567890;x\a"};
+    for (size_t chunk = 1; chunk <= input.size(); ++chunk) {
+        auto r = FeedChunked(input, chunk);
+        CHECK(r.size(), (size_t) 2);
+        CHECK(std::holds_alternative<CSISequence>(r[0]));
+        EXPECT(std::get<CSISequence>(r[0]).arg(0, -1), 65535);
+        EXPECT(std::get<CSISequence>(r[0]).arg(1, -1), 5);
+        EXPECT(std::get<CSISequence>(r[0]).arg(2, -1), 65535);
+        CHECK(std::holds_alternative<OSCSequence>(r[1]));
+        EXPECT(std::get<OSCSequence>(r[1]).id.value(), 65535);
+    }
+}
+
+TEST(SequenceParser, DEC) {
+    std::string input{"\033[?25h\033[?1049l\033[?7h\033[?1049;7;2004h"};
+    for (size_t chunk = 1; chunk <= input.size(); ++chunk) {
+        auto r = FeedChunked(input, chunk);
+        CHECK(r.size(), (size_t) 4);
+        CHECK(std::holds_alternative<ShowCursor>(r[0]));
+        EXPECT(std::get<ShowCursor>(r[0]).value == true);
+        CHECK(std::holds_alternative<EnableAlternativeBuffer>(r[1]));
+        EXPECT(std::get<EnableAlternativeBuffer>(r[1]).value == false);
+        CHECK(std::holds_alternative<DECSequence>(r[2]));
+        EXPECT(std::get<DECSequence>(r[2]).id(0), 7);
+        CHECK(std::holds_alternative<DECSequence>(r[3]));
+        EXPECT(std::get<DECSequence>(r[3]).numIds(), (size_t) 3);
+        EXPECT(std::get<DECSequence>(r[3]).id(2), 2004);
+    }
+}
+
+TEST(SequenceParser, OSC) {
+    std::string input{"\033]2;title\a\033]8;id=x;http://foo\033\\\033]52;c;a\033bc\a\033]77;a;b\a"};
+    for (size_t chunk = 1; chunk <= input.size(); ++chunk) {
+        auto r = FeedChunked(input, chunk);
+        CHECK(r.size(), (size_t) 4);
+        CHECK(std::holds_alternative<ChangeWindowTitle>(r[0]));
+        EXPECT(std::get<ChangeWindowTitle>(r[0]).payload, "title");
+        CHECK(std::holds_alternative<Hyperlink>(r[1]));
+        EXPECT(std::get<Hyperlink>(r[1]).params, "id=x");
+        EXPECT(std::get<Hyperlink>(r[1]).uri, "http://foo");
+        CHECK(std::holds_alternative<SetClipboard>(r[2]));
+        EXPECT(std::get<SetClipboard>(r[2]).data, "a\033bc");
+        CHECK(std::holds_alternative<OSCSequence>(r[3]));
+        EXPECT(std::get<OSCSequence>(r[3]).id.value(), 77);
+        EXPECT(std::get<OSCSequence>(r[3]).values.size(), (size_t) 2);
+    }
+}
+
+TEST(SequenceParser, OSCTerminatedByBel) {
+    // BEL is 0x07, while BS (0x08) is an ordinary character of the payload
+    std::string input{"\033]2;a\x08" "b\x07rest"};
+    for (size_t chunk = 1; chunk <= input.size(); ++chunk) {
+        auto r = FeedChunked(input, chunk);
+        CHECK(r.size() >= 2);
+        CHECK(std::holds_alternative<ChangeWindowTitle>(r[0]));
+        EXPECT(std::get<ChangeWindowTitle>(r[0]).payload, "a\x08" "b");
+        std::string text;
+        for (size_t i = 1; i < r.size(); ++i)
+            text += std::get<Payload>(r[i]).view();
+        EXPECT(text, "rest");
+    }
+    // the original parser agrees
+    char const * x = input.c_str();
+    auto seq = ParseSequence(x, x + input.size());
+    CHECK(seq.has_value() && std::holds_alternative<ChangeWindowTitle>(seq.value()));
+    EXPECT(std::get<ChangeWindowTitle>(seq.value()).payload, "a\x08" "b");
+    EXPECT(std::string{x}, "rest");
+}
+
+TEST(SequenceParser, Tpp) {
+    std::string input{"\033P0t80;25\033\\\033P56tfo`3bo;bar\033\\\033P12t\033\\"};
+    for (size_t chunk = 1; chunk <= input.size(); ++chunk) {
+        auto r = FeedChunked(input, chunk);
+        CHECK(r.size(), (size_t) 3);
+        CHECK(std::holds_alternative<TerminalResize>(r[0]));
+        EXPECT(std::get<TerminalResize>(r[0]).cols, 80);
+        EXPECT(std::get<TerminalResize>(r[0]).rows, 25);
+        CHECK(std::holds_alternative<TppSequence>(r[1]));
+        EXPECT(std::get<TppSequence>(r[1]).id, 56);
+        CHECK(std::get<TppSequence>(r[1]).args.size(), (size_t) 2);
+        EXPECT(std::get<TppSequence>(r[1]).args[0], "fo;o");
+        EXPECT(std::get<TppSequence>(r[1]).args[1], "bar");
+        CHECK(std::holds_alternative<TppSequence>(r[2]));
+        EXPECT(std::get<TppSequence>(r[2]).args.empty());
+    }
+}
+
+TEST(SequenceParser, Text) {
+    std::string input{"foo\033[Hbar"};
+    auto r = FeedChunked(input, input.size());
+    CHECK(r.size(), (size_t) 3);
+    EXPECT(std::get<Payload>(r[0]), "foo");
+    EXPECT(std::holds_alternative<CursorPosition>(r[1]));
+    EXPECT(std::get<Payload>(r[2]), "bar");
+    // text is returned as soon as the buffer ends
+    r = FeedChunked(input, 2);
+    CHECK(r.size(), (size_t) 5);
+    EXPECT(std::get<Payload>(r[0]), "fo");
+    EXPECT(std::get<Payload>(r[1]), "o");
+    EXPECT(std::holds_alternative<CursorPosition>(r[2]));
+}
+
+TEST(SequenceParser, Incomplete) {
+    SequenceParser p;
+    std::string input{"\033]52;c;abc"};
+    char const * x = input.c_str();
+    EXPECT(! p.feed(x, x + input.size()).has_value());
+    EXPECT(x == input.c_str() + input.size());
+    EXPECT(p.pending());
+    input = "def\a";
+    x = input.c_str();
+    auto r = p.feed(x, x + input.size());
+    CHECK(r.has_value());
+    EXPECT(x == input.c_str() + input.size());
+    EXPECT(! p.pending());
+    EXPECT(std::get<SetClipboard>(r.value()).data, "abcdef");
+}
+
+TEST(SequenceParser, Error) {
+    SequenceParser p;
+    std::string input{"\033[12<"};
+    char const * x = input.c_str();
+    EXPECT_THROWS(SequenceError, p.feed(x, x + input.size()));
+    EXPECT(x == input.c_str() + 4);
+    EXPECT(! p.pending());
+    input = "\033x";
+    x = input.c_str();
+    EXPECT_THROWS(SequenceError, p.feed(x, x + input.size()));
+    EXPECT(x == input.c_str() + 1);
+    input = "\033P5tab`x0\033\\";
+    x = input.c_str();
+    EXPECT_THROWS(SequenceError, p.feed(x, x + input.size()));
+    EXPECT(x == input.c_str() + 7);
+}
+
+TEST(SequenceParser, BorrowedPayloads) {
+    std::string input{"foo\033]52;c;a\033bc\a\033P56tbar;b`3bz\033\\"};
+    auto borrowed = [&](Payload const & p) {
+        return p.data() >= input.c_str() && p.data() + p.size() <= input.c_str() + input.size();
+    };
+    auto r = FeedChunked(input, input.size());
+    CHECK(r.size(), (size_t) 3);
+    EXPECT(borrowed(std::get<Payload>(r[0])));
+    EXPECT(std::get<SetClipboard>(r[1]).data, "a\033bc");
+    EXPECT(borrowed(std::get<SetClipboard>(r[1]).data));
+    EXPECT(std::get<TppSequence>(r[2]).args[0], "bar");
+    EXPECT(borrowed(std::get<TppSequence>(r[2]).args[0]));
+    // decoded argument must be owned
+    EXPECT(std::get<TppSequence>(r[2]).args[1], "b;z");
+    EXPECT(std::get<TppSequence>(r[2]).args[1].owned());
+}
+
+TEST(SequenceParser, PayloadsSpanningBuffers) {
+    SequenceParser p;
+    std::string input{"\033]8;id=x;htt"};
+    char const * x = input.c_str();
+    EXPECT(! p.feed(x, x + input.size()).has_value());
+    // the first buffer is released before the sequence is complete
+    input = std::string(input.size(), 'x');
+    input = "p://foo\a";
+    x = input.c_str();
+    auto r = p.feed(x, x + input.size());
+    CHECK(r.has_value());
+    EXPECT(std::get<Hyperlink>(r.value()).params, "id=x");
+    EXPECT(std::get<Hyperlink>(r.value()).uri, "http://foo");
+    EXPECT(std::get<Hyperlink>(r.value()).params.owned());
+    EXPECT(std::get<Hyperlink>(r.value()).uri.owned());
+}
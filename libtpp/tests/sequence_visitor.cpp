@@ -0,0 +1,173 @@
+#include "helpers/helpers_tests.h"
+#include "libtpp/sequence_visitor.h"
+#include "libtpp/sequence_writer.h"
+
+using namespace tpp;
+
+namespace {
+
+    /** Handles some of the sequences specifically, counts the rest.
+     */
+    struct CountingHandler {
+        int cursorPositions = 0;
+        int cursorX = 0;
+        int cursorY = 0;
+        int showCursor = -1;
+        std::string hyperlink;
+        int cols = 0;
+        int rows = 0;
+        std::string text;
+        int others = 0;
+
+        void operator () (CursorPosition && seq) { ++cursorPositions; cursorX = seq.x; cursorY = seq.y; }
+        void operator () (ShowCursor && seq) { showCursor = seq.value; }
+        void operator () (Hyperlink && seq) { hyperlink = std::string{seq.uri}; }
+        void operator () (TerminalResize && seq) { cols = seq.cols; rows = seq.rows; }
+        void operator () (Payload && payload) { text += std::string{payload}; }
+        template<typename T> void operator () (T &&) { ++others; }
+    };
+
+    /** Records the DEC modes in the order they were visited.
+     */
+    struct ModesHandler {
+        std::string modes;
+        void operator () (EnableAlternativeBuffer && seq) { modes += STR("alt" << seq.value << ","); }
+        void operator () (EnableBracketedPaste && seq) { modes += STR("paste" << seq.value << ","); }
+        void operator () (DECSequence && seq) { modes += STR(PRETTY(seq) << ","); }
+        template<typename T> void operator () (T &&) { modes += "?,"; }
+    };
+
+    /** Receives DEC sequences with multiple ids whole.
+     */
+    struct WholeModesHandler : ModesHandler {
+        static constexpr bool WholeDECSequences = true;
+    };
+
+    /** Writes all visited sequences so that they can be compared with the parsed ones.
+     */
+    struct WritingHandler {
+        SequenceWriter & writer;
+        template<typename T> void operator () (T && seq) { writer << Sequence{std::forward<T>(seq)}; }
+    };
+
+}
+
+TEST(SequenceVisitor, SpecificSequences) {
+    SequenceWriter w;
+    w.text("abc");
+    w.csi(3, 4, 'H').dec(25, false);
+    w.text("def");
+    w << Hyperlink{"", "http://foo"} << TerminalResize{80, 25};
+    w.csi(5, 'A').osc(777, {"x"});
+    CountingHandler h;
+    char const * x = w.data();
+    char const * end = x + w.size();
+    EXPECT(Visit(x, end, h) == ParseResult::Ok);
+    EXPECT(x == end);
+    EXPECT(h.cursorPositions, 1);
+    EXPECT(h.cursorX, 3);
+    EXPECT(h.cursorY, 4);
+    EXPECT(h.showCursor, 0);
+    EXPECT(h.hyperlink, std::string{"http://foo"});
+    EXPECT(h.cols, 80);
+    EXPECT(h.rows, 25);
+    EXPECT(h.text, std::string{"abcdef"});
+    // CursorUp and generic OSC
+    EXPECT(h.others, 2);
+}
+
+TEST(SequenceVisitor, DECModes) {
+    char const * input = "\033[?1049;7;2004;8h\033[?2004;1049l\033[?9l";
+    char const * x = input;
+    char const * end = input + std::strlen(input);
+    ModesHandler h;
+    EXPECT(Visit(x, end, h) == ParseResult::Ok);
+    EXPECT(h.modes, std::string{"alt1,paste1,ESC [ ? 7; 8h,paste0,alt0,ESC [ ? 9l,"});
+    // the same dispatch for generic sequence returned by the parser
+    h.modes.clear();
+    VisitDECModes(DECSequence{{2004, 1}, true}, h);
+    EXPECT(h.modes, std::string{"paste1,ESC [ ? 1h,"});
+    // handlers may opt in to get the sequences with multiple ids whole
+    WholeModesHandler w;
+    x = input;
+    EXPECT(Visit(x, end, w) == ParseResult::Ok);
+    EXPECT(w.modes, std::string{"ESC [ ? 1049; 7; 2004; 8h,ESC [ ? 2004; 1049l,ESC [ ? 9l,"});
+}
+
+TEST(SequenceVisitor, SameAsTryParseSequence) {
+    char const * input = "\033[1;31;4m\033[?1049h\033[?9999l\033]0;title\a\033]8;;uri\033\\\033]52;c;YWJj\a\033]777;a;b\a\033P0t80;25\033\\\033P99t1;2\033\\\033[5z\033[s\033[2J";
+    char const * end = input + std::strlen(input);
+    SequenceWriter expected;
+    char const * x = input;
+    while (x != end) {
+        std::optional<Sequence> seq;
+        EXPECT(TryParseSequence(x, end, seq) == ParseResult::Ok);
+        expected << seq.value();
+    }
+    SequenceWriter visited;
+    WritingHandler h{visited};
+    x = input;
+    EXPECT(Visit(x, end, h) == ParseResult::Ok);
+    EXPECT(std::string{visited.view()}, std::string{expected.view()});
+}
+
+TEST(SequenceVisitor, LongTppNumbers) {
+    // saturates the same as TppSequence::TryParse
+    char const * input = "\033P12345678901234567890t1;2\033\\\033P0t12345678901234567890;25\033\\";
+    char const * x = input;
+    char const * end = input + std::strlen(input);
+    int id = -1;
+    auto handler = overloaded{
+        [&](TppSequence && seq) { id = seq.id; },
+        [](auto &&) {},
+    };
+    EXPECT(VisitSequence(x, end, handler) == ParseResult::Ok);
+    EXPECT(id, 65535);
+    CountingHandler h;
+    EXPECT(VisitSequence(x, end, h) == ParseResult::Ok);
+    EXPECT(x == end);
+    EXPECT(h.cols, 65535);
+    EXPECT(h.rows, 25);
+}
+
+TEST(SequenceVisitor, IncompleteAndError) {
+    CountingHandler h;
+    // incomplete sequence, the text before it is visited
+    char const * input = "abc\033[12;";
+    char const * x = input;
+    char const * end = input + std::strlen(input);
+    EXPECT(Visit(x, end, h) == ParseResult::Incomplete);
+    EXPECT(x == input + 3);
+    EXPECT(h.text, std::string{"abc"});
+    EXPECT(h.others, 0);
+    // arguments do not match the specific sequence, the buffer is advanced past it
+    input = "\033[1;2;3H";
+    x = input;
+    end = input + std::strlen(input);
+    EXPECT(VisitSequence(x, end, h) == ParseResult::Error);
+    EXPECT(x == end);
+    EXPECT(h.cursorPositions, 0);
+    // syntax error leaves the buffer at the offending character
+    input = "\033]52";
+    x = input;
+    end = input + std::strlen(input);
+    EXPECT(VisitSequence(x, end, h) == ParseResult::Incomplete);
+    EXPECT(x == input);
+    input = "\033]52x;";
+    x = input;
+    end = input + std::strlen(input);
+    EXPECT(VisitSequence(x, end, h) == ParseResult::Error);
+    EXPECT(x == input + 4);
+    // invalid introducer is reported even if the buffer ends right after it
+    input = "\033x";
+    x = input;
+    end = input + std::strlen(input);
+    EXPECT(VisitSequence(x, end, h) == ParseResult::Error);
+    EXPECT(x == input + 1);
+    input = "\033[";
+    x = input;
+    end = input + std::strlen(input);
+    EXPECT(VisitSequence(x, end, h) == ParseResult::Incomplete);
+    EXPECT(x == input);
+    EXPECT(h.others, 0);
+}
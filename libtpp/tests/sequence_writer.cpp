@@ -0,0 +1,102 @@
+#include <climits>
+
+#include "helpers/helpers_tests.h"
+#include "libtpp/sequence_writer.h"
+
+using namespace tpp;
+
+TEST(SequenceWriter, Integers) {
+    SequenceWriter w;
+    for (int i : {0, 1, 9, 10, 99, 100, 999, 1000, 9999, 10000, 12345, 99999, 100000, 1234567, INT_MAX, -1, -100, INT_MIN}) {
+        w.clear();
+        w.csi(i, 'A');
+        EXPECT(std::string{w.view()}, STR("\033[" << i << "A"));
+    }
+}
+
+TEST(SequenceWriter, Sequences) {
+    SequenceWriter w;
+    CSIArgs args;
+    args.push_back(1);
+    args.push_back(std::nullopt);
+    args.push_back(38);
+    w << CSISequence{args, 'm'} << DECSequence{25, true} << DECSequence{{1049, 2004}, false};
+    w.csi('s').csi(5, 6, 'H').dec(1049, false);
+    w.osc(52, {"c", "abc"}).osc(std::nullopt, {"x"});
+    w.tpp(56, {"fo;o", "bar"});
+    w.text("hello");
+    EXPECT(std::string{w.view()}, std::string{"\033[1;;38m\033[?25h\033[?1049;2004l\033[s\033[5;6H\033[?1049l\033]52;c;abc\033\\\033]x\033\\\033P56tfo`3bo;bar\033\\hello"});
+}
+
+TEST(SequenceWriter, RoundTrip) {
+    SequenceWriter w;
+    w << TerminalResize{80, 25};
+    w.csi(5, 'A').osc(2, {"title"});
+    char const * x = w.data();
+    char const * end = x + w.size();
+    auto r = ParseSequence(x, end);
+    CHECK(r.has_value() && std::holds_alternative<TerminalResize>(r.value()));
+    EXPECT(std::get<TerminalResize>(r.value()).cols, 80);
+    EXPECT(std::get<TerminalResize>(r.value()).rows, 25);
+    r = ParseSequence(x, end);
+    CHECK(r.has_value() && std::holds_alternative<CursorUp>(r.value()));
+    EXPECT(std::get<CursorUp>(r.value()).value, 5);
+    r = ParseSequence(x, end);
+    CHECK(r.has_value() && std::holds_alternative<ChangeWindowTitle>(r.value()));
+    EXPECT(std::get<ChangeWindowTitle>(r.value()).payload, "title");
+    // the parsed sequences can be written again 
+    SequenceWriter w2;
+    x = w.data();
+    while (x != end)
+        w2 << ParseSequence(x, end).value();
+    EXPECT(w2.view() == w.view());
+}
+
+TEST(SequenceWriter, Encode) {
+    std::string data;
+    for (int i = 0; i < 256; ++i)
+        data.push_back(static_cast<char>(i));
+    data += std::string(100, 'x') + ";`";
+    SequenceWriter w;
+    w.encode(data);
+    std::string expected;
+    for (char c : data) {
+        uint8_t b = static_cast<uint8_t>(c);
+        if (b < 32 || b >= 127 || c == ';' || c == '`')
+            expected += STR('`' << nibbleToHex(b >> 4) << nibbleToHex(b & 0xf));
+        else
+            expected.push_back(c);
+    }
+    EXPECT(std::string{w.view()}, expected);
+}
+
+TEST(SequenceWriter, FixedBufferOverflow) {
+    char buffer[16];
+    SequenceWriter w{buffer, sizeof(buffer)};
+    w.csi(1, 'A');
+    EXPECT(w.size(), (size_t) 4);
+    // the sequence does not fit, nothing is written 
+    w.tpp(56, {"foobar"});
+    EXPECT(w.overflow());
+    EXPECT(w.size(), (size_t) 4);
+    // and nothing else is written after it
+    w.csi('s');
+    EXPECT(w.size(), (size_t) 4);
+    EXPECT(std::string{w.view()}, std::string{"\033[1A"});
+    w.clear();
+    EXPECT(! w.overflow());
+    w.tpp(56, {"foobar"});
+    EXPECT(! w.overflow());
+    EXPECT(std::string{w.view()}, std::string{"\033P56tfoobar\033\\"});
+}
+
+TEST(SequenceWriter, Growable) {
+    SequenceWriter w{4};
+    for (int i = 0; i < 1000; ++i)
+        w.csi(i, i + 1, 'H');
+    EXPECT(! w.overflow());
+    std::string expected;
+    for (int i = 0; i < 1000; ++i)
+        expected += STR("\033[" << i << ";" << (i + 1) << "H");
+    EXPECT(std::string{w.view()}, expected);
+}
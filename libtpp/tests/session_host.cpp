@@ -0,0 +1,114 @@
+#if (defined ARCH_LINUX)
+
+#include <condition_variable>
+
+#include "helpers/helpers_tests.h"
+#include "libtpp/session_host.h"
+
+using namespace tpp;
+using namespace tpp::pty;
+
+namespace {
+
+    /** Collects the output and exit codes of the sessions. 
+     */
+    struct Collector {
+        std::mutex guard;
+        std::condition_variable cv;
+        std::unordered_map<SessionHost::Session *, std::string> output;
+        std::unordered_map<SessionHost::Session *, int> exitCodes;
+
+        SessionHost::OutputHandler outputHandler() {
+            return [this](SessionHost::Session & s, char const * data, size_t numBytes) {
+                std::lock_guard<std::mutex> g{guard};
+                output[& s].append(data, numBytes);
+                cv.notify_all();
+            };
+        }
+
+        SessionHost::ExitHandler exitHandler() {
+            return [this](SessionHost::Session & s, int exitCode) {
+                std::lock_guard<std::mutex> g{guard};
+                exitCodes[& s] = exitCode;
+                cv.notify_all();
+            };
+        }
+
+        void waitForExits(size_t n) {
+            std::unique_lock<std::mutex> g{guard};
+            cv.wait(g, [&]() { return exitCodes.size() >= n; });
+        }
+
+        std::string waitForOutput(SessionHost::Session * s, size_t numBytes) {
+            std::unique_lock<std::mutex> g{guard};
+            cv.wait(g, [&]() { return output[s].size() >= numBytes; });
+            return output[s];
+        }
+    };
+
+}
+
+TEST(SessionHost, ManySessions) {
+    Collector c;
+    SessionHost host{3};
+    std::vector<std::shared_ptr<SessionHost::Session>> sessions;
+    for (int i = 0; i < 32; ++i)
+        sessions.push_back(host.spawn({"sh", "-c", STR("echo session " << i << "; exit " << i)}, c.outputHandler(), c.exitHandler()));
+    c.waitForExits(sessions.size());
+    for (int i = 0; i < 32; ++i) {
+        EXPECT(c.output[sessions[i].get()], STR("session " << i << "\r\n"));
+        EXPECT(c.exitCodes[sessions[i].get()], i);
+        EXPECT(sessions[i]->terminated());
+    }
+    EXPECT(host.numSessions(), (size_t) 0);
+}
+
+TEST(SessionHost, Interactive) {
+    Collector c;
+    SessionHost host{2};
+    auto s = host.spawn({"cat"}, c.outputHandler(), c.exitHandler());
+    s->send("abc\n", 4);
+    // echo of the terminal followed by the output of cat
+    EXPECT(c.waitForOutput(s.get(), 10), "abc\r\nabc\r\n");
+    // end of file
+    s->send("\004", 1);
+    c.waitForExits(1);
+    EXPECT(c.exitCodes[s.get()], 0);
+    // sending to terminated session does nothing
+    s->send("x", 1);
+}
+
+TEST(SessionHost, FloodAndInteractive) {
+    Collector c;
+    SessionHost host{2};
+    std::vector<std::shared_ptr<SessionHost::Session>> flood;
+    for (int i = 0; i < 4; ++i)
+        flood.push_back(host.spawn({"head", "-c", "4000000", "/dev/zero"}, c.outputHandler(), c.exitHandler()));
+    auto s = host.spawn({"cat"}, c.outputHandler(), c.exitHandler());
+    for (int i = 0; i < 10; ++i) {
+        s->send("x\n", 2);
+        c.waitForOutput(s.get(), (i + 1) * 6);
+    }
+    s->send("\004", 1);
+    c.waitForExits(5);
+    for (auto & f : flood)
+        EXPECT(c.output[f.get()].size(), (size_t) 4000000);
+}
+
+TEST(SessionHost, DestructionKillsTogether) {
+    Collector c;
+    auto start = std::chrono::steady_clock::now();
+    {
+        SessionHost host{2};
+        std::vector<std::shared_ptr<SessionHost::Session>> sessions;
+        // the children ignore the hangup, each would take the whole timeout if reaped one by one
+        for (int i = 0; i < 4; ++i)
+            sessions.push_back(host.spawn({"sh", "-c", "trap '' HUP; echo x; exec sleep 100"}, c.outputHandler(), c.exitHandler()));
+        for (auto & s : sessions)
+            c.waitForOutput(s.get(), 3);
+        start = std::chrono::steady_clock::now();
+    }
+    EXPECT(std::chrono::steady_clock::now() - start < LocalServer::HangupTimeout * 3);
+}
+
+#endif
@@ -0,0 +1,145 @@
+#include "helpers/helpers_tests.h"
+#include "libtpp/text_scanner.h"
+
+using namespace tpp;
+
+namespace {
+
+    using ScanFunction = char const * (*)(char const *, char const *);
+
+    std::vector<ScanFunction> Implementations() {
+        std::vector<ScanFunction> result{FindControlCharacter, text_scanner::FindControlCharacterPortable};
+#if (defined TPP_SCANNER_X86_64)
+        result.push_back(text_scanner::FindControlCharacterSSE2);
+        if (text_scanner::HasAVX2())
+            result.push_back(text_scanner::FindControlCharacterAVX2);
+#endif
+        return result;
+    }
+
+}
+
+TEST(TextScanner, PlainText) {
+    std::string text;
+    for (size_t i = 0; i < 200; ++i)
+        text.push_back(static_cast<char>(0x20 + (i % 0x5f)));
+    text += "\xc5\xbe\xe2\x82\xac";
+    for (auto fn : Implementations())
+        for (size_t start = 0; start < 40; ++start)
+            EXPECT(fn(text.c_str() + start, text.c_str() + text.size()) == text.c_str() + text.size());
+}
+
+TEST(TextScanner, ControlCharacters) {
+    std::string text(150, 'x');
+    for (auto fn : Implementations()) {
+        for (int c = 0; c < 256; ++c) {
+            bool control = c < 0x20 || c == 0x7f;
+            for (size_t pos : {0, 1, 7, 8, 15, 16, 31, 32, 33, 63, 64, 100, 149}) {
+                text[pos] = static_cast<char>(c);
+                char const * expected = control ? text.c_str() + pos : text.c_str() + text.size();
+                EXPECT(fn(text.c_str(), text.c_str() + text.size()) == expected);
+                // control characters before the start are ignored
+                if (pos > 0 && pos < 140)
+                    EXPECT(fn(text.c_str() + pos + 1, text.c_str() + text.size()) == text.c_str() + text.size());
+                text[pos] = 'x';
+            }
+        }
+    }
+}
+
+TEST(TextScanner, FirstOfMany) {
+    std::string text(128, 'a');
+    text[70] = '\n';
+    text[90] = '\033';
+    text[33] = '\r';
+    for (auto fn : Implementations()) {
+        EXPECT(fn(text.c_str(), text.c_str() + text.size()) == text.c_str() + 33);
+        EXPECT(fn(text.c_str() + 34, text.c_str() + text.size()) == text.c_str() + 70);
+        EXPECT(fn(text.c_str() + 71, text.c_str() + text.size()) == text.c_str() + 90);
+        EXPECT(fn(text.c_str(), text.c_str() + 20) == text.c_str() + 20);
+    }
+}
+
+TEST(TextScanner, ParseText) {
+    std::string text{"hello world\r\n\033[H"};
+    char const * x = text.c_str();
+    EXPECT(ParseText(x, x + text.size()) == "hello world");
+    EXPECT(*x == '\r');
+    ++x;
+    EXPECT(ParseText(x, text.c_str() + text.size()).empty());
+}
+
+TEST(TextScanner, FindAnyOf) {
+    using FindAnyOfFunction = char const * (*)(char const *, char const *, char, char, char);
+    std::vector<FindAnyOfFunction> fns{FindAnyOf, text_scanner::FindAnyOfPortable};
+#if (defined TPP_SCANNER_X86_64)
+    fns.push_back(text_scanner::FindAnyOfSSE2);
+    if (text_scanner::HasAVX2())
+        fns.push_back(text_scanner::FindAnyOfAVX2);
+#endif
+    std::string text(100, 'x');
+    for (auto fn : fns) {
+        EXPECT(fn(text.c_str(), text.c_str() + text.size(), ';', '`', '\033') == text.c_str() + text.size());
+        for (char c : {';', '`', '\033'}) {
+            for (size_t pos : {0, 5, 8, 15, 16, 31, 32, 40, 63, 64, 99}) {
+                text[pos] = c;
+                EXPECT(fn(text.c_str(), text.c_str() + text.size(), ';', '`', '\033') == text.c_str() + pos);
+                text[pos] = 'x';
+            }
+        }
+        // bytes with the top bit set must not match
+        text[20] = '\xbb';
+        text[30] = '`';
+        EXPECT(fn(text.c_str(), text.c_str() + text.size(), ';', '`', '\033') == text.c_str() + 30);
+        text[20] = 'x';
+        text[30] = 'x';
+    }
+}
+
+TEST(TextScanner, CountHexEncoded) {
+    using CountFunction = bool (*)(char const *, char const *, size_t &);
+    std::vector<CountFunction> fns{CountHexEncoded, text_scanner::CountHexEncodedPortable};
+#if (defined TPP_SCANNER_X86_64)
+    fns.push_back(text_scanner::CountHexEncodedSSE2);
+#endif
+    std::string text;
+    for (size_t i = 0; i < 20; ++i)
+        text += "ab`3fcd`A0";
+    for (auto fn : fns) {
+        size_t encoded = 0;
+        EXPECT(fn(text.c_str(), text.c_str() + text.size(), encoded));
+        EXPECT(encoded, (size_t) 40);
+        // the encoded bytes must be complete within the buffer, at any position
+        for (size_t end : {3, 4, 14, 15, 16, 17, 18, 33}) {
+            std::string prefix = text.substr(0, end);
+            bool valid = fn(prefix.c_str(), prefix.c_str() + prefix.size(), encoded);
+            size_t lastTick = prefix.rfind('`');
+            EXPECT(valid == (lastTick + 2 < prefix.size()));
+        }
+        for (size_t pos : {3, 4, 13, 14, 18, 19, 33, 39}) {
+            std::string invalid = text;
+            invalid[pos] = 'x';
+            EXPECT(! fn(invalid.c_str(), invalid.c_str() + invalid.size(), encoded));
+        }
+    }
+}
+
+TEST(TextScanner, FindCharacterToEncode) {
+    std::vector<ScanFunction> fns{FindCharacterToEncode, text_scanner::FindCharacterToEncodePortable};
+#if (defined TPP_SCANNER_X86_64)
+    fns.push_back(text_scanner::FindCharacterToEncodeSSE2);
+    if (text_scanner::HasAVX2())
+        fns.push_back(text_scanner::FindCharacterToEncodeAVX2);
+#endif
+    std::string text(100, 'x');
+    for (auto fn : fns) {
+        for (int c = 0; c < 256; ++c) {
+            for (size_t pos : {0, 7, 8, 15, 16, 33, 64, 99}) {
+                text[pos] = static_cast<char>(c);
+                char const * expected = IsCharacterToEncode(static_cast<char>(c)) ? text.c_str() + pos : text.c_str() + text.size();
+                EXPECT(fn(text.c_str(), text.c_str() + text.size()) == expected);
+                text[pos] = 'x';
+            }
+        }
+    }
+}
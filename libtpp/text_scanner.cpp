@@ -0,0 +1,402 @@
+#include <cstdint>
+#include <cstring>
+
+#include "text_scanner.h"
+
+#if (defined TPP_SCANNER_X86_64)
+    #include <immintrin.h>
+    #if (defined _MSC_VER)
+        #include <intrin.h>
+        #define TARGET_AVX2
+    #else
+        #define TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#endif
+
+namespace tpp {
+
+    namespace {
+
+        /** Returns the index of the lowest set bit.
+         */
+        inline unsigned LowestBit(uint32_t x) {
+            ASSERT(x != 0);
+#if (defined _MSC_VER)
+            unsigned long result;
+            _BitScanForward(& result, x);
+            return static_cast<unsigned>(result);
+#else
+            return static_cast<unsigned>(__builtin_ctz(x));
+#endif
+        }
+
+        inline unsigned PopCount(uint32_t x) {
+#if (defined _MSC_VER)
+            x = x - ((x >> 1) & 0x55555555);
+            x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+            return (((x + (x >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24;
+#else
+            return static_cast<unsigned>(__builtin_popcount(x));
+#endif
+        }
+
+        char const * FindControlCharacterScalar(char const * buffer, char const * end) {
+            while (buffer != end && ! IsControlCharacter(*buffer))
+                ++buffer;
+            return buffer;
+        }
+
+        char const * FindAnyOfScalar(char const * buffer, char const * end, char a, char b, char c) {
+            while (buffer != end && *buffer != a && *buffer != b && *buffer != c)
+                ++buffer;
+            return buffer;
+        }
+
+        char const * FindCharacterToEncodeScalar(char const * buffer, char const * end) {
+            while (buffer != end && ! IsCharacterToEncode(*buffer))
+                ++buffer;
+            return buffer;
+        }
+
+        using ScanFunction = char const * (*)(char const *, char const *);
+        using FindAnyOfFunction = char const * (*)(char const *, char const *, char, char, char);
+
+        struct Scanner {
+            ScanFunction fn;
+            FindAnyOfFunction findAnyOf;
+            ScanFunction findCharacterToEncode;
+            char const * name;
+        };
+
+        Scanner SelectScanner() {
+#if (defined TPP_SCANNER_X86_64)
+            if (text_scanner::HasAVX2())
+                return { text_scanner::FindControlCharacterAVX2, text_scanner::FindAnyOfAVX2, text_scanner::FindCharacterToEncodeAVX2, "AVX2" };
+            return { text_scanner::FindControlCharacterSSE2, text_scanner::FindAnyOfSSE2, text_scanner::FindCharacterToEncodeSSE2, "SSE2" };
+#else
+            return { text_scanner::FindControlCharacterPortable, text_scanner::FindAnyOfPortable, text_scanner::FindCharacterToEncodePortable, "portable" };
+#endif
+        }
+
+        Scanner const & SelectedScanner() {
+            static Scanner scanner = SelectScanner();
+            return scanner;
+        }
+
+    } // tpp::anonymous
+
+    char const * FindControlCharacter(char const * buffer, char const * end) {
+        // short runs are common (e.g. between two escape sequences), do not pay for the indirect call and vector setup
+        if (end - buffer < 16)
+            return FindControlCharacterScalar(buffer, end);
+        return SelectedScanner().fn(buffer, end);
+    }
+
+    char const * FindCharacterToEncode(char const * buffer, char const * end) {
+        if (end - buffer < 16)
+            return FindCharacterToEncodeScalar(buffer, end);
+        return SelectedScanner().findCharacterToEncode(buffer, end);
+    }
+
+    bool CountHexEncoded(char const * buffer, char const * end, size_t & encoded) {
+#if (defined TPP_SCANNER_X86_64)
+        return text_scanner::CountHexEncodedSSE2(buffer, end, encoded);
+#else
+        return text_scanner::CountHexEncodedPortable(buffer, end, encoded);
+#endif
+    }
+
+    char const * FindAnyOf(char const * buffer, char const * end, char a, char b, char c) {
+        if (end - buffer < 16)
+            return FindAnyOfScalar(buffer, end, a, b, c);
+        return SelectedScanner().findAnyOf(buffer, end, a, b, c);
+    }
+
+    namespace text_scanner {
+
+        /** Processes the buffer a 64bit word at a time.
+
+            For each byte b, (b - 0x20) & ~b has its top bit set if b < 0x20. The borrows can only propagate from a byte that matches, so the test is exact for detecting whether the word contains a control character. DEL is detected as zero byte in the word xored with 0x7f. The position is then found by a scalar scan of the word, which keeps the code endian agnostic.
+         */
+        char const * FindControlCharacterPortable(char const * buffer, char const * end) {
+            constexpr uint64_t Ones = 0x0101010101010101ull;
+            constexpr uint64_t Highs = 0x8080808080808080ull;
+            while (end - buffer >= 8) {
+                uint64_t x;
+                std::memcpy(& x, buffer, 8);
+                uint64_t lessThan20 = (x - Ones * 0x20) & ~x & Highs;
+                uint64_t del = x ^ (Ones * 0x7f);
+                uint64_t isDel = (del - Ones) & ~del & Highs;
+                if ((lessThan20 | isDel) != 0)
+                    return FindControlCharacterScalar(buffer, buffer + 8);
+                buffer += 8;
+            }
+            return FindControlCharacterScalar(buffer, end);
+        }
+
+        /** A byte equal to x is a zero byte in the word xored with x, zero bytes are detected exactly as in FindControlCharacterPortable.
+         */
+        char const * FindAnyOfPortable(char const * buffer, char const * end, char a, char b, char c) {
+            constexpr uint64_t Ones = 0x0101010101010101ull;
+            constexpr uint64_t Highs = 0x8080808080808080ull;
+            uint64_t const ma = Ones * static_cast<uint8_t>(a);
+            uint64_t const mb = Ones * static_cast<uint8_t>(b);
+            uint64_t const mc = Ones * static_cast<uint8_t>(c);
+            while (end - buffer >= 8) {
+                uint64_t x;
+                std::memcpy(& x, buffer, 8);
+                uint64_t xa = x ^ ma;
+                uint64_t xb = x ^ mb;
+                uint64_t xc = x ^ mc;
+                uint64_t found = ((xa - Ones) & ~xa) | ((xb - Ones) & ~xb) | ((xc - Ones) & ~xc);
+                if ((found & Highs) != 0)
+                    return FindAnyOfScalar(buffer, buffer + 8, a, b, c);
+                buffer += 8;
+            }
+            return FindAnyOfScalar(buffer, end, a, b, c);
+        }
+
+        /** Like FindControlCharacterPortable, with bytes >= 0x80 detected by their top bit and the other characters by a zero byte in the xored word.
+         */
+        char const * FindCharacterToEncodePortable(char const * buffer, char const * end) {
+            constexpr uint64_t Ones = 0x0101010101010101ull;
+            constexpr uint64_t Highs = 0x8080808080808080ull;
+            while (end - buffer >= 8) {
+                uint64_t x;
+                std::memcpy(& x, buffer, 8);
+                uint64_t del = x ^ (Ones * 0x7f);
+                uint64_t semicolon = x ^ (Ones * ';');
+                uint64_t tick = x ^ (Ones * '`');
+                uint64_t found = (x & Highs)
+                    | ((x - Ones * 0x20) & ~x & Highs)
+                    | ((del - Ones) & ~del & Highs)
+                    | ((semicolon - Ones) & ~semicolon & Highs)
+                    | ((tick - Ones) & ~tick & Highs);
+                if (found != 0)
+                    return FindCharacterToEncodeScalar(buffer, buffer + 8);
+                buffer += 8;
+            }
+            return FindCharacterToEncodeScalar(buffer, end);
+        }
+
+        /** Without branches on the data, since in binary payloads the backticks are unpredictable. Hexadecimal digits are never backticks, so each backtick starts an encoded byte.
+         */
+        bool CountHexEncodedPortable(char const * buffer, char const * end, size_t & encoded) {
+            size_t n = 0;
+            bool valid = true;
+            char const * x = buffer;
+            for (; end - x >= 3; ++x) {
+                bool tick = *x == '`';
+                n += tick;
+                valid &= (! tick) | (isHexadecimalDigit(x[1]) & isHexadecimalDigit(x[2]));
+            }
+            // encoded bytes would extend past the end
+            for (; x != end; ++x)
+                valid &= *x != '`';
+            encoded = n;
+            return valid;
+        }
+
+#if (defined TPP_SCANNER_X86_64)
+
+        /** Control characters are those for which max(b, 0x1f) == 0x1f (unsigned comparison), or b == 0x7f.
+         */
+        char const * FindControlCharacterSSE2(char const * buffer, char const * end) {
+            __m128i const c1f = _mm_set1_epi8(0x1f);
+            __m128i const c7f = _mm_set1_epi8(0x7f);
+            while (end - buffer >= 16) {
+                __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(buffer));
+                __m128i ctrl = _mm_or_si128(
+                    _mm_cmpeq_epi8(_mm_max_epu8(x, c1f), c1f),
+                    _mm_cmpeq_epi8(x, c7f)
+                );
+                uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+                if (mask != 0)
+                    return buffer + LowestBit(mask);
+                buffer += 16;
+            }
+            return FindControlCharacterScalar(buffer, end);
+        }
+
+        TARGET_AVX2 char const * FindControlCharacterAVX2(char const * buffer, char const * end) {
+            __m256i const c1f = _mm256_set1_epi8(0x1f);
+            __m256i const c7f = _mm256_set1_epi8(0x7f);
+            // two vectors per iteration to hide the latency of the movemask
+            while (end - buffer >= 64) {
+                __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(buffer));
+                __m256i y = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(buffer + 32));
+                __m256i ctrlX = _mm256_or_si256(
+                    _mm256_cmpeq_epi8(_mm256_max_epu8(x, c1f), c1f),
+                    _mm256_cmpeq_epi8(x, c7f)
+                );
+                __m256i ctrlY = _mm256_or_si256(
+                    _mm256_cmpeq_epi8(_mm256_max_epu8(y, c1f), c1f),
+                    _mm256_cmpeq_epi8(y, c7f)
+                );
+                if (! _mm256_testz_si256(_mm256_or_si256(ctrlX, ctrlY), _mm256_or_si256(ctrlX, ctrlY))) {
+                    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(ctrlX));
+                    if (mask != 0)
+                        return buffer + LowestBit(mask);
+                    return buffer + 32 + LowestBit(static_cast<uint32_t>(_mm256_movemask_epi8(ctrlY)));
+                }
+                buffer += 64;
+            }
+            while (end - buffer >= 32) {
+                __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(buffer));
+                __m256i ctrl = _mm256_or_si256(
+                    _mm256_cmpeq_epi8(_mm256_max_epu8(x, c1f), c1f),
+                    _mm256_cmpeq_epi8(x, c7f)
+                );
+                uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(ctrl));
+                if (mask != 0)
+                    return buffer + LowestBit(mask);
+                buffer += 32;
+            }
+            return FindControlCharacterSSE2(buffer, end);
+        }
+
+        char const * FindAnyOfSSE2(char const * buffer, char const * end, char a, char b, char c) {
+            __m128i const va = _mm_set1_epi8(a);
+            __m128i const vb = _mm_set1_epi8(b);
+            __m128i const vc = _mm_set1_epi8(c);
+            while (end - buffer >= 16) {
+                __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(buffer));
+                __m128i found = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb)),
+                    _mm_cmpeq_epi8(x, vc)
+                );
+                uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(found));
+                if (mask != 0)
+                    return buffer + LowestBit(mask);
+                buffer += 16;
+            }
+            return FindAnyOfScalar(buffer, end, a, b, c);
+        }
+
+        TARGET_AVX2 char const * FindAnyOfAVX2(char const * buffer, char const * end, char a, char b, char c) {
+            __m256i const va = _mm256_set1_epi8(a);
+            __m256i const vb = _mm256_set1_epi8(b);
+            __m256i const vc = _mm256_set1_epi8(c);
+            while (end - buffer >= 32) {
+                __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(buffer));
+                __m256i found = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(x, vb)),
+                    _mm256_cmpeq_epi8(x, vc)
+                );
+                uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(found));
+                if (mask != 0)
+                    return buffer + LowestBit(mask);
+                buffer += 32;
+            }
+            return FindAnyOfSSE2(buffer, end, a, b, c);
+        }
+
+        /** Signed comparison with 0x20 detects both the C0 controls and bytes >= 0x80.
+         */
+        char const * FindCharacterToEncodeSSE2(char const * buffer, char const * end) {
+            __m128i const c20 = _mm_set1_epi8(0x20);
+            __m128i const c7f = _mm_set1_epi8(0x7f);
+            __m128i const semicolon = _mm_set1_epi8(';');
+            __m128i const tick = _mm_set1_epi8('`');
+            while (end - buffer >= 16) {
+                __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(buffer));
+                __m128i found = _mm_or_si128(
+                    _mm_or_si128(_mm_cmplt_epi8(x, c20), _mm_cmpeq_epi8(x, c7f)),
+                    _mm_or_si128(_mm_cmpeq_epi8(x, semicolon), _mm_cmpeq_epi8(x, tick))
+                );
+                uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(found));
+                if (mask != 0)
+                    return buffer + LowestBit(mask);
+                buffer += 16;
+            }
+            return FindCharacterToEncodeScalar(buffer, end);
+        }
+
+        TARGET_AVX2 char const * FindCharacterToEncodeAVX2(char const * buffer, char const * end) {
+            __m256i const c20 = _mm256_set1_epi8(0x20);
+            __m256i const c7f = _mm256_set1_epi8(0x7f);
+            __m256i const semicolon = _mm256_set1_epi8(';');
+            __m256i const tick = _mm256_set1_epi8('`');
+            while (end - buffer >= 32) {
+                __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(buffer));
+                __m256i found = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpgt_epi8(c20, x), _mm256_cmpeq_epi8(x, c7f)),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(x, semicolon), _mm256_cmpeq_epi8(x, tick))
+                );
+                uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(found));
+                if (mask != 0)
+                    return buffer + LowestBit(mask);
+                buffer += 32;
+            }
+            return FindCharacterToEncodeSSE2(buffer, end);
+        }
+
+        /** For every 16 bytes, computes bitmasks of backticks and hexadecimal digits. Each backtick requires digits at the next two positions, the requirements that fall into the next 16 bytes are carried over. The last incomplete 16 bytes are processed from a zero padded copy, where the padding bytes are not digits.
+         */
+        bool CountHexEncodedSSE2(char const * buffer, char const * end, size_t & encoded) {
+            __m128i const tick = _mm_set1_epi8('`');
+            __m128i const c0 = _mm_set1_epi8('0');
+            __m128i const ca = _mm_set1_epi8('a');
+            __m128i const c20 = _mm_set1_epi8(0x20);
+            __m128i const c9 = _mm_set1_epi8(9);
+            __m128i const c5 = _mm_set1_epi8(5);
+            size_t n = 0;
+            uint32_t carry = 0;
+            uint32_t bad = 0;
+            auto block = [&](__m128i x) {
+                uint32_t ticks = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, tick)));
+                // unsigned x - '0' <= 9, or (x | 0x20) - 'a' <= 5
+                __m128i digit = _mm_sub_epi8(x, c0);
+                __m128i letter = _mm_sub_epi8(_mm_or_si128(x, c20), ca);
+                __m128i isHex = _mm_or_si128(
+                    _mm_cmpeq_epi8(_mm_max_epu8(digit, c9), c9),
+                    _mm_cmpeq_epi8(_mm_max_epu8(letter, c5), c5)
+                );
+                uint32_t hex = static_cast<uint32_t>(_mm_movemask_epi8(isHex));
+                uint32_t required = (ticks << 1) | (ticks << 2) | carry;
+                bad |= required & ~hex & 0xffff;
+                carry = required >> 16;
+                n += PopCount(ticks);
+            };
+            while (end - buffer >= 16) {
+                block(_mm_loadu_si128(reinterpret_cast<__m128i const *>(buffer)));
+                buffer += 16;
+            }
+            if (buffer != end || carry != 0) {
+                alignas(16) char tail[16] = {};
+                std::memcpy(tail, buffer, static_cast<size_t>(end - buffer));
+                block(_mm_load_si128(reinterpret_cast<__m128i const *>(tail)));
+            }
+            encoded = n;
+            return bad == 0 && carry == 0;
+        }
+
+        bool HasAVX2() {
+#if (defined _MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7)
+                return false;
+            __cpuid(info, 1);
+            // OSXSAVE and AVX, and the OS must save the YMM registers
+            if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+                return false;
+            if ((_xgetbv(0) & 6) != 6)
+                return false;
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#else
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#endif
+        }
+
+#endif // TPP_SCANNER_X86_64
+
+        char const * Implementation() {
+            return SelectedScanner().name;
+        }
+
+    } // namespace tpp::text_scanner
+
+} // namespace tpp
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string_view>
+
+#include "helpers/helpers.h"
+
+#if (defined __x86_64__ || defined _M_X64)
+    #define TPP_SCANNER_X86_64
+#endif
+
+namespace tpp {
+
+    /** Returns true if the given byte is a control character, i.e. a C0 control (including ESC) or DEL.
+
+        All other bytes, i.e. printable ASCII characters and bytes of UTF-8 multibyte characters are plain text.
+     */
+    inline bool IsControlCharacter(char c) {
+        return static_cast<unsigned char>(c) < 0x20 || c == 0x7f;
+    }
+
+    /** Finds the first control character in the buffer.
+
+        Returns pointer to the first control character, or end if the whole buffer is plain text. The scan is vectorized, the best implementation for the current CPU is selected at runtime (AVX2, or SSE2 on x86-64, portable word-at-a-time code elsewhere).
+     */
+    char const * FindControlCharacter(char const * buffer, char const * end);
+
+    /** Finds the first occurrence of any of the three given bytes in the buffer.
+
+        Returns pointer to the first occurrence, or end if none of the bytes is present. Used to find the delimiters of string payloads, such as tpp sequence arguments, so that the ordinary characters between them can be skipped in bulk. Like FindControlCharacter the scan is vectorized.
+     */
+    char const * FindAnyOf(char const * buffer, char const * end, char a, char b, char c);
+
+    /** Returns true if the byte must be encoded in tpp sequence arguments, i.e. if it is not printable ASCII character, or if it is the argument separator (semicolon), or the backtick used for the encoding itself.
+     */
+    constexpr inline bool IsCharacterToEncode(char c) {
+        return static_cast<unsigned char>(c) < 0x20 || static_cast<unsigned char>(c) >= 0x7f || c == ';' || c == '`';
+    }
+
+    /** Finds the first byte that must be encoded in tpp sequence arguments, or returns end if there is none. Vectorized like FindControlCharacter.
+     */
+    char const * FindCharacterToEncode(char const * buffer, char const * end);
+
+    /** Counts bytes encoded as a backtick followed by two hexadecimal digits, such as in tpp sequence arguments.
+
+        Returns false if the buffer contains a backtick that is not followed by two hexadecimal digits before the end of the buffer. On x86-64 the backticks and digits are detected 16 bytes at a time, so that the cost does not depend on how many bytes are encoded. 
+     */
+    bool CountHexEncoded(char const * buffer, char const * end, size_t & encoded);
+
+    /** Returns the longest run of plain text at the beginning of the buffer and advances the buffer to the next control character (or end).
+     */
+    inline std::string_view ParseText(char const * & buffer, char const * end) {
+        char const * start = buffer;
+        buffer = FindControlCharacter(buffer, end);
+        return std::string_view{start, static_cast<size_t>(buffer - start)};
+    }
+
+    /** Individual implementations of the text scanner.
+
+        The scanner selects the best of them at runtime, they are exposed for tests and benchmarks. The SSE2 and AVX2 versions exist only on x86-64 and the AVX2 must only be called if the CPU supports it.
+     */
+    namespace text_scanner {
+
+        char const * FindControlCharacterPortable(char const * buffer, char const * end);
+        char const * FindAnyOfPortable(char const * buffer, char const * end, char a, char b, char c);
+        bool CountHexEncodedPortable(char const * buffer, char const * end, size_t & encoded);
+        char const * FindCharacterToEncodePortable(char const * buffer, char const * end);
+
+#if (defined TPP_SCANNER_X86_64)
+        char const * FindControlCharacterSSE2(char const * buffer, char const * end);
+        char const * FindControlCharacterAVX2(char const * buffer, char const * end);
+        char const * FindAnyOfSSE2(char const * buffer, char const * end, char a, char b, char c);
+        char const * FindAnyOfAVX2(char const * buffer, char const * end, char a, char b, char c);
+        bool CountHexEncodedSSE2(char const * buffer, char const * end, size_t & encoded);
+        char const * FindCharacterToEncodeSSE2(char const * buffer, char const * end);
+        char const * FindCharacterToEncodeAVX2(char const * buffer, char const * end);
+
+        bool HasAVX2();
+#endif
+
+        /** Returns the name of the implementation selected at runtime.
+         */
+        char const * Implementation();
+
+    } // namespace tpp::text_scanner
+
+} // namespace tpp
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+/** Minimal benchmarking helpers shared by the benchmark utilities. 
+ 
+    The benchmarks are plain executables that print their results, they should be built with optimizations enabled (`-DCMAKE_BUILD_TYPE=Release`) for the numbers to be meaningful. 
+ */
+namespace bench {
+
+    /** Prevents the compiler from optimizing away the computation of given value. 
+     */
+    template<typename T>
+    inline void DoNotOptimize(T const & value) {
+#if (defined _MSC_VER)
+        static_cast<void>(static_cast<volatile T const *>(& value));
+#else
+        asm volatile("" : : "r,m"(value) : "memory");
+#endif
+    }
+
+    /** Runs the given function `repeats` times and reports the best time and throughput for processing `bytes` bytes. 
+
+        Returns the best time in seconds. 
+     */
+    template<typename FN>
+    inline double Measure(std::string const & name, size_t bytes, size_t repeats, FN fn) {
+        double best = 1e100;
+        for (size_t i = 0; i < repeats; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+            if (t.count() < best)
+                best = t.count();
+        }
+        std::cout << std::left << std::setw(48) << name << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(12) << (best * 1000) << " ms"
+                  << std::setw(12) << (bytes / best / 1024 / 1024) << " MB/s" << std::endl;
+        return best;
+    }
+
+} // namespace bench
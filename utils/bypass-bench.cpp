@@ -0,0 +1,402 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+
+#include "helpers/helpers.h"
+
+#include "bench.h"
+
+#include "bypass/shared_ring.h"
+
+extern char ** environ;
+
+/** Benchmarks of the tpp-bypass executable.
+
+    Usage: bypass-bench [benchmark...]
+
+    Runs the tpp-bypass built together with the benchmark, or the one given by the TPP_BYPASS environment variable, so that different versions of the bypass can be compared. The bypass is driven through pipes, as it is by the terminal, and through the shared memory transport to compare the two. Build in release mode for meaningful results.
+ */
+
+namespace {
+
+    /** Running bypass with pipes connected to its stdin and stdout.
+
+        When shared, the input and output go through the shared memory transport instead, for which the process acts as the terminal, and stdin stays open as the control channel.
+     */
+    class BypassProcess {
+    public:
+
+        BypassProcess(std::vector<std::string> const & command, std::vector<std::string> const & options = {}, bool shared = false) {
+            int in[2];
+            int out[2];
+            OSCHECK(pipe2(in, O_CLOEXEC) == 0 && pipe2(out, O_CLOEXEC) == 0);
+            char const * path = getenv("TPP_BYPASS");
+            std::vector<std::string> args{path != nullptr ? path : TPP_BYPASS};
+            args.insert(args.end(), options.begin(), options.end());
+            int shm = -1;
+            if (shared) {
+                shm = SharedTransport::Create(SharedCapacity);
+                bypassEvent_ = eventfd(0, EFD_CLOEXEC);
+                terminalEvent_ = eventfd(0, EFD_CLOEXEC);
+                OSCHECK(bypassEvent_ >= 0 && terminalEvent_ >= 0);
+                args.push_back(STR("--shm=" << SharedFd << ":" << (SharedFd + 1) << ":" << (SharedFd + 2)));
+            }
+            args.push_back("-e");
+            args.insert(args.end(), command.begin(), command.end());
+            std::vector<char *> argv;
+            for (auto & arg : args)
+                argv.push_back(const_cast<char *>(arg.c_str()));
+            argv.push_back(nullptr);
+            posix_spawn_file_actions_t actions;
+            posix_spawn_file_actions_init(& actions);
+            posix_spawn_file_actions_adddup2(& actions, in[0], STDIN_FILENO);
+            posix_spawn_file_actions_adddup2(& actions, out[1], STDOUT_FILENO);
+            if (shared) {
+                posix_spawn_file_actions_adddup2(& actions, shm, SharedFd);
+                posix_spawn_file_actions_adddup2(& actions, bypassEvent_, SharedFd + 1);
+                posix_spawn_file_actions_adddup2(& actions, terminalEvent_, SharedFd + 2);
+            }
+            int error = posix_spawn(& pid_, argv[0], & actions, nullptr, argv.data(), environ);
+            posix_spawn_file_actions_destroy(& actions);
+            close(in[0]);
+            close(out[1]);
+            in_ = in[1];
+            out_ = out[0];
+            errno = error;
+            OSCHECK(error == 0);
+            if (shared) {
+                shm_.reset(new SharedTransport{shm});
+                close(shm);
+                while (shm_->header()->attached.load() == 0)
+                    waitShared();
+            }
+        }
+
+        ~BypassProcess() {
+            if (in_ >= 0)
+                close(in_);
+            close(out_);
+            if (pid_ > 0)
+                waitpid(pid_, nullptr, 0);
+            if (shm_ != nullptr) {
+                close(bypassEvent_);
+                close(terminalEvent_);
+            }
+        }
+
+        void send(char const * data, size_t numBytes) {
+            if (shm_ != nullptr) {
+                SharedRing & ring = shm_->input();
+                while (numBytes > 0) {
+                    size_t n = std::min(numBytes, ring.writable());
+                    if (n == 0) {
+                        if (ring.producerIdle())
+                            waitShared();
+                        continue;
+                    }
+                    memcpy(ring.writePtr(), data, n);
+                    if (ring.commit(n))
+                        notifyShared();
+                    data += n;
+                    numBytes -= n;
+                }
+                return;
+            }
+            while (numBytes > 0) {
+                ssize_t n = ::write(in_, data, numBytes);
+                OSCHECK(n > 0);
+                data += n;
+                numBytes -= static_cast<size_t>(n);
+            }
+        }
+
+        /** Reads the output of the bypass until it contains given text.
+         */
+        void waitFor(std::string const & text) {
+            std::string output;
+            char buffer[1024];
+            while (output.find(text) == std::string::npos) {
+                size_t n = receive(buffer, sizeof(buffer));
+                output.append(buffer, n);
+            }
+        }
+
+        /** Reads whatever output of the bypass is available, waiting for some if there is none.
+         */
+        size_t receive(char * buffer, size_t size) {
+            ssize_t n = read(buffer, size);
+            OSCHECK(n > 0);
+            return static_cast<size_t>(n);
+        }
+
+        /** Reads the output of the bypass until it ends. Returns the number of reads it took.
+
+            The shared output is consumed in place, as the terminal would parse it.
+         */
+        size_t drain() {
+            char buffer[65536];
+            size_t reads = 0;
+            while (true) {
+                ssize_t n = read(shm_ != nullptr ? nullptr : buffer, sizeof(buffer));
+                OSCHECK(n >= 0);
+                if (n == 0)
+                    return reads;
+                ++reads;
+            }
+        }
+
+        /** Closes the input of the bypass and waits for it to exit.
+         */
+        void wait() {
+            close(in_);
+            in_ = -1;
+            OSCHECK(waitpid(pid_, nullptr, 0) == pid_);
+            pid_ = 0;
+        }
+
+    private:
+
+        /** Reads the output of the bypass into the buffer, or just consumes it if the buffer is null. Returns 0 when the output ends, or -1 on error.
+         */
+        ssize_t read(char * buffer, size_t size) {
+            if (shm_ == nullptr) {
+                while (true) {
+                    ssize_t n = ::read(out_, buffer, size);
+                    if (n != -1 || errno != EINTR)
+                        return n;
+                }
+            }
+            SharedRing & ring = shm_->output();
+            while (true) {
+                size_t n = std::min(ring.size(), size);
+                if (n > 0) {
+                    if (buffer != nullptr)
+                        memcpy(buffer, ring.data(), n);
+                    if (ring.consume(n))
+                        notifyShared();
+                    return static_cast<ssize_t>(n);
+                }
+                if (ring.closed())
+                    return 0;
+                if (ring.consumerIdle())
+                    waitShared();
+            }
+        }
+
+        /** Waits for the bypass to signal the terminal.
+         */
+        void waitShared() {
+            uint64_t value;
+            OSCHECK(::read(terminalEvent_, & value, sizeof(value)) == sizeof(value));
+        }
+
+        /** Signals the bypass.
+         */
+        void notifyShared() {
+            uint64_t value = 1;
+            OSCHECK(::write(bypassEvent_, & value, sizeof(value)) == sizeof(value));
+        }
+
+        /** Capacity of each shared ring, and the file descriptor numbers under which the shared memory and the eventfds are passed to the bypass.
+         */
+        static constexpr size_t SharedCapacity = 1024 * 1024;
+        static constexpr int SharedFd = 3;
+
+        pid_t pid_ = 0;
+        int in_;
+        int out_;
+        std::unique_ptr<SharedTransport> shm_;
+        int bypassEvent_ = -1;
+        int terminalEvent_ = -1;
+    }; // BypassProcess
+
+    /** Encodes the text as bypass input, i.e. doubles the backticks.
+     */
+    std::string Encode(std::string const & text) {
+        std::string result;
+        result.reserve(text.size());
+        for (char c : text) {
+            result.push_back(c);
+            if (c == '`')
+                result.push_back(c);
+        }
+        return result;
+    }
+
+    /** Builds a paste of given size by repeating lines of text.
+     */
+    std::string Repeat(std::vector<std::string> const & lines, size_t size) {
+        std::string result;
+        while (result.size() < size) {
+            for (auto & line : lines) {
+                result += line;
+                result += '\n';
+            }
+        }
+        result.resize(size);
+        return result;
+    }
+
+    /** Pastes the encoded input into a raw terminal in which the target command consumes the given number of decoded bytes.
+     */
+    void MeasurePaste(std::string const & name, std::string const & input, size_t decodedBytes, bool shared = false) {
+        bench::Measure(name, decodedBytes, 3, [&]() {
+            BypassProcess p{{"sh", "-c", STR("stty raw -echo; echo ready; head -c " << decodedBytes << " > /dev/null; echo done")}, {}, shared};
+            p.waitFor("ready");
+            p.send(input.data(), input.size());
+            p.waitFor("done");
+            p.wait();
+        });
+    }
+
+    /** Throughput of large pastes through the input decoder of the bypass.
+
+        Plain text has no commands, the markdown text has an escaped backtick every few words, which splits the data into many short spans, and the last paste is interleaved with a resize command every 64 KB.
+     */
+    void Paste() {
+        size_t size = 64 * 1024 * 1024;
+        std::string text = Repeat({
+            "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor",
+            "incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud",
+        }, size);
+        MeasurePaste("64 MB plain text", Encode(text), size);
+        MeasurePaste("64 MB plain text, shared memory", Encode(text), size, true);
+        std::string markdown = Repeat({
+            "Call `receive()` with the `buffer` and its `size`, then `consume()` the data.",
+            "The `--buffer-size` argument sets the size of the `I/O` buffers of the bypass.",
+        }, size);
+        MeasurePaste("64 MB markdown with backticks", Encode(markdown), size);
+        MeasurePaste("64 MB markdown with backticks, shared memory", Encode(markdown), size, true);
+        std::string resized;
+        for (size_t i = 0; i < size; i += 65536) {
+            resized += Encode(text.substr(i, 65536));
+            resized += STR("`r" << (80 + (i / 65536) % 40) << ":25;");
+        }
+        MeasurePaste("64 MB plain text with resizes", resized, size);
+    }
+
+    /** Output of a command that floods the terminal, relayed by the bypass with given options.
+
+        Reports the average size of the chunks in which the output arrives as well, which determines how often the terminal has to parse and repaint.
+     */
+    void MeasureFlood(std::string const & name, std::vector<std::string> const & options, size_t size, bool shared = false) {
+        size_t reads = 0;
+        bench::Measure(name, size, 3, [&]() {
+            BypassProcess p{{"sh", "-c", STR("stty raw -echo; exec head -c " << size << " /dev/zero")}, options, shared};
+            reads = p.drain();
+            p.wait();
+        });
+        std::cout << "    " << reads << " chunks, " << (reads == 0 ? 0 : size / reads) << " bytes on average" << std::endl;
+    }
+
+    /** Throughput of the output relay of the bypass when the command floods the terminal, with the output spliced, copied, coalesced, and passed via shared memory.
+     */
+    void Flood() {
+        size_t size = 256 * 1024 * 1024;
+        MeasureFlood("256 MB spliced", {}, size);
+        MeasureFlood("256 MB copied", {"--no-splice"}, size);
+        MeasureFlood("256 MB coalesced 2 ms", {"--coalesce=2000"}, size);
+        MeasureFlood("256 MB shared memory", {}, size, true);
+    }
+
+    /** Keystroke to echo latency, i.e. the time from sending a byte to the bypass until it is read back, echoed by the command in a raw terminal.
+     */
+    void MeasureEcho(std::string const & name, bool shared) {
+        size_t n = 10000;
+        BypassProcess p{{"sh", "-c", STR("stty raw -echo; printf ready; exec dd bs=1 count=" << n << " status=none")}, {}, shared};
+        p.waitFor("ready");
+        std::vector<double> latencies;
+        char c = 'x';
+        for (size_t i = 0; i < n; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            p.send(& c, 1);
+            p.receive(& c, 1);
+            latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        }
+        p.wait();
+        std::sort(latencies.begin(), latencies.end());
+        double sum = 0;
+        for (double l : latencies)
+            sum += l;
+        std::cout << std::left << std::setw(48) << name << std::right << std::fixed << std::setprecision(1)
+                  << "mean " << (sum / n) << " us, median " << latencies[n / 2] << " us, p99 " << latencies[n * 99 / 100] << " us" << std::endl;
+    }
+
+    void Echo() {
+        MeasureEcho("10000 keystrokes", false);
+        MeasureEcho("10000 keystrokes, shared memory", true);
+    }
+
+    /** Time to open a tab, i.e. from asking for a new terminal until the first output of its command arrives, with a bypass process per tab and with the tabs multiplexed as channels over a single bypass. All tabs stay open until the last one has been opened.
+     */
+    void Tabs() {
+        size_t n = 100;
+        std::vector<std::string> command{"sh", "-c", "printf ready; exec cat"};
+        auto report = [n](std::string const & name, std::chrono::steady_clock::duration elapsed) {
+            double ms = std::chrono::duration<double, std::milli>(elapsed).count();
+            std::cout << std::left << std::setw(48) << name << std::right << std::fixed << std::setprecision(3)
+                      << std::setw(12) << ms << " ms" << std::setw(12) << (ms / n) << " ms per tab" << std::endl;
+        };
+        {
+            std::vector<std::unique_ptr<BypassProcess>> tabs;
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < n; ++i) {
+                tabs.emplace_back(new BypassProcess{command});
+                tabs.back()->waitFor("ready");
+            }
+            report("100 tabs, bypass per tab", std::chrono::steady_clock::now() - start);
+        }
+        {
+            BypassProcess p{command, {"--multiplex"}};
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < n; ++i) {
+                std::string open = STR("`o" << i << ":80:25;");
+                p.send(open.data(), open.size());
+                p.waitFor("ready");
+            }
+            report("100 tabs, multiplexed", std::chrono::steady_clock::now() - start);
+            p.wait();
+        }
+    }
+
+    struct Benchmark {
+        char const * name;
+        void (*fn)();
+    };
+
+    Benchmark const Benchmarks[] = {
+        { "paste", Paste },
+        { "flood", Flood },
+        { "echo", Echo },
+        { "tabs", Tabs },
+    };
+
+} // anonymous namespace
+
+int main(int argc, char * argv[]) {
+    // the bypass may exit before reading all of its input
+    signal(SIGPIPE, SIG_IGN);
+    for (auto & b : Benchmarks) {
+        bool run = argc == 1;
+        for (int i = 1; i < argc; ++i)
+            run = run || (std::string{argv[i]} == b.name);
+        if (! run)
+            continue;
+        std::cout << "# " << b.name << std::endl;
+        b.fn();
+    }
+    return EXIT_SUCCESS;
+}
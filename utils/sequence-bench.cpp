@@ -0,0 +1,996 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if (defined ARCH_UNIX)
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+#include "libtpp/pty_reader.h"
+#include "libtpp/sequence.h"
+#include "libtpp/sequence_parser.h"
+#include "libtpp/sequence_visitor.h"
+#include "libtpp/sequence_writer.h"
+#include "libtpp/text_scanner.h"
+
+#include "bench.h"
+
+using namespace tpp;
+
+/** Number of heap allocations performed so far, counted by the replaced global operator new below. 
+ */
+std::atomic<size_t> NumAllocations{0};
+
+void * operator new(size_t size) {
+    ++NumAllocations;
+    if (void * result = std::malloc(size == 0 ? 1 : size))
+        return result;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void * ptr) noexcept { std::free(ptr); }
+
+void operator delete(void * ptr, size_t) noexcept { std::free(ptr); }
+
+/** Sequence parsing benchmarks.
+
+    Each benchmark is a function that prints its results. Run without arguments to execute all benchmarks, or specify the names of the benchmarks to run on the commandline.
+ */
+
+namespace {
+
+    /** Creates an OSC 52 clipboard sequence of given payload size.
+     */
+    std::string LongClipboard(size_t size) {
+        std::string result{"\033]52;c;"};
+        for (size_t i = 0; i < size; ++i)
+            result.push_back(static_cast<char>('A' + (i % 26)));
+        result.push_back('\a');
+        return result;
+    }
+
+    /** Long payload split into 4KB chunks, as read from the pty.
+
+        Compares restarting ParseSequence from the ESC character after every chunk, which has quadratic cost, with the incremental SequenceParser which retains its state between the chunks.
+     */
+    void Incremental() {
+        size_t const chunk = 4096;
+        for (size_t size : { 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024}) {
+            std::string input{LongClipboard(size)};
+            bench::Measure(STR("ParseSequence restart, " << size / 1024 << "KB"), input.size(), 3, [&]() {
+                std::string buffer;
+                for (size_t i = 0; i < input.size(); i += chunk) {
+                    buffer.append(input.c_str() + i, std::min(chunk, input.size() - i));
+                    char const * x = buffer.c_str();
+                    auto seq = ParseSequence(x, x + buffer.size());
+                    if (seq.has_value()) {
+                        bench::DoNotOptimize(seq);
+                        buffer.erase(0, x - buffer.c_str());
+                    }
+                }
+            });
+            bench::Measure(STR("SequenceParser::feed, " << size / 1024 << "KB"), input.size(), 3, [&]() {
+                SequenceParser p;
+                for (size_t i = 0; i < input.size(); i += chunk) {
+                    char const * x = input.c_str() + i;
+                    char const * end = x + std::min(chunk, input.size() - i);
+                    while (x != end) {
+                        auto seq = p.feed(x, end);
+                        bench::DoNotOptimize(seq);
+                    }
+                }
+            });
+        }
+    }
+
+    /** \name Legacy exception based parsers. 
+     
+        Simplified copies of the CSI and OSC parsers as they were before the exception-free `TryParse` functions, which detected the incomplete input by accessing empty std::optional. Kept here for comparison only.
+     */
+    //@{
+    std::optional<bool> LegacyParseChar(char x, char const * & buffer, char const * end, char const * msg) {
+        if (buffer == end)
+            return std::nullopt;
+        if (*buffer != x)
+            throw SequenceError(STR(msg << ". " << PRETTY(*buffer) << " found instead"));
+        ++buffer;
+        return true;
+    }
+
+    std::optional<std::vector<std::optional<int>>> LegacyParseCSI(char const * & buffer, char const * end) {
+        if (buffer == end)
+            return std::nullopt;
+        char const * x = buffer;
+        try {
+            LegacyParseChar('\033', x, end, "Expected CSI sequence start (ESC [)").value();
+            LegacyParseChar('[', x, end, "Expected CSI sequence start (ESC [)").value();
+            std::vector<std::optional<int>> result;
+            while (true) {
+                if (x == end)
+                    return std::nullopt;
+                std::optional<int> arg;
+                if (isDecimalDigit(*x)) {
+                    int value = 0;
+                    do {
+                        value = (value * 10) + (*x - '0');
+                        if (++x == end)
+                            return std::nullopt;
+                    } while (isDecimalDigit(*x));
+                    arg = value;
+                }
+                if (*x == ';') {
+                    ++x;
+                    result.push_back(arg);
+                } else {
+                    if (arg.has_value() || ! result.empty())
+                        result.push_back(arg);
+                    break; 
+                }
+            }
+            ++x;
+            buffer = x;
+            return result;
+        } catch (std::bad_optional_access const &) {
+            return std::nullopt;
+        } catch (...) {
+            buffer = x;
+            throw;
+        }
+    }
+
+    std::optional<std::vector<std::string>> LegacyParseOSC(char const * & buffer, char const * end) {
+        if (buffer == end)
+            return std::nullopt;
+        char const * x = buffer;
+        try {
+            LegacyParseChar('\033', x, end, "Expected OSC sequence start (ESC ])").value();
+            LegacyParseChar(']', x, end, "Expected OSC sequence start (ESC ])").value();
+            while (true) {
+                if (x == end)
+                    return std::nullopt;
+                if (!isDecimalDigit(*x))
+                    break;
+                ++x;
+            }
+            LegacyParseChar(';', x, end, "Expected semicolon after OSC id").value();
+            std::vector<std::string> result;
+            char const * valueStart = x;
+            while (true) {
+                if (x == end)
+                    return std::nullopt;
+                switch (* x++) {
+                    case ';':
+                        result.push_back(std::string{valueStart, x - 1});
+                        valueStart = x;
+                        break;
+                    case '\a':
+                        result.push_back(std::string{valueStart, x - 1});
+                        buffer = x;
+                        return result;
+                    default:
+                        break;
+                }
+            }
+        } catch (std::bad_optional_access const &) {
+            return std::nullopt;
+        } catch (...) {
+            buffer = x;
+            throw;
+        }
+    }
+    //@}
+
+    /** Typical short sequences as emitted by full screen apps. 
+     */
+    std::vector<std::string> const CSICorpus{
+        "\033[1;31m", "\033[0m", "\033[12;40H", "\033[K", "\033[38;5;208m", "\033[2J", "\033[H", "\033[4A",
+    };
+
+    std::vector<std::string> const OSCCorpus{
+        "\033]2;user@host: ~/projects/t2\a", "\033]8;;https://example.com\a", "\033]8;;\a",
+    };
+
+    /** Exception-free incomplete input. 
+     
+        Every sequence from the corpus is parsed with the input split at every possible position, i.e. the parser first sees all its proper prefixes (each reported as incomplete) and then the whole sequence. Compares the legacy parsers, which throw and catch std::bad_optional_access for incomplete input with the TryParse functions. 
+     */
+    void SplitInput() {
+        static constexpr size_t repeats = 20000;
+        auto run = [&](std::vector<std::string> const & corpus, auto parse) {
+            size_t bytes = 0;
+            for (auto const & seq : corpus)
+                bytes += seq.size() * (seq.size() + 1) / 2;
+            return std::make_pair(bytes * repeats, [&corpus, parse]() {
+                for (size_t i = 0; i < repeats; ++i) {
+                    for (auto const & seq : corpus) {
+                        for (size_t len = 1; len <= seq.size(); ++len) {
+                            char const * x = seq.c_str();
+                            parse(x, x + len);
+                        }
+                    }
+                }
+            });
+        };
+        auto legacyCSI = run(CSICorpus, [](char const * & x, char const * end) {
+            bench::DoNotOptimize(LegacyParseCSI(x, end));
+        });
+        bench::Measure("CSI, legacy (exceptions)", legacyCSI.first, 3, legacyCSI.second);
+        auto tryCSI = run(CSICorpus, [](char const * & x, char const * end) {
+            CSISequence seq;
+            bench::DoNotOptimize(CSISequence::TryParse(x, end, seq));
+            bench::DoNotOptimize(seq);
+        });
+        bench::Measure("CSI, CSISequence::TryParse", tryCSI.first, 3, tryCSI.second);
+        auto legacyOSC = run(OSCCorpus, [](char const * & x, char const * end) {
+            bench::DoNotOptimize(LegacyParseOSC(x, end));
+        });
+        bench::Measure("OSC, legacy (exceptions)", legacyOSC.first, 3, legacyOSC.second);
+        auto tryOSC = run(OSCCorpus, [](char const * & x, char const * end) {
+            OSCSequence seq;
+            bench::DoNotOptimize(OSCSequence::TryParse(x, end, seq));
+            bench::DoNotOptimize(seq);
+        });
+        bench::Measure("OSC, OSCSequence::TryParse", tryOSC.first, 3, tryOSC.second);
+        auto trySeq = run(CSICorpus, [](char const * & x, char const * end) {
+            std::optional<Sequence> seq;
+            bench::DoNotOptimize(TryParseSequence(x, end, seq));
+            bench::DoNotOptimize(seq);
+        });
+        bench::Measure("CSI, TryParseSequence", trySeq.first, 3, trySeq.second);
+    }
+
+    /** Heap allocations per CSI sequence.
+
+        Parses a render heavy stream of SGR and cursor movement sequences and reports the number of allocations per sequence together with the throughput. The legacy parser, which stored the arguments in std::vector<std::optional<int>> is included for comparison.
+     */
+    void CSIAllocations() {
+        std::string input;
+        size_t numSequences = 0;
+        for (size_t i = 0; i < 4096; ++i) {
+            for (auto const & seq : CSICorpus) {
+                input += seq;
+                ++numSequences;
+            }
+        }
+        auto report = [&](std::string const & name, auto parse) {
+            size_t allocations = NumAllocations;
+            bench::Measure(name, input.size(), 5, [&]() {
+                char const * x = input.c_str();
+                char const * end = x + input.size();
+                while (x != end)
+                    parse(x, end);
+            });
+            std::cout << "    allocations per sequence: " << static_cast<double>(NumAllocations - allocations) / (5 * numSequences) << std::endl;
+        };
+        report("legacy (std::vector<std::optional<int>>)", [](char const * & x, char const * end) {
+            bench::DoNotOptimize(LegacyParseCSI(x, end));
+        });
+        report("CSISequence::TryParse", [](char const * & x, char const * end) {
+            CSISequence seq;
+            bench::DoNotOptimize(CSISequence::TryParse(x, end, seq));
+            bench::DoNotOptimize(seq);
+        });
+        report("TryParseSequence", [](char const * & x, char const * end) {
+            std::optional<Sequence> seq;
+            bench::DoNotOptimize(TryParseSequence(x, end, seq));
+            bench::DoNotOptimize(seq);
+        });
+        SequenceParser p;
+        report("SequenceParser::feed", [&p](char const * & x, char const * end) {
+            bench::DoNotOptimize(p.feed(x, end));
+        });
+    }
+
+    /** Classification of plain text runs on a `cat`-like flood.
+
+        Two inputs are used, 80 column lines of text and UTF-8 terminated by CR LF and occasionally interleaved with SGR sequences, and long runs of plain text. Every implementation splits the whole input into runs of plain text separated by control characters. The byte-by-byte loop over tpp::Reader is the baseline.
+     */
+    void TextScan() {
+        auto run = [](std::string const & name, std::string const & input) {
+            auto split = [&](auto fn) {
+                return [&input, fn]() {
+                    char const * x = input.c_str();
+                    char const * end = x + input.size();
+                    size_t runs = 0;
+                    while (x != end) {
+                        x = fn(x, end);
+                        if (x != end)
+                            ++x;
+                        ++runs;
+                    }
+                    bench::DoNotOptimize(runs);
+                };
+            };
+            bench::Measure(name + ", tpp::Reader byte loop", input.size(), 3, split([](char const * x, char const * end) {
+                Reader r{x, end};
+                size_t n = 0;
+                while (! r.eof() && ! IsControlCharacter(r.top())) {
+                    r.pop();
+                    ++n;
+                }
+                return x + n;
+            }));
+            bench::Measure(name + ", portable", input.size(), 3, split(text_scanner::FindControlCharacterPortable));
+#if (defined TPP_SCANNER_X86_64)
+            bench::Measure(name + ", SSE2", input.size(), 3, split(text_scanner::FindControlCharacterSSE2));
+            if (text_scanner::HasAVX2())
+                bench::Measure(name + ", AVX2", input.size(), 3, split(text_scanner::FindControlCharacterAVX2));
+#endif
+            bench::Measure(STR(name << ", FindControlCharacter (" << text_scanner::Implementation() << ")"), input.size(), 3, split(FindControlCharacter));
+        };
+        std::string lines;
+        while (lines.size() < 64 * 1024 * 1024) {
+            for (size_t i = 0; i < 76; ++i)
+                lines.push_back(static_cast<char>('a' + (lines.size() % 26)));
+            lines += (lines.size() % 7 == 0) ? "\033[1;31m\xc5\xbe" : "\xe2\x82\xac";
+            lines += "\r\n";
+        }
+        run("80 column lines", lines);
+        // long runs, such as base64 encoded data
+        std::string runs;
+        while (runs.size() < 64 * 1024 * 1024) {
+            for (size_t i = 0; i < 65536; ++i)
+                runs.push_back(static_cast<char>('A' + (i % 26)));
+            runs += "\r\n";
+        }
+        run("64KB runs", runs);
+    }
+
+    /** The original stringstream based decoder of tpp sequence arguments, kept for comparison. 
+     */
+    bool LegacyDecodeTppArg(char const * & buffer, char const * end, std::string & result) {
+        std::stringstream s;
+        char const * x = buffer;
+        while (x < end) {
+            if (*x == ';' || *x == '\033') {
+                buffer = x;
+                result = s.str();
+                return true;
+            }
+            if (*x == '`') {
+                if (x + 2 >= end)
+                    break;
+                ++x;
+                char c = static_cast<char>(hexToNibble(*x++) << 4);
+                c |= hexToNibble(*x++);
+                s << c;
+            } else {
+                s << *x++;
+            }
+        }
+        return false;
+    }
+
+    /** Decoding of tpp sequence arguments.
+
+        Two 16MB payloads are decoded, random binary data where almost every byte is encoded and mostly ASCII text where only a few bytes per line are encoded. Reported throughput is of the encoded input. 
+     */
+    void TppDecode() {
+        auto run = [](std::string const & name, std::string const & data) {
+            std::stringstream s;
+            s << "\033P56t";
+            TppSequence::Encode(s, data);
+            s << "\033\\";
+            std::string input = s.str();
+            // the argument itself, without the sequence header 
+            char const * argStart = input.c_str() + 5;
+            char const * end = input.c_str() + input.size();
+            std::string result;
+            bench::Measure(name + ", legacy stringstream", input.size(), 3, [&]() {
+                char const * x = argStart;
+                bench::DoNotOptimize(LegacyDecodeTppArg(x, end, result));
+            });
+            bench::Measure(name + ", MeasureArg + DecodeArg", input.size(), 3, [&]() {
+                char const * argEnd;
+                size_t size;
+                if (TppSequence::MeasureArg(argStart, end, argEnd, size) == ParseResult::Ok) {
+                    result.resize(size);
+                    bench::DoNotOptimize(TppSequence::DecodeArg(argStart, argEnd, result.data()));
+                }
+            });
+            size_t allocations = NumAllocations;
+            bench::Measure(name + ", TppSequence::TryParse", input.size(), 3, [&]() {
+                char const * x = input.c_str();
+                TppSequence seq;
+                bench::DoNotOptimize(TppSequence::TryParse(x, end, seq));
+            });
+            std::cout << "    " << (NumAllocations - allocations) / 3 << " allocations per TryParse" << std::endl;
+        };
+        std::mt19937 rng{42};
+        std::string binary;
+        while (binary.size() < 16 * 1024 * 1024)
+            binary.push_back(static_cast<char>(rng() & 0xff));
+        run("random binary", binary);
+        std::string ascii;
+        while (ascii.size() < 16 * 1024 * 1024) {
+            for (size_t i = 0; i < 78; ++i)
+                ascii.push_back(static_cast<char>('a' + (rng() % 26)));
+            ascii += (ascii.size() % 3 == 0) ? "; " : "\n";
+        }
+        run("mostly ASCII", ascii);
+    }
+
+    /** The original ostream serialization of tpp sequence arguments, kept for comparison.
+     */
+    void LegacyEncode(std::ostream & s, std::string_view value) {
+        for (char c : value) {
+            if (!isPrintableCharacter(c) || c == ';' || c == '`')
+                s << '`' << nibbleToHex(static_cast<uint8_t>(c) >> 4) << nibbleToHex(c & 0xf);
+            else
+                s << c;
+        }
+    }
+
+    /** Serialization of a full screen frame and of tpp payloads. 
+
+        The frame is 200x60 cells, every row starts with cursor position and consists of runs of 8 characters, each with its own SGR truecolor foreground. This is compared to formatting the same sequences via ostream as before the SequenceWriter. When sending to /dev/null, sending every sequence separately is compared with sending the whole frame batched in a single call.
+
+        The tpp encoding is measured on 16MB of random binary and mostly ASCII data. 
+     */
+    void Writer() {
+        constexpr int Cols = 200;
+        constexpr int Rows = 60;
+        constexpr int Frames = 100;
+        auto sgr = [](int row, int col) {
+            CSIArgs args;
+            for (int a : {38, 2, (row * 4) % 256, (col * 3) % 256, (row + col) % 256})
+                args.push_back(a);
+            return CSISequence{args, 'm'};
+        };
+        std::string run(8, 'x');
+        size_t frameBytes = 0;
+        {
+            SequenceWriter w;
+            for (int row = 1; row <= Rows; ++row) {
+                w.csi(1, row, 'H');
+                for (int col = 0; col < Cols; col += 8)
+                    w << sgr(row, col) << Payload{run};
+            }
+            frameBytes = w.size();
+        }
+        bench::Measure("frame, std::ostringstream", frameBytes * Frames, 3, [&]() {
+            for (int f = 0; f < Frames; ++f) {
+                std::ostringstream s;
+                for (int row = 1; row <= Rows; ++row) {
+                    s << "\033[" << 1 << ';' << row << 'H';
+                    for (int col = 0; col < Cols; col += 8) {
+                        CSISequence seq = sgr(row, col);
+                        s << "\033[";
+                        for (size_t i = 0; i < seq.numArgs(); ++i)
+                            s << (i == 0 ? "" : ";") << seq.arg(i, 0);
+                        s << seq.suffix() << run;
+                    }
+                }
+                bench::DoNotOptimize(s.str().size());
+            }
+        });
+        SequenceWriter writer;
+        bench::Measure("frame, SequenceWriter", frameBytes * Frames, 3, [&]() {
+            for (int f = 0; f < Frames; ++f) {
+                writer.clear();
+                for (int row = 1; row <= Rows; ++row) {
+                    writer.csi(1, row, 'H');
+                    for (int col = 0; col < Cols; col += 8)
+                        writer << sgr(row, col) << Payload{run};
+                }
+                bench::DoNotOptimize(writer.size());
+            }
+        });
+#if (defined ARCH_UNIX)
+        int fd = open("/dev/null", O_WRONLY);
+        bench::Measure("frame, send per sequence", frameBytes * Frames, 3, [&]() {
+            for (int f = 0; f < Frames; ++f) {
+                for (int row = 1; row <= Rows; ++row) {
+                    writer.clear();
+                    writer.csi(1, row, 'H');
+                    bench::DoNotOptimize(::write(fd, writer.data(), writer.size()));
+                    for (int col = 0; col < Cols; col += 8) {
+                        writer.clear();
+                        writer << sgr(row, col);
+                        bench::DoNotOptimize(::write(fd, writer.data(), writer.size()));
+                        bench::DoNotOptimize(::write(fd, run.c_str(), run.size()));
+                    }
+                }
+            }
+        });
+        bench::Measure("frame, batched send", frameBytes * Frames, 3, [&]() {
+            for (int f = 0; f < Frames; ++f) {
+                writer.clear();
+                for (int row = 1; row <= Rows; ++row) {
+                    writer.csi(1, row, 'H');
+                    for (int col = 0; col < Cols; col += 8)
+                        writer << sgr(row, col) << Payload{run};
+                }
+                bench::DoNotOptimize(::write(fd, writer.data(), writer.size()));
+            }
+        });
+        close(fd);
+#endif
+        auto encode = [](std::string const & name, std::string const & data) {
+            bench::Measure(name + ", legacy ostream Encode", data.size(), 3, [&]() {
+                std::ostringstream s;
+                LegacyEncode(s, data);
+                bench::DoNotOptimize(s.str().size());
+            });
+            SequenceWriter w;
+            bench::Measure(name + ", SequenceWriter::encode", data.size(), 3, [&]() {
+                w.clear();
+                w.encode(data);
+                bench::DoNotOptimize(w.size());
+            });
+        };
+        std::mt19937 rng{42};
+        std::string binary;
+        while (binary.size() < 16 * 1024 * 1024)
+            binary.push_back(static_cast<char>(rng() & 0xff));
+        encode("tpp binary", binary);
+        std::string ascii;
+        while (ascii.size() < 16 * 1024 * 1024) {
+            for (size_t i = 0; i < 78; ++i)
+                ascii.push_back(static_cast<char>('a' + (rng() % 26)));
+            ascii += (ascii.size() % 3 == 0) ? "; " : "\n";
+        }
+        encode("tpp mostly ASCII", ascii);
+    }
+
+    /** Dispatch of sequences to their specific types on a mixed corpus.
+
+        The corpus consists of the specific CSI, DEC, OSC and tpp sequences interleaved with generic ones of unknown suffixes and ids. Parsing the generic sequence first and then converting it to the specific type via Specialize, which is what the parsers used to do, is compared with TryParseSequence and SequenceParser which build the specific types directly from the raw arguments.
+     */
+    void Dispatch() {
+        std::vector<std::string> corpus{
+            "\033[5;10H", "\033[A", "\033[3B", "\033[38;2;10;20;30m", "\033[0m", "\033[s", "\033[u", "\033[12G", "\033[2J", "\033[K", "\033[1;24r",
+            "\033[?25h", "\033[?25l", "\033[?1049h", "\033[?2004l", "\033[?7h", "\033[?1000h",
+            "\033]2;window title\a", "\033]8;;http://example.com\a", "\033]52;c;YWJjZGVm\a", "\033]112;\a", "\033]777;notify;a;b\a",
+            "\033P0t120;40\033\\", "\033P56tfoo;bar\033\\",
+        };
+        std::string input;
+        size_t numSequences = 0;
+        std::mt19937 rng{42};
+        while (input.size() < 4 * 1024 * 1024) {
+            input += corpus[rng() % corpus.size()];
+            ++numSequences;
+        }
+        std::cout << "    " << numSequences << " sequences" << std::endl;
+        auto measure = [&](std::string const & name, auto parse) {
+            bench::Measure(name, input.size(), 20, [&]() {
+                char const * x = input.c_str();
+                char const * end = x + input.size();
+                while (x != end)
+                    parse(x, end);
+            });
+        };
+        measure("generic + Specialize", [](char const * & x, char const * end) {
+            switch (x[1]) {
+                case '[':
+                    if (x[2] == '?') {
+                        DECSequence seq;
+                        DECSequence::TryParse(x, end, seq);
+                        bench::DoNotOptimize(Specialize(seq));
+                    } else {
+                        CSISequence seq;
+                        CSISequence::TryParse(x, end, seq);
+                        bench::DoNotOptimize(Specialize(std::move(seq)));
+                    }
+                    break;
+                case ']': {
+                    OSCSequence seq;
+                    OSCSequence::TryParse(x, end, seq);
+                    bench::DoNotOptimize(Specialize(std::move(seq)));
+                    break;
+                }
+                default: {
+                    TppSequence seq;
+                    TppSequence::TryParse(x, end, seq);
+                    bench::DoNotOptimize(Specialize(std::move(seq)));
+                }
+            }
+        });
+        // the result is reused as default constructing std::optional of the large variant zeroes it
+        std::optional<Sequence> seq;
+        measure("TryParseSequence", [&seq](char const * & x, char const * end) {
+            seq.reset();
+            bench::DoNotOptimize(TryParseSequence(x, end, seq));
+            bench::DoNotOptimize(seq);
+        });
+        SequenceParser p;
+        measure("SequenceParser::feed", [&p](char const * & x, char const * end) {
+            bench::DoNotOptimize(p.feed(x, end));
+        });
+    }
+
+    /** Minimal terminal state updated by the visitor benchmark.
+     */
+    struct ScreenHandler {
+        int x = 0;
+        int y = 0;
+        size_t text = 0;
+        Rendition rendition;
+        size_t other = 0;
+
+        void operator () (CursorPosition && seq) { x = seq.x; y = seq.y; }
+        void operator () (CursorUp && seq) { y -= seq.value; }
+        void operator () (CursorDown && seq) { y += seq.value; }
+        void operator () (SelectGraphicRendition && seq) { seq.delta.apply(rendition); }
+        void operator () (Payload && payload) { text += payload.size(); x += static_cast<int>(payload.size()); }
+        template<typename T> void operator () (T &&) { ++other; }
+    };
+
+    /** Callback driven parsing compared with materializing every sequence in the variant.
+
+        The corpus resembles terminal output, i.e. text runs interleaved with cursor movement, SGR and mode changes. The variant version parses each sequence with TryParseSequence and dispatches it with std::visit, the visitor version passes the sequences straight to the handler.
+     */
+    void Visitor() {
+        std::vector<std::string> corpus{
+            "\033[5;10H", "\033[A", "\033[3B", "\033[38;2;10;20;30m", "\033[0m", "\033[1;31m", "\033[2J", "\033[K",
+            "\033[?25h", "\033[?25l", "\033]2;window title\a", "\033]8;;http://example.com\a", "\033P0t120;40\033\\",
+            "hello", "some longer line of plain text", "x", "    ",
+        };
+        std::string input;
+        std::mt19937 rng{42};
+        while (input.size() < 4 * 1024 * 1024)
+            input += corpus[rng() % corpus.size()];
+        ScreenHandler h;
+        // the result is reused as default constructing std::optional of the large variant zeroes it
+        std::optional<Sequence> seq;
+        bench::Measure("TryParseSequence + std::visit", input.size(), 20, [&]() {
+            char const * x = input.c_str();
+            char const * end = x + input.size();
+            while (x != end) {
+                if (*x != '\033') {
+                    char const * esc = static_cast<char const *>(std::memchr(x, '\033', static_cast<size_t>(end - x)));
+                    if (esc == nullptr)
+                        esc = end;
+                    h(Payload{x, static_cast<size_t>(esc - x)});
+                    x = esc;
+                    continue;
+                }
+                seq.reset();
+                TryParseSequence(x, end, seq);
+                std::visit([&h](auto & s) { h(std::move(s)); }, seq.value());
+            }
+        });
+        bench::DoNotOptimize(h);
+        bench::Measure("Visit", input.size(), 20, [&]() {
+            char const * x = input.c_str();
+            Visit(x, x + input.size(), h);
+        });
+        bench::DoNotOptimize(h);
+    }
+
+    /** Output of `ls --color=always -laR /usr/share`, or similar synthetic listing if ls can't be executed.
+     */
+    std::string LsOutput() {
+        std::string result;
+#if (defined ARCH_UNIX)
+        if (FILE * f = popen("ls --color=always -laR /usr/share 2>/dev/null", "r")) {
+            char buffer[65536];
+            size_t n;
+            while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+                result.append(buffer, n);
+            pclose(f);
+        }
+#endif
+        if (result.empty()) {
+            char const * colors[] = { "01;34", "01;36", "01;32", "00", "01;31", "40;33;01" };
+            for (int i = 0; i < 20000; ++i)
+                result += STR("-rwxr-xr-x  1 root root      68496 Sep 20  2022 \033[0m\033[" << colors[i % 6] << "mfile-" << i << "\033[0m\n");
+        }
+        return result;
+    }
+
+    /** Syntax highlighted source code in the style of bat, i.e. every token in its own truecolor, created from the benchmark's source. The colon form uses `38:2::r:g:b` instead of `38;2;r;g;b`.
+     */
+    std::string HighlightedSource(bool colonForm) {
+        std::ifstream f{__FILE__};
+        std::string source{std::istreambuf_iterator<char>{f}, std::istreambuf_iterator<char>{}};
+        if (source.empty())
+            source = "int main(int argc, char * argv[]) {\n    return EXIT_SUCCESS;\n}\n";
+        std::string result;
+        std::mt19937 rng{42};
+        size_t i = 0;
+        while (i < source.size()) {
+            if (source[i] == '\n') {
+                result += "\033[0m\n";
+                ++i;
+                continue;
+            }
+            size_t start = i;
+            if (isalnum(static_cast<unsigned char>(source[i])) || source[i] == '_') {
+                while (i < source.size() && (isalnum(static_cast<unsigned char>(source[i])) || source[i] == '_'))
+                    ++i;
+            } else {
+                ++i;
+            }
+            unsigned r = rng() % 256, g = rng() % 256, b = rng() % 256;
+            if (colonForm)
+                result += STR("\033[38:2::" << r << ":" << g << ":" << b << "m");
+            else
+                result += STR("\033[38;2;" << r << ";" << g << ";" << b << "m");
+            result.append(source, start, i - start);
+        }
+        return result;
+    }
+
+    /** Decoding of SGR sequences on real world outputs.
+
+        Parsing and applying the SGR sequences to the rendition state is measured on colored directory listing, and syntax highlighted source code in both semicolon and colon forms.
+     */
+    void SGR() {
+        auto measure = [](std::string const & name, std::string const & corpus) {
+            std::string input;
+            while (input.size() < 4 * 1024 * 1024)
+                input += corpus;
+            size_t numSequences = 0;
+            for (size_t i = input.find('\033'); i != std::string::npos; i = input.find('\033', i + 1))
+                ++numSequences;
+            std::cout << "    " << name << ": " << numSequences << " sequences" << std::endl;
+            ScreenHandler h;
+            std::optional<Sequence> seq;
+            bench::Measure(name + " TryParseSequence", input.size(), 20, [&]() {
+                char const * x = input.c_str();
+                char const * end = x + input.size();
+                while (x != end) {
+                    if (*x != '\033') {
+                        char const * esc = static_cast<char const *>(std::memchr(x, '\033', static_cast<size_t>(end - x)));
+                        x = esc == nullptr ? end : esc;
+                        continue;
+                    }
+                    seq.reset();
+                    TryParseSequence(x, end, seq);
+                    bench::DoNotOptimize(seq);
+                }
+            });
+            bench::Measure(name + " Visit", input.size(), 20, [&]() {
+                char const * x = input.c_str();
+                Visit(x, x + input.size(), h);
+            });
+            bench::DoNotOptimize(h);
+        };
+        measure("ls", LsOutput());
+        measure("bat", HighlightedSource(false));
+        measure("bat colon", HighlightedSource(true));
+    }
+
+    /** Counts the modes that were set.
+     */
+    struct ModesHandler {
+        size_t modes = 0;
+        size_t other = 0;
+        void operator () (EnableAlternativeBuffer && seq) { modes += seq.value; }
+        void operator () (EnableFocusReporting && seq) { modes += seq.value; }
+        void operator () (EnableBracketedPaste && seq) { modes += seq.value; }
+        void operator () (ShowCursor && seq) { modes += seq.value; }
+        void operator () (DECSequence && seq) { modes += seq.numIds(); }
+        template<typename T> void operator () (T &&) { ++other; }
+    };
+
+    /** Full screen application redraws, which toggle the same modes on every frame.
+
+        The modes are either set by a single sequence per mode, or combined in a single sequence with multiple ids, which is dispatched per id from a single parse.
+     */
+    void DECModes() {
+        auto measure = [](std::string const & name, char const * set, char const * reset) {
+            std::string input;
+            while (input.size() < 4 * 1024 * 1024) {
+                input += set;
+                input += "\033[H\033[2Jframe\033[5;1Hstatus line";
+                input += reset;
+            }
+            ModesHandler h;
+            bench::Measure(name, input.size(), 20, [&]() {
+                char const * x = input.c_str();
+                Visit(x, x + input.size(), h);
+            });
+            bench::DoNotOptimize(h);
+        };
+        measure("separate", "\033[?1049h\033[?1004h\033[?2004h\033[?2026h\033[?25l", "\033[?25h\033[?2026l\033[?2004l\033[?1004l\033[?1049l");
+        measure("combined", "\033[?1049;1004;2004;2026h\033[?25l", "\033[?25h\033[?2026;2004;1004;1049l");
+    }
+
+    /** Parses CSI sequence using the checked stream API of the reader, i.e. testing the bounds on every byte.
+     */
+    template<typename READER>
+    std::optional<CSISequence> ParseCSIByteByByte(READER & r) {
+        if (r.pop() != '\033' || r.pop() != '[')
+            return std::nullopt;
+        CSIArgs args;
+        bool subParameter = false;
+        while (true) {
+            std::optional<int> arg;
+            if (isDecimalDigit(r.top())) {
+                int value = 0;
+                do {
+                    value = value * 10 + (r.pop() - '0');
+                } while (isDecimalDigit(r.top()));
+                arg = value;
+            }
+            if (r.top() == ';' || r.top() == ':') {
+                args.push_back(arg, subParameter);
+                subParameter = (r.pop() == ':');
+            } else {
+                if (arg.has_value() || ! args.empty())
+                    args.push_back(arg, subParameter);
+                break;
+            }
+        }
+        if (! dispatch::isFinalByte(r.top()))
+            return std::nullopt;
+        return CSISequence{std::move(args), r.pop()};
+    }
+
+    /** CSI sequences parsed from readers.
+
+        The baseline parses the sequences byte by byte using the checked stream API of the readers, which tests the bounds on every byte, and in case of the buffered reader also whether it has to be refilled. The reader parsers run the TryParse functions over the reader's window instead, so that the bounds are only tested once per sequence. The buffered reader is refilled in 4 KB reads. Parsing from the plain buffer is included for reference.
+     */
+    void Readers() {
+        std::vector<std::string> corpus{
+            "\033[5;10H", "\033[A", "\033[3B", "\033[38;2;10;20;30m", "\033[0m", "\033[s", "\033[12G", "\033[2J", "\033[K", "\033[1;24r",
+        };
+        std::string input;
+        std::mt19937 rng{42};
+        while (input.size() < 4 * 1024 * 1024)
+            input += corpus[rng() % corpus.size()];
+        // source of the buffered reader that returns the input in 4 KB reads
+        size_t pos = 0;
+        auto source = [&](char * buffer, size_t size) {
+            size_t n = std::min<size_t>({4096, size, input.size() - pos});
+            std::memcpy(buffer, input.c_str() + pos, n);
+            pos += n;
+            return n;
+        };
+        bench::Measure("byte loop, Reader", input.size(), 20, [&]() {
+            Reader r{input.c_str(), input.size()};
+            while (! r.eof())
+                bench::DoNotOptimize(ParseCSIByteByByte(r));
+        });
+        bench::Measure("byte loop, BufferedReader", input.size(), 20, [&]() {
+            pos = 0;
+            BufferedReader r{source};
+            while (! r.eof())
+                bench::DoNotOptimize(ParseCSIByteByByte(r));
+        });
+        bench::Measure("CSISequence::TryParse", input.size(), 20, [&]() {
+            char const * x = input.c_str();
+            char const * end = x + input.size();
+            CSISequence seq;
+            while (x != end) {
+                CSISequence::TryParse(x, end, seq);
+                bench::DoNotOptimize(seq);
+            }
+        });
+        bench::Measure("CSISequence::Parse(Reader)", input.size(), 20, [&]() {
+            Reader r{input.c_str(), input.size()};
+            while (auto seq = CSISequence::Parse(r))
+                bench::DoNotOptimize(seq);
+        });
+        bench::Measure("CSISequence::Parse(BufferedReader)", input.size(), 20, [&]() {
+            pos = 0;
+            BufferedReader r{source};
+            while (auto seq = CSISequence::Parse(r))
+                bench::DoNotOptimize(seq);
+        });
+        bench::Measure("TryParseSequence", input.size(), 20, [&]() {
+            char const * x = input.c_str();
+            char const * end = x + input.size();
+            std::optional<Sequence> seq;
+            while (x != end) {
+                TryParseSequence(x, end, seq);
+                bench::DoNotOptimize(seq);
+            }
+        });
+        bench::Measure("ParseSequence(BufferedReader)", input.size(), 20, [&]() {
+            pos = 0;
+            BufferedReader r{source};
+            while (auto seq = ParseSequence(r))
+                bench::DoNotOptimize(seq);
+        });
+    }
+
+    /** PTY that returns the given input in reads of given size, forever.
+     */
+    class StreamPTY : public pty::PTY {
+    public:
+        StreamPTY(std::string const & input, size_t readSize, size_t total): input_{input}, readSize_{readSize}, remaining_{total} {}
+
+        void send(char const *, size_t) override {}
+
+        size_t receive(char * buffer, size_t bufferLength) override {
+            size_t n = std::min({readSize_, bufferLength, input_.size() - pos_, remaining_});
+            std::memcpy(buffer, input_.c_str() + pos_, n);
+            pos_ = (pos_ + n) % input_.size();
+            remaining_ -= n;
+            return n;
+        }
+
+    private:
+        std::string const & input_;
+        size_t readSize_;
+        size_t pos_ = 0;
+        size_t remaining_;
+    };
+
+    /** Receives text runs and sequences from the reader the same way pty::Reader::receive() does. 
+     */
+    template<typename READER>
+    std::optional<Sequence> ReceiveFrom(READER & r) {
+        if (! r.require(1))
+            return std::nullopt;
+        char const * x = r.data();
+        if (*x != '\033') {
+            char const * esc = static_cast<char const *>(std::memchr(x, '\033', r.available()));
+            size_t n = esc == nullptr ? r.available() : static_cast<size_t>(esc - x);
+            r.advance(n);
+            return Payload{x, n};
+        }
+        return ParseSequence(r);
+    }
+
+    /** Sustained PTY output received by the ring buffer of pty::Reader compared with the copy-and-compact buffer of BufferedReader, which moves the unread part of the buffer to its beginning before each read.
+
+        Two streams of 256 MB are received, the `ls --color` output and a stream with large OSC 52 clipboard sequences that span many reads, where the compacting reader moves the partial sequence before every read.
+     */
+    void PTYReader() {
+        auto measure = [](std::string const & name, std::string const & input, size_t readSize) {
+            size_t total = 256 * 1024 * 1024;
+            bench::Measure(STR(name << " in " << readSize / 1024 << " KB reads, BufferedReader"), total, 3, [&]() {
+                StreamPTY pty{input, readSize, total};
+                BufferedReader r{[&pty](char * buffer, size_t size) { return pty.receive(buffer, size); }, 1024 * 1024};
+                while (auto seq = ReceiveFrom(r))
+                    bench::DoNotOptimize(seq);
+            });
+            bench::Measure(STR(name << " in " << readSize / 1024 << " KB reads, pty::Reader"), total, 3, [&]() {
+                pty::Reader r{std::make_unique<StreamPTY>(input, readSize, total), 1024 * 1024};
+                while (auto seq = r.receive())
+                    bench::DoNotOptimize(seq);
+            });
+        };
+        measure("ls", LsOutput(), 65536);
+        std::string clipboard;
+        for (int i = 0; i < 16; ++i)
+            clipboard += "some text\r\n" + LongClipboard(256 * 1024);
+        measure("clipboard", clipboard, 65536);
+        measure("clipboard", clipboard, 4096);
+    }
+
+    struct Benchmark {
+        char const * name;
+        void (*fn)();
+    };
+
+    Benchmark const Benchmarks[] = {
+        { "incremental", Incremental },
+        { "split-input", SplitInput },
+        { "csi-allocations", CSIAllocations },
+        { "text-scan", TextScan },
+        { "tpp-decode", TppDecode },
+        { "writer", Writer },
+        { "dispatch", Dispatch },
+        { "visitor", Visitor },
+        { "sgr", SGR },
+        { "dec-modes", DECModes },
+        { "readers", Readers },
+        { "pty-reader", PTYReader },
+    };
+
+}
+
+int main(int argc, char * argv[]) {
+    for (auto & b : Benchmarks) {
+        bool run = argc == 1;
+        for (int i = 1; i < argc; ++i)
+            run = run || (std::string{argv[i]} == b.name);
+        if (! run)
+            continue;
+        std::cout << "# " << b.name << std::endl;
+        b.fn();
+    }
+    return EXIT_SUCCESS;
+}
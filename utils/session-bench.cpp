@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "libtpp/session_host.h"
+
+using namespace tpp;
+using namespace tpp::pty;
+
+/** Stress test of the SessionHost with many local sessions.
+
+    Usage: session-bench [sessions [flooders [workers]]]
+
+    Spawns the given number of sessions (1000 by default), of which `flooders` (10 by default) write 32 MB of output each as fast as they can, while the rest are interactive sessions running `cat` on a raw terminal. While the flooders run, single keystrokes are sent to the interactive sessions round robin and the time until their echo is received is measured. Reports the throughput of the flooders and the keystroke latency percentiles. Build in release mode for meaningful results.
+ */
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    constexpr size_t FloodBytes = 32 * 1024 * 1024;
+
+    /** State of a single interactive session, only accessed by the session's handlers (which are never called concurrently) and by the main thread through the atomics.
+     */
+    struct Interactive {
+        std::shared_ptr<SessionHost::Session> session;
+        std::string prefix;
+        std::atomic<bool> ready{false};
+        std::atomic<bool> waiting{false};
+        Clock::time_point sent;
+        std::vector<double> latencies;
+    };
+
+    double Percentile(std::vector<double> & values, double p) {
+        if (values.empty())
+            return 0;
+        size_t i = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+        std::nth_element(values.begin(), values.begin() + i, values.end());
+        return values[i];
+    }
+
+} // anonymous namespace
+
+int main(int argc, char * argv[]) {
+    size_t numSessions = argc > 1 ? std::stoul(argv[1]) : 1000;
+    size_t numFlooders = argc > 2 ? std::stoul(argv[2]) : 10;
+    size_t numWorkers = argc > 3 ? std::stoul(argv[3]) : 0;
+    numFlooders = std::min(numFlooders, numSessions);
+    size_t numInteractive = numSessions - numFlooders;
+
+    SessionHost host{numWorkers};
+    std::cout << "sessions: " << numSessions << ", flooders: " << numFlooders << ", workers: " << host.numWorkers() << std::endl;
+
+    // interactive sessions first, they must be ready before the flood starts
+    auto start = Clock::now();
+    std::vector<std::unique_ptr<Interactive>> interactive;
+    std::atomic<size_t> numReady{0};
+    for (size_t i = 0; i < numInteractive; ++i) {
+        interactive.push_back(std::make_unique<Interactive>());
+        Interactive * s = interactive.back().get();
+        s->session = host.spawn({"sh", "-c", "stty raw -echo; echo ready; exec cat"},
+            [s, &numReady](SessionHost::Session &, char const * data, size_t numBytes) {
+                if (! s->ready) {
+                    s->prefix.append(data, numBytes);
+                    if (s->prefix.find("ready") != std::string::npos) {
+                        s->ready = true;
+                        ++numReady;
+                    }
+                    return;
+                }
+                if (s->waiting) {
+                    s->latencies.push_back(std::chrono::duration<double, std::micro>{Clock::now() - s->sent}.count());
+                    s->waiting = false;
+                }
+            },
+            [](SessionHost::Session &, int) {}
+        );
+    }
+    while (numReady < numInteractive)
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    std::chrono::duration<double> startup = Clock::now() - start;
+    std::cout << "interactive sessions ready in " << (startup.count() * 1000) << " ms" << std::endl;
+
+    // the flood
+    std::atomic<size_t> received{0};
+    std::atomic<size_t> numFlooding{numFlooders};
+    std::vector<std::shared_ptr<SessionHost::Session>> flooders;
+    start = Clock::now();
+    for (size_t i = 0; i < numFlooders; ++i) {
+        flooders.push_back(host.spawn({"head", "-c", std::to_string(FloodBytes), "/dev/zero"},
+            [&received](SessionHost::Session &, char const *, size_t numBytes) { received += numBytes; },
+            [&numFlooding](SessionHost::Session &, int) { --numFlooding; }
+        ));
+    }
+    // keystrokes round robin while flooding, or a single round if there are no flooders
+    size_t numKeystrokes = 0;
+    for (size_t i = 0; numInteractive > 0 && (numFlooding > 0 || i < numInteractive); ++i) {
+        Interactive & s = * interactive[i % numInteractive];
+        if (s.waiting)
+            continue;
+        s.sent = Clock::now();
+        s.waiting = true;
+        s.session->send("x", 1);
+        ++numKeystrokes;
+        std::this_thread::sleep_for(std::chrono::microseconds{100});
+    }
+    while (numFlooding > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    std::chrono::duration<double> flood = Clock::now() - start;
+    // let the last keystrokes arrive
+    for (auto & s : interactive)
+        while (s->waiting)
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+
+    std::vector<double> latencies;
+    for (auto & s : interactive)
+        latencies.insert(latencies.end(), s->latencies.begin(), s->latencies.end());
+    if (numFlooders > 0)
+        std::cout << "flood: " << (received / 1024 / 1024) << " MB in " << (flood.count() * 1000) << " ms, " << (received / flood.count() / 1024 / 1024) << " MB/s" << std::endl;
+    std::cout << "keystrokes: " << numKeystrokes << ", latency p50: " << Percentile(latencies, 0.5) << " us, p99: " << Percentile(latencies, 0.99) << " us, max: " << Percentile(latencies, 1) << " us" << std::endl;
+    std::cout << "stolen sessions: " << host.numStolen() << std::endl;
+    return EXIT_SUCCESS;
+}